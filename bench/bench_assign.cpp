@@ -0,0 +1,83 @@
+// Pairwise vs GEMM assignment over a grid of d and k, to locate the
+// crossover used by Assigner::prefer_gemm().
+//
+//   make bench && ./bin/bench_assign [n] [n_thread]
+#include <chrono>
+#include <random>
+#include "assignment.h"
+#include "matrix.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+double time_assign(const cluster::Matrix<DType> &data,
+    const cluster::Matrix<DType> &centers, cluster::AssignMethod method,
+    int n_thread) {
+  const size_t n = data.rows();
+  const size_t block = cluster::Assigner<DType>::kBlockPoints;
+  cluster::Assigner<DType> assigner;
+  vector<int> labels(n);
+  vector<DType> dists(n);
+  double best = 1e30;
+  for (int rep = 0; rep < 3; ++rep) {
+    auto start = chrono::steady_clock::now();
+    assigner.prepare(centers, method);
+#pragma omp parallel num_threads(n_thread)
+    {
+      vector<DType> workspace;
+#pragma omp for
+      for (size_t b = 0; b < n; b += block) {
+        assigner.assign(data.row(b), min(block, n - b), data.stride(),
+                        &labels[b], &dists[b], workspace);
+      }
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count());
+  }
+  return best;
+}
+
+template <typename DType>
+void run(const char *type, size_t n, int n_thread) {
+  mt19937 gen(0);
+  normal_distribution<DType> dis(0, 1);
+  const size_t dims[] = {2, 4, 8, 16, 24, 32, 64, 128, 256, 512};
+  const size_t ks[] = {4, 8, 16, 64, 256, 1024};
+  cout << type << " n=" << n << " threads=" << n_thread << "\n";
+  cout << setw(6) << "d" << setw(6) << "k" << setw(14) << "pairwise(s)"
+    << setw(14) << "gemm(s)" << setw(10) << "speedup" << setw(8) << "auto"
+    << "\n";
+  for (size_t d : dims) {
+    cluster::Matrix<DType> data(n, d);
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < d; ++j)
+        data(i, j) = dis(gen);
+    for (size_t k : ks) {
+      cluster::Matrix<DType> centers(k, d, true);
+      for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < d; ++j)
+          centers(i, j) = dis(gen);
+      double pairwise = time_assign(data, centers,
+          cluster::AssignMethod::PAIRWISE, n_thread);
+      double gemm = time_assign(data, centers,
+          cluster::AssignMethod::GEMM, n_thread);
+      bool choice = cluster::Assigner<DType>::prefer_gemm(d, k);
+      cout << setw(6) << d << setw(6) << k << setw(14) << pairwise
+        << setw(14) << gemm << setw(10) << pairwise / gemm
+        << setw(8) << (choice ? "gemm" : "pair") << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 20000;
+  int n_thread = argc > 2 ? atoi(argv[2]) : 1;
+  cout << "simd: " << cluster::simd_levels[static_cast<int>(
+      cluster::distance_kernels<float>().level)] << "\n";
+  run<float>("float", n, n_thread);
+  run<double>("double", n, n_thread);
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,66 @@
+// Lloyd passes with and without set_deterministic(), to keep an eye on the
+// cost of bucketing samples by label instead of per-thread sums.
+//
+//   make bench && ./bin/bench_deterministic [n] [n_thread]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+double time_fit(const cluster::Matrix<DType> &data,
+    const cluster::Matrix<DType> &seeds, int n_thread, bool deterministic) {
+  const int n_iter = 10;
+  double best = 1e30;
+  for (int rep = 0; rep < 3; ++rep) {
+    cluster::Kmeans<DType> kmeans(seeds.rows(), n_thread, n_iter, 0);
+    kmeans.set_deterministic(deterministic);
+    kmeans.set_centers(seeds);
+    auto start = chrono::steady_clock::now();
+    kmeans.fit(data, true);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count() / n_iter);
+  }
+  return best;
+}
+
+template <typename DType>
+void run(const char *type, size_t n, int n_thread) {
+  mt19937 gen(0);
+  normal_distribution<DType> dis(0, 1);
+  const size_t dims[] = {2, 16, 128};
+  const size_t ks[] = {8, 64, 512};
+  cout << type << " n=" << n << " threads=" << n_thread << "\n";
+  cout << setw(6) << "d" << setw(6) << "k" << setw(14) << "default(s)"
+    << setw(16) << "deterministic" << setw(12) << "overhead" << "\n";
+  for (size_t d : dims) {
+    cluster::Matrix<DType> data(n, d);
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < d; ++j)
+        data(i, j) = dis(gen);
+    for (size_t k : ks) {
+      cluster::Matrix<DType> seeds(k, d);
+      for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < d; ++j)
+          seeds(i, j) = data(i, j);
+      double plain = time_fit(data, seeds, n_thread, false);
+      double ordered = time_fit(data, seeds, n_thread, true);
+      cout << setw(6) << d << setw(6) << k << setw(14) << plain
+        << setw(16) << ordered << setw(11)
+        << 100 * (ordered - plain) / plain << "%\n";
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 200000;
+  int n_thread = argc > 2 ? atoi(argv[2]) : 4;
+  log_level = WARN;
+  run<float>("float", n, n_thread);
+  run<double>("double", n, n_thread);
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,83 @@
+// Lloyd passes over float samples vs the same samples stored as float16,
+// bfloat16 and int8, all from the same seeds. Accuracy is measured on the
+// original samples: cost of each model relative to the float one, and the
+// share of labels that agree with the float fit.
+//
+//   make bench && ./bin/bench_encoded [n] [n_thread]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename Data>
+double time_fit(cluster::Kmeans<float> &kmeans, const Data &data,
+    const cluster::Matrix<float> &seeds, int n_iter) {
+  kmeans.set_centers(seeds);
+  auto start = chrono::steady_clock::now();
+  kmeans.fit(data, true);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / n_iter;
+}
+
+void run(size_t n, size_t d, size_t k, int n_thread) {
+  // blobs around k random centers, so labels are worth comparing
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> means(k, d), data(n, d), seeds(k, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      means(i, j) = 4 * dis(gen);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = means(i % k, j) + dis(gen);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      seeds(i, j) = data(i * (n / k), j);
+
+  const int n_iter = 10;
+  cluster::Kmeans<float> kmeans(k, n_thread, n_iter, 0);
+  kmeans.set_deterministic(true);
+  double base_time = time_fit(kmeans, data, seeds, n_iter);
+  float base_cost;
+  kmeans.cost(data, base_cost);
+  const vector<int> base_labels = kmeans.labels();
+  cout << setw(6) << d << setw(6) << k << setw(10) << "float"
+    << setw(12) << data.rows() * data.cols() * sizeof(float) / (1 << 20)
+    << setw(12) << base_time << setw(10) << 1.0 << setw(12) << 1.0 << "\n";
+
+  for (int e = 0; e < 3; ++e) {
+    cluster::Encoding encoding = static_cast<cluster::Encoding>(e);
+    cluster::EncodedMatrix<float> encoded(data, encoding, n_thread);
+    double time = time_fit(kmeans, encoded, seeds, n_iter);
+    float cost;
+    kmeans.cost(data, cost);
+    vector<int> labels;
+    kmeans.predict(data, labels);
+    size_t agree = 0;
+    for (size_t i = 0; i < n; ++i) {
+      agree += labels[i] == base_labels[i];
+    }
+    cout << setw(6) << d << setw(6) << k << setw(10)
+      << cluster::encodings[e] << setw(12) << encoded.bytes() / (1 << 20)
+      << setw(12) << time << setw(10) << cost / base_cost
+      << setw(12) << static_cast<double>(agree) / n << "\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 200000;
+  int n_thread = argc > 2 ? atoi(argv[2]) : 4;
+  log_level = WARN;
+  cout << "n=" << n << " threads=" << n_thread << "\n";
+  cout << setw(6) << "d" << setw(6) << "k" << setw(10) << "storage"
+    << setw(12) << "MiB" << setw(12) << "iter(s)" << setw(10) << "cost"
+    << setw(12) << "agreement" << "\n";
+  run(n, 16, 64, n_thread);
+  run(n, 128, 64, n_thread);
+  run(n, 128, 512, n_thread);
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
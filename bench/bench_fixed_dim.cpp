@@ -0,0 +1,76 @@
+// Nearest-center search with the generic kernels vs the ones unrolled for a
+// fixed dimension, at every SIMD level the CPU supports. d = 5 and 12 have
+// no specialization and show the noise floor.
+//
+//   make bench && ./bin/bench_fixed_dim [n] [k]
+#include <chrono>
+#include <random>
+#include "distance.h"
+#include "matrix.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+double time_nearest(const cluster::DistanceKernels<DType> &kernels,
+    const cluster::Matrix<DType> &data, const cluster::Matrix<DType> &centers,
+    vector<int> &labels) {
+  const size_t n = data.rows(), d = data.cols();
+  double best = 1e30;
+  for (int rep = 0; rep < 5; ++rep) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+      DType dist;
+      labels[i] = kernels.nearest(data.row(i), centers.data(), centers.rows(),
+                                  centers.stride(), d, &dist);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count());
+  }
+  return best;
+}
+
+template <typename DType>
+void run(const char *type, size_t n, size_t k) {
+  mt19937 gen(0);
+  normal_distribution<DType> dis(0, 1);
+  const size_t dims[] = {2, 3, 4, 5, 8, 12, 16, 32};
+  cout << type << " n=" << n << " k=" << k << "\n";
+  cout << setw(8) << "level" << setw(6) << "d" << setw(14) << "generic(s)"
+    << setw(12) << "fixed(s)" << setw(10) << "speedup" << "\n";
+  for (int level = 0; level < 4; ++level) {
+    if (!cluster::set_simd_level(static_cast<cluster::SimdLevel>(level))) {
+      continue;
+    }
+    for (size_t d : dims) {
+      cluster::Matrix<DType> data(n, d), centers(k, d, true);
+      for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < d; ++j)
+          data(i, j) = dis(gen);
+      for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < d; ++j)
+          centers(i, j) = data(i, j);
+      vector<int> generic_labels(n), fixed_labels(n);
+      double generic = time_nearest(cluster::distance_kernels<DType>(), data,
+                                    centers, generic_labels);
+      double fixed = time_nearest(cluster::distance_kernels<DType>(d), data,
+                                  centers, fixed_labels);
+      cout << setw(8) << cluster::simd_levels[level] << setw(6) << d
+        << setw(14) << generic << setw(12) << fixed << setw(9)
+        << generic / fixed << "x"
+        << (generic_labels == fixed_labels ? "" : "  labels differ!") << "\n";
+    }
+  }
+  cluster::set_simd_level(cluster::detect_simd_level());
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 200000;
+  size_t k = argc > 2 ? atol(argv[2]) : 16;
+  log_level = WARN;
+  run<float>("float", n, k);
+  run<double>("double", n, k);
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
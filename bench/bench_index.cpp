@@ -0,0 +1,78 @@
+// Single-point predict() latency against a large codebook, brute force vs
+// the center index in exact mode and with a growing number of probes, along
+// with the recall of the approximate searches.
+//
+//   make bench && ./bin/bench_index [k] [d] [n_query]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// microseconds per query, labels in `labels`
+template <typename DType>
+double time_queries(cluster::Kmeans<DType> &kmeans,
+    const cluster::Matrix<DType> &queries, vector<int> &labels) {
+  labels.resize(queries.rows());
+  double best = 1e30;
+  for (int rep = 0; rep < 3; ++rep) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.rows(); ++i) {
+      DType dist;
+      kmeans.predict(queries.row(i), dist, labels[i]);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, 1e6 * elapsed.count() / queries.rows());
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  size_t k = argc > 1 ? atol(argv[1]) : 65536;
+  size_t d = argc > 2 ? atol(argv[2]) : 16;
+  size_t n_query = argc > 3 ? atol(argv[3]) : 2000;
+  log_level = WARN;
+
+  // a codebook trained on clustered data, queried with fresh samples of it
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> groups(256, d), centers(k, d), queries(n_query, d);
+  for (size_t i = 0; i < groups.rows(); ++i)
+    for (size_t j = 0; j < d; ++j)
+      groups(i, j) = 10 * dis(gen);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      centers(i, j) = groups(gen() % groups.rows(), j) + dis(gen);
+  for (size_t i = 0; i < n_query; ++i)
+    for (size_t j = 0; j < d; ++j)
+      queries(i, j) = groups(gen() % groups.rows(), j) + dis(gen);
+
+  cluster::Kmeans<float> kmeans(k);
+  kmeans.set_centers(centers);
+  vector<int> expected, labels;
+  double brute = time_queries(kmeans, queries, expected);
+
+  auto start = chrono::steady_clock::now();
+  kmeans.build_index();
+  chrono::duration<double> build = chrono::steady_clock::now() - start;
+  cout << "k=" << k << " d=" << d << " lists=" << kmeans.index().num_lists()
+    << " build=" << build.count() << "s\n";
+  cout << setw(8) << "probes" << setw(14) << "latency(us)" << setw(10)
+    << "speedup" << setw(10) << "recall" << "\n";
+  cout << setw(8) << "brute" << setw(14) << brute << setw(10) << 1
+    << setw(10) << 1 << "\n";
+  for (size_t n_probe : {0, 1, 2, 4, 8, 16, 32, 64}) {
+    kmeans.set_index_probes(n_probe);
+    double latency = time_queries(kmeans, queries, labels);
+    size_t hits = 0;
+    for (size_t i = 0; i < n_query; ++i)
+      hits += labels[i] == expected[i];
+    cout << setw(8) << (n_probe == 0 ? "exact" : to_string(n_probe))
+      << setw(14) << latency << setw(10) << brute / latency << setw(10)
+      << static_cast<double>(hits) / n_query << "\n";
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
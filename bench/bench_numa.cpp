@@ -0,0 +1,73 @@
+// Lloyd passes from one thread up to every core, with and without
+// set_numa(), to show how each mode scales across sockets.
+//
+//   make bench NUMA=1 && ./bin/bench_numa [n] [d] [k]
+//
+// On a single-node box the nodes can be emulated with KMEANS_NUMA_NODES=2
+// (threads are then grouped but not bound), or the run can be restricted to
+// some nodes with e.g. `numactl --cpunodebind=0,1 ./bin/bench_numa`.
+#include <chrono>
+#include <random>
+#include <omp.h>
+#include "kmeans.h"
+#include "topology.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+double time_fit(const cluster::Matrix<DType> &data,
+    const cluster::Matrix<DType> &seeds, int n_thread, bool numa) {
+  const int n_iter = 10;
+  double best = 1e30;
+  for (int rep = 0; rep < 3; ++rep) {
+    cluster::Kmeans<DType> kmeans(seeds.rows(), n_thread, n_iter, 0);
+    kmeans.set_numa(numa);
+    kmeans.set_centers(seeds);
+    auto start = chrono::steady_clock::now();
+    kmeans.fit(data, true);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count() / n_iter);
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 1000000;
+  size_t d = argc > 2 ? atol(argv[2]) : 32;
+  size_t k = argc > 3 ? atol(argv[3]) : 64;
+  log_level = WARN;
+
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> data(n, d), seeds(k, d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = dis(gen);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      seeds(i, j) = data(i, j);
+
+  const int max_thread = omp_get_num_procs();
+  cout << "n=" << n << " d=" << d << " k=" << k << " nodes="
+    << cluster::numa_nodes() << "\n";
+  cout << setw(8) << "threads" << setw(14) << "shared(s)" << setw(10)
+    << "speedup" << setw(14) << "numa(s)" << setw(10) << "speedup" << "\n";
+  double shared_base = 0, numa_base = 0;
+  for (int n_thread = 1; ; n_thread = min(2 * n_thread, max_thread)) {
+    double shared = time_fit(data, seeds, n_thread, false);
+    double numa = time_fit(data, seeds, n_thread, true);
+    if (n_thread == 1) {
+      shared_base = shared;
+      numa_base = numa;
+    }
+    cout << setw(8) << n_thread << setw(14) << shared << setw(10)
+      << shared_base / shared << setw(14) << numa << setw(10)
+      << numa_base / numa << "\n";
+    if (n_thread == max_thread)
+      break;
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,62 @@
+// Latency of the pointer predict() API for single points and micro-batches,
+// the serving path, with the batch sizes around the parallel threshold.
+//
+//   make bench && ./bin/bench_predict [k] [d] [n_thread]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  size_t k = argc > 1 ? atol(argv[1]) : 1024;
+  size_t d = argc > 2 ? atol(argv[2]) : 64;
+  int n_thread = argc > 3 ? atoi(argv[3]) : 4;
+  log_level = WARN;
+
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> centers(k, d), queries(4096, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      centers(i, j) = dis(gen);
+  for (size_t i = 0; i < queries.rows(); ++i)
+    for (size_t j = 0; j < d; ++j)
+      queries(i, j) = dis(gen);
+  cluster::Kmeans<float> kmeans(k, n_thread);
+  kmeans.set_centers(centers);
+  vector<int> labels(queries.rows() * 8);
+  vector<float> dists(queries.rows() * 8);
+
+  cout << "k=" << k << " d=" << d << " threads=" << n_thread << "\n";
+  cout << setw(8) << "batch" << setw(16) << "predict(us)" << setw(16)
+    << "per point(us)" << setw(16) << "top-8(us)" << "\n";
+  for (size_t batch : {1, 4, 16, 64, 256, 1024, 4096}) {
+    const size_t reps = max(static_cast<size_t>(1), 20000 / batch);
+    double best = 1e30, best_top = 1e30;
+    for (int trial = 0; trial < 3; ++trial) {
+      auto start = chrono::steady_clock::now();
+      for (size_t r = 0; r < reps; ++r) {
+        const size_t first = (r * batch) % (queries.rows() - batch + 1);
+        kmeans.predict(queries.row(first), batch, queries.stride(),
+                       labels.data(), dists.data());
+      }
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      best = min(best, 1e6 * elapsed.count() / reps);
+      start = chrono::steady_clock::now();
+      for (size_t r = 0; r < reps; ++r) {
+        const size_t first = (r * batch) % (queries.rows() - batch + 1);
+        kmeans.predict_top(queries.row(first), batch, queries.stride(), 8,
+                           labels.data(), dists.data());
+      }
+      elapsed = chrono::steady_clock::now() - start;
+      best_top = min(best_top, 1e6 * elapsed.count() / reps);
+    }
+    cout << setw(8) << batch << setw(16) << best << setw(16) << best / batch
+      << setw(16) << best_top << "\n";
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,108 @@
+// Assignment of sparse samples to dense centers: per-center gathers
+// (sparse_dot against each center row) vs SparseAssigner's axpy over the
+// transposed centers, then the time per Lloyd iteration of a sparse fit.
+//
+//   make bench && ./bin/bench_sparse [n] [d] [nnz] [n_thread]
+#include <chrono>
+#include <limits>
+#include <random>
+#include <set>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+cluster::SparseMatrix<float> make_data(size_t n, size_t d, size_t nnz) {
+  // power-law column popularity, like term frequencies
+  mt19937 gen(0);
+  uniform_real_distribution<double> uniform(0, 1);
+  cluster::SparseMatrix<float> data(d);
+  vector<uint32_t> indices;
+  vector<float> values;
+  for (size_t i = 0; i < n; ++i) {
+    set<uint32_t> columns;
+    while (columns.size() < nnz) {
+      columns.insert(static_cast<uint32_t>(pow(uniform(gen), 3) * d));
+    }
+    indices.assign(columns.begin(), columns.end());
+    values.assign(nnz, 0);
+    for (auto &v : values) v = static_cast<float>(uniform(gen));
+    data.add_row(indices.data(), values.data(), nnz);
+  }
+  return data;
+}
+
+double time_gather(const cluster::SparseMatrix<float> &data,
+    const cluster::Matrix<float> &centers, const vector<float> &norms,
+    vector<int> &labels) {
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < data.rows(); ++i) {
+    float best = numeric_limits<float>::max();
+    for (size_t c = 0; c < centers.rows(); ++c) {
+      float dist = norms[c] - 2 * cluster::sparse_dot(data.row_indices(i),
+          data.row_values(i), data.row_nnz(i), centers.row(c));
+      if (dist < best) {
+        best = dist;
+        labels[i] = static_cast<int>(c);
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+double time_transposed(const cluster::SparseMatrix<float> &data,
+    const cluster::Matrix<float> &centers, vector<int> &labels) {
+  auto start = chrono::steady_clock::now();
+  cluster::SparseAssigner<float> assigner;
+  assigner.prepare(centers);
+  vector<float> dists(data.rows()), workspace;
+  assigner.assign(data, 0, data.rows(), labels.data(), dists.data(),
+                  workspace);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 50000;
+  size_t d = argc > 2 ? atol(argv[2]) : 200000;
+  size_t nnz = argc > 3 ? atol(argv[3]) : 100;
+  int n_thread = argc > 4 ? atoi(argv[4]) : 4;
+  log_level = WARN;
+  auto data = make_data(n, d, nnz);
+  cout << "n=" << n << " d=" << d << " nnz/row=" << nnz << " ("
+    << data.bytes() / (1 << 20) << " MiB sparse, "
+    << n * d * sizeof(float) / (1 << 20) << " MiB dense)\n";
+  cout << setw(6) << "k" << setw(12) << "gather(s)" << setw(14)
+    << "transposed(s)" << setw(10) << "speedup" << setw(14) << "iter(s)"
+    << "\n";
+  for (size_t k : {16, 64, 256}) {
+    cluster::Matrix<float> centers(k, d, true);
+    vector<float> norms(k);
+    for (size_t c = 0; c < k; ++c) {
+      // centers are sums of samples, dense on the popular columns
+      for (size_t i = c; i < n; i += k) {
+        for (size_t t = 0; t < data.row_nnz(i); ++t)
+          centers(c, data.row_indices(i)[t]) += data.row_values(i)[t] * k / n;
+      }
+      for (size_t j = 0; j < d; ++j)
+        norms[c] += centers(c, j) * centers(c, j);
+    }
+    vector<int> gather_labels(n), labels(n);
+    double gather = time_gather(data, centers, norms, gather_labels);
+    double transposed = time_transposed(data, centers, labels);
+
+    const int n_iter = 5;
+    cluster::Kmeans<float> kmeans(k, n_thread, n_iter, 0);
+    kmeans.set_centers(centers);
+    auto start = chrono::steady_clock::now();
+    kmeans.fit(data, true);
+    chrono::duration<double> fit = chrono::steady_clock::now() - start;
+    cout << setw(6) << k << setw(12) << gather << setw(14) << transposed
+      << setw(9) << gather / transposed << "x" << setw(14)
+      << fit.count() / kmeans.model_info().n_iter << "\n";
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,92 @@
+// Spherical k-means against the L2 fit of samples normalized beforehand:
+// one assignment of every sample with each Assigner (AUTO for L2, the max
+// inner product for COSINE), then the time per Lloyd iteration of both
+// fits, starting from the same centers.
+//
+//   make bench && ./bin/bench_spherical [n] [d] [n_thread]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// embedding-like samples: 64 directions, lengths spread over two decades
+cluster::Matrix<float> make_data(size_t n, size_t d) {
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  uniform_real_distribution<float> length(0.1f, 10.f);
+  const size_t topics = 64;
+  cluster::Matrix<float> means(topics, d), data(n, d, true);
+  for (size_t i = 0; i < topics; ++i)
+    for (size_t j = 0; j < d; ++j)
+      means(i, j) = dis(gen);
+  cluster::normalize_rows(means.data(), topics, d, means.stride());
+  for (size_t i = 0; i < n; ++i) {
+    const size_t topic = gen() % topics;
+    const float scale = length(gen);
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = scale * (means(topic, j) + 0.5f * dis(gen) / sqrt(d));
+  }
+  return data;
+}
+
+double time_assign(const cluster::Matrix<float> &data,
+    const cluster::Matrix<float> &centers, cluster::Metric metric) {
+  const size_t n = data.rows(), block = cluster::Assigner<float>::kBlockPoints;
+  auto start = chrono::steady_clock::now();
+  cluster::Assigner<float> assigner;
+  assigner.prepare(centers, cluster::AssignMethod::AUTO, nullptr, metric);
+  vector<int> labels(n);
+  vector<float> dists(n), workspace;
+  for (size_t b = 0; b < n; b += block) {
+    assigner.assign(data.row(b), min(block, n - b), data.stride(), &labels[b],
+                    &dists[b], workspace);
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+double time_iteration(const cluster::Matrix<float> &data,
+    const cluster::Matrix<float> &centers, cluster::Metric metric,
+    int n_thread) {
+  const int n_iter = 5;
+  cluster::Kmeans<float> kmeans(centers.rows(), n_thread, n_iter, 0);
+  kmeans.set_metric(metric);
+  kmeans.set_centers(centers);
+  auto start = chrono::steady_clock::now();
+  kmeans.fit(data, true);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / kmeans.model_info().n_iter;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? atol(argv[1]) : 100000;
+  size_t d = argc > 2 ? atol(argv[2]) : 128;
+  int n_thread = argc > 3 ? atoi(argv[3]) : 4;
+  log_level = WARN;
+  auto data = make_data(n, d);
+  // what callers did before: a normalized copy, clustered by L2
+  auto unit = data;
+  cluster::normalize_rows(unit.data(), n, d, unit.stride());
+  cout << "n=" << n << " d=" << d << " threads=" << n_thread << "\n";
+  cout << setw(6) << "k" << setw(14) << "l2 assign(s)" << setw(18)
+    << "cosine assign(s)" << setw(12) << "l2 iter(s)" << setw(16)
+    << "cosine iter(s)" << "\n";
+  for (size_t k : {16, 64, 256}) {
+    cluster::Matrix<float> centers(k, d, true);
+    for (size_t c = 0; c < k; ++c)
+      copy(unit.row(c * (n / k)), unit.row(c * (n / k)) + d, centers.row(c));
+    cout << setw(6) << k
+      << setw(14) << time_assign(unit, centers, cluster::Metric::L2)
+      << setw(18) << time_assign(unit, centers, cluster::Metric::COSINE)
+      << setw(12) << time_iteration(unit, centers, cluster::Metric::L2,
+                                    n_thread)
+      << setw(16) << time_iteration(data, centers, cluster::Metric::COSINE,
+                                    n_thread)
+      << "\n";
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
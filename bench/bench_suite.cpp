@@ -0,0 +1,209 @@
+// Regression suite: Gaussian blobs over a grid of n, d and k, each phase
+// timed separately for Kmeans<float> and Kmeans<double> and a sweep of
+// thread counts, written as JSON to compare releases.
+//
+//   make bench && ./bin/bench_suite [-o out.json] [-s scale] [-t 1,2,4]
+//
+// -s scales every n (e.g. 0.1 for a quick run), -t overrides the thread
+// counts, which default to powers of two up to every core. Data and seeds
+// are fixed, so two runs of one build differ by timing noise only.
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <omp.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace {
+
+struct Workload {
+  const char *name;
+  size_t n, d, k;
+};
+
+// the last two are the high-d and large-k cases
+const Workload kWorkloads[] = {
+  {"low-d", 200000, 2, 10},
+  {"mid-d", 200000, 16, 100},
+  {"wide", 100000, 128, 100},
+  {"high-d", 50000, 512, 64},
+  {"large-k", 100000, 16, 4096},
+};
+
+const int kIters = 5;
+const uint64_t kSeed = 1;
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// k blobs with unit variance around means spread over [-10, 10]^d
+template <typename DType>
+cluster::Matrix<DType> make_blobs(size_t n, size_t d, size_t k) {
+  mt19937 gen(static_cast<unsigned>(n * 31 + d * 7 + k));
+  uniform_real_distribution<DType> spread(-10, 10);
+  normal_distribution<DType> noise(0, 1);
+  cluster::Matrix<DType> means(k, d), data(n, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      means(i, j) = spread(gen);
+  for (size_t i = 0; i < n; ++i) {
+    const size_t blob = gen() % k;
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = means(blob, j) + noise(gen);
+  }
+  return data;
+}
+
+template <typename DType>
+void write_text(const char *path, const cluster::Matrix<DType> &data) {
+  ofstream fout(path);
+  for (size_t i = 0; i < data.rows(); ++i) {
+    for (size_t j = 0; j < data.cols(); ++j)
+      fout << data(i, j) << (j + 1 < data.cols() ? ' ' : '\n');
+  }
+}
+
+// one JSON object per workload, type and thread count
+template <typename DType>
+void run(const char *type, const Workload &w, size_t n,
+         const vector<int> &threads, vector<string> &results) {
+  auto data = make_blobs<DType>(n, w.d, w.k);
+  char text_path[] = "/tmp/bench_suite_text_XXXXXX";
+  char bin_path[] = "/tmp/bench_suite_bin_XXXXXX";
+  close(mkstemp(text_path));
+  close(mkstemp(bin_path));
+  write_text(text_path, data);
+  cluster::save_dataset(bin_path, data);
+
+  for (int n_thread : threads) {
+    cluster::Matrix<DType> loaded;
+    auto start = chrono::steady_clock::now();
+    cluster::parse_text_file(text_path, loaded, n_thread);
+    const double load_text = seconds_since(start);
+    start = chrono::steady_clock::now();
+    cluster::map_dataset(bin_path, loaded);
+    const double load_binary = seconds_since(start);
+
+    // seeding alone: no Lloyd pass after init
+    cluster::Kmeans<DType> seeder(w.k, n_thread, 0, 0);
+    seeder.set_seed(kSeed);
+    seeder.set_profiling(true);
+    seeder.fit(data);
+    const double seed = seeder.stats().init_s;
+
+    // phases of each iteration from the fit's own stats
+    cluster::Kmeans<DType> kmeans(w.k, n_thread, kIters, 0);
+    kmeans.set_seed(kSeed);
+    kmeans.set_profiling(true);
+    kmeans.set_centers(seeder.center_matrix());
+    kmeans.fit(data, true);
+    const auto stats = kmeans.stats();
+    double assign = 0, update = 0, imbalance = 0;
+    for (const auto &iter : stats.iterations) {
+      assign += iter.assign_s / stats.iterations.size();
+      update += iter.update_s / stats.iterations.size();
+      imbalance = max(imbalance, iter.imbalance);
+    }
+
+    DType cost;
+    kmeans.cost(data, cost);
+    vector<int> labels;
+    start = chrono::steady_clock::now();
+    kmeans.predict(data, labels);
+    const double predict = seconds_since(start);
+    const size_t n_single = min(n, static_cast<size_t>(2000));
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n_single; ++i) {
+      DType dist;
+      int label;
+      kmeans.predict(data.row(i), dist, label);
+    }
+    const double single = seconds_since(start) / n_single;
+
+    ostringstream out;
+    out << "{\"workload\": \"" << w.name << "\", \"type\": \"" << type
+      << "\", \"n\": " << n << ", \"d\": " << w.d << ", \"k\": " << w.k
+      << ", \"threads\": " << n_thread
+      << ", \"load_text_s\": " << load_text
+      << ", \"load_binary_s\": " << load_binary
+      << ", \"seed_s\": " << seed
+      << ", \"iterations\": " << stats.iterations.size()
+      << ", \"iteration_s\": " << assign + update
+      << ", \"assign_s\": " << assign
+      << ", \"update_s\": " << update
+      << ", \"imbalance\": " << imbalance
+      << ", \"peak_bytes\": " << stats.peak_bytes
+      << ", \"predict_points_per_s\": " << n / predict
+      << ", \"predict_single_us\": " << 1e6 * single
+      << ", \"cost\": " << cost << "}";
+    results.push_back(out.str());
+    cerr << out.str() << "\n";
+  }
+  unlink(text_path);
+  unlink(bin_path);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  string out_path;
+  double scale = 1;
+  vector<int> threads;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:s:t:")) != -1) {
+    switch (opt) {
+      case 'o': out_path = optarg; break;
+      case 's': scale = atof(optarg); break;
+      case 't': {
+        istringstream list(optarg);
+        string item;
+        while (getline(list, item, ','))
+          threads.push_back(atoi(item.c_str()));
+        break;
+      }
+      default:
+        cerr << "usage: " << argv[0] << " [-o out.json] [-s scale] [-t 1,2,4]\n";
+        return 1;
+    }
+  }
+  const int max_thread = omp_get_num_procs();
+  if (threads.empty()) {
+    for (int t = 1; t < max_thread; t *= 2)
+      threads.push_back(t);
+    threads.push_back(max_thread);
+  }
+  log_level = WARN;
+
+  vector<string> results;
+  for (const auto &w : kWorkloads) {
+    const size_t n = max(w.k, static_cast<size_t>(w.n * scale));
+    run<float>("float", w, n, threads, results);
+    run<double>("double", w, n, threads, results);
+  }
+
+  ostringstream json;
+  json << "{\n  \"suite\": \"kmeans\",\n  \"simd\": \""
+    << cluster::simd_levels[static_cast<int>(
+         cluster::distance_kernels<float>().level)]
+    << "\",\n  \"max_threads\": " << max_thread << ",\n  \"scale\": " << scale
+    << ",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i)
+    json << "    " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+  json << "  ]\n}\n";
+  if (out_path.empty()) {
+    cout << json.str();
+  } else {
+    ofstream(out_path) << json.str();
+  }
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
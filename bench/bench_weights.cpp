@@ -0,0 +1,71 @@
+// A weighted fit of deduplicated samples against the fit of the samples
+// repeated as often as they occur: u distinct samples, each carrying a count
+// of 1 to 2 * m - 1, both fits starting from the same centers. Reports the
+// time per Lloyd iteration and the bytes of samples each fit reads.
+//
+//   make bench && ./bin/bench_weights [u] [d] [m] [n_thread]
+#include <chrono>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+double time_iteration(const cluster::Matrix<float> &data,
+    const vector<double> *weights, const cluster::Matrix<float> &centers,
+    int n_thread) {
+  const int n_iter = 5;
+  cluster::Kmeans<float> kmeans(centers.rows(), n_thread, n_iter, 0);
+  kmeans.set_centers(centers);
+  auto start = chrono::steady_clock::now();
+  if (weights) {
+    kmeans.fit(data, *weights, true);
+  } else {
+    kmeans.fit(data, true);
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / kmeans.model_info().n_iter;
+}
+
+int main(int argc, char **argv) {
+  size_t u = argc > 1 ? atol(argv[1]) : 100000;
+  size_t d = argc > 2 ? atol(argv[2]) : 32;
+  size_t m = argc > 3 ? atol(argv[3]) : 8;
+  int n_thread = argc > 4 ? atoi(argv[4]) : 4;
+  log_level = WARN;
+  mt19937 gen(0);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> data(u, d, true);
+  vector<double> weights(u);
+  size_t n = 0;
+  for (size_t i = 0; i < u; ++i) {
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = dis(gen);
+    weights[i] = 1 + gen() % (2 * m - 1);
+    n += static_cast<size_t>(weights[i]);
+  }
+  cluster::Matrix<float> expanded(n, d, true);
+  for (size_t i = 0, row = 0; i < u; ++i)
+    for (size_t r = 0; r < static_cast<size_t>(weights[i]); ++r, ++row)
+      copy(data.row(i), data.row(i) + d, expanded.row(row));
+
+  cout << "u=" << u << " n=" << n << " d=" << d << " threads=" << n_thread
+    << "\n";
+  cout << setw(6) << "k" << setw(16) << "weighted(s)" << setw(16)
+    << "expanded(s)" << setw(10) << "speedup" << "\n";
+  for (size_t k : {16, 64, 256}) {
+    cluster::Matrix<float> centers(k, d, true);
+    for (size_t c = 0; c < k; ++c)
+      copy(data.row(c), data.row(c) + d, centers.row(c));
+    const double weighted = time_iteration(data, &weights, centers, n_thread);
+    const double plain = time_iteration(expanded, nullptr, centers, n_thread);
+    cout << setw(6) << k << setw(16) << weighted << setw(16) << plain
+      << setw(9) << plain / weighted << "x\n";
+  }
+  cout << "sample bytes: weighted " << u * (data.stride() * sizeof(float) +
+      sizeof(double)) << ", expanded " << n * expanded.stride() * sizeof(float)
+    << "\n";
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,124 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include "distance.h"
+#include "matrix.h"
+
+#include <vector>
+
+namespace cluster {
+
+enum class Algorithm { LLOYD, HAMERLY, ELKAN, YINYANG, AUTO };
+extern const char* algorithms[5];
+
+// Assignment step that uses the triangle inequality to skip point-center
+// distances which cannot change a label.
+//
+// Both variants keep, per point, lower bounds on the distance to the centers
+// it is not assigned to, and relax them by how far centers moved since the
+// last pass. The distance to the assigned center is always evaluated, which
+// gives the exact cost and a tight upper bound for free.
+//
+//   HAMERLY  one lower bound per point (second closest center), n values
+//   ELKAN    one lower bound per point and center, n * k values, plus the
+//            k * k center-center distances
+//   YINYANG  centers are clustered once into t ~ k / 10 groups, one lower
+//            bound per point and group, n * t values. A point whose upper
+//            bound beats every group bound is skipped (global filter);
+//            otherwise only groups whose bound it fails are scanned (group
+//            filter), and in those, centers whose old group bound minus
+//            their own drift still beats it are skipped (local filter).
+//
+// Pruning tests are strict and carry a small relative slack, and surviving
+// candidates are compared on the same squared distances and with the same
+// lowest-index tie break as Assigner's PAIRWISE path, so labels are identical
+// to Lloyd with AssignMethod::PAIRWISE. Under AUTO, plain Lloyd switches to
+// the GEMM expansion once prefer_gemm(d, k) holds, and its rounding may
+// resolve near-ties differently.
+template <typename DType>
+class BoundedAssigner {
+  public:
+    BoundedAssigner() : algorithm_(Algorithm::HAMERLY), n_(0), k_(0),
+      center_evals_(0), centers_(nullptr), max_drift_center_(-1),
+      kernels_(&distance_kernels<DType>()) {}
+
+    // Start over for n points and k centers; the next assign() of every
+    // point evaluates all k distances to initialize its bounds.
+    void reset(Algorithm algorithm, size_t n, size_t k);
+
+    // Must be called before each assignment pass with the current centers.
+    // Computes center drift since the previous call and the center-center
+    // distances the pruning tests need.
+    void prepare(const Matrix<DType> &centers, int n_thread = 1);
+    // prepare() from inside a parallel region: every thread of the team
+    // calls it and the center-center distances are split among them.
+    void prepare_team(const Matrix<DType> &centers);
+
+    // Assign points begin..begin+n-1 (rows of x, `stride` apart) whose labels
+    // after the previous pass are prev_labels[0..n-1]. Concurrent calls on
+    // disjoint ranges are safe. Returns the number of point-center distances
+    // evaluated.
+    size_t assign(const DType *x, size_t begin, size_t n, size_t stride,
+                  const int *prev_labels, int *labels, DType *min_dists,
+                  std::vector<DType> &workspace);
+
+    // center-center distances evaluated by the last prepare()
+    size_t center_evals() const { return center_evals_; }
+    // memory held by the bounds and the per-center state
+    size_t bytes() const;
+    Algorithm algorithm() const { return algorithm_; }
+
+    size_t num_groups() const { return group_start_.empty() ? 0 :
+                                       group_start_.size() - 1; }
+
+    // Hamerly's single bound prunes best for few centers, Elkan's per-center
+    // bounds for a few hundred of them while n * k bounds fit in memory, and
+    // Yinyang's per-group bounds beyond that.
+    static Algorithm choose(size_t n, size_t k) {
+      if (k < 32) {
+        return Algorithm::HAMERLY;
+      }
+      if (k <= 256 && n * k <= (size_t(1) << 28)) {
+        return Algorithm::ELKAN;
+      }
+      return Algorithm::YINYANG;
+    }
+
+  private:
+    Algorithm algorithm_;
+    size_t n_;
+    size_t k_;
+    size_t center_evals_;
+    const Matrix<DType> *centers_;
+    Matrix<DType> prev_centers_;
+    std::vector<char> initialized_;     /* per point, bounds are valid */
+    std::vector<DType> lower_;          /* n, n * k or n * t */
+    std::vector<DType> drift_;          /* per center, since last pass */
+    DType max_drift_[2];                /* largest two drifts */
+    int max_drift_center_;              /* center with the largest drift */
+    std::vector<DType> half_min_dist_;  /* half distance to closest center */
+    std::vector<DType> center_dists_;   /* k * k, halved (Elkan only) */
+    std::vector<int> group_of_;         /* Yinyang: group of each center */
+    std::vector<int> group_centers_;    /* centers sorted by group */
+    std::vector<size_t> group_start_;   /* group g is group_centers_[s, e) */
+    std::vector<DType> group_drift_;    /* largest drift in each group */
+    const DistanceKernels<DType> *kernels_;
+
+    size_t init_point(const DType *p, size_t i, int *label, DType *min_dist,
+                      std::vector<DType> &workspace);
+    size_t hamerly(const DType *p, size_t i, int *label, DType *min_dist,
+                   std::vector<DType> &workspace);
+    size_t elkan(const DType *p, size_t i, int *label, DType *min_dist);
+    size_t yinyang(const DType *p, size_t i, int *label, DType *min_dist,
+                   std::vector<DType> &workspace);
+    void update_drift(const Matrix<DType> &centers, int n_thread);
+    void center_distances(const Matrix<DType> &centers);
+    void group_centers(const Matrix<DType> &centers, int n_thread);
+    void set_group_bounds(size_t i, const DType *dists, int best);
+};  // class BoundedAssigner
+
+}  // namespace cluster
+
+#endif  // BOUNDS_H
+
+// vim: ts=2 sts=2 sw=2
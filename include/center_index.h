@@ -0,0 +1,60 @@
+#ifndef CENTER_INDEX_H
+#define CENTER_INDEX_H
+
+#include "distance.h"
+#include "matrix.h"
+
+#include <vector>
+
+namespace cluster {
+
+// Two-level index over a fixed set of centers, for nearest-center queries
+// against large codebooks.
+//
+// build() clusters the centers themselves into n_list cells with a few Lloyd
+// passes and stores the members of each cell contiguously, sorted by their
+// distance r to the cell centroid. A query x at distance t from a centroid
+// can only be nearer than sqrt(best) to members with |t - r| <= sqrt(best)
+// (triangle inequality), a contiguous band of the cell that two binary
+// searches find.
+//
+// With n_probe = 0 the search is exact: it scans the nearest cell, then the
+// bands of all other cells, so the label is the one a full scan returns,
+// ties going to the lowest index. With n_probe > 0 only the bands of the
+// n_probe nearest cells are scanned, trading recall for latency;
+// bench/bench_index measures both.
+template <typename DType>
+class CenterIndex {
+  public:
+    CenterIndex() : max_members_(0), kernels_(&distance_kernels<DType>()) {}
+
+    // Index a copy of `centers`; n_list = 0 picks about sqrt(k) cells.
+    void build(const Matrix<DType> &centers, size_t n_list = 0,
+               int n_thread = 1);
+    void clear();
+    bool empty() const { return ids_.empty(); }
+    size_t num_lists() const { return cells_.rows(); }
+
+    // Nearest center to x and its squared distance in *min_dist. `workspace`
+    // is scratch owned by the calling thread; concurrent calls are safe.
+    int search(const DType *x, size_t n_probe, DType *min_dist,
+               std::vector<DType> &workspace) const;
+
+  private:
+    Matrix<DType> cells_;  /* n_list x d centroids, rows padded */
+    Matrix<DType> members_;  /* the centers grouped by cell, rows padded */
+    std::vector<DType> radii_;  /* per members_ row, not squared */
+    std::vector<int> ids_;  /* center index of each members_ row */
+    std::vector<size_t> offsets_;  /* cell i: rows offsets_[i] to [i + 1] */
+    size_t max_members_;  /* largest cell */
+    const DistanceKernels<DType> *kernels_;
+
+    void scan(const DType *x, size_t cell, DType dist, DType &best,
+              int &best_id, DType *dists) const;
+};  // class CenterIndex
+
+}  // namespace cluster
+
+#endif  // CENTER_INDEX_H
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,110 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "matrix.h"
+#include "reader.h"
+#include "status.h"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace cluster {
+
+// Binary dataset file, version 1. A 64-byte header is followed by `rows`
+// rows of `stride` elements each, row-major, in native byte order:
+//
+//   offset  size  field
+//        0     8  magic "KMEANSDS"
+//        8     4  version
+//       12     4  dtype, see DataType
+//       16     8  rows
+//       24     8  cols
+//       32     8  stride, elements per row (>= cols, padding is zero)
+//       40     4  alignment of the payload and of padded rows, in bytes
+//       44    20  reserved, zero
+//
+// The payload starts right after the header, so an mmap of the file puts it
+// on a 64-byte boundary and the rows can be used in place.
+enum class DataType : uint32_t { FLOAT32 = 1, FLOAT64 = 2 };
+
+struct DatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t stride;
+  uint32_t alignment;
+  char reserved[20];
+};
+static_assert(sizeof(DatasetHeader) == 64, "dataset header must be 64 bytes");
+
+extern const char kDatasetMagic[8];
+const uint32_t kDatasetVersion = 1;
+
+template <typename DType>
+DataType data_type();
+
+// Whether `path` starts with the dataset magic.
+bool is_dataset(const char *path);
+
+// Map a dataset file into `out` without copying. The mapping is private:
+// writes through `out` never reach the file. Returns FORMAT_ERROR if the
+// header is malformed, of another version or not of type DType.
+template <typename DType>
+Status map_dataset(const char *path, Matrix<DType> &out);
+
+// Write a dataset file in chunks of rows, for inputs that are not in memory
+// as a whole; the row count is filled in by close().
+template <typename DType>
+class DatasetWriter {
+  public:
+    DatasetWriter() : file_(nullptr), rows_(0), cols_(0), stride_(0),
+      alignment_(0) {}
+    ~DatasetWriter() { close(); }
+
+    // With `padded`, rows are padded to Matrix::kAlignment bytes, so mapped
+    // rows are aligned like those of a padded Matrix.
+    Status open(const char *path, size_t cols, bool padded = false);
+    Status append(const Matrix<DType> &rows);
+    Status close();
+
+  private:
+    FILE *file_;
+    size_t rows_;
+    size_t cols_;
+    size_t stride_;
+    size_t alignment_;
+};  // class DatasetWriter
+
+// Serves batches of a mapped dataset as views into the mapping, so streaming
+// fits read it without parsing or copying.
+template <typename DType>
+class DatasetReader : public BatchReader<DType> {
+  public:
+    DatasetReader() : next_(0) {}
+
+    Status open(const char *path) {
+      next_ = 0;
+      return map_dataset(path, data_);
+    }
+    Status read(size_t max_rows, Matrix<DType> &batch) override;
+    Status rewind() override {
+      next_ = 0;
+      return Status::OK;
+    }
+
+  private:
+    Matrix<DType> data_;
+    size_t next_;
+};  // class DatasetReader
+
+template <typename DType>
+Status save_dataset(const char *path, const Matrix<DType> &data,
+                    bool padded = false);
+
+}  // namespace cluster
+
+#endif  // DATASET_H
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,72 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <cstddef>
+
+namespace cluster {
+
+enum class SimdLevel { SCALAR, SSE, AVX2, AVX512 };
+extern const char* simd_levels[4];
+
+// Dimensions with kernels unrolled at compile time, see distance_kernels(d).
+const size_t kFixedDims[] = {2, 3, 4, 8, 16, 32};
+
+// Table of distance kernels for one instruction set. Kernels accept
+// unaligned input; centers are k rows laid out `stride` elements apart (see
+// Matrix::stride()). A table with dim == 0 accepts any dimension d, one
+// with dim > 0 must only be called with d == dim.
+template <typename DType>
+struct DistanceKernels {
+  SimdLevel level;
+  size_t dim;
+
+  // squared euclidean distance between p and q
+  DType (*sqdist)(const DType *p, const DType *q, size_t d);
+
+  // squared euclidean distances from p to each of k centers, written to out[k]
+  void (*sqdist_1xk)(const DType *p, const DType *centers, size_t k,
+                     size_t stride, size_t d, DType *out);
+
+  // index of the center nearest to p, its squared distance in *min_dist
+  int (*nearest)(const DType *p, const DType *centers, size_t k,
+                 size_t stride, size_t d, DType *min_dist);
+
+  // inner product of p and q
+  DType (*dot)(const DType *p, const DType *q, size_t d);
+
+  // out[i * ldo + j] = <x_i, c_j> for nx points x and nc centers c, the
+  // register-blocked micro-kernel of the GEMM assignment step
+  void (*dot_block)(const DType *x, size_t nx, size_t xstride,
+                    const DType *c, size_t nc, size_t cstride, size_t d,
+                    DType *out, size_t ldo);
+
+  // y[i] += a * x[i] for i < n, the inner step of the sparse assignment:
+  // one nonzero of a sample against a row of transposed centers
+  void (*axpy)(DType a, const DType *x, size_t n, DType *y);
+};
+
+// Kernels for the best instruction set supported by the running CPU. The
+// choice is made once, on first use; setting the environment variable
+// KMEANS_SIMD to scalar, sse, avx2 or avx512 caps the level.
+template <typename DType>
+const DistanceKernels<DType>& distance_kernels();
+
+// Same level, specialized for dimension d when d is one of kFixedDims: the
+// loops over the dimension are fully unrolled, and the results are
+// bit-identical to the generic table's. Other d get the generic table.
+template <typename DType>
+const DistanceKernels<DType>& distance_kernels(size_t d);
+
+// Highest level supported by the CPU and compiled into the library.
+SimdLevel detect_simd_level();
+
+// Switch the kernels returned by distance_kernels(), e.g. to compare levels
+// in tests and benchmarks. Not thread-safe with respect to running fits.
+// Returns false, leaving the kernels unchanged, if `level` is unsupported.
+bool set_simd_level(SimdLevel level);
+
+}  // namespace cluster
+
+#endif  // DISTANCE_H
+
+// vim: ts=2 sts=2 sw=2
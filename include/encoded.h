@@ -0,0 +1,98 @@
+#ifndef ENCODED_H
+#define ENCODED_H
+
+#include "matrix.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cluster {
+
+// Reduced-precision storage for samples:
+//   FLOAT16   IEEE half, 11 significant bits, range +-65504
+//   BFLOAT16  upper half of a float, 8 significant bits, full float range
+//   INT8      per-dimension affine: x = offset[j] + scale[j] * code, with the
+//             255 codes spread evenly over the dimension's [min, max]
+enum class Encoding { FLOAT16, BFLOAT16, INT8 };
+extern const char* encodings[3];
+
+// n x d samples stored in one of the encodings above, 2 or 1 bytes per
+// value instead of sizeof(DType). Rows are widened back to DType on demand,
+// a block at a time, so fits and predictions over them never hold the
+// decoded samples as a whole. Encoding rounds to nearest (double samples
+// through float); values outside FLOAT16's range become infinite.
+template <typename DType>
+class EncodedMatrix {
+  public:
+    EncodedMatrix() : encoding_(Encoding::FLOAT16), rows_(0), cols_(0) {}
+    EncodedMatrix(const Matrix<DType> &data, Encoding encoding,
+                  int n_thread = 1);
+
+    // Widen rows begin..begin+n-1 into out, rows `stride` elements apart.
+    void decode(size_t begin, size_t n, DType *out, size_t stride) const;
+    Matrix<DType> decode() const;
+
+    Encoding encoding() const { return encoding_; }
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    bool empty() const { return rows_ == 0; }
+    // memory held by the encoded values and, for INT8, the scales
+    size_t bytes() const;
+
+  private:
+    Encoding encoding_;
+    size_t rows_;
+    size_t cols_;
+    std::vector<uint16_t> halves_;  /* FLOAT16 and BFLOAT16 */
+    std::vector<int8_t> codes_;  /* INT8 */
+    std::vector<DType> scale_;  /* INT8, per dimension */
+    std::vector<DType> offset_;
+};  // class EncodedMatrix
+
+// The samples of a fit as its passes read them: rows of a Matrix are used
+// in place, rows of an EncodedMatrix are decoded into the calling thread's
+// tile just before they are assigned and summed.
+template <typename DType>
+class SampleBlocks {
+  public:
+    SampleBlocks(const Matrix<DType> &data) :
+      matrix_(&data), encoded_(nullptr) {}
+    SampleBlocks(const EncodedMatrix<DType> &data) :
+      matrix_(nullptr), encoded_(&data) {}
+
+    size_t rows() const {
+      return matrix_ != nullptr ? matrix_->rows() : encoded_->rows();
+    }
+    size_t cols() const {
+      return matrix_ != nullptr ? matrix_->cols() : encoded_->cols();
+    }
+    // elements between the rows block() points to
+    size_t stride() const {
+      return matrix_ != nullptr ? matrix_->stride() : encoded_->cols();
+    }
+
+    // rows begin..begin+n-1, stride() elements apart; `tile` is scratch of
+    // the calling thread and holds them if they had to be decoded
+    const DType* block(size_t begin, size_t n, std::vector<DType> &tile) const {
+      if (matrix_ != nullptr) {
+        return matrix_->row(begin);
+      }
+      tile.resize(n * encoded_->cols());
+      encoded_->decode(begin, n, tile.data(), encoded_->cols());
+      return tile.data();
+    }
+
+    // null for encoded samples
+    const Matrix<DType>* matrix() const { return matrix_; }
+
+  private:
+    const Matrix<DType> *matrix_;
+    const EncodedMatrix<DType> *encoded_;
+};  // class SampleBlocks
+
+}  // namespace cluster
+
+#endif  // ENCODED_H
+
+// vim: ts=2 sts=2 sw=2
@@ -1,20 +1,42 @@
 #ifndef KMEANS_H
 #define KMEANS_H
 
+#include "assignment.h"
+#include "bounds.h"
+#include "center_index.h"
+#include "dataset.h"
+#include "distance.h"
+#include "encoded.h"
+#include "matrix.h"
+#include "minibatch.h"
+#include "model.h"
+#include "parser.h"
+#include "random.h"
+#include "reader.h"
+#include "sparse.h"
+#include "stats.h"
+#include "status.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <set>
 #include <vector>
 
 namespace cluster {
 
-enum class InitMethod { RANDOM, KMEANS_PLUSPLUS, KMEANS_PARALLEL };
-enum class Status { OK, IO_ERROR, DIM_ERROR };
-extern const char* init_methods[3];
+// GREEDY_KMEANS_PLUSPLUS samples 2 + ln(k) candidates per round and keeps
+// the one that lowers the cost the most.
+enum class InitMethod { RANDOM, KMEANS_PLUSPLUS, KMEANS_PARALLEL,
+                        GREEDY_KMEANS_PLUSPLUS };
+extern const char* init_methods[4];
 
 template <typename DType>
 class Kmeans {
   public:
+    // samples per chunk of the streaming fits
+    static const size_t kDefaultChunkSize = 65536;
+
     Kmeans(int n_cluster = 8,
            int n_thread = 1,
            int n_iter = 100,
@@ -22,23 +44,136 @@ class Kmeans {
            InitMethod init = InitMethod::KMEANS_PLUSPLUS);
     ~Kmeans(){}
 
+    // input_file is either whitespace separated text, one sample per line,
+    // or a binary dataset (see dataset.h), which is mapped and used in place
     Status fit(const char *input_file);
+    Status fit(const Matrix<DType> &data, bool seeded = false);
     Status fit(std::vector<std::vector<DType>> &data, bool seeded = false);
+    // Sample i counts weights[i] times, e.g. the multiplicity of a
+    // deduplicated sample or a coreset weight: seeding draws it in proportion
+    // to its weight, it adds weights[i] * x to its center's sum and
+    // weights[i] times its distance to the cost. Weights must be finite and
+    // non-negative, one per sample, or DIM_ERROR is returned; samples of
+    // weight 0 are assigned but never move a center. Mini-batch mode is not
+    // applied to weighted fits.
+    Status fit(const Matrix<DType> &data, const std::vector<double> &weights,
+               bool seeded = false);
+    // Out-of-core fit over the samples of `reader`, which never holds more
+    // than a chunk of them in memory. Full Lloyd passes are sequential scans
+    // in chunks of set_chunk_size() samples; with set_minibatch() the first
+    // holdout samples are kept for cost reports and batches are pulled from
+    // the rest instead. Unseeded fits seed from the first chunk. labels() is
+    // left empty, the labels are written to `label_path` if given.
+    Status fit(BatchReader<DType> &reader, const char *label_path = nullptr,
+               bool seeded = false);
+    // fit(BatchReader&) on a text file of fit(const char*)'s format
+    Status fit(const char *input_file, const char *label_path);
+    // Lloyd passes over samples stored in reduced precision: each block of
+    // samples is widened into a tile of the assigning thread right before
+    // its distances and sums, so a pass reads 2 or 1 bytes per value and
+    // center sums are still added up in double. Unseeded fits seed from
+    // chunk_size() samples, one at random from each of as many equal
+    // stripes of the data. Mini-batch and NUMA modes are not applied to
+    // encoded samples.
+    Status fit(const EncodedMatrix<DType> &data, bool seeded = false);
+    // Lloyd passes over sparse samples (e.g. from parse_libsvm_file()) with
+    // dense centers. Assignment goes through SparseAssigner, O(nnz * k) per
+    // pass; each center is summed from its members' nonzeros on one thread,
+    // so updates take O(n_thread * d) scratch and give the same centers for
+    // any n_thread. Unseeded fits run k-means++ over chunk_size() samples
+    // drawn like those of encoded fits, or pick random samples for
+    // InitMethod::RANDOM. Mini-batch, NUMA and bounded algorithms apply to
+    // dense samples only.
+    Status fit(const SparseMatrix<DType> &data, bool seeded = false);
+    // fit(SparseMatrix&) on a LIBSVM file, columns counted from 1 unless
+    // zero_based; predict_libsvm() must be given the same base
+    Status fit_libsvm(const char *input_file, bool zero_based = false);
+
+    // Prediction is const: any number of threads may predict concurrently
+    // with one model, as long as nothing changes its centers meanwhile.
+    // Center norms are computed once per set of centers, and the pointer
+    // overloads allocate nothing once the calling thread has warmed up.
+    // Under Metric::COSINE the distances they report are cosine
+    // similarities instead, largest first for predict_top().
+    Status predict(const DType *data_point, DType &min_dist, int &label) const;
+    Status predict(const std::vector<DType> &data_point, DType &min_dist,
+                   int &label) const;
+    // Labels and, if min_dists is given, squared distances of the n points
+    // at x, `stride` elements apart. Batches go parallel only when large
+    // enough to pay for starting the team.
+    Status predict(const DType *x, size_t n, size_t stride, int *labels,
+                   DType *min_dists = nullptr) const;
+    // The `top` nearest centers of each point, nearest first: labels and
+    // squared distances of point i in [i * top, (i + 1) * top). Always scans
+    // every center, whether or not an index is built.
+    Status predict_top(const DType *x, size_t n, size_t stride, size_t top,
+                       int *labels, DType *dists) const;
+    Status predict(const Matrix<DType> &data_points,
+                   std::vector<int> &labels) const;
+    Status predict(const char *input_file, std::vector<int> &labels) const;
+    Status predict(const std::vector<std::vector<DType>> &data_points,
+                   std::vector<int> &labels) const;
+    Status predict(const EncodedMatrix<DType> &data_points,
+                   std::vector<int> &labels) const;
+    // Transposes the centers once per call, O(k * d), so predict in batches.
+    Status predict(const SparseMatrix<DType> &data_points,
+                   std::vector<int> &labels) const;
+    // predict(SparseMatrix&) on a LIBSVM file of the model's columns
+    Status predict_libsvm(const char *input_file, std::vector<int> &labels,
+                          bool zero_based = false) const;
+
+    // Index the current centers for predict(), see center_index.h. n_list = 0
+    // picks about sqrt(k) cells. With n_probe = 0 predict() stays exact and
+    // matches the pairwise scan; otherwise only the n_probe nearest cells are
+    // searched. The index is dropped whenever the centers change.
+    Status build_index(size_t n_list = 0, size_t n_probe = 0);
+    Status set_index_probes(size_t n_probe) {
+      LOG(INFO) << "set index probes to " << n_probe;
+      index_probes_ = n_probe;
+      return Status::OK;
+    }
+    const CenterIndex<DType>& index() const { return index_; }
 
-    Status predict(std::vector<DType> &data_point, DType &min_dist, int &label);
-    Status predict(std::vector<std::vector<DType>> &data_points,
-                   std::vector<int> &labels);
+    // sum of squared distances from each sample to its nearest center, of
+    // cosine distances 1 - cos under Metric::COSINE
+    Status cost(const Matrix<DType> &data, DType &cost) const;
+    // the same sum with sample i's distance counted weights[i] times
+    Status cost(const Matrix<DType> &data, const std::vector<double> &weights,
+                DType &cost) const;
+    Status cost(const EncodedMatrix<DType> &data, DType &cost) const;
+    Status cost(const SparseMatrix<DType> &data, DType &cost) const;
 
-    Status save_model(const char *model_path);
+    // TEXT is one center per line, BINARY is described in model.h and also
+    // stores center norms and the training metadata of model_info().
+    // load_model() tells the two apart and maps binary models in place.
+    Status save_model(const char *model_path,
+                      ModelFormat format = ModelFormat::TEXT);
     Status load_model(const char *model_path);
     Status save_labels(const char *label_path);
 
     Status set_centers(std::vector<std::vector<DType>> &centers) {
-      centers_ = std::move(centers);
+      index_.clear();
+      auto ret = Matrix<DType>::from_vectors(centers, centers_, true);
+      install_centers();
+      return ret;
+    }
+    Status set_centers(const Matrix<DType> &centers) {
+      index_.clear();
+      centers_.resize(centers.rows(), centers.cols(), true);
+      for (size_t i = 0; i < centers.rows(); ++i) {
+        std::copy(centers.row(i), centers.row(i) + centers.cols(),
+                  centers_.row(i));
+      }
+      install_centers();
       return Status::OK;
     }
-    const std::vector<std::vector<DType>>& centers() const { return centers_; }
+    std::vector<std::vector<DType>> centers() const {
+      return centers_.to_vectors();
+    }
+    const Matrix<DType>& center_matrix() const { return centers_; }
     const std::vector<int>& labels() const { return labels_; }
+    // metadata of the last fit, or of the loaded binary model
+    const ModelInfo& model_info() const { return info_; }
 
     Status set_num_threads(int n_thread) {
       LOG(INFO) << "set number of threads to " << n_thread;
@@ -68,6 +203,125 @@ class Kmeans {
       return Status::OK;
     }
 
+    // COSINE runs spherical k-means: samples count as unit vectors (their
+    // norms are computed once per fit, the caller's data is left as it is),
+    // centers are renormalized after every update, and assignment takes the
+    // largest inner product from the GEMM tiles, see assignment.h. Costs and
+    // iteration stats are sums of 1 - cos. Dense fits seed on chunk_size()
+    // normalized samples, drawn like those of encoded fits; bounded
+    // algorithms fall back to Lloyd passes. Binary models keep the metric.
+    // Centers already installed, or installed later, are scaled to unit
+    // length.
+    Status set_metric(Metric metric) {
+      LOG(INFO) << "set metric to " << metrics[static_cast<int>(metric)];
+      const bool changed = metric != metric_;
+      metric_ = metric;
+      if (changed && metric_ == Metric::COSINE && !centers_.empty()) {
+        index_.clear();
+        install_centers();
+      }
+      return Status::OK;
+    }
+    Metric metric() const { return metric_; }
+
+    Status set_assign_method(AssignMethod assign) {
+      LOG(INFO) << "set assign method to "
+        << assign_methods[static_cast<int>(assign)];
+      assign_ = assign;
+      return Status::OK;
+    }
+
+    // Lloyd variant used by fit(); HAMERLY, ELKAN and YINYANG skip
+    // distances with triangle-inequality bounds and produce the same labels
+    // as LLOYD with AssignMethod::PAIRWISE, see bounds.h.
+    Status set_algorithm(Algorithm algorithm) {
+      LOG(INFO) << "set algorithm to "
+        << algorithms[static_cast<int>(algorithm)];
+      algorithm_ = algorithm;
+      return Status::OK;
+    }
+
+    // Train on random mini-batches of `batch_size` samples instead of full
+    // Lloyd passes, 0 switches back to full batch. Up to `holdout` samples
+    // (at most a tenth of the data) are never trained on and only used to
+    // report cost. Training stops after n_iter passes' worth of batches, or
+    // once the smoothed center movement drops below threshold times the
+    // total variance of the data.
+    Status set_minibatch(size_t batch_size, size_t holdout = 10000) {
+      LOG(INFO) << "set mini-batch size to " << batch_size
+        << ", holdout = " << holdout;
+      minibatch_size_ = batch_size;
+      holdout_size_ = holdout;
+      return Status::OK;
+    }
+
+    // samples read at a time by the streaming fits
+    Status set_chunk_size(size_t chunk_size) {
+      LOG(INFO) << "set chunk size to " << chunk_size;
+      chunk_size_ = std::max(chunk_size, static_cast<size_t>(1));
+      return Status::OK;
+    }
+
+    // Seed of every random choice of the following fits: seeding, holdout
+    // and mini-batches. Without one each fit draws a fresh seed, which seed()
+    // reports afterwards to repeat the run.
+    Status set_seed(uint64_t seed) {
+      LOG(INFO) << "set random seed to " << seed;
+      seed_ = seed;
+      fixed_seed_ = true;
+      return Status::OK;
+    }
+    uint64_t seed() const { return seed_; }
+
+    // Add up costs and centers of the Lloyd passes, in memory and streaming,
+    // in an order that does not depend on the number of threads. Together
+    // with set_seed() this gives bit-identical models for any n_thread.
+    // bench/bench_deterministic measures the overhead.
+    Status set_deterministic(bool deterministic) {
+      LOG(INFO) << "set deterministic mode to " << deterministic;
+      deterministic_ = deterministic;
+      return Status::OK;
+    }
+
+    // NUMA-aware Lloyd passes, see topology.h. Threads are grouped and bound
+    // per node and first touch a private copy of the samples they assign
+    // (the data is copied once per fit). Partial sums are added up within
+    // each node before the cross-node merge, and each node assigns against
+    // its own replica of the centers; bounded algorithms share one copy.
+    Status set_numa(bool numa) {
+      LOG(INFO) << "set NUMA-aware mode to " << numa;
+      numa_ = numa;
+      return Status::OK;
+    }
+
+    // mean squared distance of the held-out samples after the last
+    // mini-batch fit
+    DType holdout_cost() const { return holdout_cost_; }
+
+    // point-center distances skipped in each iteration of the last fit
+    std::vector<size_t> dist_skipped() const {
+      std::vector<size_t> skipped;
+      for (const auto &iter : stats_.iterations) {
+        skipped.push_back(iter.dist_skipped);
+      }
+      return skipped;
+    }
+
+    // Also time each phase, iteration and thread and size the internal
+    // buffers into stats(); counters are collected either way. Off by
+    // default, profiling costs a few clock reads per pass and thread.
+    Status set_profiling(bool profiling) {
+      LOG(INFO) << "set profiling to " << profiling;
+      profiling_ = profiling;
+      return Status::OK;
+    }
+    // counters and times of the last fit, and predict() totals since
+    Stats stats() const {
+      Stats stats = stats_;
+      predict_counters_.read(stats);
+      return stats;
+    }
+
   private:
     int n_cluster_;
     int n_thread_;
@@ -76,23 +330,130 @@ class Kmeans {
     InitMethod init_;
     int kmeans_parallel_l_;
     int kmeans_parallel_r_;
-    std::vector<std::vector<DType>> centers_;
-    std::vector<std::vector<std::vector<DType>>> thread_centers_;
-    std::vector<std::vector<int>> center_ids_;
-    std::vector<std::vector<std::vector<int>>> thread_center_ids_;
+    AssignMethod assign_;
+    Metric metric_;
+    Assigner<DType> assigner_;
+    Algorithm algorithm_;
+    BoundedAssigner<DType> bounds_;
+    bool bounded_;  /* resolved algorithm_ of the current fit is not LLOYD */
+    Matrix<DType> centers_;  /* k x d, rows padded */
+    std::vector<DType> center_norms_;  /* of centers_, empty during a fit */
+    CenterIndex<DType> index_;  /* of centers_ for predict(), or empty */
+    size_t index_probes_;  /* 0 for exact index searches */
+    ModelInfo info_;
     std::vector<int> labels_;
-    int num_reassigned_;
-
-    std::vector<DType> parse_sample_from_string(std::string line);
-    Status init(std::vector<std::vector<DType>> &data);
-    Status dist(std::vector<DType> &p, std::vector<DType> &q, DType &d /*out*/);
-    Status load_data(const char *filename, std::vector<std::vector<DType>> &data);
-
-    Status random_init(std::vector<std::vector<DType>> &data);
-    Status kmeans_plusplus_init(std::vector<std::vector<DType>> &data);
-    Status kmeans_parallel_init(std::vector<std::vector<DType>> &data);
-    Status sequential_lloyd(std::vector<std::vector<DType>> &data, DType &cost);
-    Status parallel_lloyd(std::vector<std::vector<DType>> &data, DType &cost);
+    std::vector<DType> min_dists_;  /* per sample, of the last pass */
+    std::vector<DType> inv_norms_;  /* COSINE: per sample, 0 if ||x|| = 0 */
+    const double *weights_;  /* per sample of a weighted fit, else nullptr */
+    bool profiling_;
+    Stats stats_;
+    mutable PredictCounters predict_counters_;
+    double fit_start_;
+    size_t minibatch_size_;  /* 0 for full-batch Lloyd */
+    size_t holdout_size_;
+    DType holdout_cost_;
+    MiniBatch<DType> minibatch_;
+    size_t chunk_size_;
+    uint64_t seed_;
+    bool fixed_seed_;  /* seed_ was set, do not draw a new one per fit */
+    bool deterministic_;
+    Matrix<double> thread_sums_;  /* n_thread x k rows: d sums, count */
+    Matrix<double> thread_stats_;  /* per thread: reassigned, evals, cost */
+    std::vector<std::vector<DType>> workspace_;  /* per thread */
+    std::vector<std::vector<DType>> tiles_;  /* per thread, decoded samples */
+    Matrix<double> sums_;  /* per-center sums of the last pass */
+    std::vector<double> counts_;  /* per-center weights, sample counts */
+    bool sliced_;  /* deterministic sums_ holds kSlices x k rows */
+    std::vector<double> block_costs_;
+    bool numa_;
+    bool placing_;  /* numa_ applies to the current fit */
+    int n_node_;  /* nodes of the current fit, 1 unless placing_ */
+    Matrix<DType> placed_;  /* numa_: the samples, first touched per node */
+    Matrix<double> node_sums_;  /* numa_: n_node x k rows: d sums, count */
+    std::vector<Matrix<DType>> node_centers_;  /* numa_: per-node replica */
+    std::vector<Assigner<DType>> node_assigners_;
+    std::vector<size_t> order_;  /* samples bucketed by label */
+    std::vector<size_t> start_;
+    const DistanceKernels<DType> *kernels_;  /* for the centers' dimension */
+    SparseAssigner<DType> sparse_assigner_;  /* sparse fits */
+
+    Status init(const Matrix<DType> &data, const double *weights = nullptr);
+    // init() on chunk_size() rows, one at random from each of as many equal
+    // stripes of data, with their weights if given
+    Status seed_sample(const SampleBlocks<DType> &data,
+                       const double *weights = nullptr);
+    Status dense_fit(const Matrix<DType> &data, const double *weights,
+                     bool seeded);
+    void allocate(size_t n);
+    void place(const Matrix<DType> &data, int tid, int n_team);
+    size_t assign_block(const DType *x, size_t stride, size_t begin,
+                        size_t n, int *labels, DType *min_dists,
+                        std::vector<DType> &workspace);
+    Status load_data(const char *filename, Matrix<DType> &data) const;
+    // clock for stats_, always 0 unless profiling_
+    double now() const;
+    void start_fit();
+    // after each fit: metadata, then the center norms predict() uses
+    void set_info(size_t n_samples, int n_iter, double cost);
+    void update_norms();
+    // centers_ were set from outside a fit: unit length under
+    // Metric::COSINE, then update_norms()
+    void install_centers();
+    void predict_block(const Assigner<DType> &assigner, const DType *x,
+                       size_t n, size_t stride, int *labels,
+                       DType *min_dists) const;
+    // Metric::COSINE: 1 - cos of x to centers j0..j0+nj-1, written to out,
+    // and the nearest center with its distance in *min_dist
+    void cosine_dists(const DType *x, size_t j0, size_t nj, DType *out) const;
+    int nearest_cosine(const DType *x, DType *min_dist) const;
+    void draw_seed();
+
+    void copy_centers(const Matrix<DType> &data,
+                      const std::vector<size_t> &indices);
+    // weights, if given, multiply the sampling probability of each row
+    Status random_init(const Matrix<DType> &data,
+                       const double *weights = nullptr);
+    Status kmeans_plusplus_init(const Matrix<DType> &data, bool greedy,
+                                const double *weights = nullptr);
+    Status kmeans_parallel_init(const Matrix<DType> &data,
+                                const double *weights = nullptr);
+    void update_min_dists(const Matrix<DType> &data, const DType *center,
+                          const double *weights, std::vector<DType> &min_dists,
+                          std::vector<double> &block_sums);
+    size_t sample_index(const std::vector<DType> &min_dists,
+                        const double *weights,
+                        const std::vector<double> &block_sums, double cutoff);
+    void potential(const Matrix<DType> &data,
+                   const std::vector<size_t> &candidates,
+                   const double *weights, const std::vector<DType> &min_dists,
+                   std::vector<double> &partial);
+    void copy_rows(const Matrix<DType> &data,
+                   const std::vector<size_t> &indices, size_t begin,
+                   Matrix<DType> &out);
+    void weighted_lloyd(const Matrix<DType> &points,
+                        const std::vector<double> &weights);
+    Status lloyd(const SampleBlocks<DType> &data);
+    Status sparse_init(const SparseMatrix<DType> &data);
+    Status sparse_lloyd(const SparseMatrix<DType> &data);
+    // Label every sample, parallel over blocks of kBlockPoints; labels are
+    // updated in place and the number that changed is returned. Distances
+    // and the cost of each block are written if asked for.
+    size_t sparse_assign(const SparseAssigner<DType> &assigner,
+                         const SparseMatrix<DType> &data, int *labels,
+                         DType *min_dists, double *block_costs) const;
+    void sparse_update(const SparseMatrix<DType> &data, IterationStats &iter);
+    Status minibatch_fit(BatchReader<DType> &reader,
+                         const Matrix<DType> &holdout, size_t batch_size,
+                         size_t skip);
+    Status stream_lloyd(BatchReader<DType> &reader, const char *label_path);
+    // one Lloyd pass, called by every thread of lloyd()'s team
+    void parallel_pass(const SampleBlocks<DType> &data);
+    void deterministic_pass(const SampleBlocks<DType> &data);
+    void set_center(size_t i);
+    DType finish_pass(const SampleBlocks<DType> &data, IterationStats &iter);
+    Status block_cost(const SampleBlocks<DType> &data, DType &cost,
+                      const double *weights = nullptr) const;
+    size_t buffer_bytes() const;
 };  // class Kmeans
 
 }  // namespace cluster
@@ -0,0 +1,88 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include "status.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace cluster {
+
+// Dense row-major n x d matrix stored in a single buffer.
+//
+// Owned buffers are aligned to kAlignment bytes. When `padded` is set, each
+// row is padded with zeros up to a multiple of kAlignment bytes, so every row
+// starts on an aligned boundary and SIMD kernels never straddle two rows.
+// A Matrix may also wrap memory it does not own (e.g. an mmap'ed file), in
+// which case `owner` keeps that memory alive for the lifetime of the matrix.
+template <typename DType>
+class Matrix {
+  public:
+    static const size_t kAlignment = 64;  /* bytes, one cache line */
+
+    Matrix() : rows_(0), cols_(0), stride_(0), data_(nullptr) {}
+    Matrix(size_t rows, size_t cols, bool padded = false);
+    Matrix(DType *data, size_t rows, size_t cols, size_t stride,
+           std::shared_ptr<void> owner = nullptr);
+    Matrix(const Matrix &other);
+    Matrix(Matrix &&other);
+    Matrix& operator=(const Matrix &other);
+    Matrix& operator=(Matrix &&other);
+    ~Matrix(){}
+
+    // Copy nested vectors into a matrix, returns DIM_ERROR on ragged rows.
+    static Status from_vectors(const std::vector<std::vector<DType>> &rows,
+                               Matrix &out, bool padded = false);
+    std::vector<std::vector<DType>> to_vectors() const;
+    std::vector<DType> row_vector(size_t i) const {
+      return std::vector<DType>(row(i), row(i) + cols_);
+    }
+
+    // Reallocate as a zero-filled rows x cols matrix.
+    void resize(size_t rows, size_t cols, bool padded = false);
+    // Like resize(), but the memory is left untouched, so on Linux its pages
+    // land on the NUMA node of whichever thread writes them first. Row
+    // padding is left undefined as well.
+    void resize_untouched(size_t rows, size_t cols, bool padded = false);
+    void zero();
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t stride() const { return stride_; }  /* in elements */
+    bool empty() const { return rows_ == 0; }
+    bool padded() const { return stride_ != cols_; }
+
+    DType* data() { return data_; }
+    const DType* data() const { return data_; }
+    DType* row(size_t i) { return data_ + i * stride_; }
+    const DType* row(size_t i) const { return data_ + i * stride_; }
+    DType& operator()(size_t i, size_t j) { return data_[i * stride_ + j]; }
+    const DType& operator()(size_t i, size_t j) const {
+      return data_[i * stride_ + j];
+    }
+
+    // keeps the memory alive, null for an empty matrix
+    const std::shared_ptr<void>& owner() const { return buffer_; }
+
+    // Number of elements of a row padded to kAlignment bytes.
+    static size_t padded_stride(size_t cols) {
+      const size_t lanes = kAlignment / sizeof(DType);
+      return (cols + lanes - 1) / lanes * lanes;
+    }
+
+  private:
+    size_t rows_;
+    size_t cols_;
+    size_t stride_;
+    DType *data_;
+    std::shared_ptr<void> buffer_;
+
+    void allocate(size_t rows, size_t cols, size_t stride, bool zero = true);
+};  // class Matrix
+
+}  // namespace cluster
+
+#endif  // MATRIX_H
+
+// vim: ts=2 sts=2 sw=2
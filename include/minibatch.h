@@ -0,0 +1,55 @@
+#ifndef MINIBATCH_H
+#define MINIBATCH_H
+
+#include "assignment.h"
+#include "matrix.h"
+
+#include <vector>
+
+namespace cluster {
+
+// Mini-batch update step (Sculley, "Web-scale k-means clustering").
+//
+// Each step assigns a batch to the current centers and moves every center
+// towards the mean of its batch members. A center that has absorbed count_j
+// samples so far takes per-sample steps of 1 / count_j, so it converges to
+// the running mean of everything assigned to it; applying the m_j updates of
+// one batch at once gives
+//
+//   count_j += m_j
+//   c_j     += (sum of members - m_j * c_j) / count_j
+//
+// Assignment is parallel over blocks of the batch, the update over centers.
+// With Metric::COSINE the batch rows must have unit norm; each updated
+// center is projected back onto the unit sphere.
+template <typename DType>
+class MiniBatch {
+  public:
+    // Start over with k centers that have not seen any sample.
+    void reset(size_t k);
+
+    // One step on `batch`. Returns the squared distance the centers moved,
+    // averaged over centers; the cost of the batch against the centers
+    // before the update is written to batch_cost.
+    DType step(const Matrix<DType> &batch, Matrix<DType> &centers,
+               AssignMethod method, int n_thread, DType &batch_cost,
+               Metric metric = Metric::L2);
+
+    // samples absorbed by each center since reset()
+    const std::vector<size_t>& counts() const { return counts_; }
+
+  private:
+    Assigner<DType> assigner_;
+    std::vector<size_t> counts_;
+    std::vector<int> labels_;       /* per batch sample */
+    std::vector<DType> min_dists_;  /* per batch sample */
+    std::vector<size_t> order_;     /* batch samples sorted by label */
+    std::vector<size_t> start_;     /* members of c_j are order_[s, e) */
+    std::vector<DType> movement_;   /* per center, of the last step */
+};  // class MiniBatch
+
+}  // namespace cluster
+
+#endif  // MINIBATCH_H
+
+// vim: ts=2 sts=2 sw=2
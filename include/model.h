@@ -0,0 +1,86 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include "dataset.h"
+#include "matrix.h"
+#include "status.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace cluster {
+
+enum class ModelFormat { TEXT, BINARY };
+
+// Training metadata kept with a model.
+struct ModelInfo {
+  uint64_t n_samples;  /* samples of the fit, 0 if unknown */
+  uint32_t n_iter;     /* Lloyd iterations or mini-batch passes run */
+  uint32_t init;       /* InitMethod used for seeding */
+  double cost;         /* cost of the last iteration */
+  uint32_t metric;     /* Metric of the fit, 0 (L2) in older models */
+  uint32_t reserved;
+};
+
+// Binary model file, version 1, in native byte order:
+//
+//   offset  size  field
+//        0     8  magic "KMEANSMD"
+//        8     4  version
+//       12     4  dtype, see DataType
+//       16     8  k
+//       24     8  d
+//       32     8  stride, elements per center row, padded to 64 bytes
+//       40     4  flags, kModelHasNorms
+//       44     4  reserved, zero
+//       48     8  checksum of everything after the header (Fletcher-64)
+//       56     8  reserved, zero
+//       64    32  ModelInfo
+//       96    32  reserved, zero
+//      128        k rows of `stride` elements: the centers
+//                 k squared center norms, if kModelHasNorms
+//
+// Centers start on a 64-byte boundary and rows are padded like those of a
+// padded Matrix, so a mapped model is used in place without any parsing.
+struct ModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;
+  uint64_t k;
+  uint64_t d;
+  uint64_t stride;
+  uint32_t flags;
+  uint32_t reserved0;
+  uint64_t checksum;
+  uint64_t reserved1;
+  ModelInfo info;
+  char reserved2[32];
+};
+static_assert(sizeof(ModelHeader) == 128, "model header must be 128 bytes");
+
+extern const char kModelMagic[8];
+const uint32_t kModelVersion = 1;
+const uint32_t kModelHasNorms = 1;
+
+// Whether `path` starts with the model magic.
+bool is_model(const char *path);
+
+// Write `centers` (norms[k] too if not null) and `info` to a model file.
+template <typename DType>
+Status write_model(const char *path, const Matrix<DType> &centers,
+                   const DType *norms, const ModelInfo &info);
+
+// Map a model file; `centers` becomes a view of the mapping and `norms` is
+// left empty if the file has none. Returns FORMAT_ERROR on a malformed
+// header, another element type or, when `verify` is set, a checksum that
+// does not match.
+template <typename DType>
+Status map_model(const char *path, Matrix<DType> &centers,
+                 std::vector<DType> &norms, ModelInfo &info,
+                 bool verify = true);
+
+}  // namespace cluster
+
+#endif  // MODEL_H
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,54 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "matrix.h"
+#include "sparse.h"
+#include "status.h"
+
+#include <cstddef>
+
+namespace cluster {
+
+// Parser of the whitespace separated text format, in the spirit of C++17's
+// from_chars: no locale, no streams and no allocation per number.
+
+// Parse the number starting at `first` (no leading whitespace) and ending
+// before `last`. Returns the end of it, or nullptr if there is no number.
+// Values come out as from strtod, rounded once more to DType.
+template <typename DType>
+const char* parse_number(const char *first, const char *last, DType &value);
+
+// Parse the numbers of one line [first, last) into out[0, max). Returns how
+// many numbers the line holds, which may exceed max, or -1 if a token is not
+// a number.
+template <typename DType>
+long parse_line(const char *first, const char *last, DType *out, size_t max);
+
+// Load a text file, one sample per line, into `out`. The file is mapped and
+// split into newline-aligned chunks parsed by n_thread threads straight into
+// the rows of `out`; blank lines are skipped. Returns DIM_ERROR on a line
+// whose dimension differs from the first line's, FORMAT_ERROR on a token
+// that is not a number, with the line number logged in both cases.
+template <typename DType>
+Status parse_text_file(const char *path, Matrix<DType> &out,
+                       int n_thread = 1);
+
+// Load a LIBSVM / SVMlight file, one sample per line as
+//   [label] index:value index:value ... [# comment]
+// with increasing indices, into `out`, in parallel like parse_text_file().
+// Labels are skipped. Columns count from 1 as in LIBSVM, or from 0 with
+// `zero_based`; the base is never guessed, so files of one feature space
+// load alike whichever columns they use. The dimension is the highest
+// column, or `cols` if given (DIM_ERROR if a column does not fit). Returns
+// FORMAT_ERROR on a malformed line, with its line number logged, or on a
+// column 0 in a one-based file.
+template <typename DType>
+Status parse_libsvm_file(const char *path, SparseMatrix<DType> &out,
+                         int n_thread = 1, size_t cols = 0,
+                         bool zero_based = false);
+
+}  // namespace cluster
+
+#endif  // PARSER_H
+
+// vim: ts=2 sts=2 sw=2
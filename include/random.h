@@ -0,0 +1,49 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cluster {
+
+// Counter-based random numbers: the value for (stream, counter) is a hash of
+// the seed and both, so any thread can draw the numbers of any sample in any
+// order and still get the same sequence as a serial loop. The hash is the
+// SplitMix64 finalizer applied twice.
+class CounterRng {
+  public:
+    explicit CounterRng(uint64_t seed = 0) : seed_(seed) {}
+
+    uint64_t operator()(uint64_t stream, uint64_t counter) const {
+      return mix(mix(seed_ ^ (stream * 0xd1b54a32d192ed03ULL)) + counter);
+    }
+
+    // uniform in [0, 1)
+    double uniform(uint64_t stream, uint64_t counter) const {
+      return ((*this)(stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // uniform in [0, n)
+    size_t index(uint64_t stream, uint64_t counter, size_t n) const {
+      size_t i = static_cast<size_t>(uniform(stream, counter) * n);
+      return i < n ? i : n - 1;
+    }
+
+    uint64_t seed() const { return seed_; }
+
+  private:
+    uint64_t seed_;
+
+    static uint64_t mix(uint64_t x) {
+      x += 0x9e3779b97f4a7c15ULL;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    }
+};  // class CounterRng
+
+}  // namespace cluster
+
+#endif  // RANDOM_H
+
+// vim: ts=2 sts=2 sw=2
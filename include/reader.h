@@ -0,0 +1,51 @@
+#ifndef READER_H
+#define READER_H
+
+#include "matrix.h"
+#include "status.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace cluster {
+
+// Source of samples read in batches, for training on data that is not held
+// in memory as a whole.
+template <typename DType>
+class BatchReader {
+  public:
+    virtual ~BatchReader() {}
+
+    // Read up to max_rows samples into `batch`, which is resized to the rows
+    // actually read; zero rows means the end of the data was reached.
+    virtual Status read(size_t max_rows, Matrix<DType> &batch) = 0;
+
+    // Start over from the first sample.
+    virtual Status rewind() = 0;
+};  // class BatchReader
+
+// Reads the whitespace separated text format of Kmeans::fit(const char*),
+// one sample per line.
+template <typename DType>
+class TextReader : public BatchReader<DType> {
+  public:
+    TextReader() : dim_(0) {}
+
+    Status open(const char *filename);
+    Status read(size_t max_rows, Matrix<DType> &batch) override;
+    Status rewind() override;
+
+  private:
+    std::string filename_;
+    std::ifstream fin_;
+    size_t dim_;  /* taken from the first sample */
+    std::string line_;
+    std::vector<DType> values_;  /* parsed samples of the current batch */
+};  // class TextReader
+
+}  // namespace cluster
+
+#endif  // READER_H
+
+// vim: ts=2 sts=2 sw=2
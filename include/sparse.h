@@ -0,0 +1,100 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "assignment.h"
+#include "distance.h"
+#include "matrix.h"
+#include "status.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cluster {
+
+// Samples in compressed sparse row form: the nonzeros of row i are
+// values()[indptr(i), indptr(i + 1)), at the columns in indices() over the
+// same range, in increasing order. Columns are 32-bit, d is below 2^32.
+template <typename DType>
+class SparseMatrix {
+  public:
+    SparseMatrix() : cols_(0), indptr_(1, 0) {}
+    explicit SparseMatrix(size_t cols) : cols_(cols), indptr_(1, 0) {}
+    // the nonzeros of a dense matrix
+    explicit SparseMatrix(const Matrix<DType> &dense);
+    // from parts already in CSR form, e.g. filled by a parser
+    SparseMatrix(size_t cols, std::vector<size_t> &&indptr,
+                 std::vector<uint32_t> &&indices, std::vector<DType> &&values);
+
+    // Append a row of nnz nonzeros. Returns DIM_ERROR, leaving the matrix
+    // unchanged, if the columns are not increasing or not below cols().
+    Status add_row(const uint32_t *indices, const DType *values, size_t nnz);
+    Matrix<DType> to_dense() const;
+
+    size_t rows() const { return indptr_.size() - 1; }
+    size_t cols() const { return cols_; }
+    size_t nnz() const { return values_.size(); }
+    bool empty() const { return rows() == 0; }
+    size_t indptr(size_t i) const { return indptr_[i]; }
+    size_t row_nnz(size_t i) const { return indptr_[i + 1] - indptr_[i]; }
+    const uint32_t* row_indices(size_t i) const {
+      return indices_.data() + indptr_[i];
+    }
+    const DType* row_values(size_t i) const {
+      return values_.data() + indptr_[i];
+    }
+    // squared norm of row i
+    DType row_norm(size_t i) const;
+    size_t bytes() const;
+
+  private:
+    size_t cols_;
+    std::vector<size_t> indptr_;  /* rows + 1 offsets into the nonzeros */
+    std::vector<uint32_t> indices_;
+    std::vector<DType> values_;
+};  // class SparseMatrix
+
+// <x, dense> for the nonzeros of a sparse x
+template <typename DType>
+DType sparse_dot(const uint32_t *indices, const DType *values, size_t nnz,
+                 const DType *dense);
+
+// Assigns sparse samples to the nearest of dense centers, expanding
+// ||x - c||^2 = ||x||^2 - 2<x, c> + ||c||^2 like the GEMM assignment step.
+// prepare() transposes the centers to d rows of k, so the inner products of
+// a sample with every center come from one axpy per nonzero over contiguous
+// memory, instead of k gathers over rows d elements apart. Metric::COSINE
+// takes the largest inner product with unit centers, as Assigner does.
+template <typename DType>
+class SparseAssigner {
+  public:
+    SparseAssigner() : k_(0), metric_(Metric::L2),
+      kernels_(&distance_kernels<DType>()) {}
+
+    // Must be called again whenever the centers change; `norms` may carry
+    // the squared center norms, they are copied. O(k * d), parallel.
+    void prepare(const Matrix<DType> &centers, const DType *norms = nullptr,
+                 int n_thread = 1, Metric metric = Metric::L2);
+
+    // Nearest center (labels[i]) and its distance (min_dists[i]) of
+    // rows begin..begin+n-1 of x. `workspace` is scratch owned by the
+    // calling thread; concurrent calls are safe.
+    void assign(const SparseMatrix<DType> &x, size_t begin, size_t n,
+                int *labels, DType *min_dists,
+                std::vector<DType> &workspace) const;
+
+    size_t bytes() const;
+
+  private:
+    size_t k_;
+    Matrix<DType> transposed_;  /* d x k, rows padded */
+    std::vector<DType> norms_;  /* zero for COSINE */
+    Metric metric_;
+    const DistanceKernels<DType> *kernels_;
+};  // class SparseAssigner
+
+}  // namespace cluster
+
+#endif  // SPARSE_H
+
+// vim: ts=2 sts=2 sw=2
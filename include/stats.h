@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cluster {
+
+// One Lloyd pass, or one epoch of mini-batch training (steps > 0).
+// Counters are always kept; times are 0 unless profiling is on.
+struct IterationStats {
+  int iter = 0;
+  size_t samples = 0;       /* assigned in the pass, trained on in the epoch */
+  size_t reassigned = 0;
+  double cost = 0;          /* sum over the pass, mean batch cost per epoch */
+  size_t dist_evals = 0;    /* point-center distances evaluated */
+  size_t dist_skipped = 0;  /* ... and skipped by the bounds */
+  size_t center_evals = 0;  /* center-center distances of the bounds */
+  size_t empty_clusters = 0;
+  size_t moved = 0;         /* empty clusters moved to a far sample */
+  size_t steps = 0;         /* mini-batch steps */
+  double movement = 0;      /* smoothed mini-batch center movement */
+  double holdout_cost = 0;  /* mean, after a mini-batch epoch */
+  double assign_s = 0;      /* slowest thread's assignment */
+  double update_s = 0;      /* the rest of the pass: sums, centers, bounds */
+  double imbalance = 0;     /* slowest over mean thread assignment time */
+};
+
+// The log line of an iteration, e.g. "iter: 3 reassign_ratio: 0.01 ..."
+std::ostream& operator<<(std::ostream &out, const IterationStats &iter);
+
+// Counters and wall times of the last fit, plus predict() totals since.
+struct Stats {
+  bool profiled = false;    /* times and buffer sizes were collected */
+  double load_s = 0;        /* reading or mapping the input file */
+  std::string init;         /* seeding method, empty for seeded fits */
+  double init_s = 0;
+  std::vector<IterationStats> iterations;
+  double fit_s = 0;         /* the whole fit, load excluded */
+  size_t peak_bytes = 0;    /* internal buffers of the passes */
+  uint64_t predict_calls = 0;
+  uint64_t predict_points = 0;
+  double predict_s = 0;
+};
+
+// Totals bumped by concurrent const predict() calls; copyable, unlike the
+// atomics inside.
+class PredictCounters {
+  public:
+    PredictCounters() : calls_(0), points_(0), ns_(0) {}
+    PredictCounters(const PredictCounters &other) { *this = other; }
+    PredictCounters& operator=(const PredictCounters &other) {
+      calls_ = other.calls_.load();
+      points_ = other.points_.load();
+      ns_ = other.ns_.load();
+      return *this;
+    }
+
+    void add(uint64_t points, double seconds) {
+      calls_ += 1;
+      points_ += points;
+      ns_ += static_cast<uint64_t>(seconds * 1e9);
+    }
+    void reset() { calls_ = 0; points_ = 0; ns_ = 0; }
+    void read(Stats &stats) const {
+      stats.predict_calls = calls_;
+      stats.predict_points = points_;
+      stats.predict_s = ns_ * 1e-9;
+    }
+
+  private:
+    std::atomic<uint64_t> calls_, points_, ns_;
+};  // class PredictCounters
+
+}  // namespace cluster
+
+#endif  // STATS_H
+
+// vim: ts=2 sts=2 sw=2
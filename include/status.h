@@ -0,0 +1,13 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+namespace cluster {
+
+// FORMAT_ERROR: a binary file with a bad header or the wrong element type
+enum class Status { OK, IO_ERROR, DIM_ERROR, FORMAT_ERROR };
+
+}  // namespace cluster
+
+#endif  // STATUS_H
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,36 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+namespace cluster {
+
+// NUMA layout used by the NUMA-aware fit (Kmeans::set_numa).
+//
+// The threads of a team are split into contiguous groups, one per node, and
+// each group is bound to the CPUs of its node. Node counts and binding come
+// from libnuma when built with `make NUMA=1`; otherwise, or to try the code
+// paths on a single-node box, KMEANS_NUMA_NODES sets the number of groups
+// (threads are then not bound).
+
+// number of nodes to spread a team over, at least 1
+int numa_nodes();
+
+// Restrict the calling thread to the CPUs of `node`, or lift the
+// restriction for node -1. No-op without libnuma.
+void bind_to_node(int node);
+
+// node of thread `tid` in a team of n_thread threads over n_node nodes
+inline int thread_node(int tid, int n_thread, int n_node) {
+  return static_cast<int>(static_cast<long>(tid) * n_node / n_thread);
+}
+
+// first thread of `node`; the node's threads are [first(node), first(node+1))
+inline int node_first_thread(int node, int n_thread, int n_node) {
+  return static_cast<int>((static_cast<long>(node) * n_thread + n_node - 1) /
+                          n_node);
+}
+
+}  // namespace cluster
+
+#endif  // TOPOLOGY_H
+
+// vim: ts=2 sts=2 sw=2
@@ -35,18 +35,23 @@ class Log {
   public:
     explicit Log(LogLevel level = INFO) {
       msglevel = level;
+      // filtered messages skip the clock, they are logged in hot loops
+      if (level < log_level) {
+        return;
+      }
       if (level >= WARN) {
         operator << ("\033[31m");
       }
       operator << (get_level(level) + " " + current_time() + " ");
     }
     ~Log() {
+      if (!opened) {
+        return;
+      }
       if (msglevel >= WARN) {
         msg_ << "\033[0m";
       }
-      if (opened) {
-        msg_ << std::endl;
-      }
+      msg_ << std::endl;
       std::cout << msg_.str() << std::flush;
     }
     template<class T>
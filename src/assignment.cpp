@@ -0,0 +1,173 @@
+#include "assignment.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef KMEANS_USE_BLAS
+#include <cblas.h>
+#endif
+
+namespace cluster {
+
+const char* assign_methods[3] = {"auto", "pairwise", "gemm"};
+const char* metrics[2] = {"l2", "cosine"};
+
+template <typename DType>
+const size_t Assigner<DType>::kBlockPoints;
+template <typename DType>
+const size_t Assigner<DType>::kBlockCenters;
+
+namespace {
+
+#ifdef KMEANS_USE_BLAS
+// out = x * c^T, row-major, nx x nc
+void gemm_nt(const float *x, size_t nx, size_t xstride, const float *c,
+    size_t nc, size_t cstride, size_t d, float *out, size_t ldo) {
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, nx, nc, d, 1.0f,
+              x, xstride, c, cstride, 0.0f, out, ldo);
+}
+
+void gemm_nt(const double *x, size_t nx, size_t xstride, const double *c,
+    size_t nc, size_t cstride, size_t d, double *out, size_t ldo) {
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, nx, nc, d, 1.0,
+              x, xstride, c, cstride, 0.0, out, ldo);
+}
+#endif
+
+}  // namespace
+
+template <typename DType>
+void normalize_rows(DType *x, size_t n, size_t d, size_t stride) {
+  const DistanceKernels<DType> &kernels = distance_kernels<DType>(d);
+  for (size_t i = 0; i < n; ++i) {
+    DType *row = x + i * stride;
+    const DType norm = std::sqrt(kernels.dot(row, row, d));
+    if (norm > 0) {
+      const DType scale = 1 / norm;
+      for (size_t j = 0; j < d; ++j) {
+        row[j] *= scale;
+      }
+    }
+  }
+}
+
+template <typename DType>
+void Assigner<DType>::prepare(const Matrix<DType> &centers,
+    AssignMethod method, const DType *norms, Metric metric) {
+  centers_ = &centers;
+  metric_ = metric;
+  kernels_ = &distance_kernels<DType>(centers.cols());
+  if (metric == Metric::COSINE) {
+    // unit centers: comparing -2<x, c> is comparing ||x - c||^2, so no
+    // norms are needed and preparing allocates nothing
+    gemm_ = true;
+    norms_ = nullptr;
+    return;
+  }
+  switch (method) {
+    case AssignMethod::PAIRWISE: gemm_ = false; break;
+    case AssignMethod::GEMM:     gemm_ = true; break;
+    default: gemm_ = prefer_gemm(centers.cols(), centers.rows()); break;
+  }
+  if (!gemm_) {
+    return;
+  }
+  norms_ = norms;
+  if (norms != nullptr) {
+    return;
+  }
+  owned_norms_.resize(centers.rows());
+  for (size_t i = 0; i < centers.rows(); ++i) {
+    owned_norms_[i] = kernels_->dot(centers.row(i), centers.row(i),
+                                    centers.cols());
+  }
+}
+
+template <typename DType>
+void Assigner<DType>::assign(const DType *x, size_t n, size_t stride,
+    int *labels, DType *min_dists, std::vector<DType> &workspace) const {
+  if (gemm_) {
+    assign_gemm(x, n, stride, labels, min_dists, workspace);
+    return;
+  }
+  const size_t k = centers_->rows(), d = centers_->cols();
+  for (size_t i = 0; i < n; ++i) {
+    labels[i] = kernels_->nearest(x + i * stride, centers_->data(), k,
+                                  centers_->stride(), d, &min_dists[i]);
+  }
+}
+
+template <typename DType>
+void Assigner<DType>::assign_gemm(const DType *x, size_t n, size_t stride,
+    int *labels, DType *min_dists, std::vector<DType> &workspace) const {
+  const size_t k = centers_->rows(), d = centers_->cols();
+  const size_t cstride = centers_->stride();
+  workspace.resize(kBlockPoints * (kBlockCenters + 1));
+  DType *dots = workspace.data();
+  DType *point_norms = dots + kBlockPoints * kBlockCenters;
+  // COSINE compares -2<x, c> alone, against a tile of zero norms
+  static const DType kZeroNorms[kBlockCenters] = {};
+  const DType *norms = metric_ == Metric::COSINE ? nullptr : center_norms();
+
+  for (size_t i0 = 0; i0 < n; i0 += kBlockPoints) {
+    const size_t ni = std::min(kBlockPoints, n - i0);
+    const DType *xi = x + i0 * stride;
+    for (size_t i = 0; i < ni; ++i) {
+      point_norms[i] = kernels_->dot(xi + i * stride, xi + i * stride, d);
+      labels[i0 + i] = -1;
+      min_dists[i0 + i] = std::numeric_limits<DType>::max();
+    }
+    // the point tile stays in cache while center tiles stream past it
+    for (size_t j0 = 0; j0 < k; j0 += kBlockCenters) {
+      const size_t nj = std::min(kBlockCenters, k - j0);
+#ifdef KMEANS_USE_BLAS
+      gemm_nt(xi, ni, stride, centers_->row(j0), nj, cstride, d, dots,
+              kBlockCenters);
+#else
+      kernels_->dot_block(xi, ni, stride, centers_->row(j0), nj, cstride, d,
+                          dots, kBlockCenters);
+#endif
+      const DType *tile_norms = norms != nullptr ? norms + j0 : kZeroNorms;
+      for (size_t i = 0; i < ni; ++i) {
+        const DType *row = dots + i * kBlockCenters;
+        DType best = min_dists[i0 + i];
+        int label = labels[i0 + i];
+        for (size_t j = 0; j < nj; ++j) {
+          DType dist = tile_norms[j] - 2 * row[j];
+          if (dist < best) {
+            best = dist;
+            label = static_cast<int>(j0 + j);
+          }
+        }
+        min_dists[i0 + i] = best;
+        labels[i0 + i] = label;
+      }
+    }
+    if (metric_ == Metric::COSINE) {
+      // best is -2<x, c> of the nearest unit center, rounding may take a
+      // point on it slightly past cos = 1; a zero point is orthogonal to
+      // every center
+      for (size_t i = 0; i < ni; ++i) {
+        const DType norm = std::sqrt(point_norms[i]);
+        min_dists[i0 + i] = norm > 0 ?
+          std::max(1 + min_dists[i0 + i] / (2 * norm), static_cast<DType>(0)) :
+          static_cast<DType>(1);
+      }
+      continue;
+    }
+    // ||x||^2 was left out of the comparisons above; cancellation can make
+    // the expanded form slightly negative for points sitting on a center
+    for (size_t i = 0; i < ni; ++i) {
+      min_dists[i0 + i] = std::max(min_dists[i0 + i] + point_norms[i],
+                                   static_cast<DType>(0));
+    }
+  }
+}
+
+template class Assigner<float>;
+template class Assigner<double>;
+template void normalize_rows(float *x, size_t n, size_t d, size_t stride);
+template void normalize_rows(double *x, size_t n, size_t d, size_t stride);
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,415 @@
+#include "bounds.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace cluster {
+
+const char* algorithms[5] = {"lloyd", "hamerly", "elkan", "yinyang", "auto"};
+
+namespace {
+
+// A bound only prunes when it wins by this relative margin, which absorbs
+// the rounding in sqrt() and in the accumulated drift. Near-ties are
+// evaluated exactly instead.
+template <typename DType>
+DType slack() {
+  return 1 + std::sqrt(std::numeric_limits<DType>::epsilon());
+}
+
+}  // namespace
+
+template <typename DType>
+void BoundedAssigner<DType>::reset(Algorithm algorithm, size_t n, size_t k) {
+  algorithm_ = algorithm;
+  n_ = n;
+  k_ = k;
+  initialized_.assign(n, 0);
+  // Yinyang sizes its bounds once the groups are known
+  lower_.assign(algorithm == Algorithm::ELKAN ? n * k :
+                algorithm == Algorithm::YINYANG ? 0 : n, 0);
+  prev_centers_ = Matrix<DType>();
+  group_start_.clear();
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::group_centers(const Matrix<DType> &centers,
+    int n_thread) {
+  const size_t k = centers.rows(), d = centers.cols();
+  const size_t t = std::max(k / 10, static_cast<size_t>(1));
+
+  // a few Lloyd iterations over the centers themselves, seeded with evenly
+  // spaced centers so grouping is deterministic
+  Matrix<DType> means(t, d, true);
+  for (size_t g = 0; g < t; ++g) {
+    std::copy(centers.row(g * k / t), centers.row(g * k / t) + d,
+              means.row(g));
+  }
+  group_of_.assign(k, 0);
+  std::vector<size_t> counts(t);
+  for (int iter = 0; iter < 5; ++iter) {
+#pragma omp parallel for num_threads(n_thread)
+    for (size_t j = 0; j < k; ++j) {
+      DType dist;
+      group_of_[j] = kernels_->nearest(centers.row(j), means.data(), t,
+                                       means.stride(), d, &dist);
+    }
+    std::vector<DType> sums(t * d, 0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t j = 0; j < k; ++j) {
+      const DType *c = centers.row(j);
+      DType *sum = &sums[group_of_[j] * d];
+      for (size_t m = 0; m < d; ++m) {
+        sum[m] += c[m];
+      }
+      counts[group_of_[j]]++;
+    }
+    for (size_t g = 0; g < t; ++g) {
+      for (size_t m = 0; m < d && counts[g] > 0; ++m) {
+        means(g, m) = sums[g * d + m] / counts[g];
+      }
+    }
+  }
+
+  // drop empty groups and lay members out contiguously
+  std::vector<int> remap(t, -1);
+  group_start_.assign(1, 0);
+  for (size_t g = 0; g < t; ++g) {
+    if (counts[g] > 0) {
+      remap[g] = static_cast<int>(group_start_.size()) - 1;
+      group_start_.push_back(group_start_.back() + counts[g]);
+    }
+  }
+  group_centers_.resize(k);
+  std::vector<size_t> fill(group_start_.begin(), group_start_.end() - 1);
+  for (size_t j = 0; j < k; ++j) {
+    group_of_[j] = remap[group_of_[j]];
+    group_centers_[fill[group_of_[j]]++] = static_cast<int>(j);
+  }
+  lower_.assign(n_ * num_groups(), 0);
+  LOG(DEBUG) << "grouped " << k << " centers into " << num_groups()
+    << " groups";
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::prepare(const Matrix<DType> &centers,
+    int n_thread) {
+  update_drift(centers, n_thread);
+  if (algorithm_ != Algorithm::YINYANG) {
+#pragma omp parallel num_threads(n_thread)
+    center_distances(centers);
+  }
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::prepare_team(const Matrix<DType> &centers) {
+#pragma omp single
+  update_drift(centers, 1);
+  if (algorithm_ != Algorithm::YINYANG) {
+    center_distances(centers);
+  }
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::update_drift(const Matrix<DType> &centers,
+    int n_thread) {
+  const size_t k = centers.rows(), d = centers.cols();
+  const DType inf = std::numeric_limits<DType>::infinity();
+  centers_ = &centers;
+  kernels_ = &distance_kernels<DType>(d);
+
+  // how far each center moved since the previous pass
+  drift_.assign(k, 0);
+  max_drift_[0] = max_drift_[1] = 0;
+  max_drift_center_ = -1;
+  if (prev_centers_.rows() == k && prev_centers_.cols() == d) {
+    for (size_t j = 0; j < k; ++j) {
+      drift_[j] = std::sqrt(kernels_->sqdist(prev_centers_.row(j),
+                                             centers.row(j), d));
+      if (drift_[j] > max_drift_[0]) {
+        max_drift_[1] = max_drift_[0];
+        max_drift_[0] = drift_[j];
+        max_drift_center_ = static_cast<int>(j);
+      } else if (drift_[j] > max_drift_[1]) {
+        max_drift_[1] = drift_[j];
+      }
+    }
+  }
+  prev_centers_ = centers;
+
+  if (algorithm_ == Algorithm::YINYANG) {
+    if (group_start_.empty()) {
+      group_centers(centers, n_thread);
+    }
+    const size_t t = num_groups();
+    group_drift_.assign(t, 0);
+    for (size_t j = 0; j < k; ++j) {
+      group_drift_[group_of_[j]] = std::max(group_drift_[group_of_[j]],
+                                            drift_[j]);
+    }
+    center_evals_ = 0;
+    return;
+  }
+
+  half_min_dist_.assign(k, inf);
+  if (algorithm_ == Algorithm::ELKAN) {
+    center_dists_.resize(k * k);
+  }
+  center_evals_ = k * (k - 1);
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::center_distances(const Matrix<DType> &centers) {
+  // half the distance from each center to its closest other center, split
+  // among the threads of the enclosing team
+  const size_t k = centers.rows(), d = centers.cols();
+#pragma omp for schedule(dynamic, 16)
+  for (size_t j = 0; j < k; ++j) {
+    for (size_t t = 0; t < k; ++t) {
+      if (t == j) {
+        continue;
+      }
+      // each thread owns row j, evaluate both triangles rather than sync
+      DType half = std::sqrt(kernels_->sqdist(centers.row(j), centers.row(t),
+                                              d)) / 2;
+      half_min_dist_[j] = std::min(half_min_dist_[j], half);
+      if (algorithm_ == Algorithm::ELKAN) {
+        center_dists_[j * k + t] = half;
+      }
+    }
+  }
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::init_point(const DType *p, size_t i,
+    int *label, DType *min_dist, std::vector<DType> &workspace) {
+  const size_t k = k_, d = centers_->cols();
+  workspace.resize(k);
+  DType *dists = workspace.data();
+  kernels_->sqdist_1xk(p, centers_->data(), k, centers_->stride(), d, dists);
+  int best = 0;
+  for (size_t j = 1; j < k; ++j) {
+    if (dists[j] < dists[best]) {
+      best = static_cast<int>(j);
+    }
+  }
+  if (algorithm_ == Algorithm::ELKAN) {
+    DType *lower = &lower_[i * k];
+    for (size_t j = 0; j < k; ++j) {
+      lower[j] = std::sqrt(dists[j]);
+    }
+  } else if (algorithm_ == Algorithm::YINYANG) {
+    set_group_bounds(i, dists, best);
+  } else {
+    DType second = std::numeric_limits<DType>::infinity();
+    for (size_t j = 0; j < k; ++j) {
+      if (static_cast<int>(j) != best && dists[j] < second) {
+        second = dists[j];
+      }
+    }
+    lower_[i] = std::sqrt(second);
+  }
+  initialized_[i] = 1;
+  *label = best;
+  *min_dist = dists[best];
+  return k;
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::hamerly(const DType *p, size_t i, int *label,
+    DType *min_dist, std::vector<DType> &workspace) {
+  const int a = *label;
+  DType lower = lower_[i] -
+    (a == max_drift_center_ ? max_drift_[1] : max_drift_[0]);
+  lower_[i] = lower;
+
+  DType dist_sq = kernels_->sqdist(p, centers_->row(a), centers_->cols());
+  DType upper = std::sqrt(dist_sq);
+  if (upper * slack<DType>() < std::max(half_min_dist_[a], lower)) {
+    *min_dist = dist_sq;
+    return 1;
+  }
+  return 1 + init_point(p, i, label, min_dist, workspace);
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::elkan(const DType *p, size_t i, int *label,
+    DType *min_dist) {
+  const size_t k = k_, d = centers_->cols();
+  DType *lower = &lower_[i * k];
+  for (size_t j = 0; j < k; ++j) {
+    lower[j] = std::max(lower[j] - drift_[j], static_cast<DType>(0));
+  }
+
+  int best = *label;
+  DType best_sq = kernels_->sqdist(p, centers_->row(best), d);
+  DType upper = std::sqrt(best_sq);
+  lower[best] = upper;
+  size_t evals = 1;
+  if (upper * slack<DType>() < half_min_dist_[best]) {
+    *min_dist = best_sq;
+    return evals;
+  }
+
+  const int a = best;
+  for (size_t j = 0; j < k; ++j) {
+    if (static_cast<int>(j) == a) {
+      continue;
+    }
+    const DType u = upper * slack<DType>();
+    if (u < lower[j] || u < center_dists_[best * k + j]) {
+      continue;
+    }
+    DType dist_sq = kernels_->sqdist(p, centers_->row(j), d);
+    ++evals;
+    lower[j] = std::sqrt(dist_sq);
+    // same tie break as a full scan: lowest index wins
+    if (dist_sq < best_sq || (dist_sq == best_sq && static_cast<int>(j) < best)) {
+      best = static_cast<int>(j);
+      best_sq = dist_sq;
+      upper = lower[j];
+    }
+  }
+  *label = best;
+  *min_dist = best_sq;
+  return evals;
+}
+
+template <typename DType>
+void BoundedAssigner<DType>::set_group_bounds(size_t i, const DType *dists,
+    int best) {
+  DType *lower = &lower_[i * num_groups()];
+  for (size_t g = 0; g < num_groups(); ++g) {
+    DType bound = std::numeric_limits<DType>::infinity();
+    for (size_t m = group_start_[g]; m < group_start_[g + 1]; ++m) {
+      const int j = group_centers_[m];
+      if (j != best && dists[j] < bound) {
+        bound = dists[j];
+      }
+    }
+    lower[g] = std::sqrt(bound);
+  }
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::yinyang(const DType *p, size_t i, int *label,
+    DType *min_dist, std::vector<DType> &workspace) {
+  const DType inf = std::numeric_limits<DType>::infinity();
+  const size_t t = num_groups(), d = centers_->cols();
+  // lower[] keeps last pass's bounds for the local filter until the end
+  DType *lower = &lower_[i * t];
+  workspace.resize(3 * t);
+  DType *relaxed = workspace.data();
+  DType *first = relaxed + t;   /* smallest value seen in a scanned group */
+  DType *second = first + t;
+  DType global = inf;
+  for (size_t g = 0; g < t; ++g) {
+    relaxed[g] = lower[g] - group_drift_[g];
+    first[g] = second[g] = inf;
+    global = std::min(global, relaxed[g]);
+  }
+
+  const int a = *label;
+  const DType a_sq = kernels_->sqdist(p, centers_->row(a), d);
+  int best = a;
+  DType best_sq = a_sq;
+  DType upper = std::sqrt(a_sq);
+  size_t evals = 1;
+  if (upper * slack<DType>() < global) {  // global filter
+    std::copy(relaxed, relaxed + t, lower);
+    *min_dist = a_sq;
+    return evals;
+  }
+
+  for (size_t g = 0; g < t; ++g) {
+    if (upper * slack<DType>() < relaxed[g]) {  // group filter
+      continue;
+    }
+    for (size_t m = group_start_[g]; m < group_start_[g + 1]; ++m) {
+      const int j = group_centers_[m];
+      // each value is an exact distance or a local filter bound
+      DType value;
+      if (j == a) {
+        value = std::sqrt(a_sq);
+      } else {
+        const DType local = lower[g] - drift_[j];
+        if (upper * slack<DType>() < local) {  // local filter
+          value = local;
+        } else {
+          DType dist_sq = kernels_->sqdist(p, centers_->row(j), d);
+          ++evals;
+          value = std::sqrt(dist_sq);
+          // same tie break as a full scan: lowest index wins
+          if (dist_sq < best_sq || (dist_sq == best_sq && j < best)) {
+            best = j;
+            best_sq = dist_sq;
+            upper = value;
+          }
+        }
+      }
+      if (value < first[g]) {
+        second[g] = first[g];
+        first[g] = value;
+      } else if (value < second[g]) {
+        second[g] = value;
+      }
+    }
+  }
+
+  // The best center holds the smallest value of its group, so that group's
+  // bound is its second smallest. Unscanned groups keep the relaxed bound,
+  // which covers every member but `a`.
+  const int best_group = group_of_[best], a_group = group_of_[a];
+  for (size_t g = 0; g < t; ++g) {
+    if (first[g] == inf) {
+      lower[g] = relaxed[g];
+    } else {
+      lower[g] = static_cast<int>(g) == best_group ? second[g] : first[g];
+    }
+  }
+  if (best != a && first[a_group] == inf) {
+    lower[a_group] = std::min(lower[a_group], std::sqrt(a_sq));
+  }
+  *label = best;
+  *min_dist = best_sq;
+  return evals;
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::assign(const DType *x, size_t begin, size_t n,
+    size_t stride, const int *prev_labels, int *labels, DType *min_dists,
+    std::vector<DType> &workspace) {
+  size_t evals = 0;
+  for (size_t t = 0; t < n; ++t) {
+    const size_t i = begin + t;
+    const DType *p = x + t * stride;
+    labels[t] = prev_labels[t];
+    if (!initialized_[i] || labels[t] < 0) {
+      evals += init_point(p, i, &labels[t], &min_dists[t], workspace);
+    } else if (algorithm_ == Algorithm::ELKAN) {
+      evals += elkan(p, i, &labels[t], &min_dists[t]);
+    } else if (algorithm_ == Algorithm::YINYANG) {
+      evals += yinyang(p, i, &labels[t], &min_dists[t], workspace);
+    } else {
+      evals += hamerly(p, i, &labels[t], &min_dists[t], workspace);
+    }
+  }
+  return evals;
+}
+
+template <typename DType>
+size_t BoundedAssigner<DType>::bytes() const {
+  return prev_centers_.rows() * prev_centers_.stride() * sizeof(DType) +
+    initialized_.capacity() +
+    (lower_.capacity() + drift_.capacity() + half_min_dist_.capacity() +
+     center_dists_.capacity() + group_drift_.capacity()) * sizeof(DType) +
+    (group_of_.capacity() + group_centers_.capacity()) * sizeof(int) +
+    group_start_.capacity() * sizeof(size_t);
+}
+
+template class BoundedAssigner<float>;
+template class BoundedAssigner<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,207 @@
+#include "center_index.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace cluster {
+
+namespace {
+
+// Lloyd passes over the centers when building the cells; the partition only
+// affects speed, never the exact labels
+const int kBuildIters = 10;
+
+// Relative margin on the triangle-inequality bands, so rounding in the
+// distances can never skip the nearest center.
+const double kBoundSlack = 1e-4;
+
+}  // namespace
+
+template <typename DType>
+void CenterIndex<DType>::build(const Matrix<DType> &centers, size_t n_list,
+    int n_thread) {
+  const size_t k = centers.rows(), d = centers.cols();
+  clear();
+  kernels_ = &distance_kernels<DType>(d);
+  if (k == 0) {
+    return;
+  }
+  if (n_list == 0) {
+    n_list = static_cast<size_t>(std::sqrt(static_cast<double>(k)) + 0.5);
+  }
+  n_list = std::max(static_cast<size_t>(1), std::min(n_list, k));
+
+  // spread the initial cells over the codebook, then refine them
+  cells_.resize(n_list, d, true);
+  for (size_t c = 0; c < n_list; ++c) {
+    const DType *center = centers.row(c * k / n_list);
+    std::copy(center, center + d, cells_.row(c));
+  }
+  std::vector<int> cell(k, -1);
+  Matrix<double> sums(n_list, d);
+  std::vector<size_t> counts(n_list);
+  for (int iter = 0; iter < kBuildIters; ++iter) {
+    size_t moved = 0;
+#pragma omp parallel for num_threads(n_thread) if (n_thread > 1) \
+    reduction(+:moved)
+    for (size_t i = 0; i < k; ++i) {
+      DType dist;
+      int c = kernels_->nearest(centers.row(i), cells_.data(), n_list,
+                                cells_.stride(), d, &dist);
+      if (c != cell[i]) {
+        cell[i] = c;
+        ++moved;
+      }
+    }
+    if (moved == 0) {
+      break;
+    }
+    sums.zero();
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t i = 0; i < k; ++i) {
+      double *sum = sums.row(cell[i]);
+      for (size_t j = 0; j < d; ++j) {
+        sum[j] += centers(i, j);
+      }
+      ++counts[cell[i]];
+    }
+    // an empty cell keeps its centroid, and is dropped after the passes
+    for (size_t c = 0; c < n_list; ++c) {
+      if (counts[c] > 0) {
+        for (size_t j = 0; j < d; ++j) {
+          cells_(c, j) = static_cast<DType>(sums(c, j) / counts[c]);
+        }
+      }
+    }
+  }
+
+  // drop the cells left empty, so every cell a search probes has members
+  std::vector<int> renumbered(n_list, -1);
+  size_t n_kept = 0;
+  for (size_t c = 0; c < n_list; ++c) {
+    if (counts[c] > 0) {
+      if (n_kept != c) {
+        std::copy(cells_.row(c), cells_.row(c) + d, cells_.row(n_kept));
+      }
+      renumbered[c] = static_cast<int>(n_kept++);
+    }
+  }
+  if (n_kept < n_list) {
+    Matrix<DType> kept(n_kept, d, true);
+    for (size_t c = 0; c < n_kept; ++c) {
+      std::copy(cells_.row(c), cells_.row(c) + d, kept.row(c));
+    }
+    cells_ = kept;
+    for (size_t i = 0; i < k; ++i) {
+      cell[i] = renumbered[cell[i]];
+    }
+    n_list = n_kept;
+  }
+
+  // group the members by cell, each cell by radius, then center index
+  std::vector<DType> radius(k);
+  for (size_t i = 0; i < k; ++i) {
+    radius[i] = std::sqrt(kernels_->sqdist(centers.row(i),
+                                           cells_.row(cell[i]), d));
+  }
+  ids_.resize(k);
+  for (size_t i = 0; i < k; ++i) {
+    ids_[i] = static_cast<int>(i);
+  }
+  std::sort(ids_.begin(), ids_.end(), [&](int a, int b) {
+    return cell[a] != cell[b] ? cell[a] < cell[b] :
+      radius[a] != radius[b] ? radius[a] < radius[b] : a < b;
+  });
+  offsets_.assign(n_list + 1, 0);
+  for (size_t i = 0; i < k; ++i) {
+    ++offsets_[cell[i] + 1];
+  }
+  for (size_t c = 0; c < n_list; ++c) {
+    offsets_[c + 1] += offsets_[c];
+  }
+  members_.resize(k, d, true);
+  radii_.resize(k);
+  for (size_t row = 0; row < k; ++row) {
+    const DType *center = centers.row(ids_[row]);
+    std::copy(center, center + d, members_.row(row));
+    radii_[row] = radius[ids_[row]];
+  }
+  max_members_ = 0;
+  for (size_t c = 0; c < n_list; ++c) {
+    max_members_ = std::max(max_members_, offsets_[c + 1] - offsets_[c]);
+  }
+}
+
+template <typename DType>
+void CenterIndex<DType>::clear() {
+  cells_ = Matrix<DType>();
+  members_ = Matrix<DType>();
+  radii_.clear();
+  ids_.clear();
+  offsets_.clear();
+  max_members_ = 0;
+}
+
+template <typename DType>
+void CenterIndex<DType>::scan(const DType *x, size_t cell, DType dist,
+    DType &best, int &best_id, DType *dists) const {
+  // members with radius in [t - b, t + b]
+  const double t = std::sqrt(static_cast<double>(dist));
+  const double b = best_id < 0 ? std::numeric_limits<double>::max() :
+    std::sqrt(static_cast<double>(best));
+  const double slack = kBoundSlack * (t + b);
+  const DType *radii = radii_.data();
+  const size_t begin = std::lower_bound(radii + offsets_[cell],
+      radii + offsets_[cell + 1], t - b - slack) - radii;
+  const size_t end = std::upper_bound(radii + begin,
+      radii + offsets_[cell + 1], t + b + slack) - radii;
+  if (begin == end) {
+    return;
+  }
+  kernels_->sqdist_1xk(x, members_.row(begin), end - begin,
+                       members_.stride(), members_.cols(), dists);
+  for (size_t i = begin; i < end; ++i) {
+    const DType d = dists[i - begin];
+    if (d < best || (d == best && ids_[i] < best_id)) {
+      best = d;
+      best_id = ids_[i];
+    }
+  }
+}
+
+template <typename DType>
+int CenterIndex<DType>::search(const DType *x, size_t n_probe,
+    DType *min_dist, std::vector<DType> &workspace) const {
+  const size_t n_list = cells_.rows();
+  workspace.resize(n_list + max_members_);
+  DType *dists = workspace.data(), *scratch = dists + n_list;
+  kernels_->sqdist_1xk(x, cells_.data(), n_list, cells_.stride(),
+                       cells_.cols(), dists);
+  DType best = std::numeric_limits<DType>::max();
+  int best_id = -1;
+
+  if (n_probe > 0 && n_probe < n_list) {
+    // the n_probe nearest cells, picked one at a time
+    for (size_t p = 0; p < n_probe; ++p) {
+      size_t cell = std::min_element(dists, dists + n_list) - dists;
+      scan(x, cell, dists[cell], best, best_id, scratch);
+      dists[cell] = std::numeric_limits<DType>::max();
+    }
+  } else {
+    const size_t first = std::min_element(dists, dists + n_list) - dists;
+    scan(x, first, dists[first], best, best_id, scratch);
+    for (size_t c = 0; c < n_list; ++c) {
+      if (c != first) {
+        scan(x, c, dists[c], best, best_id, scratch);
+      }
+    }
+  }
+  *min_dist = best;
+  return best_id;
+}
+
+template class CenterIndex<float>;
+template class CenterIndex<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
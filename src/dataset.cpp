@@ -0,0 +1,210 @@
+#include "dataset.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace cluster {
+
+const char kDatasetMagic[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'D', 'S'};
+
+template <>
+DataType data_type<float>() { return DataType::FLOAT32; }
+template <>
+DataType data_type<double>() { return DataType::FLOAT64; }
+
+namespace {
+
+DatasetHeader make_header(DataType dtype, size_t rows, size_t cols,
+                          size_t stride, size_t alignment) {
+  DatasetHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kDatasetMagic, sizeof(header.magic));
+  header.version = kDatasetVersion;
+  header.dtype = static_cast<uint32_t>(dtype);
+  header.rows = rows;
+  header.cols = cols;
+  header.stride = stride;
+  header.alignment = static_cast<uint32_t>(alignment);
+  return header;
+}
+
+}  // namespace
+
+bool is_dataset(const char *path) {
+  char magic[sizeof(kDatasetMagic)];
+  FILE *file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool match = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+    std::memcmp(magic, kDatasetMagic, sizeof(magic)) == 0;
+  std::fclose(file);
+  return match;
+}
+
+template <typename DType>
+Status map_dataset(const char *path, Matrix<DType> &out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "unable to open file \"" << path << "\" to read";
+    return Status::IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    LOG(ERROR) << "unable to stat \"" << path << "\"";
+    ::close(fd);
+    return Status::IO_ERROR;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  DatasetHeader header;
+  if (size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    LOG(ERROR) << "\"" << path << "\" is too short for a dataset header";
+    ::close(fd);
+    return Status::FORMAT_ERROR;
+  }
+  const char *error = nullptr;
+  if (std::memcmp(header.magic, kDatasetMagic, sizeof(header.magic)) != 0) {
+    error = "bad magic";
+  } else if (header.version != kDatasetVersion) {
+    error = "unsupported version";
+  } else if (header.dtype != static_cast<uint32_t>(data_type<DType>())) {
+    error = "element type does not match";
+  } else if (header.stride < header.cols || header.alignment == 0 ||
+             header.alignment % sizeof(DType) != 0) {
+    error = "bad row layout";
+  } else if (header.stride != 0 &&
+             header.rows > (size - sizeof(header)) / sizeof(DType) /
+                           header.stride) {
+    error = "payload is truncated";
+  }
+  if (error != nullptr) {
+    LOG(ERROR) << "invalid dataset \"" << path << "\": " << error;
+    ::close(fd);
+    return Status::FORMAT_ERROR;
+  }
+
+  // private and writable, so the view can be handed out as DType* without
+  // writes ever reaching the file
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "unable to mmap \"" << path << "\"";
+    return Status::IO_ERROR;
+  }
+  std::shared_ptr<void> owner(addr, [size](void *p) { munmap(p, size); });
+  DType *payload = reinterpret_cast<DType*>(
+      static_cast<char*>(addr) + sizeof(header));
+  out = Matrix<DType>(payload, header.rows, header.cols, header.stride, owner);
+  return Status::OK;
+}
+
+template <typename DType>
+Status DatasetWriter<DType>::open(const char *path, size_t cols,
+    bool padded) {
+  close();
+  file_ = std::fopen(path, "wb");
+  if (file_ == nullptr) {
+    LOG(ERROR) << "unable to open file \"" << path << "\" to write";
+    return Status::IO_ERROR;
+  }
+  rows_ = 0;
+  cols_ = cols;
+  stride_ = padded ? Matrix<DType>::padded_stride(cols) : cols;
+  alignment_ = padded ? Matrix<DType>::kAlignment : sizeof(DType);
+  // rewritten with the final row count by close()
+  DatasetHeader header = make_header(data_type<DType>(), 0, cols_, stride_,
+                                     alignment_);
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1) {
+    LOG(ERROR) << "failed writing \"" << path << "\"";
+    return Status::IO_ERROR;
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status DatasetWriter<DType>::append(const Matrix<DType> &rows) {
+  if (file_ == nullptr) {
+    return Status::IO_ERROR;
+  }
+  if (rows.empty()) {
+    return Status::OK;
+  }
+  if (rows.cols() != cols_) {
+    LOG(ERROR) << "rows have dimension " << rows.cols() << ", expected "
+      << cols_;
+    return Status::DIM_ERROR;
+  }
+  std::vector<DType> padding(stride_ - cols_);
+  for (size_t i = 0; i < rows.rows(); ++i) {
+    if (std::fwrite(rows.row(i), sizeof(DType), cols_, file_) != cols_ ||
+        std::fwrite(padding.data(), sizeof(DType), padding.size(), file_) !=
+        padding.size()) {
+      LOG(ERROR) << "failed writing dataset rows";
+      return Status::IO_ERROR;
+    }
+  }
+  rows_ += rows.rows();
+  return Status::OK;
+}
+
+template <typename DType>
+Status DatasetWriter<DType>::close() {
+  if (file_ == nullptr) {
+    return Status::OK;
+  }
+  DatasetHeader header = make_header(data_type<DType>(), rows_, cols_,
+                                     stride_, alignment_);
+  bool ok = std::fseek(file_, 0, SEEK_SET) == 0 &&
+    std::fwrite(&header, sizeof(header), 1, file_) == 1;
+  ok = std::fclose(file_) == 0 && ok;
+  file_ = nullptr;
+  if (!ok) {
+    LOG(ERROR) << "failed finishing dataset file";
+    return Status::IO_ERROR;
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status DatasetReader<DType>::read(size_t max_rows, Matrix<DType> &batch) {
+  const size_t rows = std::min(max_rows, data_.rows() - next_);
+  // the view shares ownership of the mapping
+  batch = Matrix<DType>(data_.row(next_), rows, data_.cols(), data_.stride(),
+                        data_.owner());
+  next_ += rows;
+  return Status::OK;
+}
+
+template <typename DType>
+Status save_dataset(const char *path, const Matrix<DType> &data,
+    bool padded) {
+  DatasetWriter<DType> writer;
+  auto ret = writer.open(path, data.cols(), padded);
+  if (ret == Status::OK) {
+    ret = writer.append(data);
+  }
+  if (ret == Status::OK) {
+    ret = writer.close();
+  }
+  return ret;
+}
+
+template Status map_dataset(const char *path, Matrix<float> &out);
+template Status map_dataset(const char *path, Matrix<double> &out);
+template Status save_dataset(const char *path, const Matrix<float> &data,
+                             bool padded);
+template Status save_dataset(const char *path, const Matrix<double> &data,
+                             bool padded);
+template class DatasetReader<float>;
+template class DatasetReader<double>;
+template class DatasetWriter<float>;
+template class DatasetWriter<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
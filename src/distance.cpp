@@ -0,0 +1,162 @@
+#include "distance.h"
+#include "distance_impl.h"
+#include "utils.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace cluster {
+
+const char* simd_levels[4] = {"scalar", "sse", "avx2", "avx512"};
+
+namespace {
+
+template <typename DType>
+struct Scalar {
+  typedef DType T;
+  typedef DType V;
+  static const size_t W = 1;
+  static V zero() { return 0; }
+  static V load(const T *p) { return *p; }
+  static V load_tail(const T *p, size_t n) { return n > 0 ? *p : 0; }
+  static V sqdiff_acc(V acc, V x, V y) { return acc + (x - y) * (x - y); }
+  static V dot_acc(V acc, V x, V y) { return acc + x * y; }
+  static T hsum(V v) { return v; }
+  static V set1(T a) { return a; }
+  static void store(T *p, V v) { *p = v; }
+};
+
+bool cpu_supports(SimdLevel level) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  switch (level) {
+    case SimdLevel::SCALAR: return true;
+    case SimdLevel::SSE:    return __builtin_cpu_supports("sse2");
+    case SimdLevel::AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdLevel::AVX512: return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+#else
+  return level == SimdLevel::SCALAR;
+#endif
+}
+
+const size_t kNumFixedDims = sizeof(kFixedDims) / sizeof(kFixedDims[0]);
+
+// slot 0 of a KernelSet is the generic table, slot i + 1 is for kFixedDims[i]
+template <typename DType>
+struct KernelSet {
+  DistanceKernels<DType> tables[kNumFixedDims + 1];
+};
+
+size_t slot_of(size_t d) {
+  for (size_t i = 0; i < kNumFixedDims; ++i) {
+    if (kFixedDims[i] == d) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+template <typename DType>
+bool select_kernels(SimdLevel level, DistanceKernels<DType> &kernels,
+    size_t d = 0) {
+  if (!cpu_supports(level)) {
+    return false;
+  }
+  switch (level) {
+    case SimdLevel::SCALAR:
+      fill_kernels<Scalar<DType>>(kernels, SimdLevel::SCALAR, d);
+      return true;
+    case SimdLevel::SSE:    return sse_kernels(kernels, d);
+    case SimdLevel::AVX2:   return avx2_kernels(kernels, d);
+    case SimdLevel::AVX512: return avx512_kernels(kernels, d);
+  }
+  return false;
+}
+
+SimdLevel env_simd_cap() {
+  const char *env = std::getenv("KMEANS_SIMD");
+  if (env != nullptr) {
+    for (int i = 0; i < 4; ++i) {
+      if (std::strcmp(env, simd_levels[i]) == 0) {
+        return static_cast<SimdLevel>(i);
+      }
+    }
+    LOG(WARN) << "ignoring unknown KMEANS_SIMD=" << env;
+  }
+  return SimdLevel::AVX512;
+}
+
+template <typename DType>
+bool select_set(SimdLevel level, KernelSet<DType> &set) {
+  if (!select_kernels(level, set.tables[0])) {
+    return false;
+  }
+  for (size_t i = 0; i < kNumFixedDims; ++i) {
+    select_kernels(level, set.tables[i + 1], kFixedDims[i]);
+  }
+  return true;
+}
+
+template <typename DType>
+KernelSet<DType> make_kernels() {
+  KernelSet<DType> set;
+  SimdLevel cap = std::min(detect_simd_level(), env_simd_cap());
+  for (int i = static_cast<int>(cap); i >= 0; --i) {
+    if (select_set(static_cast<SimdLevel>(i), set)) {
+      break;
+    }
+  }
+  return set;
+}
+
+template <typename DType>
+KernelSet<DType>& kernel_table() {
+  static KernelSet<DType> set = make_kernels<DType>();
+  return set;
+}
+
+}  // namespace
+
+SimdLevel detect_simd_level() {
+  DistanceKernels<float> probe;
+  for (int i = static_cast<int>(SimdLevel::AVX512); i > 0; --i) {
+    if (select_kernels(static_cast<SimdLevel>(i), probe)) {
+      return static_cast<SimdLevel>(i);
+    }
+  }
+  return SimdLevel::SCALAR;
+}
+
+bool set_simd_level(SimdLevel level) {
+  KernelSet<float> f;
+  KernelSet<double> d;
+  if (!select_set(level, f) || !select_set(level, d)) {
+    return false;
+  }
+  kernel_table<float>() = f;
+  kernel_table<double>() = d;
+  LOG(DEBUG) << "using " << simd_levels[static_cast<int>(level)]
+    << " distance kernels";
+  return true;
+}
+
+template <typename DType>
+const DistanceKernels<DType>& distance_kernels() {
+  return kernel_table<DType>().tables[0];
+}
+
+template <typename DType>
+const DistanceKernels<DType>& distance_kernels(size_t d) {
+  return kernel_table<DType>().tables[slot_of(d)];
+}
+
+template const DistanceKernels<float>& distance_kernels<float>();
+template const DistanceKernels<double>& distance_kernels<double>();
+template const DistanceKernels<float>& distance_kernels<float>(size_t);
+template const DistanceKernels<double>& distance_kernels<double>(size_t);
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
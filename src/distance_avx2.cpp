@@ -0,0 +1,91 @@
+// AVX2 + FMA distance kernels, built with -mavx2 -mfma and only called after
+// the CPU has been checked for both (see distance.cpp).
+#include "distance_impl.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#include <cstdint>
+
+namespace cluster {
+namespace {
+
+struct Avx2Float {
+  typedef float T;
+  typedef __m256 V;
+  static const size_t W = 8;
+  static V zero() { return _mm256_setzero_ps(); }
+  static V load(const T *p) { return _mm256_loadu_ps(p); }
+  static V load_tail(const T *p, size_t n) {
+    const int32_t idx[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    __m256i mask = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(static_cast<int>(n)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)));
+    return _mm256_maskload_ps(p, mask);
+  }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm256_sub_ps(x, y);
+    return _mm256_fmadd_ps(t, t, acc);
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm256_fmadd_ps(x, y, acc); }
+  static T hsum(V v) {
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+  }
+  static V set1(T a) { return _mm256_set1_ps(a); }
+  static void store(T *p, V v) { _mm256_storeu_ps(p, v); }
+};
+
+struct Avx2Double {
+  typedef double T;
+  typedef __m256d V;
+  static const size_t W = 4;
+  static V zero() { return _mm256_setzero_pd(); }
+  static V load(const T *p) { return _mm256_loadu_pd(p); }
+  static V load_tail(const T *p, size_t n) {
+    const int64_t idx[4] = {0, 1, 2, 3};
+    __m256i mask = _mm256_cmpgt_epi64(
+        _mm256_set1_epi64x(static_cast<int64_t>(n)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)));
+    return _mm256_maskload_pd(p, mask);
+  }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm256_sub_pd(x, y);
+    return _mm256_fmadd_pd(t, t, acc);
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm256_fmadd_pd(x, y, acc); }
+  static T hsum(V v) {
+    __m128d t = _mm_add_pd(_mm256_castpd256_pd128(v),
+                           _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(t, _mm_unpackhi_pd(t, t)));
+  }
+  static V set1(T a) { return _mm256_set1_pd(a); }
+  static void store(T *p, V v) { _mm256_storeu_pd(p, v); }
+};
+
+}  // namespace
+
+bool avx2_kernels(DistanceKernels<float> &kernels, size_t d) {
+  fill_kernels<Avx2Float>(kernels, SimdLevel::AVX2, d);
+  return true;
+}
+
+bool avx2_kernels(DistanceKernels<double> &kernels, size_t d) {
+  fill_kernels<Avx2Double>(kernels, SimdLevel::AVX2, d);
+  return true;
+}
+
+}  // namespace cluster
+
+#else
+
+namespace cluster {
+bool avx2_kernels(DistanceKernels<float> &, size_t) { return false; }
+bool avx2_kernels(DistanceKernels<double> &, size_t) { return false; }
+}  // namespace cluster
+
+#endif
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,97 @@
+// AVX-512F distance kernels, built with -mavx512f and only called after the
+// CPU has been checked for it (see distance.cpp). Tails use masked loads.
+#include "distance_impl.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+
+namespace cluster {
+namespace {
+
+// Lower and upper 256 bits. The masked form with an explicit zero source
+// avoids a bogus -Wuninitialized from GCC 12's _mm512_extractf64x4_pd and
+// _mm512_reduce_add_* implementations.
+inline __m256d low_half(__m512d v) {
+  return _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xff, v, 0);
+}
+
+inline __m256d high_half(__m512d v) {
+  return _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xff, v, 1);
+}
+
+struct Avx512Float {
+  typedef float T;
+  typedef __m512 V;
+  static const size_t W = 16;
+  static V zero() { return _mm512_setzero_ps(); }
+  static V load(const T *p) { return _mm512_loadu_ps(p); }
+  static V load_tail(const T *p, size_t n) {
+    return _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << n) - 1), p);
+  }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm512_sub_ps(x, y);
+    return _mm512_fmadd_ps(t, t, acc);
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm512_fmadd_ps(x, y, acc); }
+  static T hsum(V v) {
+    __m512d w = _mm512_castps_pd(v);
+    __m256 h = _mm256_add_ps(_mm256_castpd_ps(low_half(w)),
+                             _mm256_castpd_ps(high_half(w)));
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(h),
+                          _mm256_extractf128_ps(h, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+  }
+  static V set1(T a) { return _mm512_set1_ps(a); }
+  static void store(T *p, V v) { _mm512_storeu_ps(p, v); }
+};
+
+struct Avx512Double {
+  typedef double T;
+  typedef __m512d V;
+  static const size_t W = 8;
+  static V zero() { return _mm512_setzero_pd(); }
+  static V load(const T *p) { return _mm512_loadu_pd(p); }
+  static V load_tail(const T *p, size_t n) {
+    return _mm512_maskz_loadu_pd(static_cast<__mmask8>((1u << n) - 1), p);
+  }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm512_sub_pd(x, y);
+    return _mm512_fmadd_pd(t, t, acc);
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm512_fmadd_pd(x, y, acc); }
+  static T hsum(V v) {
+    __m256d h = _mm256_add_pd(low_half(v), high_half(v));
+    __m128d t = _mm_add_pd(_mm256_castpd256_pd128(h),
+                           _mm256_extractf128_pd(h, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(t, _mm_unpackhi_pd(t, t)));
+  }
+  static V set1(T a) { return _mm512_set1_pd(a); }
+  static void store(T *p, V v) { _mm512_storeu_pd(p, v); }
+};
+
+}  // namespace
+
+bool avx512_kernels(DistanceKernels<float> &kernels, size_t d) {
+  fill_kernels<Avx512Float>(kernels, SimdLevel::AVX512, d);
+  return true;
+}
+
+bool avx512_kernels(DistanceKernels<double> &kernels, size_t d) {
+  fill_kernels<Avx512Double>(kernels, SimdLevel::AVX512, d);
+  return true;
+}
+
+}  // namespace cluster
+
+#else
+
+namespace cluster {
+bool avx512_kernels(DistanceKernels<float> &, size_t) { return false; }
+bool avx512_kernels(DistanceKernels<double> &, size_t) { return false; }
+}  // namespace cluster
+
+#endif
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,279 @@
+#ifndef DISTANCE_IMPL_H
+#define DISTANCE_IMPL_H
+
+// Generic distance kernels, written once against a small SIMD traits class
+// and instantiated by each distance_<isa>.cpp with its own compiler flags.
+//
+// Everything here has internal linkage on purpose: a TU built with -mavx512f
+// must not export inline functions the linker could pick for callers running
+// on older CPUs. For the same reason, do not use std:: algorithms in here.
+//
+// A traits class S provides
+//   T, V, W            element type, vector type, lanes per vector
+//   zero()             all-zero vector
+//   load(p)            unaligned load of W elements
+//   load_tail(p, n)    load of n < W elements, zero filled
+//   sqdiff_acc(a,x,y)  a + (x - y)^2
+//   dot_acc(a,x,y)     a + x * y
+//   hsum(v)            horizontal sum
+//   set1(a)            a in every lane
+//   store(p, v)        unaligned store of W elements
+//
+// sqdist, sqdist_1xk, nearest and dot also take a compile-time dimension D.
+// Instantiated with D > 0 they ignore their d argument, so the loops over
+// the dimension unroll completely and the tail mask folds to a constant;
+// the arithmetic, and so every result, is the same as with D = 0.
+
+#include "distance.h"
+
+namespace cluster {
+
+// fill `kernels` for one instruction set, specialized for dimension d if it
+// is one of kFixedDims; return false if the set is not compiled in
+bool sse_kernels(DistanceKernels<float> &kernels, size_t d);
+bool sse_kernels(DistanceKernels<double> &kernels, size_t d);
+bool avx2_kernels(DistanceKernels<float> &kernels, size_t d);
+bool avx2_kernels(DistanceKernels<double> &kernels, size_t d);
+bool avx512_kernels(DistanceKernels<float> &kernels, size_t d);
+bool avx512_kernels(DistanceKernels<double> &kernels, size_t d);
+
+namespace {
+
+template <size_t D>
+inline size_t fixed_dim(size_t d) { return D > 0 ? D : d; }
+
+// All kernels accumulate in the same order (one W-wide accumulator, zero
+// filled tail), so a distance is bit-identical whichever kernel computed it.
+template <typename S, size_t D = 0>
+typename S::T sqdist(const typename S::T *p, const typename S::T *q,
+    size_t d) {
+  d = fixed_dim<D>(d);
+  typedef typename S::V V;
+  const size_t W = S::W;
+  V acc = S::zero();
+  size_t i = 0;
+  for (; i + W <= d; i += W) {
+    acc = S::sqdiff_acc(acc, S::load(p + i), S::load(q + i));
+  }
+  if (i < d) {
+    acc = S::sqdiff_acc(acc, S::load_tail(p + i, d - i),
+                        S::load_tail(q + i, d - i));
+  }
+  return S::hsum(acc);
+}
+
+// Distances from p to four centers at once: each chunk of p is loaded into a
+// register once and reused against the four centers, so the point stays in
+// registers while the centers stream through.
+template <typename S, size_t D = 0>
+void sqdist_1x4(const typename S::T *p, const typename S::T *c,
+    size_t stride, size_t d, typename S::T *out) {
+  d = fixed_dim<D>(d);
+  typedef typename S::V V;
+  const size_t W = S::W;
+  const typename S::T *c0 = c, *c1 = c + stride, *c2 = c + 2 * stride,
+        *c3 = c + 3 * stride;
+  V acc0 = S::zero(), acc1 = S::zero(), acc2 = S::zero(), acc3 = S::zero();
+  size_t i = 0;
+  for (; i + W <= d; i += W) {
+    V x = S::load(p + i);
+    acc0 = S::sqdiff_acc(acc0, x, S::load(c0 + i));
+    acc1 = S::sqdiff_acc(acc1, x, S::load(c1 + i));
+    acc2 = S::sqdiff_acc(acc2, x, S::load(c2 + i));
+    acc3 = S::sqdiff_acc(acc3, x, S::load(c3 + i));
+  }
+  if (i < d) {
+    const size_t n = d - i;
+    V x = S::load_tail(p + i, n);
+    acc0 = S::sqdiff_acc(acc0, x, S::load_tail(c0 + i, n));
+    acc1 = S::sqdiff_acc(acc1, x, S::load_tail(c1 + i, n));
+    acc2 = S::sqdiff_acc(acc2, x, S::load_tail(c2 + i, n));
+    acc3 = S::sqdiff_acc(acc3, x, S::load_tail(c3 + i, n));
+  }
+  out[0] = S::hsum(acc0);
+  out[1] = S::hsum(acc1);
+  out[2] = S::hsum(acc2);
+  out[3] = S::hsum(acc3);
+}
+
+template <typename S, size_t D = 0>
+void sqdist_1xk(const typename S::T *p, const typename S::T *centers,
+    size_t k, size_t stride, size_t d, typename S::T *out) {
+  size_t j = 0;
+  for (; j + 4 <= k; j += 4) {
+    sqdist_1x4<S, D>(p, centers + j * stride, stride, d, out + j);
+  }
+  for (; j < k; ++j) {
+    out[j] = sqdist<S, D>(p, centers + j * stride, d);
+  }
+}
+
+template <typename S, size_t D = 0>
+int nearest(const typename S::T *p, const typename S::T *centers,
+    size_t k, size_t stride, size_t d, typename S::T *min_dist) {
+  typename S::T dists[4];
+  int label = -1;
+  typename S::T best = 0;
+  size_t j = 0;
+  for (; j + 4 <= k; j += 4) {
+    sqdist_1x4<S, D>(p, centers + j * stride, stride, d, dists);
+    for (int t = 0; t < 4; ++t) {
+      if (label < 0 || dists[t] < best) {
+        best = dists[t];
+        label = static_cast<int>(j) + t;
+      }
+    }
+  }
+  for (; j < k; ++j) {
+    typename S::T cur = sqdist<S, D>(p, centers + j * stride, d);
+    if (label < 0 || cur < best) {
+      best = cur;
+      label = static_cast<int>(j);
+    }
+  }
+  *min_dist = best;
+  return label;
+}
+
+template <typename S, size_t D = 0>
+typename S::T dot(const typename S::T *p, const typename S::T *q, size_t d) {
+  d = fixed_dim<D>(d);
+  typedef typename S::V V;
+  const size_t W = S::W;
+  V acc = S::zero();
+  size_t i = 0;
+  for (; i + W <= d; i += W) {
+    acc = S::dot_acc(acc, S::load(p + i), S::load(q + i));
+  }
+  if (i < d) {
+    acc = S::dot_acc(acc, S::load_tail(p + i, d - i),
+                     S::load_tail(q + i, d - i));
+  }
+  return S::hsum(acc);
+}
+
+// GEMM micro-kernel: inner products of two points with four centers, held in
+// eight accumulators so each load feeds several multiply-adds.
+template <typename S>
+void dot_2x4(const typename S::T *x0, const typename S::T *x1,
+    const typename S::T *c, size_t stride, size_t d,
+    typename S::T *out0, typename S::T *out1) {
+  typedef typename S::V V;
+  const size_t W = S::W;
+  const typename S::T *c0 = c, *c1 = c + stride, *c2 = c + 2 * stride,
+        *c3 = c + 3 * stride;
+  V a00 = S::zero(), a01 = S::zero(), a02 = S::zero(), a03 = S::zero();
+  V a10 = S::zero(), a11 = S::zero(), a12 = S::zero(), a13 = S::zero();
+  size_t i = 0;
+  for (; i + W <= d; i += W) {
+    V p = S::load(x0 + i), q = S::load(x1 + i), y = S::load(c0 + i);
+    a00 = S::dot_acc(a00, p, y);
+    a10 = S::dot_acc(a10, q, y);
+    y = S::load(c1 + i);
+    a01 = S::dot_acc(a01, p, y);
+    a11 = S::dot_acc(a11, q, y);
+    y = S::load(c2 + i);
+    a02 = S::dot_acc(a02, p, y);
+    a12 = S::dot_acc(a12, q, y);
+    y = S::load(c3 + i);
+    a03 = S::dot_acc(a03, p, y);
+    a13 = S::dot_acc(a13, q, y);
+  }
+  if (i < d) {
+    const size_t n = d - i;
+    V p = S::load_tail(x0 + i, n), q = S::load_tail(x1 + i, n);
+    V y = S::load_tail(c0 + i, n);
+    a00 = S::dot_acc(a00, p, y);
+    a10 = S::dot_acc(a10, q, y);
+    y = S::load_tail(c1 + i, n);
+    a01 = S::dot_acc(a01, p, y);
+    a11 = S::dot_acc(a11, q, y);
+    y = S::load_tail(c2 + i, n);
+    a02 = S::dot_acc(a02, p, y);
+    a12 = S::dot_acc(a12, q, y);
+    y = S::load_tail(c3 + i, n);
+    a03 = S::dot_acc(a03, p, y);
+    a13 = S::dot_acc(a13, q, y);
+  }
+  out0[0] = S::hsum(a00);
+  out0[1] = S::hsum(a01);
+  out0[2] = S::hsum(a02);
+  out0[3] = S::hsum(a03);
+  out1[0] = S::hsum(a10);
+  out1[1] = S::hsum(a11);
+  out1[2] = S::hsum(a12);
+  out1[3] = S::hsum(a13);
+}
+
+template <typename S>
+void dot_block(const typename S::T *x, size_t nx, size_t xstride,
+    const typename S::T *c, size_t nc, size_t cstride, size_t d,
+    typename S::T *out, size_t ldo) {
+  size_t i = 0;
+  for (; i + 2 <= nx; i += 2) {
+    const typename S::T *x0 = x + i * xstride, *x1 = x0 + xstride;
+    typename S::T *out0 = out + i * ldo, *out1 = out0 + ldo;
+    size_t j = 0;
+    for (; j + 4 <= nc; j += 4) {
+      dot_2x4<S>(x0, x1, c + j * cstride, cstride, d, out0 + j, out1 + j);
+    }
+    for (; j < nc; ++j) {
+      out0[j] = dot<S>(x0, c + j * cstride, d);
+      out1[j] = dot<S>(x1, c + j * cstride, d);
+    }
+  }
+  if (i < nx) {
+    for (size_t j = 0; j < nc; ++j) {
+      out[i * ldo + j] = dot<S>(x + i * xstride, c + j * cstride, d);
+    }
+  }
+}
+
+template <typename S>
+void axpy(typename S::T a, const typename S::T *x, size_t n,
+    typename S::T *y) {
+  const typename S::V va = S::set1(a);
+  const size_t W = S::W;
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    S::store(y + i, S::dot_acc(S::load(y + i), va, S::load(x + i)));
+  }
+  for (; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+// the GEMM micro-kernel is only used for d >= 64 and axpy runs over k, both
+// stay generic
+template <typename S, size_t D>
+void fill_fixed(DistanceKernels<typename S::T> &kernels) {
+  kernels.dim = D;
+  kernels.sqdist = sqdist<S, D>;
+  kernels.sqdist_1xk = sqdist_1xk<S, D>;
+  kernels.nearest = nearest<S, D>;
+  kernels.dot = dot<S, D>;
+  kernels.dot_block = dot_block<S>;
+  kernels.axpy = axpy<S>;
+}
+
+template <typename S>
+void fill_kernels(DistanceKernels<typename S::T> &kernels, SimdLevel level,
+    size_t d) {
+  kernels.level = level;
+  switch (d) {
+    case 2:  fill_fixed<S, 2>(kernels); break;
+    case 3:  fill_fixed<S, 3>(kernels); break;
+    case 4:  fill_fixed<S, 4>(kernels); break;
+    case 8:  fill_fixed<S, 8>(kernels); break;
+    case 16: fill_fixed<S, 16>(kernels); break;
+    case 32: fill_fixed<S, 32>(kernels); break;
+    default: fill_fixed<S, 0>(kernels); break;
+  }
+}
+
+}  // namespace
+}  // namespace cluster
+
+#endif  // DISTANCE_IMPL_H
+
+// vim: ts=2 sts=2 sw=2
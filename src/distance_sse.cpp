@@ -0,0 +1,79 @@
+// SSE2 distance kernels. Part of the x86-64 baseline, built without extra
+// flags; see distance_impl.h for why nothing here has external linkage
+// besides the fill functions.
+#include "distance_impl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+
+namespace cluster {
+namespace {
+
+struct SseFloat {
+  typedef float T;
+  typedef __m128 V;
+  static const size_t W = 4;
+  static V zero() { return _mm_setzero_ps(); }
+  static V load(const T *p) { return _mm_loadu_ps(p); }
+  static V load_tail(const T *p, size_t n) {
+    T buf[W] = {0};
+    for (size_t i = 0; i < n; ++i) buf[i] = p[i];
+    return _mm_loadu_ps(buf);
+  }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm_sub_ps(x, y);
+    return _mm_add_ps(acc, _mm_mul_ps(t, t));
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm_add_ps(acc, _mm_mul_ps(x, y)); }
+  static T hsum(V v) {
+    V t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+  }
+  static V set1(T a) { return _mm_set1_ps(a); }
+  static void store(T *p, V v) { _mm_storeu_ps(p, v); }
+};
+
+struct SseDouble {
+  typedef double T;
+  typedef __m128d V;
+  static const size_t W = 2;
+  static V zero() { return _mm_setzero_pd(); }
+  static V load(const T *p) { return _mm_loadu_pd(p); }
+  static V load_tail(const T *p, size_t n) { return _mm_load_sd(p); }
+  static V sqdiff_acc(V acc, V x, V y) {
+    V t = _mm_sub_pd(x, y);
+    return _mm_add_pd(acc, _mm_mul_pd(t, t));
+  }
+  static V dot_acc(V acc, V x, V y) { return _mm_add_pd(acc, _mm_mul_pd(x, y)); }
+  static T hsum(V v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+  }
+  static V set1(T a) { return _mm_set1_pd(a); }
+  static void store(T *p, V v) { _mm_storeu_pd(p, v); }
+};
+
+}  // namespace
+
+bool sse_kernels(DistanceKernels<float> &kernels, size_t d) {
+  fill_kernels<SseFloat>(kernels, SimdLevel::SSE, d);
+  return true;
+}
+
+bool sse_kernels(DistanceKernels<double> &kernels, size_t d) {
+  fill_kernels<SseDouble>(kernels, SimdLevel::SSE, d);
+  return true;
+}
+
+}  // namespace cluster
+
+#else
+
+namespace cluster {
+bool sse_kernels(DistanceKernels<float> &, size_t) { return false; }
+bool sse_kernels(DistanceKernels<double> &, size_t) { return false; }
+}  // namespace cluster
+
+#endif
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,209 @@
+#include "encoded.h"
+#include "distance.h"
+#include "encoded_impl.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <omp.h>
+
+namespace cluster {
+
+const char* encodings[3] = {"float16", "bfloat16", "int8"};
+
+namespace {
+
+uint32_t bits_of(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+float float_of(uint32_t u) {
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// round to nearest even, after F. Giesen's float_to_half_fast3_rtne
+uint16_t to_half(float f) {
+  uint32_t u = bits_of(f);
+  const uint32_t sign = (u >> 16) & 0x8000;
+  u &= 0x7fffffff;
+  uint32_t h;
+  if (u >= 0x47800000) {
+    // beyond half's range, or inf and nan
+    h = u > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (u < 0x38800000) {
+    // subnormal or zero: let the float adder round at 2^-24
+    h = bits_of(float_of(u) + 0.5f) - 0x3f000000;
+  } else {
+    // rebias the exponent and round, a carry bumps the exponent
+    h = (u + 0xc8000fff + ((u >> 13) & 1)) >> 13;
+  }
+  return static_cast<uint16_t>(sign | h);
+}
+
+float from_half(uint16_t h) {
+  uint32_t u = static_cast<uint32_t>(h & 0x7fff) << 13;
+  const uint32_t exponent = u & 0x0f800000;
+  u += 0x38000000;
+  if (exponent == 0x0f800000) {
+    u += 0x38000000;  // inf and nan
+  } else if (exponent == 0) {
+    u = bits_of(float_of(u + 0x00800000) - float_of(0x38800000));
+  }
+  return float_of(u | static_cast<uint32_t>(h & 0x8000) << 16);
+}
+
+uint16_t to_bfloat(float f) {
+  const uint32_t u = bits_of(f);
+  if ((u & 0x7fffffff) > 0x7f800000) {
+    return static_cast<uint16_t>((u >> 16) | 0x40);  // keep nan a nan
+  }
+  return static_cast<uint16_t>((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+}
+
+template <typename DType>
+void widen_f16(const uint16_t *x, size_t n, DType *out) {
+  for (size_t j = 0; j < n; ++j) {
+    out[j] = from_half(x[j]);
+  }
+}
+
+template <typename DType>
+void widen_bf16(const uint16_t *x, size_t n, DType *out) {
+  for (size_t j = 0; j < n; ++j) {
+    out[j] = float_of(static_cast<uint32_t>(x[j]) << 16);
+  }
+}
+
+template <typename DType>
+void widen_i8(const int8_t *x, const DType *scale, const DType *offset,
+    size_t n, DType *out) {
+  for (size_t j = 0; j < n; ++j) {
+    const DType scaled = scale[j] * x[j];
+    out[j] = offset[j] + scaled;
+  }
+}
+
+template <typename DType>
+const Wideners<DType>& wideners() {
+  static const Wideners<DType> portable = {
+    widen_f16<DType>, widen_bf16<DType>, widen_i8<DType>
+  };
+  static Wideners<DType> avx2;
+  static const bool has_avx2 = detect_simd_level() >= SimdLevel::AVX2 &&
+    __builtin_cpu_supports("f16c") && avx2_wideners(avx2);
+  // follow the level of the distance kernels, so KMEANS_SIMD and
+  // set_simd_level() cover these too
+  return has_avx2 && distance_kernels<DType>().level >= SimdLevel::AVX2 ?
+    avx2 : portable;
+}
+
+}  // namespace
+
+template <typename DType>
+EncodedMatrix<DType>::EncodedMatrix(const Matrix<DType> &data,
+    Encoding encoding, int n_thread) :
+  encoding_(encoding), rows_(data.rows()), cols_(data.cols()) {
+  const size_t n = rows_, d = cols_;
+  if (encoding != Encoding::INT8) {
+    halves_.resize(n * d);
+#pragma omp parallel for num_threads(n_thread)
+    for (size_t i = 0; i < n; ++i) {
+      const DType *row = data.row(i);
+      uint16_t *out = &halves_[i * d];
+      for (size_t j = 0; j < d; ++j) {
+        const float value = static_cast<float>(row[j]);
+        out[j] = encoding == Encoding::FLOAT16 ? to_half(value) :
+                                                 to_bfloat(value);
+      }
+    }
+    return;
+  }
+
+  // 255 evenly spaced codes from each dimension's min (-127) to max (127)
+  Matrix<DType> lo(n_thread, d), hi(n_thread, d);
+  for (int t = 0; t < n_thread; ++t) {
+    std::fill(lo.row(t), lo.row(t) + d, std::numeric_limits<DType>::max());
+    std::fill(hi.row(t), hi.row(t) + d, std::numeric_limits<DType>::lowest());
+  }
+#pragma omp parallel num_threads(n_thread)
+  {
+    DType *thread_lo = lo.row(omp_get_thread_num());
+    DType *thread_hi = hi.row(omp_get_thread_num());
+#pragma omp for
+    for (size_t i = 0; i < n; ++i) {
+      const DType *row = data.row(i);
+      for (size_t j = 0; j < d; ++j) {
+        thread_lo[j] = std::min(thread_lo[j], row[j]);
+        thread_hi[j] = std::max(thread_hi[j], row[j]);
+      }
+    }
+  }
+  scale_.assign(d, 0);
+  offset_.assign(d, 0);
+  std::vector<DType> inverse(d, 0);
+  for (size_t j = 0; j < d && n > 0; ++j) {
+    DType min = lo(0, j), max = hi(0, j);
+    for (int t = 1; t < n_thread; ++t) {
+      min = std::min(min, lo(t, j));
+      max = std::max(max, hi(t, j));
+    }
+    scale_[j] = (max - min) / 254;
+    offset_[j] = min + 127 * scale_[j];
+    inverse[j] = scale_[j] > 0 ? 1 / scale_[j] : 0;
+  }
+  codes_.resize(n * d);
+#pragma omp parallel for num_threads(n_thread)
+  for (size_t i = 0; i < n; ++i) {
+    const DType *row = data.row(i);
+    int8_t *out = &codes_[i * d];
+    for (size_t j = 0; j < d; ++j) {
+      const long code = std::lround((row[j] - offset_[j]) * inverse[j]);
+      out[j] = static_cast<int8_t>(std::max(-127L, std::min(127L, code)));
+    }
+  }
+}
+
+template <typename DType>
+void EncodedMatrix<DType>::decode(size_t begin, size_t n, DType *out,
+    size_t stride) const {
+  const Wideners<DType> &widen = wideners<DType>();
+  const size_t d = cols_;
+  for (size_t i = begin; i < begin + n; ++i, out += stride) {
+    switch (encoding_) {
+      case Encoding::FLOAT16:
+        widen.f16(&halves_[i * d], d, out);
+        break;
+      case Encoding::BFLOAT16:
+        widen.bf16(&halves_[i * d], d, out);
+        break;
+      case Encoding::INT8:
+        widen.i8(&codes_[i * d], scale_.data(), offset_.data(), d, out);
+        break;
+    }
+  }
+}
+
+template <typename DType>
+Matrix<DType> EncodedMatrix<DType>::decode() const {
+  Matrix<DType> data(rows_, cols_, true);
+  if (rows_ > 0) {
+    decode(0, rows_, data.data(), data.stride());
+  }
+  return data;
+}
+
+template <typename DType>
+size_t EncodedMatrix<DType>::bytes() const {
+  return halves_.size() * sizeof(uint16_t) + codes_.size() +
+    (scale_.size() + offset_.size()) * sizeof(DType);
+}
+
+template class EncodedMatrix<float>;
+template class EncodedMatrix<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
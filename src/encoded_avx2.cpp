@@ -0,0 +1,156 @@
+// AVX2 + F16C wideners, built with -mavx2 -mf16c and only called after the
+// CPU has been checked for both (see encoded.cpp).
+#include "encoded_impl.h"
+
+#if defined(__AVX2__) && defined(__F16C__)
+#include <immintrin.h>
+#include <cstring>
+
+namespace cluster {
+namespace {
+
+// Widen 8 values at a time; the tail goes through a zero-filled buffer, so
+// there is one code path per encoding.
+template <typename Widen8>
+void widen_rows(size_t n, Widen8 widen8) {
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    widen8(j, 8);
+  }
+  if (j < n) {
+    widen8(j, n - j);
+  }
+}
+
+__m256 f16x8(const uint16_t *x, size_t m) {
+  if (m == 8) {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+  }
+  uint16_t tail[8] = {0};
+  std::memcpy(tail, x, m * sizeof(uint16_t));
+  return _mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+}
+
+__m256 bf16x8(const uint16_t *x, size_t m) {
+  uint16_t tail[8] = {0};
+  if (m < 8) {
+    std::memcpy(tail, x, m * sizeof(uint16_t));
+    x = tail;
+  }
+  __m256i wide = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+
+__m256 i8x8(const int8_t *x, size_t m) {
+  int8_t tail[8] = {0};
+  if (m < 8) {
+    std::memcpy(tail, x, m);
+    x = tail;
+  }
+  return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x))));
+}
+
+void store(float *out, __m256 v, size_t m) {
+  if (m == 8) {
+    _mm256_storeu_ps(out, v);
+    return;
+  }
+  float tail[8];
+  _mm256_storeu_ps(tail, v);
+  std::memcpy(out, tail, m * sizeof(float));
+}
+
+void store(double *out, __m256 v, size_t m) {
+  double wide[8];
+  _mm256_storeu_pd(wide, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+  _mm256_storeu_pd(wide + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+  std::memcpy(out, wide, m * sizeof(double));
+}
+
+template <typename DType>
+void widen_f16(const uint16_t *x, size_t n, DType *out) {
+  widen_rows(n, [&](size_t j, size_t m) {
+    store(out + j, f16x8(x + j, m), m);
+  });
+}
+
+template <typename DType>
+void widen_bf16(const uint16_t *x, size_t n, DType *out) {
+  widen_rows(n, [&](size_t j, size_t m) {
+    store(out + j, bf16x8(x + j, m), m);
+  });
+}
+
+// int8 codes are exact in float, the affine map runs in DType
+void widen_i8(const int8_t *x, const float *scale, const float *offset,
+    size_t n, float *out) {
+  widen_rows(n, [&](size_t j, size_t m) {
+    float codes[8];
+    _mm256_storeu_ps(codes, i8x8(x + j, m));
+    if (m < 8) {
+      for (size_t t = 0; t < m; ++t) {
+        const float scaled = scale[j + t] * codes[t];
+        out[j + t] = offset[j + t] + scaled;
+      }
+      return;
+    }
+    __m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(scale + j),
+                                  _mm256_loadu_ps(codes));
+    _mm256_storeu_ps(out + j, _mm256_add_ps(_mm256_loadu_ps(offset + j),
+                                            scaled));
+  });
+}
+
+void widen_i8(const int8_t *x, const double *scale, const double *offset,
+    size_t n, double *out) {
+  widen_rows(n, [&](size_t j, size_t m) {
+    double codes[8];
+    store(codes, i8x8(x + j, m), 8);
+    if (m < 8) {
+      for (size_t t = 0; t < m; ++t) {
+        const double scaled = scale[j + t] * codes[t];
+        out[j + t] = offset[j + t] + scaled;
+      }
+      return;
+    }
+    for (size_t h = 0; h < 8; h += 4) {
+      __m256d scaled = _mm256_mul_pd(_mm256_loadu_pd(scale + j + h),
+                                     _mm256_loadu_pd(codes + h));
+      _mm256_storeu_pd(out + j + h,
+                       _mm256_add_pd(_mm256_loadu_pd(offset + j + h), scaled));
+    }
+  });
+}
+
+}  // namespace
+
+bool avx2_wideners(Wideners<float> &wideners) {
+  wideners.f16 = widen_f16<float>;
+  wideners.bf16 = widen_bf16<float>;
+  wideners.i8 = widen_i8;
+  return true;
+}
+
+bool avx2_wideners(Wideners<double> &wideners) {
+  wideners.f16 = widen_f16<double>;
+  wideners.bf16 = widen_bf16<double>;
+  wideners.i8 = widen_i8;
+  return true;
+}
+
+}  // namespace cluster
+
+#else
+
+namespace cluster {
+bool avx2_wideners(Wideners<float> &) { return false; }
+bool avx2_wideners(Wideners<double> &) { return false; }
+}  // namespace cluster
+
+#endif
+
+// vim: ts=2 sts=2 sw=2
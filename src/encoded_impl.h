@@ -0,0 +1,31 @@
+#ifndef ENCODED_IMPL_H
+#define ENCODED_IMPL_H
+
+// Kernels widening encoded values back to DType, one table per instruction
+// set like the distance kernels. Every table gives bit-identical results:
+// FLOAT16 and BFLOAT16 widen exactly, and INT8 is a multiply and an add,
+// never fused.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cluster {
+
+template <typename DType>
+struct Wideners {
+  void (*f16)(const uint16_t *x, size_t n, DType *out);
+  void (*bf16)(const uint16_t *x, size_t n, DType *out);
+  // out[j] = offset[j] + scale[j] * x[j]
+  void (*i8)(const int8_t *x, const DType *scale, const DType *offset,
+             size_t n, DType *out);
+};
+
+// fill `wideners` with AVX2 + F16C code, return false if not compiled in
+bool avx2_wideners(Wideners<float> &wideners);
+bool avx2_wideners(Wideners<double> &wideners);
+
+}  // namespace cluster
+
+#endif  // ENCODED_IMPL_H
+
+// vim: ts=2 sts=2 sw=2
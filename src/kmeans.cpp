@@ -1,70 +1,374 @@
 #include "kmeans.h"
+#include "topology.h"
 #include <omp.h>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <iterator>
 #include <algorithm>
 #include <sstream>
 #include <limits>
 #include <set>
 #include <random>
+#include <cstdio>
+#include <memory>
+#include <numeric>
 
 LogLevel log_level = INFO;
 namespace cluster {
 
-const char* init_methods[3] = {"random", "k-means++", "k-means||"};
+const char* init_methods[4] = {"random", "k-means++", "k-means||",
+                               "greedy k-means++"};
+
+template <typename DType>
+const size_t Kmeans<DType>::kDefaultChunkSize;
+
+namespace {
+
+// weight of the newest step in the smoothed center movement, which averages
+// out batch noise over roughly the last ten steps
+const double kSmoothing = 0.1;
+
+// Seeding splits the samples into this many blocks whatever the number of
+// threads, so partial sums, and the samples they select, do not depend on it.
+const int kSeedBlocks = 64;
+
+// Deterministic Lloyd passes sum samples in this many fixed slices, while
+// their k * d sums take at most kSliceBudget doubles (32 MB) in total.
+const int kSlices = 64;
+const size_t kSliceBudget = size_t(1) << 22;
+
+// random streams of CounterRng, one per kind of draw; k-means|| round r
+// uses kParallelStream + r
+enum : uint64_t {
+  kRandomStream = 1,
+  kPlusPlusStream,
+  kHoldoutStream,
+  kBatchStream,
+  kSeedSampleStream,
+  kParallelStream = 1024
+};
+
+// The const predict paths go parallel only for batches of at least this many
+// point-center coordinate products (n * k * d), some 50-100 us of work on
+// one core; below it starting a team costs more than it saves.
+const size_t kParallelPredictWork = size_t(1) << 20;
+
+// centers whose distances predict_top() computes at a time, on the stack
+const size_t kTopBlock = 256;
+
+template <typename T>
+size_t bytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+template <typename T>
+size_t bytes(const Matrix<T> &m) {
+  return m.rows() * m.stride() * sizeof(T);
+}
+
+// scratch of the calling thread for the const predict paths, so that they
+// are allocation free once a thread has warmed up
+template <typename DType>
+std::vector<DType>& thread_workspace() {
+  static thread_local std::vector<DType> workspace;
+  return workspace;
+}
+
+// Random mini-batches drawn with replacement from the rows of an in-memory
+// matrix that are not held out; a pass ends after rows / batch draws.
+template <typename DType>
+class SampleReader : public BatchReader<DType> {
+  public:
+    SampleReader(const Matrix<DType> &data, const std::vector<bool> &held_out,
+                 size_t rows, size_t batch_size, int n_thread, uint64_t seed) :
+      data_(data), held_out_(held_out), gen_(seed), dis_(0, data.rows() - 1),
+      draws_(0), n_thread_(n_thread) {
+      draws_per_pass_ = (rows + batch_size - 1) / batch_size;
+    }
+
+    Status read(size_t max_rows, Matrix<DType> &batch) override {
+      if (draws_ == draws_per_pass_) {
+        batch.resize(0, data_.cols());
+        return Status::OK;
+      }
+      ++draws_;
+      indices_.resize(max_rows);
+      for (auto &index : indices_) {
+        do {
+          index = dis_(gen_);
+        } while (held_out_[index]);
+      }
+      if (batch.rows() != max_rows || batch.cols() != data_.cols()) {
+        batch.resize(max_rows, data_.cols());
+      }
+      const size_t d = data_.cols();
+#pragma omp parallel for num_threads(n_thread_) if (n_thread_ > 1)
+      for (size_t i = 0; i < max_rows; ++i) {
+        std::copy(data_.row(indices_[i]), data_.row(indices_[i]) + d,
+                  batch.row(i));
+      }
+      return Status::OK;
+    }
+
+    Status rewind() override {
+      draws_ = 0;
+      return Status::OK;
+    }
+
+  private:
+    const Matrix<DType> &data_;
+    const std::vector<bool> &held_out_;
+    std::mt19937_64 gen_;
+    std::uniform_int_distribution<size_t> dis_;
+    std::vector<size_t> indices_;
+    size_t draws_;
+    size_t draws_per_pass_;
+    int n_thread_;
+};  // class SampleReader
+
+template <size_t D, typename DType>
+inline void add_fixed(double *sum, const DType *x) {
+  for (size_t j = 0; j < D; ++j) {
+    sum[j] += x[j];
+  }
+}
+
+// sum[0..d) += x[0..d), unrolled for the dimensions the distance kernels are
+// specialized for; d is loop invariant at every call, so the switch predicts
+template <typename DType>
+inline void add_row(double *sum, const DType *x, size_t d) {
+  switch (d) {
+    case 2:  add_fixed<2>(sum, x); return;
+    case 3:  add_fixed<3>(sum, x); return;
+    case 4:  add_fixed<4>(sum, x); return;
+    case 8:  add_fixed<8>(sum, x); return;
+    case 16: add_fixed<16>(sum, x); return;
+    case 32: add_fixed<32>(sum, x); return;
+  }
+  for (size_t j = 0; j < d; ++j) {
+    sum[j] += x[j];
+  }
+}
+
+// sum[0..d) += scale * x[0..d), to add samples of spherical passes as unit
+// vectors without normalizing them, and samples of weighted fits
+template <typename DType>
+inline void add_scaled(double *sum, const DType *x, size_t d, double scale) {
+  for (size_t j = 0; j < d; ++j) {
+    sum[j] += scale * x[j];
+  }
+}
+
+// sum[indices] += scale * values for the nonzeros of sparse row i
+template <typename DType>
+inline void add_sparse(double *sum, const SparseMatrix<DType> &data,
+    size_t i, double scale) {
+  const uint32_t *indices = data.row_indices(i);
+  const DType *values = data.row_values(i);
+  for (size_t t = 0, nnz = data.row_nnz(i); t < nnz; ++t) {
+    sum[indices[t]] += scale * values[t];
+  }
+}
+
+// sum of the per-dimension variances of the rows of data
+template <typename DType>
+DType total_variance(const Matrix<DType> &data) {
+  const size_t n = data.rows(), d = data.cols();
+  std::vector<double> mean(d), sq(d);
+  for (size_t i = 0; i < n; ++i) {
+    const DType *sample = data.row(i);
+    for (size_t j = 0; j < d; ++j) {
+      mean[j] += sample[j];
+      sq[j] += static_cast<double>(sample[j]) * sample[j];
+    }
+  }
+  double variance = 0.0;
+  for (size_t j = 0; j < d; ++j) {
+    mean[j] /= n;
+    variance += sq[j] / n - mean[j] * mean[j];
+  }
+  return static_cast<DType>(std::max(variance, 0.0));
+}
+
+// one finite, non-negative weight per sample
+inline Status check_weights(const std::vector<double> &weights, size_t n) {
+  if (weights.size() != n) {
+    LOG(ERROR) << weights.size() << " weights for " << n << " samples";
+    return Status::DIM_ERROR;
+  }
+  for (auto weight : weights) {
+    if (!(weight >= 0) || !std::isfinite(weight)) {
+      LOG(ERROR) << "sample weight " << weight
+        << " is not finite and non-negative";
+      return Status::DIM_ERROR;
+    }
+  }
+  return Status::OK;
+}
+
+// The first row at which the running sum of weights passes cutoff, for a
+// cutoff below their total; rows of weight 0 are never picked.
+inline size_t weighted_row(const double *weights, size_t n, double cutoff) {
+  size_t last = n;
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    if (weights[i] > 0) {
+      last = i;
+      sum += weights[i];
+      if (sum > cutoff) {
+        return i;
+      }
+    }
+  }
+  // rounding left the cutoff just past the sum
+  return last;
+}
+
+// Counting sort of the n samples by label: the members of center j are
+// order[start[j], start[j + 1]), in row order.
+inline void bucket_by_label(const int *labels, size_t n, size_t k,
+                            std::vector<size_t> &order,
+                            std::vector<size_t> &start) {
+  start.assign(k + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    ++start[labels[i] + 1];
+  }
+  for (size_t j = 0; j < k; ++j) {
+    start[j + 1] += start[j];
+  }
+  order.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[start[labels[i]]++] = i;
+  }
+  for (size_t j = k; j > 0; --j) {
+    start[j] = start[j - 1];
+  }
+  start[0] = 0;
+}
+
+// Adds the rows of data labeled j to sums + j * sum_stride, each times
+// weights[row] and inv_norms[row] if given, and their weights, 1 each
+// without, to counts[j]. Rows are bucketed
+// by label first and each center sums its members in row order on one
+// thread, so the result is the same for any number of threads. Every thread
+// of the enclosing team calls it.
+template <typename DType>
+void ordered_sums(const SampleBlocks<DType> &data, const int *labels, size_t k,
+                  const DType *inv_norms, const double *weights,
+                  std::vector<size_t> &order, std::vector<size_t> &start,
+                  double *sums, size_t sum_stride, double *counts) {
+  const size_t n = data.rows(), d = data.cols();
+#pragma omp single
+  bucket_by_label(labels, n, k, order, start);
+
+  std::vector<DType> tile;
+#pragma omp for schedule(dynamic, 16)
+  for (size_t j = 0; j < k; ++j) {
+    double *sum = sums + j * sum_stride;
+    double count = 0.0;
+    for (size_t m = start[j]; m < start[j + 1]; ++m) {
+      const DType *sample = data.block(order[m], 1, tile);
+      const double weight = weights != nullptr ? weights[order[m]] : 1.0;
+      if (inv_norms == nullptr && weights == nullptr) {
+        add_row(sum, sample, d);
+      } else {
+        add_scaled(sum, sample, d, weight *
+                   (inv_norms != nullptr ? inv_norms[order[m]] : 1.0));
+      }
+      count += weight;
+    }
+    counts[j] += count;
+  }
+}
+
+}  // namespace
 
 template <typename DType>
 Kmeans<DType>::Kmeans(int n_cluster, int n_thread, int n_iter, float threshold,
     InitMethod init) :
   n_cluster_(n_cluster), n_thread_(n_thread), n_iter_(n_iter),
   threshold_(threshold), init_(init), kmeans_parallel_l_(2 * n_cluster),
-  kmeans_parallel_r_(2), num_reassigned_(0) {
+  kmeans_parallel_r_(2), assign_(AssignMethod::AUTO), metric_(Metric::L2),
+  algorithm_(Algorithm::LLOYD), bounded_(false), index_probes_(0), info_(),
+  weights_(nullptr), profiling_(false), fit_start_(0), minibatch_size_(0),
+  holdout_size_(10000), holdout_cost_(0), chunk_size_(kDefaultChunkSize),
+  seed_(0),
+  fixed_seed_(false), deterministic_(false), sliced_(false), numa_(false),
+  placing_(false), n_node_(1),
+  kernels_(&distance_kernels<DType>()) {
 }
 
 template <typename DType>
-std::vector<DType> Kmeans<DType>::parse_sample_from_string(std::string line) {
-  std::vector<DType> sample;
-  std::istringstream coordinates(line);
-  std::copy(std::istream_iterator<DType>(coordinates),
-      std::istream_iterator<DType>(),
-      std::back_inserter(sample));
-  return sample;
+void Kmeans<DType>::draw_seed() {
+  if (!fixed_seed_) {
+    std::random_device rd;
+    seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  LOG(DEBUG) << "random seed " << seed_;
 }
 
 template <typename DType>
 Status Kmeans<DType>::load_data(const char *filename,
-                                std::vector<std::vector<DType>> &data) {
-  std::ifstream fin(filename);
-  if (!fin) {
-    LOG(ERROR) << "unable to open file \"" << filename << "\" to read";
-    return Status::IO_ERROR;
+    Matrix<DType> &data) const {
+  if (is_dataset(filename)) {
+    // binary datasets are used in place
+    return map_dataset(filename, data);
   }
+  return parse_text_file(filename, data, n_thread_);
+}
 
-  data.clear();
+template <typename DType>
+void Kmeans<DType>::set_info(size_t n_samples, int n_iter, double cost) {
+  info_.n_samples = n_samples;
+  info_.n_iter = static_cast<uint32_t>(n_iter);
+  info_.init = static_cast<uint32_t>(init_);
+  info_.cost = cost;
+  info_.metric = static_cast<uint32_t>(metric_);
+  stats_.fit_s = now() - fit_start_;
+  update_norms();
+}
 
-  std::string line;
-  while (std::getline(fin, line)) {
-    auto sample = parse_sample_from_string(line);
-    data.push_back(sample);
-  }
+template <typename DType>
+double Kmeans<DType>::now() const {
+  return profiling_ ? omp_get_wtime() : 0.0;
+}
 
-  return Status::OK;
-}  // load_data
+template <typename DType>
+void Kmeans<DType>::start_fit() {
+  center_norms_.clear();
+  index_.clear();
+  draw_seed();
+  stats_ = Stats();
+  stats_.profiled = profiling_;
+  predict_counters_.reset();
+  fit_start_ = now();
+}
 
 template <typename DType>
-Status Kmeans<DType>::save_model(const char *model_path) {
+Status Kmeans<DType>::save_model(const char *model_path, ModelFormat format) {
+  if (format == ModelFormat::BINARY) {
+    std::vector<DType> norms(centers_.rows());
+    for (size_t i = 0; i < centers_.rows(); ++i) {
+      norms[i] = kernels_->dot(centers_.row(i), centers_.row(i),
+                               centers_.cols());
+    }
+    return write_model(model_path, centers_, norms.data(), info_);
+  }
+
   std::ofstream fout(model_path);
   if (!fout) {
     LOG(ERROR) << "unable to open file \"" << model_path << "\" to write";
     return Status::IO_ERROR;
   }
 
-  for (auto const &center : centers_) {
-    for (auto value : center) {
-      fout << value << ' ';
+  // enough digits to read back the same values
+  fout.precision(std::numeric_limits<DType>::max_digits10);
+  for (size_t i = 0; i < centers_.rows(); ++i) {
+    const DType *center = centers_.row(i);
+    for (size_t j = 0; j < centers_.cols(); ++j) {
+      fout << center[j] << ' ';
     }
     fout << std::endl;
   }
@@ -74,7 +378,28 @@ Status Kmeans<DType>::save_model(const char *model_path) {
 
 template <typename DType>
 Status Kmeans<DType>::load_model(const char *model_path) {
-  return load_data(model_path, centers_);
+  index_.clear();
+  if (is_model(model_path)) {
+    auto ret = map_model(model_path, centers_, center_norms_, info_);
+    kernels_ = &distance_kernels<DType>(centers_.cols());
+    if (ret != Status::OK) {
+      return ret;
+    }
+    metric_ = info_.metric == static_cast<uint32_t>(Metric::COSINE) ?
+      Metric::COSINE : Metric::L2;
+    LOG(INFO) << "set metric to " << metrics[static_cast<int>(metric_)];
+    // the mapping is private, so unit rows can be written in place
+    if (metric_ == Metric::COSINE) {
+      install_centers();
+    }
+    return Status::OK;
+  }
+  Matrix<DType> centers;
+  auto ret = load_data(model_path, centers);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  return set_centers(centers);
 }
 
 template <typename DType>
@@ -94,109 +419,480 @@ Status Kmeans<DType>::save_labels(const char *label_path) {
 }
 
 template <typename DType>
-Status Kmeans<DType>::dist(std::vector<DType> &p, std::vector<DType> &q, DType &d) {
-  d = 0;
-  if (p.size() != q.size()) {
+Status Kmeans<DType>::build_index(size_t n_list, size_t n_probe) {
+  if (centers_.empty()) {
+    LOG(ERROR) << "no centers to index";
+    return Status::DIM_ERROR;
+  }
+  index_.build(centers_, n_list, n_thread_);
+  index_probes_ = n_probe;
+  LOG(INFO) << "indexed " << centers_.rows() << " centers in "
+    << index_.num_lists() << " lists, probes = " << n_probe;
+  return Status::OK;
+}
+
+template <typename DType>
+void Kmeans<DType>::update_norms() {
+  kernels_ = &distance_kernels<DType>(centers_.cols());
+  center_norms_.resize(centers_.rows());
+  for (size_t i = 0; i < centers_.rows(); ++i) {
+    center_norms_[i] = kernels_->dot(centers_.row(i), centers_.row(i),
+                                     centers_.cols());
+  }
+}
+
+template <typename DType>
+void Kmeans<DType>::install_centers() {
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(centers_.data(), centers_.rows(), centers_.cols(),
+                   centers_.stride());
+  }
+  update_norms();
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict(const DType *data_point,
+    DType &min_dist, int &label) const {
+  if (centers_.empty()) {
     return Status::DIM_ERROR;
   }
-  for (size_t i = 0; i < p.size(); ++i) {
-    d += (p[i] - q[i])*(p[i] - q[i]);
+  const double start = now();
+  if (metric_ == Metric::COSINE) {
+    label = nearest_cosine(data_point, &min_dist);
+    min_dist = 1 - min_dist;
+  } else if (!index_.empty()) {
+    label = index_.search(data_point, index_probes_, &min_dist,
+                          thread_workspace<DType>());
+  } else {
+    label = kernels_->nearest(data_point, centers_.data(), centers_.rows(),
+                              centers_.stride(), centers_.cols(), &min_dist);
+  }
+  if (profiling_) {
+    predict_counters_.add(1, now() - start);
   }
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::predict(std::vector<DType> &data_point,
-    DType &min_dist, int &label) {
-  if (data_point.size() != centers_[0].size()) {
+Status Kmeans<DType>::predict(const std::vector<DType> &data_point,
+    DType &min_dist, int &label) const {
+  if (centers_.empty() || data_point.size() != centers_.cols()) {
     return Status::DIM_ERROR;
   }
+  return predict(data_point.data(), min_dist, label);
+}
 
-  label = -1;
-  DType cur_dist;
-  min_dist = std::numeric_limits<DType>::max();
-  for (size_t i = 0; i < centers_.size(); ++i) {
-    auto ret = dist(data_point, centers_[i], cur_dist);
-    if (ret != Status::OK) {
-      return ret;
+template <typename DType>
+void Kmeans<DType>::predict_block(const Assigner<DType> &assigner,
+    const DType *x, size_t n, size_t stride, int *labels,
+    DType *min_dists) const {
+  DType dists[Assigner<DType>::kBlockPoints];
+  if (min_dists == nullptr) {
+    min_dists = dists;
+  }
+  std::vector<DType> &workspace = thread_workspace<DType>();
+  if (index_.empty()) {
+    assigner.assign(x, n, stride, labels, min_dists, workspace);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    labels[i] = metric_ == Metric::COSINE ?
+      nearest_cosine(x + i * stride, &min_dists[i]) :
+      index_.search(x + i * stride, index_probes_, &min_dists[i], workspace);
+  }
+}
+
+template <typename DType>
+void Kmeans<DType>::cosine_dists(const DType *x, size_t j0, size_t nj,
+    DType *out) const {
+  const size_t d = centers_.cols();
+  kernels_->dot_block(x, 1, d, centers_.row(j0), nj, centers_.stride(), d,
+                      out, nj);
+  const DType norm = std::sqrt(kernels_->dot(x, x, d));
+  for (size_t j = 0; j < nj; ++j) {
+    out[j] = norm > 0 ? std::max(1 - out[j] / norm, static_cast<DType>(0)) :
+                        static_cast<DType>(1);
+  }
+}
+
+template <typename DType>
+int Kmeans<DType>::nearest_cosine(const DType *x, DType *min_dist) const {
+  const size_t k = centers_.rows(), d = centers_.cols();
+  if (!index_.empty()) {
+    // the index holds unit centers, and for unit x ||x - c||^2 = 2 (1 - cos)
+    static thread_local std::vector<DType> unit;
+    unit.assign(x, x + d);
+    normalize_rows(unit.data(), 1, d, d);
+    const int label = index_.search(unit.data(), index_probes_, min_dist,
+                                    thread_workspace<DType>());
+    *min_dist = kernels_->dot(unit.data(), unit.data(), d) > 0 ?
+      *min_dist / 2 : static_cast<DType>(1);
+    return label;
+  }
+  DType dists[kTopBlock];
+  DType best = std::numeric_limits<DType>::max();
+  int label = 0;
+  for (size_t j0 = 0; j0 < k; j0 += kTopBlock) {
+    const size_t nj = std::min(kTopBlock, k - j0);
+    cosine_dists(x, j0, nj, dists);
+    for (size_t j = 0; j < nj; ++j) {
+      if (dists[j] < best) {
+        best = dists[j];
+        label = static_cast<int>(j0 + j);
+      }
+    }
+  }
+  *min_dist = best;
+  return label;
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict(const DType *x, size_t n, size_t stride,
+    int *labels, DType *min_dists) const {
+  if (centers_.empty()) {
+    return Status::DIM_ERROR;
+  }
+  const double start = now();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  Assigner<DType> assigner;
+  assigner.prepare(centers_, assign_, center_norms_.empty() ? nullptr :
+                                      center_norms_.data(), metric_);
+  if (n_thread_ <= 1 || n <= block ||
+      n * centers_.rows() * centers_.cols() < kParallelPredictWork) {
+    for (size_t b = 0; b < n; b += block) {
+      predict_block(assigner, x + b * stride, std::min(block, n - b), stride,
+                    labels + b, min_dists != nullptr ? min_dists + b : nullptr);
+    }
+  } else {
+#pragma omp parallel for num_threads(n_thread_) schedule(dynamic)
+    for (size_t b = 0; b < n; b += block) {
+      predict_block(assigner, x + b * stride, std::min(block, n - b), stride,
+                    labels + b, min_dists != nullptr ? min_dists + b : nullptr);
     }
-    if (cur_dist < min_dist) {
-      label = static_cast<int>(i);
-      min_dist = cur_dist;
+  }
+  if (metric_ == Metric::COSINE && min_dists != nullptr) {
+    for (size_t i = 0; i < n; ++i) {
+      min_dists[i] = 1 - min_dists[i];
     }
   }
+  if (profiling_) {
+    predict_counters_.add(n, now() - start);
+  }
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::predict(std::vector<std::vector<DType>> &data_points,
-    std::vector<int> &labels) {
-  labels.clear();
-  if (n_thread_ > 1) {
-    LOG(DEBUG) << "parallel predicting using " << n_thread_ << " threads";
-    Status ret = Status::OK;
-    labels.resize(data_points.size());
-#pragma omp parallel num_threads(n_thread_)
-    {
-#pragma omp for
-      for (size_t i = 0; i < data_points.size(); ++i) {
-        int label;
-        DType min_dist;
-        auto r = predict(data_points[i], min_dist, label);
-        if (r != Status::OK) {
-          ret = r;
-          LOG(ERROR) << "data point " << i << " has inconsistent dimension";
+Status Kmeans<DType>::predict_top(const DType *x, size_t n, size_t stride,
+    size_t top, int *labels, DType *dists) const {
+  const size_t k = centers_.rows(), d = centers_.cols();
+  if (top == 0 || top > k) {
+    return Status::DIM_ERROR;
+  }
+  auto nearest = [&](size_t i) {
+    // insertion into the sorted top list, ties keep the lower index first
+    int *top_labels = labels + i * top;
+    DType *top_dists = dists + i * top;
+    std::fill(top_dists, top_dists + top, std::numeric_limits<DType>::max());
+    std::fill(top_labels, top_labels + top, -1);
+    DType block_dists[kTopBlock];
+    for (size_t j0 = 0; j0 < k; j0 += kTopBlock) {
+      const size_t nj = std::min(kTopBlock, k - j0);
+      if (metric_ == Metric::COSINE) {
+        cosine_dists(x + i * stride, j0, nj, block_dists);
+      } else {
+        kernels_->sqdist_1xk(x + i * stride, centers_.row(j0), nj,
+                             centers_.stride(), d, block_dists);
+      }
+      for (size_t j = 0; j < nj; ++j) {
+        const DType dist = block_dists[j];
+        if (dist >= top_dists[top - 1]) {
+          continue;
         }
-        labels[i] = label;
+        size_t pos = top - 1;
+        for (; pos > 0 && top_dists[pos - 1] > dist; --pos) {
+          top_dists[pos] = top_dists[pos - 1];
+          top_labels[pos] = top_labels[pos - 1];
+        }
+        top_dists[pos] = dist;
+        top_labels[pos] = static_cast<int>(j0 + j);
       }
     }
-    if (ret != Status::OK) {
-      return ret;
+    for (size_t t = 0; metric_ == Metric::COSINE && t < top; ++t) {
+      top_dists[t] = 1 - top_dists[t];
+    }
+  };
+  const double start = now();
+  if (n_thread_ <= 1 || n <= Assigner<DType>::kBlockPoints ||
+      n * k * d < kParallelPredictWork) {
+    for (size_t i = 0; i < n; ++i) {
+      nearest(i);
     }
   } else {
-    for (auto &data_point : data_points) {
-      int label;
-      DType min_dist;
-      auto ret = predict(data_point, min_dist, label);
-      if (ret != Status::OK) {
-        return ret;
+#pragma omp parallel for num_threads(n_thread_) schedule(dynamic, 16)
+    for (size_t i = 0; i < n; ++i) {
+      nearest(i);
+    }
+  }
+  if (profiling_) {
+    predict_counters_.add(n, now() - start);
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict(const Matrix<DType> &data_points,
+    std::vector<int> &labels) const {
+  if (centers_.empty() || data_points.cols() != centers_.cols()) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  labels.resize(data_points.rows());
+  return predict(data_points.data(), data_points.rows(), data_points.stride(),
+                 labels.data());
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict(const EncodedMatrix<DType> &data_points,
+    std::vector<int> &labels) const {
+  if (centers_.empty() || data_points.cols() != centers_.cols()) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  const size_t n = data_points.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  const SampleBlocks<DType> samples(data_points);
+  labels.resize(n);
+  const double start = now();
+  Assigner<DType> assigner;
+  assigner.prepare(centers_, assign_, center_norms_.empty() ? nullptr :
+                                      center_norms_.data(), metric_);
+#pragma omp parallel num_threads(n_thread_) \
+  if (n_thread_ > 1 && n * centers_.rows() * centers_.cols() >= \
+      kParallelPredictWork)
+  {
+    std::vector<DType> tile;
+#pragma omp for schedule(dynamic)
+    for (size_t b = 0; b < n; b += block) {
+      const size_t nb = std::min(block, n - b);
+      predict_block(assigner, samples.block(b, nb, tile), nb,
+                    samples.stride(), &labels[b], nullptr);
+    }
+  }
+  if (profiling_) {
+    predict_counters_.add(n, now() - start);
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status Kmeans<DType>::cost(const Matrix<DType> &data, DType &cost) const {
+  return block_cost(data, cost);
+}
+
+template <typename DType>
+Status Kmeans<DType>::cost(const Matrix<DType> &data,
+    const std::vector<double> &weights, DType &cost) const {
+  auto ret = check_weights(weights, data.rows());
+  if (ret != Status::OK) {
+    return ret;
+  }
+  return block_cost(data, cost, weights.data());
+}
+
+template <typename DType>
+Status Kmeans<DType>::cost(const EncodedMatrix<DType> &data,
+    DType &cost) const {
+  return block_cost(data, cost);
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict(const SparseMatrix<DType> &data_points,
+    std::vector<int> &labels) const {
+  if (centers_.empty() || data_points.cols() != centers_.cols()) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  const double start = now();
+  SparseAssigner<DType> assigner;
+  assigner.prepare(centers_, center_norms_.empty() ? nullptr :
+                             center_norms_.data(), n_thread_, metric_);
+  labels.resize(data_points.rows());
+  sparse_assign(assigner, data_points, labels.data(), nullptr, nullptr);
+  if (profiling_) {
+    predict_counters_.add(data_points.rows(), now() - start);
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status Kmeans<DType>::cost(const SparseMatrix<DType> &data,
+    DType &cost) const {
+  if (centers_.empty() || data.cols() != centers_.cols()) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  const size_t block = Assigner<DType>::kBlockPoints;
+  SparseAssigner<DType> assigner;
+  assigner.prepare(centers_, center_norms_.empty() ? nullptr :
+                             center_norms_.data(), n_thread_, metric_);
+  std::vector<int> labels(data.rows());
+  std::vector<double> block_costs((data.rows() + block - 1) / block);
+  sparse_assign(assigner, data, labels.data(), nullptr, block_costs.data());
+  cost = static_cast<DType>(std::accumulate(block_costs.begin(),
+                                            block_costs.end(), 0.0));
+  return Status::OK;
+}
+
+template <typename DType>
+size_t Kmeans<DType>::sparse_assign(const SparseAssigner<DType> &assigner,
+    const SparseMatrix<DType> &data, int *labels, DType *min_dists,
+    double *block_costs) const {
+  const size_t n = data.rows(), block = Assigner<DType>::kBlockPoints;
+  size_t changed = 0;
+  // rows vary in nnz, blocks are handed out dynamically
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+  {
+    int block_labels[block];
+    DType block_dists[block];
+    std::vector<DType> &workspace = thread_workspace<DType>();
+#pragma omp for schedule(dynamic) reduction(+:changed)
+    for (size_t b = 0; b < n; b += block) {
+      const size_t m = std::min(block, n - b);
+      DType *dists = min_dists != nullptr ? min_dists + b : block_dists;
+      assigner.assign(data, b, m, block_labels, dists, workspace);
+      double cost = 0.0;
+      for (size_t t = 0; t < m; ++t) {
+        cost += dists[t];
+        if (block_labels[t] != labels[b + t]) {
+          ++changed;
+          labels[b + t] = block_labels[t];
+        }
+      }
+      if (block_costs != nullptr) {
+        block_costs[b / block] = cost;
+      }
+    }
+  }
+  return changed;
+}
+
+template <typename DType>
+Status Kmeans<DType>::block_cost(const SampleBlocks<DType> &data,
+    DType &cost, const double *weights) const {
+  if (centers_.empty() || data.cols() != centers_.cols()) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  const size_t n = data.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  Assigner<DType> assigner;
+  assigner.prepare(centers_, assign_, center_norms_.empty() ? nullptr :
+                                      center_norms_.data(), metric_);
+  DType total_cost = 0.0;
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+  {
+    int labels[block];
+    DType min_dists[block];
+    std::vector<DType> workspace, tile;
+#pragma omp for reduction(+:total_cost)
+    for (size_t b = 0; b < n; b += block) {
+      const size_t nb = std::min(block, n - b);
+      assigner.assign(data.block(b, nb, tile), nb, data.stride(), labels,
+                      min_dists, workspace);
+      for (size_t i = 0; i < nb; ++i) {
+        total_cost += weights != nullptr ? weights[b + i] * min_dists[i] :
+                                           min_dists[i];
       }
-      labels.push_back(label);
     }
   }
+  cost = total_cost;
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::init(std::vector<std::vector<DType>> &data) {
-  // allocate memory for variables
-  thread_center_ids_.resize(n_thread_);
-  thread_centers_.resize(n_thread_);
+Status Kmeans<DType>::predict(const char *input_file,
+    std::vector<int> &labels) const {
+  Matrix<DType> data_points;
+  auto ret = load_data(input_file, data_points);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  return predict(data_points, labels);
+}
+
+template <typename DType>
+Status Kmeans<DType>::predict_libsvm(const char *input_file,
+    std::vector<int> &labels, bool zero_based) const {
+  if (centers_.empty()) {
+    LOG(ERROR) << "no centers to predict with";
+    return Status::DIM_ERROR;
+  }
+  SparseMatrix<DType> data_points;
+  auto ret = parse_libsvm_file(input_file, data_points, n_thread_,
+                               centers_.cols(), zero_based);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  return predict(data_points, labels);
+}
 
-  centers_.resize(n_cluster_);
-  center_ids_.resize(n_cluster_);
+template <typename DType>
+Status Kmeans<DType>::predict(
+    const std::vector<std::vector<DType>> &data_points,
+    std::vector<int> &labels) const {
+  Matrix<DType> points;
+  auto ret = Matrix<DType>::from_vectors(data_points, points);
+  if (ret != Status::OK) {
+    LOG(ERROR) << "data points have inconsistent dimension";
+    return ret;
+  }
+  return predict(points, labels);
+}
 
+template <typename DType>
+void Kmeans<DType>::allocate(size_t n) {
   // init labels to -1
-  labels_.resize(data.size());
+  labels_.resize(n);
   std::fill(labels_.begin(), labels_.end(), -1);
+  min_dists_.resize(n);
+  workspace_.resize(n_thread_);
+  tiles_.resize(n_thread_);
+}
+
+template <typename DType>
+Status Kmeans<DType>::init(const Matrix<DType> &data,
+    const double *weights) {
+  const size_t m = weights == nullptr ? data.rows() :
+    std::count_if(weights, weights + data.rows(),
+                  [](double weight) { return weight > 0; });
+  if (m < static_cast<size_t>(n_cluster_)) {
+    LOG(ERROR) << "cannot seed " << n_cluster_ << " clusters from " << m
+      << (weights == nullptr ? " samples" : " samples of positive weight");
+    return Status::DIM_ERROR;
+  }
+  centers_.resize(n_cluster_, data.cols(), true);
+  kernels_ = &distance_kernels<DType>(data.cols());
 
   // init centers
+  const double start = now();
   Status ret = Status::OK;
   switch (init_) {
     case InitMethod::RANDOM:
-      ret = random_init(data);
+      ret = random_init(data, weights);
       if (ret != Status::OK) {
         return ret;
       }
       break;
     case InitMethod::KMEANS_PLUSPLUS:
-      ret = kmeans_plusplus_init(data);
+    case InitMethod::GREEDY_KMEANS_PLUSPLUS:
+      ret = kmeans_plusplus_init(data,
+          init_ == InitMethod::GREEDY_KMEANS_PLUSPLUS, weights);
       if (ret != Status::OK) {
         return ret;
       }
       break;
     case InitMethod::KMEANS_PARALLEL:
-      ret = kmeans_parallel_init(data);
+      ret = kmeans_parallel_init(data, weights);
       if (ret != Status::OK) {
         return ret;
       }
@@ -204,307 +900,1678 @@ Status Kmeans<DType>::init(std::vector<std::vector<DType>> &data) {
     default:
       break;
   }
-  for (size_t i = 0; i < centers_.size(); ++i) {
+  for (size_t i = 0; i < centers_.rows(); ++i) {
     std::ostringstream ss;
     ss << "center[" << i << "]:";
-    for (auto v : centers_[i]) {
-      ss << ' '  << v;
+    for (size_t j = 0; j < centers_.cols(); ++j) {
+      ss << ' '  << centers_(i, j);
     }
     LOG(VERBOSE) << ss.str();
   }
+  stats_.init = init_methods[static_cast<int>(init_)];
+  stats_.init_s = now() - start;
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::random_init(std::vector<std::vector<DType>> &data) {
-  std::set<int> indices;
+Status Kmeans<DType>::seed_sample(const SampleBlocks<DType> &data,
+    const double *weights) {
+  // copy only the rows seeding looks at: one at random from each of m equal
+  // stripes, so ordered data is covered evenly
+  const size_t n = data.rows(), d = data.cols();
+  const size_t m = std::min(n, std::max(chunk_size_,
+      3 * static_cast<size_t>(n_cluster_)));
+  CounterRng rng(seed_);
+  Matrix<DType> sample(m, d, true);
+  std::vector<double> sample_weights(weights != nullptr ? m : 0);
+  std::vector<DType> tile;
+  for (size_t i = 0; i < m; ++i) {
+    const size_t begin = i * n / m, end = (i + 1) * n / m;
+    const size_t row = begin + rng.index(kSeedSampleStream, i, end - begin);
+    const DType *x = data.block(row, 1, tile);
+    std::copy(x, x + d, sample.row(i));
+    if (weights != nullptr) {
+      sample_weights[i] = weights[row];
+    }
+  }
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(sample.data(), m, d, sample.stride());
+  }
+  LOG(INFO) << "seeding centers from " << m << " samples...";
+  return init(sample, weights != nullptr ? sample_weights.data() : nullptr);
+}
 
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<> dis(0, data.size()-1);
+template <typename DType>
+void Kmeans<DType>::copy_centers(const Matrix<DType> &data,
+    const std::vector<size_t> &indices) {
+  copy_rows(data, indices, 0, centers_);
+}
 
-  centers_.clear();
+template <typename DType>
+Status Kmeans<DType>::random_init(const Matrix<DType> &data,
+    const double *weights) {
+  const size_t n = data.rows();
+  std::set<size_t> chosen;
+  std::vector<size_t> indices;
+  CounterRng rng(seed_);
 
-  for (int i = 0; i < n_cluster_; ++i) {
-    int index = dis(gen);
-    while (indices.find(index) != indices.end()) {
-      index = dis(gen);
+  // weighted draws search the running sums of the weights; rows of weight 0
+  // share their sum with the row before and are never found
+  std::vector<double> running;
+  if (weights != nullptr) {
+    running.resize(n);
+    std::partial_sum(weights, weights + n, running.begin());
+  }
+  for (uint64_t draw = 0; indices.size() < static_cast<size_t>(n_cluster_);
+       ++draw) {
+    size_t index;
+    if (weights == nullptr) {
+      index = rng.index(kRandomStream, draw, n);
+    } else {
+      index = std::upper_bound(running.begin(), running.end(),
+          rng.uniform(kRandomStream, draw) * running.back()) - running.begin();
+    }
+    if (index < n && chosen.insert(index).second) {
+      indices.push_back(index);
     }
-    indices.insert(index);
   }
 
-  for (auto index : indices) {
-    centers_.push_back(data[index]);
-  }
+  copy_centers(data, indices);
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::kmeans_plusplus_init(
-    std::vector<std::vector<DType>> &data) {
-  std::set<int> indices;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<DType> dis(0.0, 1.0);
+Status Kmeans<DType>::kmeans_plusplus_init(const Matrix<DType> &data,
+    bool greedy, const double *weights) {
+  const size_t n = data.rows();
+  const size_t k = static_cast<size_t>(n_cluster_);
+  // as in Arthur & Vassilvitskii's experiments
+  const size_t trials = greedy ? 2 + static_cast<size_t>(std::log(k)) : 1;
+  CounterRng rng(seed_);
+  uint64_t draw = 0;
 
-  centers_.clear();
-
-  // randomly sample first center
-  indices.insert(static_cast<int>(dis(gen) * data.size()));
-
-  std::vector<DType> dists(data.size());
+  // randomly sample first center, in proportion to the weights if any
+  size_t first = rng.index(kPlusPlusStream, draw++, n);
+  if (weights) {
+    double total = std::accumulate(weights, weights + n, 0.0);
+    first = weighted_row(weights, n,
+                         rng.uniform(kPlusPlusStream, draw++) * total);
+  }
+  std::vector<size_t> indices(1, first);
+  indices.reserve(k);
 
-  // sample rest n_cluster_ - 1 centers
-  for (int i = 1; i < n_cluster_; ++i) {
-    DType sum_dists = 0.0;
-    auto ret = Status::OK;
-#pragma omp parallel for num_threads(n_thread_) reduction(+:sum_dists)
-    for (int j = 0; j < static_cast<int>(data.size()); ++j) {
-      DType cur_dist = 0.0, min_dist = std::numeric_limits<DType>::max();
-      for (auto id : indices) {
-        auto status = dist(data[j], data[id], cur_dist);
-        if (status != Status::OK) {
-          ret = status;
+  // squared distance of every point to its closest center so far, and the
+  // weighted sums of them over contiguous blocks for sampling
+  std::vector<DType> min_dists(n, std::numeric_limits<DType>::max());
+  std::vector<double> block_sums(kSeedBlocks);
+  std::vector<size_t> candidates(trials);
+  std::vector<double> partial(kSeedBlocks * trials);
+  bool done = false;
+  // one team for all rounds, which only meets at barriers in between
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+  {
+    while (!done) {
+      update_min_dists(data, data.row(indices.back()), weights, min_dists,
+                       block_sums);
+#pragma omp single
+      {
+        double total = std::accumulate(block_sums.begin(), block_sums.end(),
+                                       0.0);
+        if (indices.size() == k) {
+          done = true;
+        } else if (!(total > 0)) {
+          // every point sits on a center, repeat the distinct ones
+          LOG(WARN) << "only " << indices.size() << " distinct samples for "
+            << k << " clusters, the remaining centers are duplicates";
+          const size_t distinct = indices.size();
+          while (indices.size() < k) {
+            indices.push_back(indices[indices.size() % distinct]);
+          }
+          done = true;
+        } else {
+          for (auto &candidate : candidates) {
+            candidate = sample_index(min_dists, weights, block_sums,
+                rng.uniform(kPlusPlusStream, draw++) * total);
+          }
+          if (trials == 1) {
+            indices.push_back(candidates[0]);
+            done = indices.size() == k;
+          }
         }
-        if (cur_dist < min_dist) {
-          min_dist = cur_dist;
+      }
+      if (!done && trials > 1) {
+        // greedy: keep the candidate that lowers the potential the most
+        potential(data, candidates, weights, min_dists, partial);
+#pragma omp single
+        {
+          std::vector<double> potentials(trials);
+          for (int b = 0; b < kSeedBlocks; ++b) {
+            for (size_t c = 0; c < trials; ++c) {
+              potentials[c] += partial[b * trials + c];
+            }
+          }
+          indices.push_back(candidates[std::min_element(potentials.begin(),
+              potentials.end()) - potentials.begin()]);
+          done = indices.size() == k;
         }
       }
-      sum_dists += min_dist;
-      dists[j] = min_dist;
-    }
-    if (ret != Status::OK) {
-      return ret;
     }
+  }
 
-    while (true) {
-      DType cutoff_dist = dis(gen) * sum_dists, cur_dist_sum = 0.0;
-      int j = 0;
-      for (j = 0; j < static_cast<int>(data.size()); ++j) {
-        cur_dist_sum += dists[j];
-        if (cur_dist_sum >= cutoff_dist) {
-          indices.insert(j);
-          break;
-        }
-      }
-      if (j < static_cast<int>(data.size())) {
-        break;
+  copy_centers(data, indices);
+  return Status::OK;
+}
+
+template <typename DType>
+void Kmeans<DType>::update_min_dists(const Matrix<DType> &data,
+    const DType *center, const double *weights, std::vector<DType> &min_dists,
+    std::vector<double> &block_sums) {
+  // split among the threads of the enclosing team
+  const size_t n = data.rows(), d = data.cols();
+  const int n_block = static_cast<int>(block_sums.size());
+#pragma omp for
+  for (int b = 0; b < n_block; ++b) {
+    double sum = 0.0;
+    for (size_t i = n * b / n_block; i < n * (b + 1) / n_block; ++i) {
+      DType dist = kernels_->sqdist(data.row(i), center, d);
+      if (dist < min_dists[i]) {
+        min_dists[i] = dist;
       }
+      sum += weights ? weights[i] * min_dists[i] : min_dists[i];
     }
+    block_sums[b] = sum;
   }
+}
 
-  for (auto index : indices) {
-    centers_.push_back(data[index]);
+template <typename DType>
+size_t Kmeans<DType>::sample_index(const std::vector<DType> &min_dists,
+    const double *weights, const std::vector<double> &block_sums,
+    double cutoff) {
+  // skip whole blocks, then scan the one holding the cutoff
+  const size_t n = min_dists.size(), n_block = block_sums.size();
+  size_t b = 0;
+  double sum = 0.0;
+  while (b + 1 < n_block && sum + block_sums[b] <= cutoff) {
+    sum += block_sums[b++];
   }
-
-  return Status::OK;
+  size_t last = n;
+  for (size_t i = n * b / n_block; i < n * (b + 1) / n_block; ++i) {
+    double weight = weights ? weights[i] * min_dists[i] : min_dists[i];
+    if (weight > 0) {
+      last = i;
+      sum += weight;
+      if (sum > cutoff) {
+        return i;
+      }
+    }
+  }
+  // rounding left the cutoff just past the sum; points on a center, with
+  // weight 0, are never picked
+  for (size_t i = n; last == n && i > 0; --i) {
+    if (min_dists[i - 1] > 0 && (!weights || weights[i - 1] > 0)) {
+      last = i - 1;
+    }
+  }
+  return last;
 }
 
 template <typename DType>
-Status Kmeans<DType>::kmeans_parallel_init(
-    std::vector<std::vector<DType>> &data) {
-  std::set<int> indices;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<DType> dis(0.0, 1.0);
-  std::vector<std::vector<DType>> candidate_centers;
+void Kmeans<DType>::potential(const Matrix<DType> &data,
+    const std::vector<size_t> &candidates, const double *weights,
+    const std::vector<DType> &min_dists, std::vector<double> &partial) {
+  // potentials of the candidates over each of kSeedBlocks fixed blocks,
+  // split among the threads of the enclosing team
+  const size_t n = data.rows(), d = data.cols(), m = candidates.size();
+#pragma omp for
+  for (int b = 0; b < kSeedBlocks; ++b) {
+    double *local = &partial[b * m];
+    std::fill(local, local + m, 0.0);
+    for (size_t i = n * b / kSeedBlocks; i < n * (b + 1) / kSeedBlocks; ++i) {
+      const double weight = weights ? weights[i] : 1.0;
+      for (size_t c = 0; c < m; ++c) {
+        DType dist = kernels_->sqdist(data.row(i), data.row(candidates[c]), d);
+        local[c] += weight * std::min(dist, min_dists[i]);
+      }
+    }
+  }
+}
 
-  // randomly sample first center
-  indices.insert(static_cast<int>(dis(gen) * data.size()));
+template <typename DType>
+Status Kmeans<DType>::kmeans_parallel_init(const Matrix<DType> &data,
+    const double *weights) {
+  const size_t n = data.rows(), d = data.cols();
+  const int n_block = kSeedBlocks;
+  CounterRng rng(seed_);
 
-  std::vector<DType> dists(data.size());
+  // randomly sample first center, in proportion to the weights if any
+  std::vector<size_t> indices(1, weights == nullptr ?
+      rng.index(kParallelStream, 0, n) :
+      weighted_row(weights, n, rng.uniform(kParallelStream, 0) *
+                   std::accumulate(weights, weights + n, 0.0)));
 
-  int num_pass = 0;
-  while (num_pass < kmeans_parallel_r_) {
-    DType sum_dists = 0.0;
-    auto ret = Status::OK;
-#pragma omp parallel for num_threads(n_thread_) reduction(+:sum_dists)
-    for (int j = 0; j < static_cast<int>(data.size()); ++j) {
-      DType cur_dist = 0.0, min_dist = std::numeric_limits<DType>::max();
-      for (auto id : indices) {
-        auto status = dist(data[j], data[id], cur_dist);
-        if (status != Status::OK) {
-          ret = status;
-        }
-        if (cur_dist < min_dist) {
-          min_dist = cur_dist;
+  // distance of every point to its closest candidate, and which one it is;
+  // each round only compares against the candidates it added
+  std::vector<DType> min_dists(n, std::numeric_limits<DType>::max());
+  std::vector<int> nearest(n, 0);
+  std::vector<double> block_sums(n_block);
+  std::vector<std::vector<size_t>> picked(n_block);
+  Matrix<DType> added;
+  size_t first_added = 0;
+  for (int round = 0; round <= kmeans_parallel_r_; ++round) {
+    copy_rows(data, indices, first_added, added);
+#pragma omp parallel for num_threads(n_thread_)
+    for (int b = 0; b < n_block; ++b) {
+      double sum = 0.0;
+      for (size_t i = n * b / n_block; i < n * (b + 1) / n_block; ++i) {
+        DType dist;
+        int c = kernels_->nearest(data.row(i), added.data(), added.rows(),
+                                  added.stride(), d, &dist);
+        if (dist < min_dists[i]) {
+          min_dists[i] = dist;
+          nearest[i] = static_cast<int>(first_added) + c;
         }
+        sum += weights != nullptr ? weights[i] * min_dists[i] : min_dists[i];
       }
-      sum_dists += min_dist;
-      dists[j] = min_dist;
+      block_sums[b] = sum;
     }
-    if (ret != Status::OK) {
-      return ret;
+    // the last update only settles the nearest candidate of each point
+    double total = std::accumulate(block_sums.begin(), block_sums.end(), 0.0);
+    if (round == kmeans_parallel_r_ || !(total > 0)) {
+      break;
     }
-    for (int j = 0; j < static_cast<int>(data.size()); ++j) {
-      DType prob = dis(gen);
-      if (prob < kmeans_parallel_l_ * dists[j] / sum_dists) {
-        indices.insert(j);
+
+    // keep each point with probability l * w(x) * d(x)^2 / total, drawn from
+    // the point's own random stream so the picks do not depend on the threads
+    const double scale = kmeans_parallel_l_ / total;
+#pragma omp parallel for num_threads(n_thread_)
+    for (int b = 0; b < n_block; ++b) {
+      picked[b].clear();
+      for (size_t i = n * b / n_block; i < n * (b + 1) / n_block; ++i) {
+        const double weight = weights != nullptr ? weights[i] : 1.0;
+        if (rng.uniform(kParallelStream + 1 + round, i) <
+            scale * weight * min_dists[i]) {
+          picked[b].push_back(i);
+        }
       }
     }
-    num_pass++;
+    first_added = indices.size();
+    for (auto &block : picked) {
+      indices.insert(indices.end(), block.begin(), block.end());
+    }
+    if (indices.size() == first_added) {
+      break;
+    }
+  }
+  if (indices.size() < static_cast<size_t>(n_cluster_)) {
+    LOG(WARN) << "k-means|| sampled only " << indices.size()
+      << " candidates, seeding with k-means++ instead";
+    return kmeans_plusplus_init(data, false, weights);
   }
 
-  // recluster sampled points into k clusters
-  for (auto index : indices) {
-    candidate_centers.push_back(data[index]);
+  // weight each candidate by the number, or total weight, of the points
+  // closest to it; added up in row order, so fractional weights give the
+  // same sums for any n_thread
+  const size_t m = indices.size();
+  std::vector<double> candidate_weights(m);
+  for (size_t i = 0; i < n; ++i) {
+    candidate_weights[nearest[i]] += weights != nullptr ? weights[i] : 1.0;
   }
-  kmeans_plusplus_init(candidate_centers);
-  fit(candidate_centers, true);
 
+  // recluster the weighted candidates into k clusters; there are few of
+  // them, so the greedy seeding is cheap
+  Matrix<DType> candidates;
+  copy_rows(data, indices, 0, candidates);
+  LOG(INFO) << "reclustering " << m << " k-means|| candidates";
+  kmeans_plusplus_init(candidates, true, candidate_weights.data());
+  weighted_lloyd(candidates, candidate_weights);
   return Status::OK;
 }
 
+template <typename DType>
+void Kmeans<DType>::copy_rows(const Matrix<DType> &data,
+    const std::vector<size_t> &indices, size_t begin, Matrix<DType> &out) {
+  out.resize(indices.size() - begin, data.cols(), true);
+  for (size_t i = begin; i < indices.size(); ++i) {
+    std::copy(data.row(indices[i]), data.row(indices[i]) + data.cols(),
+              out.row(i - begin));
+  }
+}
+
+template <typename DType>
+void Kmeans<DType>::weighted_lloyd(const Matrix<DType> &points,
+    const std::vector<double> &weights) {
+  // Lloyd on the rows of points, each counting weights[i] times, refining
+  // centers_ in place; labels_ and friends belong to the outer fit
+  const size_t m = points.rows(), d = points.cols(), k = centers_.rows();
+  std::vector<int> labels(m, -1);
+  Matrix<double> sums(k, d);
+  std::vector<double> counts(k);
+  for (int iter = 0; iter < n_iter_; ++iter) {
+    size_t changed = 0;
+#pragma omp parallel for num_threads(n_thread_) reduction(+:changed)
+    for (size_t i = 0; i < m; ++i) {
+      DType dist;
+      int label = kernels_->nearest(points.row(i), centers_.data(), k,
+                                    centers_.stride(), d, &dist);
+      if (label != labels[i]) {
+        labels[i] = label;
+        ++changed;
+      }
+    }
+    if (changed == 0) {
+      break;
+    }
+    std::fill(sums.data(), sums.data() + k * sums.stride(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0.0);
+    for (size_t i = 0; i < m; ++i) {
+      double *sum = sums.row(labels[i]);
+      const DType *point = points.row(i);
+      for (size_t j = 0; j < d; ++j) {
+        sum[j] += weights[i] * point[j];
+      }
+      counts[labels[i]] += weights[i];
+    }
+    // empty clusters keep their center
+    for (size_t c = 0; c < k; ++c) {
+      if (counts[c] > 0) {
+        for (size_t j = 0; j < d; ++j) {
+          centers_(c, j) = static_cast<DType>(sums(c, j) / counts[c]);
+        }
+      }
+    }
+  }
+}
+
 template <typename DType>
 Status Kmeans<DType>::fit(const char *input_file) {
-  std::vector<std::vector<DType>> data;
+  Matrix<DType> data;
   LOG(INFO) << "loading data from " << input_file;
+  const double start = now();
   auto ret = load_data(input_file, data);
   if (ret != Status::OK) {
     return ret;
   }
-  return fit(data);
+  const double load_s = now() - start;
+  ret = fit(data);
+  stats_.load_s = load_s;
+  return ret;
 }
 
 template <typename DType>
 Status Kmeans<DType>::fit(std::vector<std::vector<DType>> &data, bool seeded) {
-  LOG(INFO) << "fitting data with n=" << data.size()
-    << " d=" << data[0].size()
+  Matrix<DType> matrix;
+  auto ret = Matrix<DType>::from_vectors(data, matrix);
+  if (ret != Status::OK) {
+    LOG(ERROR) << "samples have inconsistent dimension";
+    return ret;
+  }
+  return fit(matrix, seeded);
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(const Matrix<DType> &data, bool seeded) {
+  return dense_fit(data, nullptr, seeded);
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(const Matrix<DType> &data,
+    const std::vector<double> &weights, bool seeded) {
+  auto ret = check_weights(weights, data.rows());
+  if (ret != Status::OK) {
+    return ret;
+  }
+  if (!data.empty() && !(std::accumulate(weights.begin(), weights.end(),
+                                         0.0) > 0)) {
+    LOG(ERROR) << "every sample has weight 0";
+    return Status::DIM_ERROR;
+  }
+  return dense_fit(data, weights.data(), seeded);
+}
+
+template <typename DType>
+Status Kmeans<DType>::dense_fit(const Matrix<DType> &data,
+    const double *weights, bool seeded) {
+  if (data.empty()) {
+    LOG(ERROR) << "no samples to fit";
+    return Status::DIM_ERROR;
+  }
+  start_fit();
+  LOG(INFO) << "fitting " << (weights != nullptr ? "weighted " : "")
+    << "data with n=" << data.rows()
+    << " d=" << data.cols()
+    << " k=" << n_cluster_;
+  if (minibatch_size_ > 0 && weights != nullptr) {
+    LOG(WARN) << "mini-batches are not drawn from weighted samples, "
+      << "running full passes";
+  } else if (minibatch_size_ > 0) {
+    // seed on a sample and train on the rest, except for the holdout
+    const size_t n = data.rows(), d = data.cols();
+    const size_t n_holdout = std::min(holdout_size_, n / 10);
+    std::vector<bool> held_out(n);
+    Matrix<DType> holdout(n_holdout, d);
+    CounterRng rng(seed_);
+    std::mt19937_64 gen(rng(kHoldoutStream, 0));
+    std::uniform_int_distribution<size_t> dis(0, n - 1);
+    for (size_t i = 0; i < n_holdout; ++i) {
+      size_t index = dis(gen);
+      while (held_out[index]) {
+        index = dis(gen);
+      }
+      held_out[index] = true;
+      std::copy(data.row(index), data.row(index) + d, holdout.row(i));
+    }
+    SampleReader<DType> reader(data, held_out, n - n_holdout, minibatch_size_,
+                               n_thread_, rng(kBatchStream, 0));
+    if (!seeded) {
+      LOG(INFO) << "seeding centers...";
+      Matrix<DType> sample;
+      reader.read(std::min(n - n_holdout, std::max(3 * minibatch_size_,
+          3 * static_cast<size_t>(n_cluster_))), sample);
+      if (metric_ == Metric::COSINE) {
+        normalize_rows(sample.data(), sample.rows(), d, sample.stride());
+      }
+      auto ret = init(sample);
+      if (ret != Status::OK) {
+        return ret;
+      }
+      // the seed draw does not count against the first epoch's batches
+      reader.rewind();
+    }
+    auto ret = minibatch_fit(reader, holdout, minibatch_size_, 0);
+    if (ret != Status::OK) {
+      return ret;
+    }
+    LOG(INFO) << "labeling samples...";
+    return predict(data, labels_);
+  }
+  if (!seeded) {
+    Status ret;
+    if (metric_ == Metric::COSINE) {
+      ret = seed_sample(data, weights);
+    } else {
+      LOG(INFO) << "seeding centers...";
+      ret = init(data, weights);
+    }
+    if (ret != Status::OK) {
+      return ret;
+    }
+  }
+  weights_ = weights;
+  auto ret = lloyd(data);
+  weights_ = nullptr;
+  return ret;
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(const EncodedMatrix<DType> &data, bool seeded) {
+  if (data.empty()) {
+    LOG(ERROR) << "no samples to fit";
+    return Status::DIM_ERROR;
+  }
+  start_fit();
+  LOG(INFO) << "fitting " << encodings[static_cast<int>(data.encoding())]
+    << " data with n=" << data.rows()
+    << " d=" << data.cols()
     << " k=" << n_cluster_;
+  if (minibatch_size_ > 0) {
+    LOG(WARN) << "mini-batches are not drawn from encoded data, "
+      << "running full passes";
+  }
+  if (!seeded) {
+    auto ret = seed_sample(data);
+    if (ret != Status::OK) {
+      return ret;
+    }
+  } else if (centers_.cols() != data.cols()) {
+    LOG(ERROR) << "samples have dimension " << data.cols()
+      << ", centers " << centers_.cols();
+    return Status::DIM_ERROR;
+  }
+  return lloyd(data);
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(const SparseMatrix<DType> &data, bool seeded) {
+  if (data.empty()) {
+    LOG(ERROR) << "no samples to fit";
+    return Status::DIM_ERROR;
+  }
+  start_fit();
+  LOG(INFO) << "fitting sparse data with n=" << data.rows()
+    << " d=" << data.cols()
+    << " nnz=" << data.nnz()
+    << " k=" << n_cluster_;
+  if (minibatch_size_ > 0 || numa_ || algorithm_ != Algorithm::LLOYD) {
+    LOG(WARN) << "mini-batch, NUMA and bounded passes are not applied to "
+      << "sparse data, running Lloyd passes";
+  }
   if (!seeded) {
     LOG(INFO) << "seeding centers...";
-    auto ret = init(data);
+    auto ret = sparse_init(data);
     if (ret != Status::OK) {
       return ret;
     }
+  } else if (centers_.cols() != data.cols()) {
+    LOG(ERROR) << "samples have dimension " << data.cols()
+      << ", centers " << centers_.cols();
+    return Status::DIM_ERROR;
   }
+  return sparse_lloyd(data);
+}
 
-  LOG(INFO) << "start clustering...";
+template <typename DType>
+Status Kmeans<DType>::fit_libsvm(const char *input_file, bool zero_based) {
+  SparseMatrix<DType> data;
+  LOG(INFO) << "loading sparse data from " << input_file;
+  const double start = now();
+  auto ret = parse_libsvm_file(input_file, data, n_thread_, 0, zero_based);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  const double load_s = now() - start;
+  ret = fit(data);
+  stats_.load_s = load_s;
+  return ret;
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(const char *input_file, const char *label_path) {
+  LOG(INFO) << "streaming data from " << input_file;
+  if (is_dataset(input_file)) {
+    DatasetReader<DType> reader;
+    auto ret = reader.open(input_file);
+    if (ret != Status::OK) {
+      return ret;
+    }
+    return fit(reader, label_path);
+  }
+  TextReader<DType> reader;
+  auto ret = reader.open(input_file);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  return fit(reader, label_path);
+}
+
+template <typename DType>
+Status Kmeans<DType>::fit(BatchReader<DType> &reader, const char *label_path,
+    bool seeded) {
+  labels_.clear();
+  start_fit();
+  auto ret = reader.rewind();
+  if (ret != Status::OK) {
+    return ret;
+  }
+  Matrix<DType> holdout, sample;
+  if (minibatch_size_ > 0) {
+    ret = reader.read(holdout_size_, holdout);
+    if (ret != Status::OK) {
+      return ret;
+    }
+  }
+  // seed from the head of the stream, rows are assumed to be in no
+  // particular order
+  const size_t sample_size = minibatch_size_ > 0 ? 3 * minibatch_size_ :
+                                                  chunk_size_;
+  ret = reader.read(std::max(sample_size, 3 * static_cast<size_t>(n_cluster_)),
+                    sample);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  if (sample.empty()) {
+    LOG(ERROR) << "no samples to fit after " << holdout.rows()
+      << " held-out samples";
+    return Status::DIM_ERROR;
+  }
+  LOG(INFO) << "fitting stream with d=" << sample.cols()
+    << " k=" << n_cluster_;
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(sample.data(), sample.rows(), sample.cols(),
+                   sample.stride());
+  }
+  if (!seeded) {
+    LOG(INFO) << "seeding centers...";
+    ret = init(sample);
+    if (ret != Status::OK) {
+      return ret;
+    }
+  } else if (centers_.cols() != sample.cols()) {
+    LOG(ERROR) << "samples have dimension " << sample.cols()
+      << ", centers " << centers_.cols();
+    return Status::DIM_ERROR;
+  }
+
+  if (minibatch_size_ == 0) {
+    return stream_lloyd(reader, label_path);
+  }
+  ret = minibatch_fit(reader, holdout, minibatch_size_, holdout.rows());
+  if (ret != Status::OK || label_path == nullptr) {
+    return ret;
+  }
+  // one more scan to label every sample, held-out ones included
+  std::ofstream fout(label_path);
+  if (!fout) {
+    LOG(ERROR) << "unable to open file \"" << label_path << "\" to write";
+    return Status::IO_ERROR;
+  }
+  ret = reader.rewind();
+  std::vector<int> labels;
+  while (ret == Status::OK) {
+    ret = reader.read(chunk_size_, sample);
+    if (ret != Status::OK || sample.empty()) {
+      break;
+    }
+    ret = predict(sample, labels);
+    for (auto label : labels) {
+      fout << label << '\n';
+    }
+  }
+  if (ret == Status::OK && !fout) {
+    LOG(ERROR) << "failed writing \"" << label_path << "\"";
+    ret = Status::IO_ERROR;
+  }
+  return ret;
+}
+
+template <typename DType>
+Status Kmeans<DType>::stream_lloyd(BatchReader<DType> &reader,
+    const char *label_path) {
+  const size_t k = centers_.rows(), d = centers_.cols();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  // Labels of the previous and the current pass go to two scratch files, so
+  // reassignments can be counted with memory bounded by the chunk size.
+  std::unique_ptr<FILE, int (*)(FILE*)> files[2] = {
+    std::unique_ptr<FILE, int (*)(FILE*)>(std::tmpfile(), std::fclose),
+    std::unique_ptr<FILE, int (*)(FILE*)>(std::tmpfile(), std::fclose)
+  };
+  if (!files[0] || !files[1]) {
+    LOG(ERROR) << "unable to create scratch files for labels";
+    return Status::IO_ERROR;
+  }
+  // per-thread partial sums, accumulated in double over the whole pass; the
+  // deterministic mode only uses thread 0's, see ordered_sums()
+  Matrix<double> sums(n_thread_ * k, d, true);
+  std::vector<double> counts(n_thread_ * k);
+  Matrix<DType> chunk;
+  std::vector<int> labels, prev_labels;
+  std::vector<double> block_costs;
+  std::vector<size_t> order, start;
+
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(centers_.data(), k, d, centers_.stride());
+  }
+  LOG(INFO) << "start out-of-core clustering with chunks of " << chunk_size_
+    << " samples...";
   int iter = 0;
   float reassign_ratio = 1.;
-  DType total_cost = 0.0;
+  size_t n = 0;
+  double cost = 0.0;
+  FILE *prev = files[0].get(), *cur = files[1].get();
   while (iter < n_iter_ && reassign_ratio >= threshold_) {
-    // clear membership
-    for (size_t i = 0; i < center_ids_.size(); ++i) {
-      center_ids_[i].clear();
-    }
-    num_reassigned_ = 0;
-    auto ret = Status::OK;
-    if (n_thread_ > 1) {
-      ret = parallel_lloyd(data, total_cost);
-    } else {
-      ret = sequential_lloyd(data, total_cost);
+    const double pass_start = now();
+    assigner_.prepare(centers_, assign_, nullptr, metric_);
+    sums.zero();
+    std::fill(counts.begin(), counts.end(), 0.0);
+    std::rewind(prev);
+    std::rewind(cur);
+    auto ret = reader.rewind();
+    size_t reassigned = 0;
+    n = 0;
+    cost = 0.0;
+    while (ret == Status::OK) {
+      ret = reader.read(chunk_size_, chunk);
+      if (ret != Status::OK || chunk.empty()) {
+        break;
+      }
+      if (chunk.cols() != d) {
+        LOG(ERROR) << "chunk has dimension " << chunk.cols()
+          << ", expected " << d;
+        return Status::DIM_ERROR;
+      }
+      if (metric_ == Metric::COSINE) {
+        normalize_rows(chunk.data(), chunk.rows(), d, chunk.stride());
+      }
+      const size_t nc = chunk.rows();
+      labels.resize(nc);
+      prev_labels.resize(nc);
+      block_costs.assign((nc + block - 1) / block, 0.0);
+      if (iter == 0) {
+        std::fill(prev_labels.begin(), prev_labels.end(), -1);
+      } else if (std::fread(prev_labels.data(), sizeof(int), nc, prev) != nc) {
+        LOG(ERROR) << "failed reading labels of the previous pass";
+        return Status::IO_ERROR;
+      }
+#pragma omp parallel num_threads(n_thread_)
+      {
+        const int tid = omp_get_thread_num();
+        double *thread_sums = sums.row(tid * k);
+        double *thread_counts = &counts[tid * k];
+        const size_t sum_stride = sums.stride();
+        DType min_dists[block];
+        std::vector<DType> workspace;
+#pragma omp for reduction(+:reassigned)
+        for (size_t b = 0; b < nc; b += block) {
+          const size_t nb = std::min(block, nc - b);
+          assigner_.assign(chunk.row(b), nb, chunk.stride(), &labels[b],
+                           min_dists, workspace);
+          double block_cost = 0.0;
+          for (size_t t = 0; t < nb; ++t) {
+            const int label = labels[b + t];
+            block_cost += min_dists[t];
+            reassigned += label != prev_labels[b + t];
+            if (deterministic_) {
+              continue;
+            }
+            const DType *sample = chunk.row(b + t);
+            double *sum = thread_sums + label * sum_stride;
+            ++thread_counts[label];
+            add_row(sum, sample, d);
+          }
+          block_costs[b / block] = block_cost;
+        }
+      }
+      for (auto block_cost : block_costs) {
+        cost += block_cost;
+      }
+      if (deterministic_) {
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+        ordered_sums<DType>(chunk, labels.data(), k, nullptr, nullptr, order,
+                            start, sums.data(), sums.stride(), counts.data());
+      }
+      if (std::fwrite(labels.data(), sizeof(int), nc, cur) != nc) {
+        LOG(ERROR) << "failed writing labels to scratch file";
+        return Status::IO_ERROR;
+      }
+      n += nc;
     }
-    if (ret != Status::OK)
+    if (ret != Status::OK) {
       return ret;
-    reassign_ratio = 1.0 * num_reassigned_ / data.size();
-    ++iter;
-    LOG(INFO) << "iter: " << iter << " reassign_ratio: " << reassign_ratio
-      << " cost: " << total_cost;
+    }
+    const double assign_end = now();
+
+    // merge the partial sums of all threads, empty clusters keep their center
+#pragma omp parallel for num_threads(n_thread_)
+    for (size_t i = 0; i < k; ++i) {
+      double num_samples = 0;
+      for (int t = 0; t < n_thread_; ++t) {
+        num_samples += counts[t * k + i];
+      }
+      if (num_samples == 0) {
+        continue;
+      }
+      for (size_t j = 0; j < d; ++j) {
+        double sum = 0.0;
+        for (int t = 0; t < n_thread_; ++t) {
+          sum += sums(t * k + i, j);
+        }
+        centers_(i, j) = static_cast<DType>(sum / num_samples);
+      }
+      if (metric_ == Metric::COSINE) {
+        normalize_rows(centers_.row(i), 1, d, d);
+      }
+    }
+    std::swap(prev, cur);
+    reassign_ratio = 1.0 * reassigned / n;
+    IterationStats stats;
+    stats.iter = ++iter;
+    stats.samples = n;
+    stats.reassigned = reassigned;
+    stats.cost = cost;
+    stats.dist_evals = n * k;
+    stats.assign_s = assign_end - pass_start;
+    stats.update_s = now() - assign_end;
+    LOG(INFO) << stats;
+    stats_.iterations.push_back(stats);
+  }
+  if (profiling_) {
+    stats_.peak_bytes = bytes(sums) + bytes(counts) + bytes(chunk) +
+      bytes(labels) + bytes(prev_labels) + bytes(block_costs) + bytes(order) +
+      bytes(start);
+  }
+  set_info(n, iter, cost);
+
+  if (label_path != nullptr) {
+    // the last pass's labels, now in `prev`
+    std::ofstream fout(label_path);
+    if (!fout) {
+      LOG(ERROR) << "unable to open file \"" << label_path << "\" to write";
+      return Status::IO_ERROR;
+    }
+    std::rewind(prev);
+    labels.resize(chunk_size_);
+    size_t nread;
+    while ((nread = std::fread(labels.data(), sizeof(int), labels.size(),
+                               prev)) > 0) {
+      for (size_t i = 0; i < nread; ++i) {
+        fout << labels[i] << '\n';
+      }
+    }
+    if (!fout) {
+      LOG(ERROR) << "failed writing \"" << label_path << "\"";
+      return Status::IO_ERROR;
+    }
   }
   LOG(INFO) << "finished";
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::sequential_lloyd(std::vector<std::vector<DType>> &data,
-    DType &total_cost) {
-  total_cost = 0;
-  // update membership
-  for (size_t i = 0; i < data.size(); ++i) {
-    int label = -1;
-    DType min_dist = 0.0;
-    predict(data[i], min_dist, label);
-    total_cost += min_dist;
-    center_ids_[label].push_back(static_cast<int>(i));
-    if (label != labels_[i]) {
-      num_reassigned_++;
-      labels_[i] = label;
-    }
+Status Kmeans<DType>::minibatch_fit(BatchReader<DType> &reader,
+    const Matrix<DType> &holdout, size_t batch_size, size_t skip) {
+  const size_t d = centers_.cols();
+  if (!holdout.empty() && holdout.cols() != d) {
+    LOG(ERROR) << "held-out samples have inconsistent dimension";
+    return Status::DIM_ERROR;
+  }
+  minibatch_.reset(centers_.rows());
+  holdout_cost_ = 0;
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(centers_.data(), centers_.rows(), d, centers_.stride());
   }
 
-  // update centers
-  for (int i = 0; i < n_cluster_; ++i) {
-    LOG(VERBOSE) << "cluster " << i << " #samples " << center_ids_[i].size();
-    std::vector<DType> center(data[0].size());
-    for (auto id : center_ids_[i]) {  // iterate over members of cluster[i]
-      for (size_t j = 0; j < data[id].size(); ++j) {
-        center[j] += data[id][j];
+  LOG(INFO) << "start mini-batch clustering with batch size " << batch_size
+    << ", " << holdout.rows() << " held-out samples...";
+  Matrix<DType> batch;
+  DType tolerance = -1, smoothed = -1;
+  size_t steps = 0, samples = 0;
+  bool converged = false;
+  for (int epoch = 1; epoch <= n_iter_ && !converged; ++epoch) {
+    const double epoch_start = now();
+    DType epoch_cost = 0;
+    size_t epoch_samples = 0;
+    while (!converged) {
+      auto ret = reader.read(batch_size, batch);
+      if (ret != Status::OK) {
+        return ret;
+      }
+      if (batch.empty()) {
+        break;
+      }
+      if (batch.cols() != d) {
+        LOG(ERROR) << "batch has dimension " << batch.cols()
+          << ", expected " << d;
+        return Status::DIM_ERROR;
+      }
+      if (metric_ == Metric::COSINE) {
+        normalize_rows(batch.data(), batch.rows(), d, batch.stride());
       }
+      if (tolerance < 0) {
+        tolerance = threshold_ * total_variance(batch);
+      }
+      DType batch_cost = 0;
+      DType movement = minibatch_.step(batch, centers_, assign_, n_thread_,
+                                       batch_cost, metric_);
+      smoothed = smoothed < 0 ? movement :
+        smoothed + static_cast<DType>(kSmoothing) * (movement - smoothed);
+      converged = smoothed <= tolerance;
+      epoch_cost += batch_cost;
+      epoch_samples += batch.rows();
+      samples += batch.rows();
+      ++steps;
+    }
+    if (steps == 0) {
+      LOG(ERROR) << "no samples to fit";
+      return Status::DIM_ERROR;
+    }
+    if (!holdout.empty()) {
+      DType total_cost = 0;
+      cost(holdout, total_cost);
+      holdout_cost_ = total_cost / holdout.rows();
+    }
+    // steps assign and update in one go, the epoch counts as assignment
+    IterationStats stats;
+    stats.iter = epoch;
+    stats.samples = epoch_samples;
+    stats.cost = epoch_samples ? epoch_cost / epoch_samples : 0;
+    stats.dist_evals = epoch_samples * centers_.rows();
+    stats.steps = steps;
+    stats.movement = smoothed;
+    stats.holdout_cost = holdout_cost_;
+    stats.assign_s = now() - epoch_start;
+    LOG(INFO) << stats;
+    stats_.iterations.push_back(stats);
+    set_info(samples, epoch, holdout_cost_);
+    if (converged || epoch == n_iter_) {
+      break;
+    }
+    auto ret = reader.rewind();
+    if (ret == Status::OK && skip > 0) {
+      ret = reader.read(skip, batch);
+    }
+    if (ret != Status::OK) {
+      return ret;
+    }
+  }
+  LOG(INFO) << "finished";
+  return Status::OK;
+}
+
+template <typename DType>
+Status Kmeans<DType>::lloyd(const SampleBlocks<DType> &data) {
+  allocate(data.rows());
+
+  bounded_ = false;
+  Algorithm algorithm = algorithm_;
+  if (metric_ == Metric::COSINE && algorithm != Algorithm::LLOYD) {
+    if (algorithm != Algorithm::AUTO) {
+      LOG(WARN) << "bounds are not applied to cosine passes, running Lloyd "
+        << "passes";
+    }
+    algorithm = Algorithm::LLOYD;
+  }
+  if (algorithm == Algorithm::AUTO) {
+    algorithm = BoundedAssigner<DType>::choose(data.rows(), centers_.rows());
+  }
+  if (algorithm != Algorithm::LLOYD) {
+    LOG(INFO) << "using " << algorithms[static_cast<int>(algorithm)]
+      << " bounds";
+    bounds_.reset(algorithm, data.rows(), centers_.rows());
+    bounded_ = true;
+  }
+
+  // scratch of the passes, sized once for the whole fit
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  const size_t n_block = (n + Assigner<DType>::kBlockPoints - 1) /
+    Assigner<DType>::kBlockPoints;
+  thread_stats_.resize(n_thread_, 4, true);
+  thread_stats_.zero();
+  if (deterministic_) {
+    sliced_ = kSlices * k * d <= kSliceBudget;
+    sums_.resize(sliced_ ? kSlices * k : k, d, true);
+    counts_.resize(sliced_ ? kSlices * k : k);
+    block_costs_.resize(n_block);
+  } else {
+    // first touched by the thread owning the rows
+    thread_sums_.resize_untouched(n_thread_ * k, d + 1, true);
+    sums_.resize(k, d, true);
+    counts_.resize(k);
+  }
+  placing_ = numa_ && data.matrix() != nullptr;
+  if (numa_ && !placing_) {
+    LOG(WARN) << "NUMA-aware passes need the samples in a Matrix, "
+      << "running shared passes";
+  }
+  n_node_ = placing_ ? std::max(1, std::min(numa_nodes(), n_thread_)) : 1;
+  if (placing_) {
+    LOG(INFO) << "NUMA-aware passes over " << n_node_ << " nodes";
+    placed_.resize_untouched(n, d, data.matrix()->padded());
+    node_sums_.resize_untouched(n_node_ * k, d + 1, true);
+    // each replica is first touched by its node's first thread
+    node_centers_.resize(n_node_);
+    for (auto &replica : node_centers_) {
+      replica.resize_untouched(k, d, centers_.padded());
     }
-    if (center_ids_[i].size() > 0) {  // skip empty cluster
-      for (size_t j = 0; j < center.size(); ++j) {
-        center[j] /= center_ids_[i].size();
+    node_assigners_.resize(n_node_);
+  }
+  const SampleBlocks<DType> samples = placing_ ?
+    SampleBlocks<DType>(placed_) : data;
+  inv_norms_.clear();
+  if (metric_ == Metric::COSINE) {
+    // samples are summed as unit vectors, assignment does not need them
+    // normalized
+    inv_norms_.resize(n);
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+    {
+      std::vector<DType> tile;
+#pragma omp for
+      for (size_t b = 0; b < n; b += Assigner<DType>::kBlockPoints) {
+        const size_t m = std::min(Assigner<DType>::kBlockPoints, n - b);
+        const DType *rows = data.block(b, m, tile);
+        for (size_t t = 0; t < m; ++t) {
+          const DType *x = rows + t * data.stride();
+          const DType norm = std::sqrt(kernels_->dot(x, x, d));
+          inv_norms_[b + t] = norm > 0 ? 1 / norm : 0;
+        }
       }
-      centers_[i] = center;
     }
+    normalize_rows(centers_.data(), k, d, centers_.stride());
   }
 
+  LOG(INFO) << "start clustering...";
+  int iter = 0;
+  float reassign_ratio = 1.;
+  DType total_cost = 0.0;
+  bool done = !(iter < n_iter_ && reassign_ratio >= threshold_);
+  double pass_start = now();
+  // One team lives for the whole fit. Each thread assigns the same samples
+  // in every pass, so they stay in its cache, and the convergence test is
+  // the only serial step between passes.
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+  {
+    const int tid = omp_get_thread_num(), n_team = omp_get_num_threads();
+    const int n_node = std::min(n_node_, n_team);
+    const int node = thread_node(tid, n_team, n_node);
+    if (placing_) {
+      bind_to_node(node);
+      place(*data.matrix(), tid, n_team);
+    }
+    while (!done) {
+      if (bounded_) {
+        bounds_.prepare_team(centers_);
+      } else if (placing_) {
+        // each node assigns against its own replica of the centers
+        if (tid == node_first_thread(node, n_team, n_node)) {
+          Matrix<DType> &replica = node_centers_[node];
+          for (size_t c = 0; c < k; ++c) {
+            std::copy(centers_.row(c), centers_.row(c) + centers_.stride(),
+                      replica.row(c));
+          }
+          node_assigners_[node].prepare(replica, assign_,
+                                        nullptr, metric_);
+        }
+#pragma omp barrier
+      } else {
+#pragma omp single
+        assigner_.prepare(centers_, assign_, nullptr, metric_);
+      }
+      if (deterministic_) {
+        deterministic_pass(samples);
+      } else {
+        parallel_pass(samples);
+      }
+#pragma omp single
+      {
+        IterationStats stats;
+        total_cost = finish_pass(samples, stats);
+        stats.iter = ++iter;
+        stats.samples = n;
+        stats.cost = total_cost;
+        stats.dist_skipped = n * k - stats.dist_evals;
+        stats.center_evals = bounded_ ? bounds_.center_evals() : 0;
+        if (profiling_) {
+          // the slowest thread's assignment, the rest is the update
+          double slowest = 0, mean = 0;
+          for (int t = 0; t < n_team; ++t) {
+            slowest = std::max(slowest, thread_stats_(t, 3));
+            mean += thread_stats_(t, 3) / n_team;
+          }
+          const double end = now();
+          stats.assign_s = slowest;
+          stats.update_s = std::max(0.0, end - pass_start - slowest);
+          stats.imbalance = mean > 0 ? slowest / mean : 0;
+          pass_start = end;
+        }
+        LOG(INFO) << stats;
+        stats_.iterations.push_back(stats);
+        reassign_ratio = 1.0 * stats.reassigned / n;
+        done = !(iter < n_iter_ && reassign_ratio >= threshold_);
+      }
+    }
+    if (placing_) {
+      bind_to_node(-1);
+    }
+  }
+  if (profiling_) {
+    stats_.peak_bytes = buffer_bytes();
+  }
+  placed_ = Matrix<DType>();
+  set_info(n, iter, total_cost);
+  LOG(INFO) << "finished";
   return Status::OK;
 }
 
 template <typename DType>
-Status Kmeans<DType>::parallel_lloyd(std::vector<std::vector<DType>> &data,
-    DType &total_cost) {
-  // Older OpenMP cannot carry out reduction on class member (num_reassigned_
-  // here), we need to use a temporary vector to accumulate this in each thread.
-  // Also, we cannot directly reduce on total_cost, which is a reference type and
-  // not supported by OpenMP <= 3.1, thus we use a local `cost` variable.
-  std::vector<int> num_reassigned(n_thread_);
-  DType cost = 0.0;
-#pragma omp parallel num_threads(n_thread_)
-  {
-    int tid = omp_get_thread_num();
-    thread_center_ids_[tid].clear();
-    thread_center_ids_[tid].resize(n_cluster_);
-    thread_centers_[tid].resize(n_cluster_);
-    for (auto &tc : thread_centers_[tid])
-      tc.resize(data[0].size());
-#pragma omp for reduction(+:cost)
-    for (size_t i = 0; i < data.size(); ++i) {
-      int label = 0;
-      DType min_dist;
-      predict(data[i], min_dist, label);
-      cost += min_dist;
-      thread_center_ids_[tid][label].push_back(static_cast<int>(i));
-      if (label != labels_[i]) {
-        num_reassigned[tid]++;
-        labels_[i] = label;
+size_t Kmeans<DType>::buffer_bytes() const {
+  size_t total = bytes(labels_) + bytes(min_dists_) + bytes(inv_norms_) +
+    bytes(thread_sums_) +
+    bytes(thread_stats_) + bytes(sums_) + bytes(counts_) +
+    bytes(block_costs_) + bytes(order_) + bytes(start_) + bytes(placed_) +
+    bytes(node_sums_) + (bounded_ ? bounds_.bytes() : 0);
+  for (const auto &centers : node_centers_) {
+    total += bytes(centers);
+  }
+  for (const auto &workspace : workspace_) {
+    total += bytes(workspace);
+  }
+  for (const auto &tile : tiles_) {
+    total += bytes(tile);
+  }
+  return total + sparse_assigner_.bytes();
+}
+
+template <typename DType>
+void Kmeans<DType>::place(const Matrix<DType> &data, int tid, int n_team) {
+  // copy the blocks parallel_pass() gives this thread, so their pages are
+  // first touched on its node
+  const size_t n = data.rows(), block = Assigner<DType>::kBlockPoints;
+  const size_t n_block = (n + block - 1) / block;
+  const size_t begin = std::min(n, n_block * tid / n_team * block);
+  const size_t end = std::min(n, n_block * (tid + 1) / n_team * block);
+  for (size_t i = begin; i < end; ++i) {
+    std::copy(data.row(i), data.row(i) + data.stride(), placed_.row(i));
+  }
+#pragma omp barrier
+}
+
+template <typename DType>
+size_t Kmeans<DType>::assign_block(const DType *x, size_t stride,
+    size_t begin, size_t n, int *labels, DType *min_dists,
+    std::vector<DType> &workspace) {
+  if (bounded_) {
+    return bounds_.assign(x, begin, n, stride, &labels_[begin], labels,
+                          min_dists, workspace);
+  }
+  const Assigner<DType> &assigner = placing_ ? node_assigners_[thread_node(
+      omp_get_thread_num(), omp_get_num_threads(),
+      std::min(n_node_, omp_get_num_threads()))] : assigner_;
+  assigner.assign(x, n, stride, labels, min_dists, workspace);
+  return n * centers_.rows();
+}
+
+template <typename DType>
+void Kmeans<DType>::parallel_pass(const SampleBlocks<DType> &data) {
+  // Each thread assigns a fixed range of blocks and adds its samples into
+  // its own k rows of thread_sums_, d sums and a count (or the weight of
+  // weighted fits) per row; rows are
+  // padded to cache lines, so threads never write to the same line. The
+  // rows of all threads are then added up in parallel over centers.
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  const size_t n_block = (n + block - 1) / block;
+  const int tid = omp_get_thread_num(), n_team = omp_get_num_threads();
+  const size_t stride = thread_sums_.stride();
+  double *sums = thread_sums_.row(tid * k);
+  std::fill(sums, sums + k * stride, 0.0);
+  double *stats = thread_stats_.row(tid);
+  double cost = 0.0;
+  size_t num_reassigned = 0, num_evals = 0;
+  int labels[block];
+  std::vector<DType> &workspace = workspace_[tid];
+  const DType *inv_norms = inv_norms_.empty() ? nullptr : inv_norms_.data();
+  const double *weights = weights_;
+  const double start = now();
+  for (size_t nb = n_block * tid / n_team; nb < n_block * (tid + 1) / n_team;
+       ++nb) {
+    const size_t b = nb * block, m = std::min(block, n - b);
+    DType *min_dists = &min_dists_[b];
+    const DType *rows = data.block(b, m, tiles_[tid]);
+    num_evals += assign_block(rows, data.stride(), b, m, labels, min_dists,
+                              workspace);
+    // accumulate the block while its samples are still in cache
+    for (size_t t = 0; t < m; ++t) {
+      const int label = labels[t];
+      const DType *sample = rows + t * data.stride();
+      double *sum = sums + label * stride;
+      if (label != labels_[b + t]) {
+        ++num_reassigned;
+        labels_[b + t] = label;
       }
+      if (inv_norms == nullptr && weights == nullptr) {
+        cost += min_dists[t];
+        add_row(sum, sample, d);
+        sum[d] += 1;
+        continue;
+      }
+      const double weight = weights != nullptr ? weights[b + t] : 1.0;
+      cost += weight * min_dists[t];
+      add_scaled(sum, sample, d, weight *
+                 (inv_norms != nullptr ? inv_norms[b + t] : 1.0));
+      sum[d] += weight;
+    }
+  }
+  stats[0] = num_reassigned;
+  stats[1] = num_evals;
+  stats[2] = cost;
+  stats[3] = now() - start;
+#pragma omp barrier
 
-      for (size_t j = 0; j < data[i].size(); ++j) {
-        thread_centers_[tid][label][j] += data[i][j];
+  // NUMA mode first adds up the rows of each node's threads on that node,
+  // so only n_node partial sums per center cross the interconnect
+  int first = 0, last = n_team, n_node = 1;
+  const Matrix<double> *partial = &thread_sums_;
+  if (placing_) {
+    n_node = std::min(n_node_, n_team);
+    const int node = thread_node(tid, n_team, n_node);
+    first = node_first_thread(node, n_team, n_node);
+    last = node_first_thread(node + 1, n_team, n_node);
+    const int share = tid - first, n_share = last - first;
+    for (size_t i = k * share / n_share; i < k * (share + 1) / n_share; ++i) {
+      double *sum = node_sums_.row(node * k + i);
+      std::fill(sum, sum + d + 1, 0.0);
+      for (int t = first; t < last; ++t) {
+        const double *thread_sum = thread_sums_.row(t * k + i);
+        for (size_t j = 0; j <= d; ++j) {
+          sum[j] += thread_sum[j];
+        }
       }
     }
+    first = 0;
+    last = n_node;
+    partial = &node_sums_;
+#pragma omp barrier
   }
-  for (int i = 0; i < n_thread_; ++i) {
-    num_reassigned_ += num_reassigned[i];
+
+#pragma omp for
+  for (size_t i = 0; i < k; ++i) {
+    double *sum = sums_.row(i);
+    std::fill(sum, sum + d, 0.0);
+    double count = 0;
+    for (int t = first; t < last; ++t) {
+      const double *part = partial->row(t * k + i);
+      for (size_t j = 0; j < d; ++j) {
+        sum[j] += part[j];
+      }
+      count += part[d];
+    }
+    counts_[i] = count;
+    set_center(i);
   }
+}
 
-  // main thread reduce centers of each thread
-  for (int i = 0; i < n_cluster_; ++i) {
-    int num_samples = 0;
-    for (int j = 0; j < n_thread_; ++j) {
-      for (size_t k = 0; k < data[0].size(); ++k) {
-        centers_[i][k] += thread_centers_[j][i][k];
-        thread_centers_[j][i][k] = 0.0;
+template <typename DType>
+void Kmeans<DType>::deterministic_pass(const SampleBlocks<DType> &data) {
+  // The same pass as parallel_pass, in an order independent of the number
+  // of threads: blocks are grouped into kSlices fixed slices, each summed on
+  // one thread into its own rows of sums_, and the slices are added up
+  // pairwise in a fixed tree. When those rows would take too much memory,
+  // samples are bucketed by label afterwards instead, see ordered_sums().
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  const size_t n_block = (n + block - 1) / block;
+  const int tid = omp_get_thread_num();
+  double *stats = thread_stats_.row(tid);
+  size_t num_reassigned = 0, num_evals = 0;
+  int labels[block];
+  std::vector<DType> &workspace = workspace_[tid];
+  const DType *inv_norms = inv_norms_.empty() ? nullptr : inv_norms_.data();
+  const double *weights = weights_;
+  double assign_s = 0;
+  if (!sliced_) {
+#pragma omp single
+    {
+      sums_.zero();
+      std::fill(counts_.begin(), counts_.end(), 0.0);
+    }
+  }
+#pragma omp for schedule(static)
+  for (int s = 0; s < kSlices; ++s) {
+    const double start = now();
+    double *slice_sums = sums_.row(sliced_ ? s * k : 0);
+    double *slice_counts = &counts_[sliced_ ? s * k : 0];
+    if (sliced_) {
+      std::fill(slice_sums, slice_sums + k * sums_.stride(), 0.0);
+      std::fill(slice_counts, slice_counts + k, 0.0);
+    }
+    for (size_t nb = n_block * s / kSlices; nb < n_block * (s + 1) / kSlices;
+         ++nb) {
+      const size_t b = nb * block, m = std::min(block, n - b);
+      DType *min_dists = &min_dists_[b];
+      const DType *rows = data.block(b, m, tiles_[tid]);
+      num_evals += assign_block(rows, data.stride(), b, m, labels, min_dists,
+                                workspace);
+      double cost = 0.0;
+      for (size_t t = 0; t < m; ++t) {
+        const double weight = weights != nullptr ? weights[b + t] : 1.0;
+        cost += weight * min_dists[t];
+        if (labels[t] != labels_[b + t]) {
+          ++num_reassigned;
+          labels_[b + t] = labels[t];
+        }
+        if (sliced_) {
+          const DType *sample = rows + t * data.stride();
+          double *sum = slice_sums + labels[t] * sums_.stride();
+          slice_counts[labels[t]] += weight;
+          if (inv_norms == nullptr && weights == nullptr) {
+            add_row(sum, sample, d);
+          } else {
+            add_scaled(sum, sample, d, weight *
+                       (inv_norms != nullptr ? inv_norms[b + t] : 1.0));
+          }
+        }
       }
-      num_samples += static_cast<int>(thread_center_ids_[j][i].size());
+      block_costs_[nb] = cost;
     }
+    assign_s += now() - start;
+  }
+  stats[0] = num_reassigned;
+  stats[1] = num_evals;
+  stats[3] = assign_s;
 
-    LOG(VERBOSE) << "cluster " << i << " #samples " << num_samples;
-    if (num_samples > 1) {
-      for (size_t k = 0; k < centers_[i].size(); ++k) {
-        centers_[i][k] /= num_samples;
+  if (!sliced_) {
+    ordered_sums(data, labels_.data(), k, inv_norms, weights, order_, start_,
+                 sums_.data(), sums_.stride(), counts_.data());
+  }
+#pragma omp for
+  for (size_t i = 0; i < k; ++i) {
+    for (int step = 1; sliced_ && step < kSlices; step *= 2) {
+      for (int s = 0; s + step < kSlices; s += 2 * step) {
+        double *sum = sums_.row(s * k + i);
+        const double *other = sums_.row((s + step) * k + i);
+        for (size_t j = 0; j < d; ++j) {
+          sum[j] += other[j];
+        }
+        counts_[s * k + i] += counts_[(s + step) * k + i];
       }
     }
+    set_center(i);
+  }
+}
+
+template <typename DType>
+void Kmeans<DType>::set_center(size_t i) {
+  // empty clusters are dealt with by finish_pass()
+  LOG(VERBOSE) << "cluster " << i << " #samples " << counts_[i];
+  if (counts_[i] > 0) {
+    for (size_t j = 0; j < centers_.cols(); ++j) {
+      centers_(i, j) = static_cast<DType>(sums_(i, j) / counts_[i]);
+    }
+    if (metric_ == Metric::COSINE) {
+      normalize_rows(centers_.row(i), 1, centers_.cols(), centers_.stride());
+    }
+  }
+}
+
+template <typename DType>
+DType Kmeans<DType>::finish_pass(const SampleBlocks<DType> &data,
+    IterationStats &iter) {
+  // Adds up the statistics of the pass. An empty cluster is moved to the
+  // sample farthest from its center, which leaves its old cluster (Lloyd's
+  // pass would otherwise never refill it); that sample's label is left to
+  // the next pass. Samples of weight 0 would leave it empty, they rank
+  // after all others and are never taken.
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  double cost = 0.0;
+  for (int t = 0; t < n_thread_; ++t) {
+    iter.reassigned += static_cast<size_t>(thread_stats_(t, 0));
+    iter.dist_evals += static_cast<size_t>(thread_stats_(t, 1));
+    cost += deterministic_ ? 0.0 : thread_stats_(t, 2);
+  }
+  if (deterministic_) {
+    for (auto block_cost : block_costs_) {
+      cost += block_cost;
+    }
   }
 
-  total_cost = cost;
+  std::vector<size_t> empty;
+  for (size_t i = 0; i < k; ++i) {
+    if (counts_[i] == 0) {
+      empty.push_back(i);
+    }
+  }
+  if (empty.empty()) {
+    return static_cast<DType>(cost);
+  }
+  // farthest samples first, ties by index so the choice is deterministic
+  auto weight = [this](size_t p) {
+    return weights_ != nullptr ? weights_[p] : 1.0;
+  };
+  std::vector<size_t> farthest(n);
+  std::iota(farthest.begin(), farthest.end(), 0);
+  const size_t m = std::min(n, 2 * empty.size());
+  std::partial_sort(farthest.begin(), farthest.begin() + m, farthest.end(),
+      [this, &weight](size_t a, size_t b) {
+        const bool weighs_a = weight(a) > 0, weighs_b = weight(b) > 0;
+        return weighs_a != weighs_b ? weighs_a :
+          min_dists_[a] > min_dists_[b] ||
+          (min_dists_[a] == min_dists_[b] && a < b);
+      });
+  size_t next = 0, moved = 0;
+  std::vector<DType> tile;
+  for (auto c : empty) {
+    // skip samples that would empty their own cluster
+    while (next < m && (!(weight(farthest[next]) > 0) ||
+        !(counts_[labels_[farthest[next]]] > weight(farthest[next])))) {
+      ++next;
+    }
+    if (next == m || !(min_dists_[farthest[next]] > 0)) {
+      break;
+    }
+    const size_t p = farthest[next++];
+    const DType *sample = data.block(p, 1, tile);
+    const double scale = weight(p) *
+      (inv_norms_.empty() ? 1.0 : inv_norms_[p]);
+    double *sum = sums_.row(labels_[p]);
+    for (size_t j = 0; j < d; ++j) {
+      sum[j] -= scale * sample[j];
+    }
+    counts_[labels_[p]] -= weight(p);
+    set_center(labels_[p]);
+    std::copy(sample, sample + d, centers_.row(c));
+    if (!inv_norms_.empty()) {
+      normalize_rows(centers_.row(c), 1, d, d);
+    }
+    ++moved;
+  }
+  iter.empty_clusters = empty.size();
+  iter.moved = moved;
+  return static_cast<DType>(cost);
+}
 
+template <typename DType>
+Status Kmeans<DType>::sparse_init(const SparseMatrix<DType> &data) {
+  const size_t n = data.rows(), d = data.cols();
+  const size_t k = static_cast<size_t>(n_cluster_);
+  if (n < k) {
+    LOG(ERROR) << "cannot seed " << n_cluster_ << " clusters from " << n
+      << " samples";
+    return Status::DIM_ERROR;
+  }
+  centers_.resize(k, d, true);
+  kernels_ = &distance_kernels<DType>(d);
+  const double start = now();
+  CounterRng rng(seed_);
+  std::vector<size_t> indices;
+  if (init_ == InitMethod::RANDOM) {
+    std::set<size_t> chosen;
+    for (uint64_t draw = 0; indices.size() < k; ++draw) {
+      size_t index = rng.index(kRandomStream, draw, n);
+      if (chosen.insert(index).second) {
+        indices.push_back(index);
+      }
+    }
+  } else {
+    if (init_ != InitMethod::KMEANS_PLUSPLUS) {
+      LOG(INFO) << init_methods[static_cast<int>(init_)]
+        << " is not implemented for sparse samples, using k-means++";
+    }
+    // k-means++ over one random row from each of m equal stripes; each new
+    // center is written to its dense row, distances to it are sparse dots.
+    // Cosine seeding weighs samples by 1 - cos, half the squared distance
+    // of the normalized samples.
+    const bool cosine = metric_ == Metric::COSINE;
+    const size_t m = std::min(n, std::max(chunk_size_, 3 * k));
+    std::vector<size_t> rows(m);
+    std::vector<DType> norms(m);
+    for (size_t i = 0; i < m; ++i) {
+      const size_t begin = i * n / m, end = (i + 1) * n / m;
+      rows[i] = begin + rng.index(kSeedSampleStream, i, end - begin);
+      norms[i] = data.row_norm(rows[i]);
+    }
+    std::vector<DType> min_dists(m, std::numeric_limits<DType>::max());
+    std::vector<double> block_sums(kSeedBlocks);
+    std::vector<DType> center(d);
+    uint64_t draw = 0;
+    indices.push_back(rows[rng.index(kPlusPlusStream, draw++, m)]);
+    while (true) {
+      const size_t newest = indices.back();
+      std::fill(center.begin(), center.end(), static_cast<DType>(0));
+      const uint32_t *nonzeros = data.row_indices(newest);
+      for (size_t t = 0; t < data.row_nnz(newest); ++t) {
+        center[nonzeros[t]] = data.row_values(newest)[t];
+      }
+      const DType center_norm = data.row_norm(newest);
+#pragma omp parallel for num_threads(n_thread_) if (n_thread_ > 1)
+      for (int b = 0; b < kSeedBlocks; ++b) {
+        double sum = 0.0;
+        for (size_t i = m * b / kSeedBlocks; i < m * (b + 1) / kSeedBlocks;
+             ++i) {
+          const size_t row = rows[i];
+          const DType dot = sparse_dot(data.row_indices(row),
+              data.row_values(row), data.row_nnz(row), center.data());
+          const DType norms_product = std::sqrt(norms[i] * center_norm);
+          DType dist = !cosine ? norms[i] + center_norm - 2 * dot :
+            norms_product > 0 ? 1 - dot / norms_product : 1;
+          // the expansion rounds, a sample is exactly on its own center
+          dist = row == newest ? 0 : std::max(dist, static_cast<DType>(0));
+          min_dists[i] = std::min(min_dists[i], dist);
+          sum += min_dists[i];
+        }
+        block_sums[b] = sum;
+      }
+      if (indices.size() == k) {
+        break;
+      }
+      const double total = std::accumulate(block_sums.begin(),
+                                           block_sums.end(), 0.0);
+      if (!(total > 0)) {
+        LOG(WARN) << "only " << indices.size() << " distinct samples for "
+          << k << " clusters, the remaining centers are duplicates";
+        const size_t distinct = indices.size();
+        while (indices.size() < k) {
+          indices.push_back(indices[indices.size() % distinct]);
+        }
+        break;
+      }
+      indices.push_back(rows[sample_index(min_dists, nullptr, block_sums,
+          rng.uniform(kPlusPlusStream, draw++) * total)]);
+    }
+  }
+  for (size_t i = 0; i < k; ++i) {
+    const uint32_t *nonzeros = data.row_indices(indices[i]);
+    const DType *values = data.row_values(indices[i]);
+    for (size_t t = 0; t < data.row_nnz(indices[i]); ++t) {
+      centers_(i, nonzeros[t]) = values[t];
+    }
+  }
+  stats_.init = init_ == InitMethod::RANDOM ?
+    init_methods[static_cast<int>(InitMethod::RANDOM)] :
+    init_methods[static_cast<int>(InitMethod::KMEANS_PLUSPLUS)];
+  stats_.init_s = now() - start;
   return Status::OK;
 }
 
+template <typename DType>
+Status Kmeans<DType>::sparse_lloyd(const SparseMatrix<DType> &data) {
+  allocate(data.rows());
+  bounded_ = false;
+  placing_ = false;
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  block_costs_.assign((n + block - 1) / block, 0.0);
+  counts_.resize(k);
+  // one dense row of sums per thread, see sparse_update()
+  thread_sums_.resize_untouched(n_thread_, d, true);
+  if (metric_ == Metric::COSINE) {
+    normalize_rows(centers_.data(), k, d, centers_.stride());
+  }
+
+  LOG(INFO) << "start clustering sparse samples...";
+  int iter = 0;
+  float reassign_ratio = 1.;
+  double total_cost = 0.0;
+  size_t peak_bytes = 0;
+  while (iter < n_iter_ && reassign_ratio >= threshold_) {
+    const double pass_start = now();
+    sparse_assigner_.prepare(centers_, nullptr, n_thread_, metric_);
+    IterationStats stats;
+    stats.reassigned = sparse_assign(sparse_assigner_, data, labels_.data(),
+                                     min_dists_.data(), block_costs_.data());
+    // blocks are added up in order, the cost does not depend on n_thread
+    total_cost = std::accumulate(block_costs_.begin(), block_costs_.end(),
+                                 0.0);
+    const double assign_end = now();
+    if (profiling_) {
+      peak_bytes = buffer_bytes();
+    }
+    sparse_update(data, stats);
+    stats.iter = ++iter;
+    stats.samples = n;
+    stats.cost = total_cost;
+    stats.dist_evals = n * k;
+    stats.assign_s = assign_end - pass_start;
+    stats.update_s = now() - assign_end;
+    LOG(INFO) << stats;
+    stats_.iterations.push_back(stats);
+    reassign_ratio = 1.0 * stats.reassigned / n;
+  }
+  if (profiling_) {
+    stats_.peak_bytes = peak_bytes;
+  }
+  // the transposed centers are as large as the centers, do not keep them
+  sparse_assigner_ = SparseAssigner<DType>();
+  set_info(n, iter, total_cost);
+  LOG(INFO) << "finished";
+  return Status::OK;
+}
+
+template <typename DType>
+void Kmeans<DType>::sparse_update(const SparseMatrix<DType> &data,
+    IterationStats &iter) {
+  // Per-thread k x d sums do not fit once d is in the millions. Samples are
+  // bucketed by label instead and each center is summed from its members'
+  // nonzeros into one dense row of its thread, in row order, so memory is
+  // n_thread rows of d and the centers do not depend on n_thread.
+  const size_t n = data.rows(), d = data.cols(), k = centers_.rows();
+  std::fill(counts_.begin(), counts_.end(), 0.0);
+  for (size_t i = 0; i < n; ++i) {
+    ++counts_[labels_[i]];
+  }
+
+  // An empty cluster takes the sample farthest from its center, as in
+  // finish_pass(); here it is relabeled before the sums, so it leaves its
+  // old cluster's mean and becomes the empty one's.
+  std::vector<size_t> empty;
+  for (size_t i = 0; i < k; ++i) {
+    if (counts_[i] == 0) {
+      empty.push_back(i);
+    }
+  }
+  if (!empty.empty()) {
+    std::vector<size_t> farthest(n);
+    std::iota(farthest.begin(), farthest.end(), 0);
+    const size_t m = std::min(n, 2 * empty.size());
+    std::partial_sort(farthest.begin(), farthest.begin() + m, farthest.end(),
+        [this](size_t a, size_t b) {
+          return min_dists_[a] > min_dists_[b] ||
+            (min_dists_[a] == min_dists_[b] && a < b);
+        });
+    size_t next = 0;
+    for (auto c : empty) {
+      while (next < m && counts_[labels_[farthest[next]]] < 2) {
+        ++next;
+      }
+      if (next == m || !(min_dists_[farthest[next]] > 0)) {
+        break;
+      }
+      const size_t p = farthest[next++];
+      --counts_[labels_[p]];
+      ++counts_[c];
+      labels_[p] = static_cast<int>(c);
+      ++iter.moved;
+    }
+    iter.empty_clusters = empty.size();
+  }
+
+  // spherical centers are the normalized sums of the normalized samples
+  const bool cosine = metric_ == Metric::COSINE;
+  bucket_by_label(labels_.data(), n, k, order_, start_);
+#pragma omp parallel num_threads(n_thread_) if (n_thread_ > 1)
+  {
+    double *sum = thread_sums_.row(omp_get_thread_num());
+    std::fill(sum, sum + d, 0.0);
+#pragma omp for schedule(dynamic)
+    for (size_t i = 0; i < k; ++i) {
+      if (counts_[i] == 0) {
+        continue;
+      }
+      for (size_t s = start_[i]; s < start_[i + 1]; ++s) {
+        const double norm = cosine ? std::sqrt(data.row_norm(order_[s])) : 1;
+        add_sparse(sum, data, order_[s], norm > 0 ? 1 / norm : 0.0);
+      }
+      // write the mean and clear the row for the next center
+      DType *center = centers_.row(i);
+      const double count = counts_[i];
+      for (size_t j = 0; j < d; ++j) {
+        center[j] = static_cast<DType>(sum[j] / count);
+        sum[j] = 0.0;
+      }
+      if (cosine) {
+        normalize_rows(center, 1, d, d);
+      }
+    }
+  }
+}
+
 template class Kmeans<float>;
 template class Kmeans<double>;
 }  // namespace cluster
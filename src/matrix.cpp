@@ -0,0 +1,139 @@
+#include "matrix.h"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+
+namespace cluster {
+
+template <typename DType>
+const size_t Matrix<DType>::kAlignment;
+
+template <typename DType>
+Matrix<DType>::Matrix(size_t rows, size_t cols, bool padded) :
+  rows_(0), cols_(0), stride_(0), data_(nullptr) {
+  resize(rows, cols, padded);
+}
+
+template <typename DType>
+Matrix<DType>::Matrix(DType *data, size_t rows, size_t cols, size_t stride,
+    std::shared_ptr<void> owner) :
+  rows_(rows), cols_(cols), stride_(stride), data_(data),
+  buffer_(std::move(owner)) {
+}
+
+template <typename DType>
+Matrix<DType>::Matrix(const Matrix &other) :
+  rows_(0), cols_(0), stride_(0), data_(nullptr) {
+  *this = other;
+}
+
+template <typename DType>
+Matrix<DType>::Matrix(Matrix &&other) :
+  rows_(other.rows_), cols_(other.cols_), stride_(other.stride_),
+  data_(other.data_), buffer_(std::move(other.buffer_)) {
+  other.rows_ = other.cols_ = other.stride_ = 0;
+  other.data_ = nullptr;
+}
+
+template <typename DType>
+Matrix<DType>& Matrix<DType>::operator=(const Matrix &other) {
+  if (this == &other) {
+    return *this;
+  }
+  // a copy always owns its memory, even if `other` is a view
+  allocate(other.rows_, other.cols_, other.stride_);
+  for (size_t i = 0; i < rows_; ++i) {
+    std::memcpy(row(i), other.row(i), cols_ * sizeof(DType));
+  }
+  return *this;
+}
+
+template <typename DType>
+Matrix<DType>& Matrix<DType>::operator=(Matrix &&other) {
+  if (this == &other) {
+    return *this;
+  }
+  rows_ = other.rows_;
+  cols_ = other.cols_;
+  stride_ = other.stride_;
+  data_ = other.data_;
+  buffer_ = std::move(other.buffer_);
+  other.rows_ = other.cols_ = other.stride_ = 0;
+  other.data_ = nullptr;
+  return *this;
+}
+
+template <typename DType>
+void Matrix<DType>::allocate(size_t rows, size_t cols, size_t stride,
+    bool zero) {
+  buffer_.reset();
+  data_ = nullptr;
+  rows_ = rows;
+  cols_ = cols;
+  stride_ = stride;
+
+  size_t bytes = rows * stride * sizeof(DType);
+  if (bytes == 0) {
+    return;
+  }
+  // round up to whole cache lines so the tail of the last row is addressable
+  bytes = (bytes + kAlignment - 1) / kAlignment * kAlignment;
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, kAlignment, bytes) != 0) {
+    throw std::bad_alloc();
+  }
+  if (zero) {
+    std::memset(ptr, 0, bytes);
+  }
+  data_ = static_cast<DType*>(ptr);
+  buffer_ = std::shared_ptr<void>(ptr, std::free);
+}
+
+template <typename DType>
+void Matrix<DType>::resize(size_t rows, size_t cols, bool padded) {
+  allocate(rows, cols, padded ? padded_stride(cols) : cols);
+}
+
+template <typename DType>
+void Matrix<DType>::resize_untouched(size_t rows, size_t cols, bool padded) {
+  allocate(rows, cols, padded ? padded_stride(cols) : cols, false);
+}
+
+template <typename DType>
+void Matrix<DType>::zero() {
+  if (data_ != nullptr) {
+    std::memset(data_, 0, rows_ * stride_ * sizeof(DType));
+  }
+}
+
+template <typename DType>
+Status Matrix<DType>::from_vectors(const std::vector<std::vector<DType>> &rows,
+    Matrix &out, bool padded) {
+  size_t cols = rows.empty() ? 0 : rows[0].size();
+  for (auto const &r : rows) {
+    if (r.size() != cols) {
+      return Status::DIM_ERROR;
+    }
+  }
+  out.resize(rows.size(), cols, padded);
+  for (size_t i = 0; i < rows.size(); ++i) {
+    std::copy(rows[i].begin(), rows[i].end(), out.row(i));
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+std::vector<std::vector<DType>> Matrix<DType>::to_vectors() const {
+  std::vector<std::vector<DType>> rows(rows_);
+  for (size_t i = 0; i < rows_; ++i) {
+    rows[i].assign(row(i), row(i) + cols_);
+  }
+  return rows;
+}
+
+template class Matrix<float>;
+template class Matrix<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
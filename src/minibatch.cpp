@@ -0,0 +1,105 @@
+#include "minibatch.h"
+#include <algorithm>
+
+namespace cluster {
+
+template <typename DType>
+void MiniBatch<DType>::reset(size_t k) {
+  counts_.assign(k, 0);
+}
+
+template <typename DType>
+DType MiniBatch<DType>::step(const Matrix<DType> &batch,
+    Matrix<DType> &centers, AssignMethod method, int n_thread,
+    DType &batch_cost, Metric metric) {
+  const size_t n = batch.rows(), d = batch.cols(), k = centers.rows();
+  const size_t block = Assigner<DType>::kBlockPoints;
+  labels_.resize(n);
+  min_dists_.resize(n);
+  assigner_.prepare(centers, method, nullptr, metric);
+
+  DType cost = 0.0;
+#pragma omp parallel num_threads(n_thread) if (n_thread > 1)
+  {
+    std::vector<DType> workspace;
+#pragma omp for reduction(+:cost)
+    for (size_t b = 0; b < n; b += block) {
+      const size_t nb = std::min(block, n - b);
+      assigner_.assign(batch.row(b), nb, batch.stride(), &labels_[b],
+                       &min_dists_[b], workspace);
+      for (size_t i = b; i < b + nb; ++i) {
+        cost += min_dists_[i];
+      }
+    }
+  }
+  batch_cost = cost;
+
+  // bucket the batch by label so each center is updated by one thread
+  start_.assign(k + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    ++start_[labels_[i] + 1];
+  }
+  for (size_t j = 0; j < k; ++j) {
+    start_[j + 1] += start_[j];
+  }
+  order_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    order_[start_[labels_[i]]++] = i;
+  }
+  for (size_t j = k; j > 0; --j) {
+    start_[j] = start_[j - 1];
+  }
+  start_[0] = 0;
+
+  // movement is added up in center order, whatever thread moved them
+  movement_.assign(k, 0);
+#pragma omp parallel num_threads(n_thread) if (n_thread > 1)
+  {
+    std::vector<DType> sum(d);
+#pragma omp for schedule(dynamic, 16)
+    for (size_t j = 0; j < k; ++j) {
+      const size_t members = start_[j + 1] - start_[j];
+      if (members == 0) {
+        continue;
+      }
+      std::fill(sum.begin(), sum.end(), static_cast<DType>(0));
+      for (size_t m = start_[j]; m < start_[j + 1]; ++m) {
+        const DType *sample = batch.row(order_[m]);
+        for (size_t t = 0; t < d; ++t) {
+          sum[t] += sample[t];
+        }
+      }
+      counts_[j] += members;
+      DType *center = centers.row(j);
+      const DType rate = static_cast<DType>(1) / counts_[j];
+      if (metric == Metric::COSINE) {
+        // the step, then back onto the sphere; movement is the whole move
+        for (size_t t = 0; t < d; ++t) {
+          sum[t] = center[t] + (sum[t] - members * center[t]) * rate;
+        }
+        normalize_rows(sum.data(), 1, d, d);
+        for (size_t t = 0; t < d; ++t) {
+          movement_[j] += (sum[t] - center[t]) * (sum[t] - center[t]);
+          center[t] = sum[t];
+        }
+        continue;
+      }
+      for (size_t t = 0; t < d; ++t) {
+        DType delta = (sum[t] - members * center[t]) * rate;
+        center[t] += delta;
+        movement_[j] += delta * delta;
+      }
+    }
+  }
+  DType movement = 0.0;
+  for (auto move : movement_) {
+    movement += move;
+  }
+  return movement / k;
+}
+
+template class MiniBatch<float>;
+template class MiniBatch<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
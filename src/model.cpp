@@ -0,0 +1,203 @@
+#include "model.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace cluster {
+
+const char kModelMagic[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'M', 'D'};
+
+namespace {
+
+// Fletcher-64 over 32-bit words, a zero-padded tail counts as one word.
+class Fletcher64 {
+  public:
+    Fletcher64() : a_(0), b_(0) {}
+
+    void update(const void *data, size_t bytes) {
+      const char *p = static_cast<const char*>(data);
+      const size_t words = bytes / 4;
+      // reduce every 1024 words, before b_ can overflow 64 bits
+      for (size_t i0 = 0; i0 < words; i0 += 1024) {
+        const size_t i1 = std::min(words, i0 + 1024);
+        for (size_t i = i0; i < i1; ++i) {
+          uint32_t word;
+          std::memcpy(&word, p + 4 * i, 4);
+          a_ += word;
+          b_ += a_;
+        }
+        a_ %= kModulus;
+        b_ %= kModulus;
+      }
+      if (bytes % 4 != 0) {
+        uint32_t word = 0;
+        std::memcpy(&word, p + 4 * words, bytes % 4);
+        a_ = (a_ + word) % kModulus;
+        b_ = (b_ + a_) % kModulus;
+      }
+    }
+
+    uint64_t value() const { return b_ << 32 | a_; }
+
+  private:
+    static const uint64_t kModulus = 0xffffffffu;
+    uint64_t a_;
+    uint64_t b_;
+};
+
+struct Unmap {
+  explicit Unmap(size_t size) : size(size) {}
+  void operator()(void *addr) const { munmap(addr, size); }
+  size_t size;
+};
+
+}  // namespace
+
+bool is_model(const char *path) {
+  char magic[sizeof(kModelMagic)];
+  FILE *file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool match = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+    std::memcmp(magic, kModelMagic, sizeof(magic)) == 0;
+  std::fclose(file);
+  return match;
+}
+
+template <typename DType>
+Status write_model(const char *path, const Matrix<DType> &centers,
+    const DType *norms, const ModelInfo &info) {
+  const size_t k = centers.rows(), d = centers.cols();
+  const size_t stride = Matrix<DType>::padded_stride(d);
+  // centers with zeroed row padding, then the norms
+  std::vector<DType> payload(k * stride + (norms ? k : 0));
+  for (size_t i = 0; i < k; ++i) {
+    std::copy(centers.row(i), centers.row(i) + d, &payload[i * stride]);
+  }
+  if (norms != nullptr) {
+    std::copy(norms, norms + k, &payload[k * stride]);
+  }
+
+  ModelHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kModelMagic, sizeof(header.magic));
+  header.version = kModelVersion;
+  header.dtype = static_cast<uint32_t>(data_type<DType>());
+  header.k = k;
+  header.d = d;
+  header.stride = stride;
+  header.flags = norms ? kModelHasNorms : 0;
+  header.info = info;
+  Fletcher64 checksum;
+  checksum.update(payload.data(), payload.size() * sizeof(DType));
+  header.checksum = checksum.value();
+
+  FILE *file = std::fopen(path, "wb");
+  if (file == nullptr) {
+    LOG(ERROR) << "unable to open file \"" << path << "\" to write";
+    return Status::IO_ERROR;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+    std::fwrite(payload.data(), sizeof(DType), payload.size(), file) ==
+    payload.size();
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    LOG(ERROR) << "failed writing \"" << path << "\"";
+    return Status::IO_ERROR;
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status map_model(const char *path, Matrix<DType> &centers,
+    std::vector<DType> &norms, ModelInfo &info, bool verify) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "unable to open file \"" << path << "\" to read";
+    return Status::IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    LOG(ERROR) << "unable to stat \"" << path << "\"";
+    close(fd);
+    return Status::IO_ERROR;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  ModelHeader header;
+  if (size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    LOG(ERROR) << "\"" << path << "\" is too short for a model header";
+    close(fd);
+    return Status::FORMAT_ERROR;
+  }
+  const char *error = nullptr;
+  const bool has_norms = (header.flags & kModelHasNorms) != 0;
+  const size_t capacity = (size - sizeof(header)) / sizeof(DType);
+  const size_t per_center = header.stride + (has_norms ? 1 : 0);
+  if (std::memcmp(header.magic, kModelMagic, sizeof(header.magic)) != 0) {
+    error = "bad magic";
+  } else if (header.version != kModelVersion) {
+    error = "unsupported version";
+  } else if (header.dtype != static_cast<uint32_t>(data_type<DType>())) {
+    error = "element type does not match";
+  } else if (header.stride != Matrix<DType>::padded_stride(header.d)) {
+    error = "bad row layout";
+  } else if (per_center != 0 && header.k > capacity / per_center) {
+    error = "payload is truncated";
+  }
+  if (error != nullptr) {
+    LOG(ERROR) << "invalid model \"" << path << "\": " << error;
+    close(fd);
+    return Status::FORMAT_ERROR;
+  }
+
+  // private and writable like map_dataset(), so a loaded model can be
+  // refined by a seeded fit
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "unable to mmap \"" << path << "\"";
+    return Status::IO_ERROR;
+  }
+  std::shared_ptr<void> owner(addr, Unmap(size));
+  DType *payload = reinterpret_cast<DType*>(
+      static_cast<char*>(addr) + sizeof(header));
+  if (verify) {
+    Fletcher64 checksum;
+    checksum.update(payload, header.k * per_center * sizeof(DType));
+    if (checksum.value() != header.checksum) {
+      LOG(ERROR) << "invalid model \"" << path << "\": checksum mismatch";
+      return Status::FORMAT_ERROR;
+    }
+  }
+  centers = Matrix<DType>(payload, header.k, header.d, header.stride, owner);
+  if (has_norms) {
+    norms.assign(payload + header.k * header.stride,
+                 payload + header.k * header.stride + header.k);
+  } else {
+    norms.clear();
+  }
+  info = header.info;
+  return Status::OK;
+}
+
+template Status write_model(const char *path, const Matrix<float> &centers,
+                            const float *norms, const ModelInfo &info);
+template Status write_model(const char *path, const Matrix<double> &centers,
+                            const double *norms, const ModelInfo &info);
+template Status map_model(const char *path, Matrix<float> &centers,
+                          std::vector<float> &norms, ModelInfo &info,
+                          bool verify);
+template Status map_model(const char *path, Matrix<double> &centers,
+                          std::vector<double> &norms, ModelInfo &info,
+                          bool verify);
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
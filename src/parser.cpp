@@ -0,0 +1,490 @@
+#include "parser.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace cluster {
+
+namespace {
+
+// Powers of ten that are exact in a double; a mantissa of at most 2^53
+// scaled by one of them is correctly rounded (Clinger's fast path).
+const double kPowersOf10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const int kMaxFastExponent = 22;
+const uint64_t kMaxFastMantissa = uint64_t(1) << 53;
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// separators within a line
+inline bool is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Everything the fast path cannot do exactly (long mantissas, large
+// exponents, inf and nan) goes through strtod on a terminated copy.
+const char* parse_slow(const char *first, const char *last, double &value) {
+  char buffer[128];
+  const char *end = first;
+  while (end != last && !is_blank(*end) && *end != '\n') {
+    ++end;
+  }
+  const size_t length = static_cast<size_t>(end - first);
+  if (length == 0 || length >= sizeof(buffer)) {
+    return nullptr;
+  }
+  std::memcpy(buffer, first, length);
+  buffer[length] = '\0';
+  char *parsed = nullptr;
+  value = std::strtod(buffer, &parsed);
+  if (parsed == buffer) {
+    return nullptr;
+  }
+  return first + (parsed - buffer);
+}
+
+const char* parse_double(const char *first, const char *last,
+                         double &value) {
+  const char *p = first;
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int exponent = 0, digits = 0;
+  bool exact = true, any_digit = false;
+  for (; p != last && is_digit(*p); ++p) {
+    any_digit = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    } else {
+      ++exponent;
+      exact = false;
+    }
+  }
+  if (p != last && *p == '.') {
+    for (++p; p != last && is_digit(*p); ++p) {
+      any_digit = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        --exponent;
+      } else {
+        exact = false;
+      }
+    }
+  }
+  if (!any_digit) {
+    return parse_slow(first, last, value);
+  }
+  if (p != last && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negative_exponent = false;
+    if (q != last && (*q == '-' || *q == '+')) {
+      negative_exponent = *q == '-';
+      ++q;
+    }
+    if (q != last && is_digit(*q)) {
+      int e = 0;
+      for (; q != last && is_digit(*q); ++q) {
+        e = std::min(e * 10 + (*q - '0'), 100000);
+      }
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+  if (!exact || mantissa > kMaxFastMantissa || exponent > kMaxFastExponent ||
+      exponent < -kMaxFastExponent) {
+    return parse_slow(first, last, value);
+  }
+  double v = static_cast<double>(mantissa);
+  v = exponent < 0 ? v / kPowersOf10[-exponent] : v * kPowersOf10[exponent];
+  value = negative ? -v : v;
+  return p;
+}
+
+// Byte ranges of newline-aligned chunks and what parsing them found.
+struct Chunk {
+  const char *begin;
+  const char *end;
+  size_t rows;         /* non-blank lines */
+  size_t nnz;          /* index:value pairs, libsvm files only */
+  Status status;
+  const char *error;   /* start of the offending line */
+};
+
+struct Unmap {
+  explicit Unmap(size_t size = 0) : size(size) {}
+  void operator()(void *addr) const { munmap(addr, size); }
+  size_t size;
+};
+
+typedef std::unique_ptr<void, Unmap> Mapping;
+
+// first non-blank character of [p, end) on the current line, or the
+// newline/end that terminates it
+inline const char* skip_blanks(const char *p, const char *end) {
+  while (p != end && is_blank(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+inline const char* line_end(const char *p, const char *end) {
+  const void *nl = std::memchr(p, '\n', end - p);
+  return nl ? static_cast<const char*>(nl) : end;
+}
+
+// Map `path` read-only into `mapping`; an empty file maps nothing and
+// leaves size at 0.
+Status map_text(const char *path, Mapping &mapping, size_t &size) {
+  size = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "unable to open file \"" << path << "\" to read";
+    return Status::IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    LOG(ERROR) << "unable to stat \"" << path << "\"";
+    close(fd);
+    return Status::IO_ERROR;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return Status::OK;
+  }
+  void *addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "unable to mmap \"" << path << "\"";
+    return Status::IO_ERROR;
+  }
+  size = static_cast<size_t>(st.st_size);
+  mapping = Mapping(addr, Unmap(size));
+  madvise(addr, size, MADV_SEQUENTIAL);
+  return Status::OK;
+}
+
+// Newline-aligned chunks of text, a few per thread so uneven lines still
+// balance.
+std::vector<Chunk> split_chunks(const char *text, size_t size, int n_thread) {
+  const char *text_end = text + size;
+  const size_t min_chunk = 1 << 20;
+  size_t n_chunks = std::max<size_t>(1, std::min<size_t>(
+      4 * std::max(n_thread, 1), size / min_chunk));
+  std::vector<Chunk> chunks;
+  const char *begin = text;
+  for (size_t c = 1; c <= n_chunks && begin != text_end; ++c) {
+    const char *end = c == n_chunks ? text_end : text + size / n_chunks * c;
+    if (end < begin) {
+      continue;
+    }
+    end = line_end(end, text_end);
+    if (end != text_end) {
+      ++end;
+    }
+    Chunk chunk = {begin, end, 0, 0, Status::OK, nullptr};
+    chunks.push_back(chunk);
+    begin = end;
+  }
+  return chunks;
+}
+
+// end of the data of a libsvm line, before any '#' comment
+inline const char* content_end(const char *p, const char *end) {
+  const void *hash = std::memchr(p, '#', end - p);
+  return hash ? static_cast<const char*>(hash) : end;
+}
+
+// Parse the index:value pairs of one libsvm line [first, last), after an
+// optional label, into indices and values. Returns the number of pairs, or
+// -1 if a token is malformed or the indices do not increase.
+template <typename DType>
+long parse_libsvm_line(const char *first, const char *last,
+                       uint32_t *indices, DType *values) {
+  long count = 0;
+  bool leading = true;
+  const char *p = skip_blanks(first, last);
+  while (p != last) {
+    const char *q = p;
+    uint64_t index = 0;
+    for (; q != last && is_digit(*q) && index <= 0xffffffffu; ++q) {
+      index = index * 10 + (*q - '0');
+    }
+    const char *end;
+    if (q != p && q != last && *q == ':' && index <= 0xffffffffu) {
+      end = parse_number(q + 1, last, values[count]);
+      if (count > 0 && index <= indices[count - 1]) {
+        return -1;
+      }
+      indices[count++] = static_cast<uint32_t>(index);
+    } else if (leading) {
+      DType label;
+      end = parse_number(p, last, label);
+    } else {
+      return -1;
+    }
+    if (end == nullptr || (end != last && !is_blank(*end))) {
+      return -1;
+    }
+    leading = false;
+    p = skip_blanks(end, last);
+  }
+  return count;
+}
+
+}  // namespace
+
+template <typename DType>
+const char* parse_number(const char *first, const char *last, DType &value) {
+  double v = 0.0;
+  const char *end = parse_double(first, last, v);
+  if (end != nullptr) {
+    value = static_cast<DType>(v);
+  }
+  return end;
+}
+
+template <typename DType>
+long parse_line(const char *first, const char *last, DType *out, size_t max) {
+  long count = 0;
+  const char *p = skip_blanks(first, last);
+  while (p != last) {
+    DType value;
+    const char *end = parse_number(p, last, value);
+    if (end == nullptr || (end != last && !is_blank(*end))) {
+      return -1;
+    }
+    if (static_cast<size_t>(count) < max) {
+      out[count] = value;
+    }
+    ++count;
+    p = skip_blanks(end, last);
+  }
+  return count;
+}
+
+template <typename DType>
+Status parse_text_file(const char *path, Matrix<DType> &out, int n_thread) {
+  Mapping mapping;
+  size_t size;
+  Status ret = map_text(path, mapping, size);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  if (size == 0) {
+    out.resize(0, 0);
+    return Status::OK;
+  }
+  const char *text = static_cast<const char*>(mapping.get());
+  const char *text_end = text + size;
+
+  // dimension of the first non-blank line
+  size_t d = 0;
+  for (const char *p = text; p != text_end; ) {
+    const char *e = line_end(p, text_end);
+    long count = parse_line<DType>(p, e, nullptr, 0);
+    if (count != 0) {
+      d = count > 0 ? static_cast<size_t>(count) : 0;
+      break;
+    }
+    p = e == text_end ? e : e + 1;
+  }
+
+  std::vector<Chunk> chunks = split_chunks(text, size, n_thread);
+
+  // count rows, then parse each chunk into its rows of `out`
+#pragma omp parallel for num_threads(n_thread) schedule(dynamic) \
+  if (n_thread > 1)
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    size_t rows = 0;
+    for (const char *p = chunks[c].begin; p != chunks[c].end; ) {
+      const char *e = line_end(p, chunks[c].end);
+      rows += skip_blanks(p, e) != e;
+      p = e == chunks[c].end ? e : e + 1;
+    }
+    chunks[c].rows = rows;
+  }
+  std::vector<size_t> first_row(chunks.size() + 1, 0);
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    first_row[c + 1] = first_row[c] + chunks[c].rows;
+  }
+  out.resize(first_row.back(), d);
+
+#pragma omp parallel for num_threads(n_thread) schedule(dynamic) \
+  if (n_thread > 1)
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    size_t row = first_row[c];
+    for (const char *p = chunks[c].begin; p != chunks[c].end; ) {
+      const char *e = line_end(p, chunks[c].end);
+      if (skip_blanks(p, e) != e) {
+        long count = parse_line(p, e, out.row(row), d);
+        if (count != static_cast<long>(d)) {
+          chunks[c].status = count < 0 ? Status::FORMAT_ERROR :
+                                         Status::DIM_ERROR;
+          chunks[c].error = p;
+          break;
+        }
+        ++row;
+      }
+      p = e == chunks[c].end ? e : e + 1;
+    }
+  }
+
+  for (auto const &chunk : chunks) {
+    if (chunk.status != Status::OK) {
+      size_t line = 1 + std::count(text, chunk.error, '\n');
+      if (chunk.status == Status::DIM_ERROR) {
+        LOG(ERROR) << "line " << line << " of \"" << path
+          << "\" has a different dimension than the first line, expected "
+          << d;
+      } else {
+        LOG(ERROR) << "line " << line << " of \"" << path
+          << "\" has a token that is not a number";
+      }
+      out.resize(0, 0);
+      return chunk.status;
+    }
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status parse_libsvm_file(const char *path, SparseMatrix<DType> &out,
+    int n_thread, size_t cols, bool zero_based) {
+  Mapping mapping;
+  size_t size;
+  Status ret = map_text(path, mapping, size);
+  if (ret != Status::OK) {
+    return ret;
+  }
+  if (size == 0) {
+    out = SparseMatrix<DType>(cols);
+    return Status::OK;
+  }
+  const char *text = static_cast<const char*>(mapping.get());
+  std::vector<Chunk> chunks = split_chunks(text, size, n_thread);
+
+  // count rows and pairs, one ':' each, then parse each chunk into its
+  // range of the nonzeros
+#pragma omp parallel for num_threads(n_thread) schedule(dynamic) \
+  if (n_thread > 1)
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    size_t rows = 0, nnz = 0;
+    for (const char *p = chunks[c].begin; p != chunks[c].end; ) {
+      const char *e = line_end(p, chunks[c].end), *ce = content_end(p, e);
+      if (skip_blanks(p, ce) != ce) {
+        ++rows;
+        nnz += std::count(p, ce, ':');
+      }
+      p = e == chunks[c].end ? e : e + 1;
+    }
+    chunks[c].rows = rows;
+    chunks[c].nnz = nnz;
+  }
+  std::vector<size_t> first_row(chunks.size() + 1, 0);
+  std::vector<size_t> first_nnz(chunks.size() + 1, 0);
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    first_row[c + 1] = first_row[c] + chunks[c].rows;
+    first_nnz[c + 1] = first_nnz[c] + chunks[c].nnz;
+  }
+  std::vector<size_t> indptr(first_row.back() + 1, 0);
+  std::vector<uint32_t> indices(first_nnz.back());
+  std::vector<DType> values(first_nnz.back());
+  std::vector<uint32_t> min_index(chunks.size(), 0xffffffffu);
+  std::vector<uint32_t> max_index(chunks.size(), 0);
+
+#pragma omp parallel for num_threads(n_thread) schedule(dynamic) \
+  if (n_thread > 1)
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    size_t row = first_row[c], pos = first_nnz[c];
+    for (const char *p = chunks[c].begin; p != chunks[c].end; ) {
+      const char *e = line_end(p, chunks[c].end), *ce = content_end(p, e);
+      if (skip_blanks(p, ce) != ce) {
+        long count = parse_libsvm_line(p, ce, &indices[pos], &values[pos]);
+        if (count < 0 || count != std::count(p, ce, ':')) {
+          chunks[c].status = Status::FORMAT_ERROR;
+          chunks[c].error = p;
+          break;
+        }
+        if (count > 0) {
+          min_index[c] = std::min(min_index[c], indices[pos]);
+          max_index[c] = std::max(max_index[c], indices[pos + count - 1]);
+        }
+        pos += count;
+        indptr[++row] = pos;
+      }
+      p = e == chunks[c].end ? e : e + 1;
+    }
+  }
+
+  for (auto const &chunk : chunks) {
+    if (chunk.status != Status::OK) {
+      size_t line = 1 + std::count(text, chunk.error, '\n');
+      LOG(ERROR) << "line " << line << " of \"" << path
+        << "\" is not index:value pairs with increasing indices";
+      return chunk.status;
+    }
+  }
+  // LIBSVM counts columns from 1
+  const uint32_t lowest = *std::min_element(min_index.begin(),
+                                            min_index.end());
+  const uint32_t highest = *std::max_element(max_index.begin(),
+                                             max_index.end());
+  const bool one_based = !zero_based && !indices.empty();
+  if (one_based && lowest == 0) {
+    LOG(ERROR) << "\"" << path << "\" has a column 0, "
+      << "load it as zero-based";
+    return Status::FORMAT_ERROR;
+  }
+  const size_t needed = indices.empty() ? 0 : highest + (one_based ? 0 : 1);
+  if (cols > 0 && needed > cols) {
+    LOG(ERROR) << "\"" << path << "\" has column " << needed
+      << ", more than the " << cols << " expected";
+    return Status::DIM_ERROR;
+  }
+  if (one_based) {
+#pragma omp parallel for num_threads(n_thread) if (n_thread > 1)
+    for (size_t t = 0; t < indices.size(); ++t) {
+      --indices[t];
+    }
+  }
+  out = SparseMatrix<DType>(cols > 0 ? cols : needed, std::move(indptr),
+                            std::move(indices), std::move(values));
+  return Status::OK;
+}
+
+template const char* parse_number(const char *first, const char *last,
+                                  float &value);
+template const char* parse_number(const char *first, const char *last,
+                                  double &value);
+template long parse_line(const char *first, const char *last, float *out,
+                         size_t max);
+template long parse_line(const char *first, const char *last, double *out,
+                         size_t max);
+template Status parse_text_file(const char *path, Matrix<float> &out,
+                                int n_thread);
+template Status parse_text_file(const char *path, Matrix<double> &out,
+                                int n_thread);
+template Status parse_libsvm_file(const char *path, SparseMatrix<float> &out,
+                                  int n_thread, size_t cols, bool zero_based);
+template Status parse_libsvm_file(const char *path, SparseMatrix<double> &out,
+                                  int n_thread, size_t cols, bool zero_based);
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,81 @@
+#include "reader.h"
+#include "parser.h"
+#include "utils.h"
+#include <algorithm>
+
+namespace cluster {
+
+template <typename DType>
+Status TextReader<DType>::open(const char *filename) {
+  fin_.close();
+  fin_.clear();
+  fin_.open(filename);
+  if (!fin_) {
+    LOG(ERROR) << "unable to open file \"" << filename << "\" to read";
+    return Status::IO_ERROR;
+  }
+  filename_ = filename;
+  dim_ = 0;
+  return Status::OK;
+}
+
+template <typename DType>
+Status TextReader<DType>::rewind() {
+  fin_.clear();
+  fin_.seekg(0);
+  if (!fin_) {
+    LOG(ERROR) << "unable to rewind \"" << filename_ << "\"";
+    return Status::IO_ERROR;
+  }
+  return Status::OK;
+}
+
+template <typename DType>
+Status TextReader<DType>::read(size_t max_rows, Matrix<DType> &batch) {
+  size_t rows = 0;
+  values_.clear();
+  while (rows < max_rows && std::getline(fin_, line_)) {
+    const char *first = line_.data(), *last = first + line_.size();
+    size_t before = values_.size();
+    values_.resize(before + std::max<size_t>(dim_, 1));
+    long dim = parse_line(first, last, &values_[before], dim_);
+    if (dim < 0) {
+      LOG(ERROR) << "sample in \"" << filename_ << "\" has a token that is "
+        "not a number";
+      return Status::FORMAT_ERROR;
+    }
+    if (dim == 0) {  // blank line
+      values_.resize(before);
+      continue;
+    }
+    if (dim_ == 0) {
+      dim_ = static_cast<size_t>(dim);
+      values_.resize(before + dim_);
+      parse_line(first, last, &values_[before], dim_);
+    }
+    if (static_cast<size_t>(dim) != dim_) {
+      LOG(ERROR) << "sample in \"" << filename_ << "\" has dimension " << dim
+        << ", expected " << dim_;
+      return Status::DIM_ERROR;
+    }
+    values_.resize(before + dim_);
+    ++rows;
+  }
+  if (fin_.bad()) {
+    LOG(ERROR) << "failed reading \"" << filename_ << "\"";
+    return Status::IO_ERROR;
+  }
+  if (batch.rows() != rows || batch.cols() != dim_ || !batch.owner()) {
+    batch.resize(rows, dim_);
+  }
+  for (size_t i = 0; i < rows; ++i) {
+    std::copy(&values_[i * dim_], &values_[i * dim_] + dim_, batch.row(i));
+  }
+  return Status::OK;
+}
+
+template class TextReader<float>;
+template class TextReader<double>;
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
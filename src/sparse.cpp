@@ -0,0 +1,186 @@
+#include "sparse.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace cluster {
+
+namespace {
+
+// columns transposed at a time, so the writes to the d rows of the
+// transposed centers stay within a few pages
+const size_t kTransposeTile = 64;
+
+}  // namespace
+
+template <typename DType>
+SparseMatrix<DType>::SparseMatrix(const Matrix<DType> &dense) :
+  cols_(dense.cols()), indptr_(1, 0) {
+  indptr_.reserve(dense.rows() + 1);
+  for (size_t i = 0; i < dense.rows(); ++i) {
+    const DType *row = dense.row(i);
+    for (size_t j = 0; j < cols_; ++j) {
+      if (row[j] != 0) {
+        indices_.push_back(static_cast<uint32_t>(j));
+        values_.push_back(row[j]);
+      }
+    }
+    indptr_.push_back(values_.size());
+  }
+}
+
+template <typename DType>
+SparseMatrix<DType>::SparseMatrix(size_t cols, std::vector<size_t> &&indptr,
+    std::vector<uint32_t> &&indices, std::vector<DType> &&values) :
+  cols_(cols), indptr_(std::move(indptr)), indices_(std::move(indices)),
+  values_(std::move(values)) {
+  if (indptr_.empty()) {
+    indptr_.push_back(0);
+  }
+}
+
+template <typename DType>
+Status SparseMatrix<DType>::add_row(const uint32_t *indices,
+    const DType *values, size_t nnz) {
+  for (size_t t = 0; t < nnz; ++t) {
+    if (indices[t] >= cols_ || (t > 0 && indices[t] <= indices[t - 1])) {
+      return Status::DIM_ERROR;
+    }
+  }
+  indices_.insert(indices_.end(), indices, indices + nnz);
+  values_.insert(values_.end(), values, values + nnz);
+  indptr_.push_back(values_.size());
+  return Status::OK;
+}
+
+template <typename DType>
+Matrix<DType> SparseMatrix<DType>::to_dense() const {
+  Matrix<DType> dense(rows(), cols_);
+  for (size_t i = 0; i < rows(); ++i) {
+    for (size_t t = indptr_[i]; t < indptr_[i + 1]; ++t) {
+      dense(i, indices_[t]) = values_[t];
+    }
+  }
+  return dense;
+}
+
+template <typename DType>
+DType SparseMatrix<DType>::row_norm(size_t i) const {
+  DType norm = 0;
+  for (size_t t = indptr_[i]; t < indptr_[i + 1]; ++t) {
+    norm += values_[t] * values_[t];
+  }
+  return norm;
+}
+
+template <typename DType>
+size_t SparseMatrix<DType>::bytes() const {
+  return indptr_.size() * sizeof(size_t) + indices_.size() * sizeof(uint32_t) +
+    values_.size() * sizeof(DType);
+}
+
+template <typename DType>
+DType sparse_dot(const uint32_t *indices, const DType *values, size_t nnz,
+    const DType *dense) {
+  // two accumulators hide some of the latency of the gathered loads
+  DType even = 0, odd = 0;
+  size_t t = 0;
+  for (; t + 2 <= nnz; t += 2) {
+    even += values[t] * dense[indices[t]];
+    odd += values[t + 1] * dense[indices[t + 1]];
+  }
+  if (t < nnz) {
+    even += values[t] * dense[indices[t]];
+  }
+  return even + odd;
+}
+
+template <typename DType>
+void SparseAssigner<DType>::prepare(const Matrix<DType> &centers,
+    const DType *norms, int n_thread, Metric metric) {
+  const size_t k = centers.rows(), d = centers.cols();
+  k_ = k;
+  metric_ = metric;
+  kernels_ = &distance_kernels<DType>();
+  if (transposed_.rows() != d || transposed_.cols() != k) {
+    transposed_.resize(d, k, true);
+  }
+#pragma omp parallel for num_threads(n_thread) if (n_thread > 1)
+  for (size_t j0 = 0; j0 < d; j0 += kTransposeTile) {
+    const size_t j1 = std::min(d, j0 + kTransposeTile);
+    for (size_t i = 0; i < k; ++i) {
+      const DType *center = centers.row(i);
+      for (size_t j = j0; j < j1; ++j) {
+        transposed_(j, i) = center[j];
+      }
+    }
+  }
+  if (metric == Metric::COSINE) {
+    norms_.assign(k, static_cast<DType>(0));
+    return;
+  }
+  norms_.resize(k);
+  const DistanceKernels<DType> &kernels = distance_kernels<DType>(d);
+  for (size_t i = 0; i < k; ++i) {
+    norms_[i] = norms != nullptr ? norms[i] :
+      kernels.dot(centers.row(i), centers.row(i), d);
+  }
+}
+
+template <typename DType>
+void SparseAssigner<DType>::assign(const SparseMatrix<DType> &x,
+    size_t begin, size_t n, int *labels, DType *min_dists,
+    std::vector<DType> &workspace) const {
+  // rows of transposed_ are padded with zeros, so every axpy runs over whole
+  // vectors
+  const size_t k = k_, stride = transposed_.stride();
+  workspace.resize(stride);
+  DType *dots = workspace.data();
+  for (size_t i = 0; i < n; ++i) {
+    const size_t row = begin + i, nnz = x.row_nnz(row);
+    const uint32_t *indices = x.row_indices(row);
+    const DType *values = x.row_values(row);
+    std::fill(dots, dots + stride, static_cast<DType>(0));
+    DType norm = 0;
+    for (size_t t = 0; t < nnz; ++t) {
+      kernels_->axpy(values[t], transposed_.row(indices[t]), stride, dots);
+      norm += values[t] * values[t];
+    }
+    DType best = std::numeric_limits<DType>::max();
+    int label = 0;
+    for (size_t c = 0; c < k; ++c) {
+      const DType dist = norms_[c] - 2 * dots[c];
+      if (dist < best) {
+        best = dist;
+        label = static_cast<int>(c);
+      }
+    }
+    // cancellation can leave a sample on its center slightly negative
+    labels[i] = label;
+    if (metric_ == Metric::COSINE) {
+      min_dists[i] = norm > 0 ? std::max(1 + best / (2 * std::sqrt(norm)),
+                                         static_cast<DType>(0)) :
+                                static_cast<DType>(1);
+    } else {
+      min_dists[i] = std::max(best + norm, static_cast<DType>(0));
+    }
+  }
+}
+
+template <typename DType>
+size_t SparseAssigner<DType>::bytes() const {
+  return transposed_.rows() * transposed_.stride() * sizeof(DType) +
+    norms_.capacity() * sizeof(DType);
+}
+
+template class SparseMatrix<float>;
+template class SparseMatrix<double>;
+template class SparseAssigner<float>;
+template class SparseAssigner<double>;
+template float sparse_dot(const uint32_t *indices, const float *values,
+                          size_t nnz, const float *dense);
+template double sparse_dot(const uint32_t *indices, const double *values,
+                           size_t nnz, const double *dense);
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,36 @@
+#include "stats.h"
+
+namespace cluster {
+
+std::ostream& operator<<(std::ostream &out, const IterationStats &iter) {
+  if (iter.steps > 0) {
+    out << "epoch: " << iter.iter << " steps: " << iter.steps
+      << " batch_cost: " << iter.cost << " movement: " << iter.movement
+      << " holdout_cost: " << iter.holdout_cost;
+  } else {
+    out << "iter: " << iter.iter << " reassign_ratio: "
+      << (iter.samples ? 1.0 * iter.reassigned / iter.samples : 0.0)
+      << " cost: " << iter.cost;
+    if (iter.dist_skipped > 0 || iter.center_evals > 0) {
+      const size_t total = iter.dist_evals + iter.dist_skipped;
+      out << " dist_skipped: " << iter.dist_skipped << " ("
+        << 100.0 * iter.dist_skipped / total << "%, " << iter.center_evals
+        << " center-center)";
+    }
+  }
+  if (iter.empty_clusters > 0) {
+    out << " empty: " << iter.empty_clusters << " moved: " << iter.moved;
+  }
+  if (iter.assign_s > 0 || iter.update_s > 0) {
+    out << " assign: " << iter.assign_s << "s update: " << iter.update_s
+      << "s";
+    if (iter.imbalance > 0) {
+      out << " imbalance: " << iter.imbalance;
+    }
+  }
+  return out;
+}
+
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,38 @@
+#include "topology.h"
+#include "utils.h"
+#include <cstdlib>
+#ifdef KMEANS_USE_NUMA
+#include <numa.h>
+#endif
+
+namespace cluster {
+
+int numa_nodes() {
+  const char *env = std::getenv("KMEANS_NUMA_NODES");
+  if (env != nullptr && std::atoi(env) > 0) {
+    return std::atoi(env);
+  }
+#ifdef KMEANS_USE_NUMA
+  if (numa_available() >= 0) {
+    return numa_num_configured_nodes();
+  }
+#endif
+  return 1;
+}
+
+void bind_to_node(int node) {
+#ifdef KMEANS_USE_NUMA
+  if (numa_available() < 0 || node >= numa_num_configured_nodes()) {
+    return;
+  }
+  if (numa_run_on_node(node) != 0) {
+    LOG(WARN) << "unable to bind thread to node " << node;
+  }
+#else
+  (void)node;
+#endif
+}
+
+}  // namespace cluster
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,40 @@
+#ifndef FIXTURES_H
+#define FIXTURES_H
+
+#include <cstring>
+#include <random>
+#include "matrix.h"
+
+// Data shared by the tests.
+
+// k gaussian blobs of unit spread; row i belongs to blob i % k, whose mean
+// is drawn from N(0, spread^2) per dimension
+template <typename DType>
+cluster::Matrix<DType> make_blobs(size_t n, size_t d, size_t k, unsigned seed,
+                                  DType spread = 4) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<DType> dis(0, 1);
+  cluster::Matrix<DType> means(k, d), data(n, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      means(i, j) = spread * dis(gen);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = means(i % k, j) + dis(gen);
+  return data;
+}
+
+template <typename DType>
+bool same_bits(const cluster::Matrix<DType> &a,
+               const cluster::Matrix<DType> &b) {
+  if (a.rows() != b.rows() || a.cols() != b.cols())
+    return false;
+  for (size_t i = 0; i < a.rows(); ++i)
+    if (std::memcmp(a.row(i), b.row(i), a.cols() * sizeof(DType)) != 0)
+      return false;
+  return true;
+}
+
+#endif  // FIXTURES_H
+
+// vim: ts=2 sts=2 sw=2
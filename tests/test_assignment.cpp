@@ -0,0 +1,81 @@
+#include <cmath>
+#include <random>
+#include "assignment.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+void test_gemm_matches_pairwise(size_t n, size_t d, size_t k) {
+  mt19937 gen(7);
+  normal_distribution<DType> dis(0, 1);
+  cluster::Matrix<DType> data(n, d), centers(k, d, true);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      centers(i, j) = 10 * dis(gen);
+  // points scattered tightly around known centers, so there are no ties
+  vector<int> expected(n);
+  for (size_t i = 0; i < n; ++i) {
+    expected[i] = static_cast<int>(i % k);
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = centers(expected[i], j) + 0.1 * dis(gen);
+  }
+
+  cluster::Assigner<DType> pairwise, gemm;
+  pairwise.prepare(centers, cluster::AssignMethod::PAIRWISE);
+  gemm.prepare(centers, cluster::AssignMethod::GEMM);
+  assert(!pairwise.use_gemm() && gemm.use_gemm());
+
+  vector<int> labels_p(n), labels_g(n);
+  vector<DType> dists_p(n), dists_g(n), workspace;
+  pairwise.assign(data.data(), n, data.stride(), labels_p.data(),
+                  dists_p.data(), workspace);
+  gemm.assign(data.data(), n, data.stride(), labels_g.data(),
+              dists_g.data(), workspace);
+  for (size_t i = 0; i < n; ++i) {
+    assert(labels_p[i] == expected[i]);
+    assert(labels_g[i] == expected[i]);
+    assert(fabs(dists_p[i] - dists_g[i]) < 1e-2 * (1 + dists_p[i]));
+  }
+}
+
+int main() {
+  log_level = DEBUG;
+  // odd sizes exercise partial point and center tiles
+  test_gemm_matches_pairwise<float>(333, 3, 5);
+  test_gemm_matches_pairwise<float>(1000, 77, 130);
+  test_gemm_matches_pairwise<double>(1000, 129, 261);
+
+  assert(!cluster::Assigner<float>::prefer_gemm(2, 1000));
+  assert(cluster::Assigner<float>::prefer_gemm(256, 1000));
+
+  // batch predict agrees whichever engine is forced
+  mt19937 gen(3);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> centers(100, 96, true), points(500, 96);
+  for (size_t i = 0; i < centers.rows(); ++i)
+    for (size_t j = 0; j < centers.cols(); ++j)
+      centers(i, j) = 10 * dis(gen);
+  for (size_t i = 0; i < points.rows(); ++i)
+    for (size_t j = 0; j < points.cols(); ++j)
+      points(i, j) = centers(i % 100, j) + dis(gen);
+  cluster::Kmeans<float> kmeans(100, 2);
+  kmeans.set_centers(centers);
+  vector<int> labels_p, labels_g;
+  kmeans.set_assign_method(cluster::AssignMethod::PAIRWISE);
+  auto ret = kmeans.predict(points, labels_p);
+  assert(ret == cluster::Status::OK);
+  kmeans.set_assign_method(cluster::AssignMethod::GEMM);
+  ret = kmeans.predict(points, labels_g);
+  assert(ret == cluster::Status::OK);
+  assert(labels_p == labels_g);
+  for (size_t i = 0; i < points.rows(); ++i) {
+    assert(labels_g[i] == static_cast<int>(i % 100));
+  }
+
+  Test::test_passed("test assignment");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,71 @@
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+void test_same_as_lloyd(cluster::Algorithm algorithm, size_t d, size_t k,
+    int n_thread) {
+  auto data = make_blobs<DType>(6000, d, k, 11, 5);
+  // seed every run with the same centers
+  cluster::Matrix<DType> seeds(k, data.cols());
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      seeds(i, j) = data(3 * i, j);
+
+  // bounded passes match the pairwise path, not the GEMM one AUTO would
+  // pick for d, k >= 64
+  cluster::Kmeans<DType> lloyd(k, n_thread, 20, 0);
+  lloyd.set_algorithm(cluster::Algorithm::LLOYD);
+  lloyd.set_assign_method(cluster::AssignMethod::PAIRWISE);
+  lloyd.set_centers(seeds);
+  auto ret = lloyd.fit(data, true);
+  assert(ret == cluster::Status::OK);
+
+  cluster::Kmeans<DType> bounded(k, n_thread, 20, 0);
+  bounded.set_algorithm(algorithm);
+  bounded.set_centers(seeds);
+  ret = bounded.fit(data, true);
+  assert(ret == cluster::Status::OK);
+
+  assert(lloyd.labels() == bounded.labels());
+  assert(lloyd.centers() == bounded.centers());
+
+  // nothing is skipped while bounds are initialized, most of it afterwards
+  auto const &skipped = bounded.dist_skipped();
+  assert(skipped.size() == 20);
+  assert(skipped[0] == 0);
+  assert(skipped.back() > data.rows() * k / 2);
+  for (auto s : lloyd.dist_skipped()) {
+    assert(s == 0);
+  }
+}
+
+int main() {
+  log_level = WARN;
+  test_same_as_lloyd<float>(cluster::Algorithm::HAMERLY, 5, 8, 1);
+  test_same_as_lloyd<float>(cluster::Algorithm::HAMERLY, 5, 8, 4);
+  test_same_as_lloyd<double>(cluster::Algorithm::HAMERLY, 5, 8, 3);
+  test_same_as_lloyd<float>(cluster::Algorithm::ELKAN, 5, 40, 1);
+  test_same_as_lloyd<float>(cluster::Algorithm::ELKAN, 5, 40, 4);
+  test_same_as_lloyd<double>(cluster::Algorithm::ELKAN, 5, 40, 2);
+  test_same_as_lloyd<float>(cluster::Algorithm::YINYANG, 5, 40, 1);
+  test_same_as_lloyd<float>(cluster::Algorithm::YINYANG, 5, 300, 4);
+  test_same_as_lloyd<double>(cluster::Algorithm::YINYANG, 5, 300, 2);
+  test_same_as_lloyd<float>(cluster::Algorithm::AUTO, 5, 40, 2);
+  test_same_as_lloyd<float>(cluster::Algorithm::ELKAN, 64, 64, 4);
+  test_same_as_lloyd<double>(cluster::Algorithm::YINYANG, 64, 128, 3);
+
+  assert(cluster::BoundedAssigner<float>::choose(1000, 8) ==
+         cluster::Algorithm::HAMERLY);
+  assert(cluster::BoundedAssigner<float>::choose(1000, 100) ==
+         cluster::Algorithm::ELKAN);
+  assert(cluster::BoundedAssigner<float>::choose(1000, 4096) ==
+         cluster::Algorithm::YINYANG);
+
+  Test::test_passed("test bounds");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
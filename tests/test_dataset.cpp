@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+string temp_path() {
+  char path[] = "/tmp/test_dataset_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  return path;
+}
+
+template <typename DType>
+void test_round_trip(bool padded) {
+  cluster::Matrix<DType> data(37, 5);
+  for (size_t i = 0; i < data.rows(); ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      data(i, j) = static_cast<DType>(i) / 3 - static_cast<DType>(j) / 7;
+
+  auto path = temp_path();
+  assert(cluster::save_dataset(path.c_str(), data, padded) ==
+         cluster::Status::OK);
+  assert(cluster::is_dataset(path.c_str()));
+
+  cluster::Matrix<DType> mapped;
+  assert(cluster::map_dataset(path.c_str(), mapped) == cluster::Status::OK);
+  assert(mapped.rows() == data.rows() && mapped.cols() == data.cols());
+  assert(mapped.padded() == padded);
+  assert(mapped.to_vectors() == data.to_vectors());
+  // payload starts on a cache line, as do padded rows
+  assert(reinterpret_cast<uintptr_t>(mapped.data()) % 64 == 0);
+  if (padded)
+    assert(reinterpret_cast<uintptr_t>(mapped.row(1)) % 64 == 0);
+
+  // writes stay in the private mapping
+  mapped(0, 0) = 42;
+  cluster::Matrix<DType> again;
+  assert(cluster::map_dataset(path.c_str(), again) == cluster::Status::OK);
+  assert(again(0, 0) == data(0, 0));
+
+  // the other element type is rejected
+  cluster::Matrix<float> as_float;
+  cluster::Matrix<double> as_double;
+  if (sizeof(DType) == sizeof(float))
+    assert(cluster::map_dataset(path.c_str(), as_double) ==
+           cluster::Status::FORMAT_ERROR);
+  else
+    assert(cluster::map_dataset(path.c_str(), as_float) ==
+           cluster::Status::FORMAT_ERROR);
+
+  // batches are views of the mapping
+  cluster::DatasetReader<DType> reader;
+  cluster::Matrix<DType> batch;
+  assert(reader.open(path.c_str()) == cluster::Status::OK);
+  size_t rows = 0;
+  while (reader.read(10, batch) == cluster::Status::OK && !batch.empty()) {
+    assert(batch.row_vector(0) == data.row_vector(rows));
+    rows += batch.rows();
+  }
+  assert(rows == data.rows());
+  remove(path.c_str());
+}
+
+void test_bad_files() {
+  cluster::Matrix<float> mapped;
+  auto path = temp_path();
+  {
+    ofstream fout(path);
+    fout << "1 2 3\n4 5 6\n";
+  }
+  assert(!cluster::is_dataset(path.c_str()));
+  assert(cluster::map_dataset(path.c_str(), mapped) ==
+         cluster::Status::FORMAT_ERROR);
+
+  // header claims more rows than the file holds
+  cluster::Matrix<float> data(4, 3);
+  assert(cluster::save_dataset(path.c_str(), data) == cluster::Status::OK);
+  assert(truncate(path.c_str(), 64 + 3 * 3 * sizeof(float)) == 0);
+  assert(cluster::map_dataset(path.c_str(), mapped) ==
+         cluster::Status::FORMAT_ERROR);
+  remove(path.c_str());
+  assert(cluster::map_dataset(path.c_str(), mapped) ==
+         cluster::Status::IO_ERROR);
+}
+
+void test_fit_mapped() {
+  cluster::Matrix<float> data(3000, 3);
+  for (size_t i = 0; i < data.rows(); ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      data(i, j) = (i % 3) * 10 + (i * 7 + j) % 5 * 0.1f;
+  cluster::Matrix<float> seeds(3, 3);
+  for (size_t i = 0; i < 3; ++i)
+    for (size_t j = 0; j < 3; ++j)
+      seeds(i, j) = data(i, j);
+  auto path = temp_path();
+  assert(cluster::save_dataset(path.c_str(), data, true) ==
+         cluster::Status::OK);
+
+  cluster::Kmeans<float> kmeans(3);
+  kmeans.set_centers(seeds);
+  assert(kmeans.fit(data, true) == cluster::Status::OK);
+  assert(kmeans.fit(path.c_str()) == cluster::Status::OK);
+  vector<int> mapped_labels, labels;
+  assert(kmeans.predict(path.c_str(), mapped_labels) == cluster::Status::OK);
+  assert(kmeans.predict(data, labels) == cluster::Status::OK);
+  assert(mapped_labels == labels);
+  remove(path.c_str());
+}
+
+int main() {
+  log_level = NONE;
+  test_round_trip<float>(false);
+  test_round_trip<float>(true);
+  test_round_trip<double>(false);
+  test_round_trip<double>(true);
+  test_bad_files();
+  test_fit_mapped();
+  Test::test_passed("test dataset");
+  return 0;
+}
+// vim: ts=2 sts=2 sw=2
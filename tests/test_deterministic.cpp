@@ -0,0 +1,115 @@
+#include <unistd.h>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+cluster::Matrix<DType> fit(const cluster::Matrix<DType> &data, int n_thread,
+                           cluster::InitMethod init,
+                           cluster::Algorithm algorithm, size_t batch_size) {
+  cluster::Kmeans<DType> kmeans(10, n_thread, 30, 0, init);
+  kmeans.set_seed(42);
+  kmeans.set_deterministic(true);
+  kmeans.set_algorithm(algorithm);
+  if (batch_size > 0)
+    kmeans.set_minibatch(batch_size, 500);
+  auto ret = kmeans.fit(data);
+  assert(ret == cluster::Status::OK);
+  assert(kmeans.seed() == 42);
+  return kmeans.center_matrix();
+}
+
+// loosely separated blobs, so the passes do many reassignments
+template <typename DType>
+void test_thread_count_invariance() {
+  auto data = make_blobs<DType>(20000, 5, 10, 11, 3);
+  for (auto init : {cluster::InitMethod::RANDOM,
+                    cluster::InitMethod::KMEANS_PLUSPLUS,
+                    cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS,
+                    cluster::InitMethod::KMEANS_PARALLEL}) {
+    for (auto algorithm : {cluster::Algorithm::LLOYD,
+                           cluster::Algorithm::HAMERLY}) {
+      auto reference = fit(data, 1, init, algorithm, 0);
+      for (int n_thread : {2, 3, 8})
+        assert(same_bits(reference, fit(data, n_thread, init, algorithm, 0)));
+    }
+  }
+  // mini-batches are drawn from the seed as well
+  auto reference = fit(data, 1, cluster::InitMethod::KMEANS_PLUSPLUS,
+                       cluster::Algorithm::LLOYD, 1000);
+  assert(same_bits(reference, fit(data, 4,
+      cluster::InitMethod::KMEANS_PLUSPLUS, cluster::Algorithm::LLOYD, 1000)));
+}
+
+// k * d too large for per-slice sums, samples are bucketed by label instead
+template <typename DType>
+void test_bucketed() {
+  auto data = make_blobs<DType>(3000, 256, 300, 11, 3);
+  cluster::Matrix<DType> reference;
+  for (int n_thread : {1, 3}) {
+    cluster::Kmeans<DType> kmeans(300, n_thread, 5, 0,
+                                  cluster::InitMethod::RANDOM);
+    kmeans.set_seed(3);
+    kmeans.set_deterministic(true);
+    auto ret = kmeans.fit(data);
+    assert(ret == cluster::Status::OK);
+    if (n_thread == 1)
+      reference = kmeans.center_matrix();
+    else
+      assert(same_bits(reference, kmeans.center_matrix()));
+  }
+}
+
+template <typename DType>
+void test_stream() {
+  auto data = make_blobs<DType>(10000, 4, 10, 11, 3);
+  char path[] = "/tmp/test_deterministic_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  auto ret = cluster::save_dataset(path, data);
+  assert(ret == cluster::Status::OK);
+
+  cluster::Matrix<DType> reference;
+  for (int n_thread : {1, 2, 5}) {
+    cluster::Kmeans<DType> kmeans(10, n_thread, 30, 0);
+    kmeans.set_seed(7);
+    kmeans.set_deterministic(true);
+    kmeans.set_chunk_size(3000);
+    ret = kmeans.fit(path, nullptr);
+    assert(ret == cluster::Status::OK);
+    if (n_thread == 1)
+      reference = kmeans.center_matrix();
+    else
+      assert(same_bits(reference, kmeans.center_matrix()));
+  }
+  unlink(path);
+}
+
+// without a seed every fit draws its own, which repeats the run
+void test_seed_reported() {
+  auto data = make_blobs<double>(5000, 3, 10, 11, 3);
+  cluster::Kmeans<double> first(10, 4, 30, 0);
+  first.set_deterministic(true);
+  first.fit(data);
+  cluster::Kmeans<double> second(10, 2, 30, 0);
+  second.set_deterministic(true);
+  second.set_seed(first.seed());
+  second.fit(data);
+  assert(same_bits(first.center_matrix(), second.center_matrix()));
+}
+
+int main() {
+  log_level = WARN;
+  test_thread_count_invariance<float>();
+  test_thread_count_invariance<double>();
+  test_bucketed<float>();
+  test_stream<float>();
+  test_stream<double>();
+  test_seed_reported();
+  Test::test_passed("deterministic");
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,129 @@
+#include <cmath>
+#include <random>
+#include "distance.h"
+#include "matrix.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+void test_kernels(cluster::SimdLevel level) {
+  mt19937 gen(42);
+  uniform_real_distribution<DType> dis(-1, 1);
+  assert(cluster::set_simd_level(level));
+  auto const &kernels = cluster::distance_kernels<DType>();
+  assert(kernels.level == level);
+
+  // cover every tail length of every vector width
+  for (size_t d = 1; d <= 37; ++d) {
+    for (size_t k = 1; k <= 9; ++k) {
+      cluster::Matrix<DType> centers(k, d, true);
+      vector<DType> p(d);
+      for (auto &v : p) v = dis(gen);
+      for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < d; ++j)
+          centers(i, j) = dis(gen);
+
+      vector<DType> dists(k);
+      kernels.sqdist_1xk(p.data(), centers.data(), k, centers.stride(), d,
+                         dists.data());
+      int best = -1;
+      double best_dist = 0;
+      for (size_t i = 0; i < k; ++i) {
+        double expected = 0;
+        for (size_t j = 0; j < d; ++j) {
+          expected += (p[j] - centers(i, j)) * (p[j] - centers(i, j));
+        }
+        DType single = kernels.sqdist(p.data(), centers.row(i), d);
+        assert(fabs(single - expected) < 1e-4 * (1 + expected));
+        // same accumulation order in every kernel, results are bit-identical
+        assert(single == dists[i]);
+        if (best < 0 || dists[i] < best_dist) {
+          best = static_cast<int>(i);
+          best_dist = dists[i];
+        }
+      }
+
+      DType min_dist;
+      int label = kernels.nearest(p.data(), centers.data(), k,
+                                  centers.stride(), d, &min_dist);
+      assert(label == best);
+      assert(min_dist == dists[best]);
+    }
+
+    vector<DType> x(d), y(d), expected(d);
+    const DType a = dis(gen);
+    for (size_t j = 0; j < d; ++j) {
+      x[j] = dis(gen);
+      y[j] = dis(gen);
+      expected[j] = y[j] + a * x[j];
+    }
+    kernels.axpy(a, x.data(), d, y.data());
+    for (size_t j = 0; j < d; ++j) {
+      assert(fabs(y[j] - expected[j]) < 1e-5);
+    }
+  }
+}
+
+// the tables unrolled for a fixed d give the generic table's exact results
+template <typename DType>
+void test_fixed_dims(cluster::SimdLevel level) {
+  mt19937 gen(7);
+  uniform_real_distribution<DType> dis(-1, 1);
+  assert(cluster::set_simd_level(level));
+  auto const &generic = cluster::distance_kernels<DType>();
+  assert(generic.dim == 0);
+  assert(&cluster::distance_kernels<DType>(5) == &generic);
+
+  for (size_t d : cluster::kFixedDims) {
+    auto const &fixed = cluster::distance_kernels<DType>(d);
+    assert(fixed.dim == d);
+    assert(fixed.level == level);
+    for (size_t k : {1, 4, 7, 21}) {
+      cluster::Matrix<DType> centers(k, d, true);
+      vector<DType> p(d);
+      for (auto &v : p) v = dis(gen);
+      for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < d; ++j)
+          centers(i, j) = dis(gen);
+
+      vector<DType> expected(k), dists(k);
+      generic.sqdist_1xk(p.data(), centers.data(), k, centers.stride(), d,
+                         expected.data());
+      fixed.sqdist_1xk(p.data(), centers.data(), k, centers.stride(), d,
+                       dists.data());
+      assert(dists == expected);
+      for (size_t i = 0; i < k; ++i) {
+        assert(fixed.sqdist(p.data(), centers.row(i), d) == expected[i]);
+        assert(fixed.dot(p.data(), centers.row(i), d) ==
+               generic.dot(p.data(), centers.row(i), d));
+      }
+      DType generic_min, fixed_min;
+      assert(fixed.nearest(p.data(), centers.data(), k, centers.stride(), d,
+                           &fixed_min) ==
+             generic.nearest(p.data(), centers.data(), k, centers.stride(), d,
+                             &generic_min));
+      assert(fixed_min == generic_min);
+    }
+  }
+}
+
+int main() {
+  log_level = DEBUG;
+  auto detected = cluster::detect_simd_level();
+  LOG(INFO) << "detected simd level "
+    << cluster::simd_levels[static_cast<int>(detected)];
+
+  for (int i = 0; i <= static_cast<int>(detected); ++i) {
+    auto level = static_cast<cluster::SimdLevel>(i);
+    test_kernels<float>(level);
+    test_kernels<double>(level);
+    test_fixed_dims<float>(level);
+    test_fixed_dims<double>(level);
+  }
+
+  Test::test_passed("test distance");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
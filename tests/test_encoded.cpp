@@ -0,0 +1,135 @@
+#include <cmath>
+#include <limits>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// each encoding's rounding error, and its special values
+void test_round_trip() {
+  const float inf = numeric_limits<float>::infinity();
+  cluster::Matrix<float> data(1, 9);
+  const float values[9] = {0.f, -1.5f, 65504.f, 70000.f, 1.f / (1 << 24),
+                           -inf, 3.14159f, 1e-3f, 1e30f};
+  copy(values, values + 9, data.row(0));
+
+  auto half = cluster::EncodedMatrix<float>(data, cluster::Encoding::FLOAT16)
+    .decode();
+  assert(half(0, 0) == 0 && half(0, 1) == -1.5f && half(0, 2) == 65504.f);
+  assert(half(0, 3) == inf && half(0, 4) == 1.f / (1 << 24));
+  assert(half(0, 5) == -inf && half(0, 8) == inf);
+  assert(fabs(half(0, 6) - 3.14159f) < 3.14159f / 2048);
+  assert(fabs(half(0, 7) - 1e-3f) < 1e-3f / 2048);
+
+  auto bf = cluster::EncodedMatrix<float>(data, cluster::Encoding::BFLOAT16)
+    .decode();
+  assert(bf(0, 1) == -1.5f && bf(0, 5) == -inf);
+  for (int j : {2, 3, 6, 7, 8})
+    assert(fabs(bf(0, j) - values[j]) <= fabs(values[j]) / 256);
+
+  auto blobs = make_blobs<double>(1000, 5, 3, 5);
+  for (size_t i = 0; i < blobs.rows(); ++i)
+    blobs(i, 4) = 7;  // constant dimensions come back exactly
+  cluster::EncodedMatrix<double> codes(blobs, cluster::Encoding::INT8, 3);
+  assert(codes.bytes() == 1000 * 5 + 2 * 5 * sizeof(double));
+  auto decoded = codes.decode();
+  for (size_t j = 0; j < 5; ++j) {
+    double lo = blobs(0, j), hi = blobs(0, j);
+    for (size_t i = 0; i < blobs.rows(); ++i) {
+      lo = min(lo, blobs(i, j));
+      hi = max(hi, blobs(i, j));
+    }
+    for (size_t i = 0; i < blobs.rows(); ++i)
+      assert(fabs(decoded(i, j) - blobs(i, j)) <= (hi - lo) / 254 / 2 + 1e-12);
+  }
+  assert(decoded(17, 4) == 7);
+}
+
+// every level widens to the same bits, for every tail length
+template <typename DType>
+void test_levels() {
+  auto detected = cluster::detect_simd_level();
+  for (size_t d = 1; d <= 19; ++d) {
+    auto data = make_blobs<DType>(50, d, 4, 5);
+    for (auto encoding : {cluster::Encoding::FLOAT16,
+                          cluster::Encoding::BFLOAT16,
+                          cluster::Encoding::INT8}) {
+      cluster::EncodedMatrix<DType> encoded(data, encoding);
+      assert(cluster::set_simd_level(cluster::SimdLevel::SCALAR));
+      auto reference = encoded.decode();
+      assert(cluster::set_simd_level(detected));
+      assert(same_bits(reference, encoded.decode()));
+    }
+  }
+}
+
+// fitting the encoded samples is fitting their decoded values
+template <typename DType>
+void test_fit(cluster::Encoding encoding, int n_thread,
+              cluster::Algorithm algorithm, bool deterministic) {
+  const size_t k = 6;
+  auto data = make_blobs<DType>(5000, 7, k, 5);
+  cluster::EncodedMatrix<DType> encoded(data, encoding, n_thread);
+  auto decoded = encoded.decode();
+  cluster::Matrix<DType> seeds(k, 7);
+  for (size_t i = 0; i < k; ++i)
+    copy(decoded.row(3 * i), decoded.row(3 * i) + 7, seeds.row(i));
+
+  cluster::Kmeans<DType> plain(k, n_thread, 30, 0), fused(k, n_thread, 30, 0);
+  for (auto *kmeans : {&plain, &fused}) {
+    kmeans->set_algorithm(algorithm);
+    kmeans->set_deterministic(deterministic);
+    kmeans->set_centers(seeds);
+  }
+  assert(plain.fit(decoded, true) == cluster::Status::OK);
+  assert(fused.fit(encoded, true) == cluster::Status::OK);
+  assert(plain.labels() == fused.labels());
+  assert(same_bits(plain.center_matrix(), fused.center_matrix()));
+
+  vector<int> labels;
+  assert(fused.predict(encoded, labels) == cluster::Status::OK);
+  assert(labels == fused.labels());
+  DType plain_cost, fused_cost;
+  assert(plain.cost(decoded, plain_cost) == cluster::Status::OK);
+  assert(fused.cost(encoded, fused_cost) == cluster::Status::OK);
+  assert(fabs(plain_cost - fused_cost) <= 1e-4 * plain_cost);
+}
+
+// unseeded fits seed from decoded samples and find the blobs
+void test_unseeded() {
+  auto data = make_blobs<float>(20000, 4, 5, 5);
+  for (size_t i = 0; i < data.rows(); ++i)
+    data(i, i % 5 % 4) += 20 * (i % 5 + 1);  // well separated
+  cluster::EncodedMatrix<float> encoded(data, cluster::Encoding::BFLOAT16);
+  cluster::Kmeans<float> kmeans(5, 2, 50, 0);
+  kmeans.set_chunk_size(2000);
+  assert(kmeans.fit(encoded) == cluster::Status::OK);
+  assert(kmeans.labels().size() == data.rows());
+  float cost;
+  kmeans.cost(data, cost);
+  assert(cost < 1.5 * data.rows() * data.cols());
+
+  cluster::Kmeans<float> other(5, 1, 5, 0);
+  cluster::Matrix<float> seeds(5, 3);
+  other.set_centers(seeds);
+  assert(other.fit(encoded, true) == cluster::Status::DIM_ERROR);
+}
+
+int main() {
+  log_level = WARN;
+  test_round_trip();
+  test_levels<float>();
+  test_levels<double>();
+  for (auto encoding : {cluster::Encoding::FLOAT16, cluster::Encoding::INT8}) {
+    for (int n_thread : {1, 3}) {
+      test_fit<float>(encoding, n_thread, cluster::Algorithm::LLOYD, false);
+      test_fit<float>(encoding, n_thread, cluster::Algorithm::HAMERLY, false);
+      test_fit<double>(encoding, n_thread, cluster::Algorithm::LLOYD, true);
+    }
+  }
+  test_unseeded();
+  Test::test_passed("encoded");
+}
+
+// vim: ts=2 sts=2 sw=2
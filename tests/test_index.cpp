@@ -0,0 +1,111 @@
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// clustered codebook, so the cells of the index are meaningful
+template <typename DType>
+cluster::Matrix<DType> make_codebook(size_t k, size_t d, mt19937 &gen) {
+  normal_distribution<DType> dis(0, 1);
+  cluster::Matrix<DType> groups(32, d), centers(k, d);
+  for (size_t i = 0; i < groups.rows(); ++i)
+    for (size_t j = 0; j < d; ++j)
+      groups(i, j) = 10 * dis(gen);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      centers(i, j) = groups(i % groups.rows(), j) + 2 * dis(gen);
+  return centers;
+}
+
+// the exact index gives the labels of the full scan, and probing every
+// cell does too
+template <typename DType>
+void test_exact(size_t k, size_t d, int n_thread) {
+  mt19937 gen(5);
+  auto centers = make_codebook<DType>(k, d, gen);
+  normal_distribution<DType> dis(0, 12);
+  cluster::Matrix<DType> queries(2000, d);
+  for (size_t i = 0; i < queries.rows(); ++i)
+    for (size_t j = 0; j < d; ++j)
+      queries(i, j) = dis(gen);
+  // a few queries on or midway between centers, to exercise ties
+  for (size_t j = 0; j < d; ++j) {
+    queries(0, j) = centers(3, j);
+    queries(1, j) = (centers(4, j) + centers(4 + k / 2, j)) / 2;
+  }
+
+  cluster::Kmeans<DType> kmeans(k, n_thread);
+  kmeans.set_assign_method(cluster::AssignMethod::PAIRWISE);
+  kmeans.set_centers(centers);
+  vector<int> expected, labels;
+  assert(kmeans.predict(queries, expected) == cluster::Status::OK);
+
+  assert(kmeans.build_index() == cluster::Status::OK);
+  assert(!kmeans.index().empty());
+  assert(kmeans.predict(queries, labels) == cluster::Status::OK);
+  assert(labels == expected);
+  for (size_t i = 0; i < 100; ++i) {
+    DType dist;
+    int label;
+    kmeans.predict(queries.row(i), dist, label);
+    assert(label == expected[i]);
+  }
+
+  kmeans.set_index_probes(kmeans.index().num_lists());
+  kmeans.predict(queries, labels);
+  assert(labels == expected);
+
+  // approximate search still finds most labels
+  kmeans.set_index_probes(4);
+  kmeans.predict(queries, labels);
+  size_t hits = 0;
+  for (size_t i = 0; i < labels.size(); ++i)
+    hits += labels[i] == expected[i];
+  assert(hits > labels.size() / 2);
+
+  // new centers drop the index
+  kmeans.set_centers(centers);
+  assert(kmeans.index().empty());
+}
+
+// approximate search returns a center for every query, even when the
+// build leaves some cells empty and only one cell is probed
+template <typename DType>
+void test_probes(size_t k, size_t d) {
+  mt19937 gen(7);
+  auto centers = make_codebook<DType>(k, d, gen);
+  normal_distribution<DType> dis(0, 12);
+  cluster::Matrix<DType> queries(3000, d);
+  for (size_t i = 0; i < queries.rows(); ++i)
+    for (size_t j = 0; j < d; ++j)
+      queries(i, j) = dis(gen);
+  cluster::Kmeans<DType> kmeans(k, 2);
+  kmeans.set_centers(centers);
+  for (size_t n_probe : {1, 2, 4}) {
+    assert(kmeans.build_index(0, n_probe) == cluster::Status::OK);
+    assert(kmeans.index().num_lists() > n_probe);
+    vector<int> labels;
+    assert(kmeans.predict(queries, labels) == cluster::Status::OK);
+    for (auto label : labels)
+      assert(label >= 0 && label < static_cast<int>(k));
+  }
+}
+
+int main() {
+  log_level = WARN;
+  cluster::Kmeans<float> kmeans(4);
+  assert(kmeans.build_index() == cluster::Status::DIM_ERROR);
+  for (int n_thread : {1, 3}) {
+    test_exact<float>(1000, 4, n_thread);
+    test_exact<float>(3000, 16, n_thread);
+    test_exact<double>(2000, 8, n_thread);
+    test_exact<double>(50, 3, n_thread);
+  }
+  test_probes<float>(1000, 8);
+  test_probes<float>(5000, 16);
+  test_probes<double>(1000, 8);
+  Test::test_passed("index");
+}
+
+// vim: ts=2 sts=2 sw=2
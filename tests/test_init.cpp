@@ -0,0 +1,120 @@
+#include <set>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// seed only: n_iter = 0 stops fit() right after init
+template <typename DType>
+DType seed_cost(const cluster::Matrix<DType> &data, size_t k, int n_thread,
+                cluster::InitMethod init, cluster::Matrix<DType> &centers) {
+  cluster::Kmeans<DType> kmeans(k, n_thread, 0, 0, init);
+  auto ret = kmeans.fit(data);
+  assert(ret == cluster::Status::OK);
+  centers = kmeans.center_matrix();
+  DType cost;
+  ret = kmeans.cost(data, cost);
+  assert(ret == cluster::Status::OK);
+  return cost;
+}
+
+template <typename DType>
+size_t num_distinct(const cluster::Matrix<DType> &centers) {
+  set<vector<DType>> distinct;
+  for (size_t i = 0; i < centers.rows(); ++i)
+    distinct.insert(vector<DType>(centers.row(i),
+                                  centers.row(i) + centers.cols()));
+  return distinct.size();
+}
+
+template <typename DType>
+void test_distinct_centers(int n_thread) {
+  const size_t k = 20;
+  auto data = make_blobs<DType>(5000, 7, k, 3, 30);
+  cluster::Matrix<DType> centers;
+  for (auto init : {cluster::InitMethod::RANDOM,
+                    cluster::InitMethod::KMEANS_PLUSPLUS,
+                    cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS}) {
+    seed_cost(data, k, n_thread, init, centers);
+    assert(centers.rows() == k);
+    assert(num_distinct(centers) == k);
+  }
+}
+
+// more clusters than distinct samples: the distinct ones are all picked and
+// repeated instead of looping or leaving centers unset
+template <typename DType>
+void test_duplicates(int n_thread) {
+  const size_t k = 8, distinct = 5;
+  cluster::Matrix<DType> data(400, 3);
+  for (size_t i = 0; i < data.rows(); ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      data(i, j) = static_cast<DType>(10 * (i % distinct) + j);
+  cluster::Matrix<DType> centers;
+  for (auto init : {cluster::InitMethod::KMEANS_PLUSPLUS,
+                    cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS}) {
+    DType cost = seed_cost(data, k, n_thread, init, centers);
+    assert(centers.rows() == k);
+    assert(num_distinct(centers) == distinct);
+    assert(cost == 0);
+  }
+}
+
+// the greedy variant never does worse on average
+template <typename DType>
+void test_greedy(int n_thread) {
+  const size_t k = 30;
+  auto data = make_blobs<DType>(6000, 10, k, 3, 30);
+  cluster::Matrix<DType> centers;
+  double plain = 0, greedy = 0;
+  for (int trial = 0; trial < 10; ++trial) {
+    plain += seed_cost(data, k, n_thread,
+                       cluster::InitMethod::KMEANS_PLUSPLUS, centers);
+    greedy += seed_cost(data, k, n_thread,
+                        cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS, centers);
+  }
+  assert(greedy <= plain);
+}
+
+// k-means|| finds every blob; its recluster leaves the outer fit's state alone
+template <typename DType>
+void test_kmeans_parallel(int n_thread) {
+  const size_t k = 16, d = 8, n = 8000;
+  auto data = make_blobs<DType>(n, d, k, 3, 30);
+  cluster::Kmeans<DType> kmeans(k, n_thread, 100, 0);
+  // the paper's five rounds; the default two can leave close blobs without
+  // a candidate
+  kmeans.set_init_method(cluster::InitMethod::KMEANS_PARALLEL, 2 * k, 5);
+  auto ret = kmeans.fit(data);
+  assert(ret == cluster::Status::OK);
+  assert(kmeans.center_matrix().rows() == k);
+  assert(num_distinct(kmeans.center_matrix()) == k);
+  assert(kmeans.labels().size() == n);
+  DType cost;
+  kmeans.cost(data, cost);
+  // unit variance per dimension within blobs
+  assert(cost < 1.5 * n * d);
+
+  // fewer candidates than clusters falls back to k-means++
+  kmeans.set_init_method(cluster::InitMethod::KMEANS_PARALLEL, 1, 1);
+  ret = kmeans.fit(data);
+  assert(ret == cluster::Status::OK);
+  assert(num_distinct(kmeans.center_matrix()) == k);
+}
+
+int main() {
+  log_level = WARN;
+  for (int n_thread : {1, 4}) {
+    test_distinct_centers<float>(n_thread);
+    test_distinct_centers<double>(n_thread);
+    test_duplicates<float>(n_thread);
+    test_duplicates<double>(n_thread);
+    test_greedy<double>(n_thread);
+    test_kmeans_parallel<float>(n_thread);
+    test_kmeans_parallel<double>(n_thread);
+  }
+  Test::test_passed("init");
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,120 @@
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+cluster::Matrix<DType> make_data(size_t n, size_t d) {
+  mt19937 gen(17);
+  normal_distribution<DType> dis(0, 1);
+  cluster::Matrix<DType> data(n, d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = dis(gen) + (i % 3) * 6;
+  return data;
+}
+
+// one pass from fixed centers gives the exact means of the assigned samples
+template <typename DType>
+void test_means(int n_thread, cluster::Algorithm algorithm) {
+  const size_t n = 10007, d = 5, k = 6;
+  auto data = make_data<DType>(n, d);
+  cluster::Matrix<DType> seeds(k, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      seeds(i, j) = data(7 * i, j);
+
+  cluster::Kmeans<DType> kmeans(k, n_thread, 1, 0);
+  kmeans.set_algorithm(algorithm);
+  kmeans.set_centers(seeds);
+  vector<int> labels;
+  kmeans.predict(data, labels);
+  auto ret = kmeans.fit(data, true);
+  assert(ret == cluster::Status::OK);
+  assert(kmeans.labels() == labels);
+
+  vector<vector<double>> sums(k, vector<double>(d));
+  vector<size_t> counts(k);
+  for (size_t i = 0; i < n; ++i) {
+    ++counts[labels[i]];
+    for (size_t j = 0; j < d; ++j)
+      sums[labels[i]][j] += data(i, j);
+  }
+  const auto &centers = kmeans.center_matrix();
+  for (size_t i = 0; i < k; ++i) {
+    assert(counts[i] > 0);
+    for (size_t j = 0; j < d; ++j)
+      assert(fabs(centers(i, j) - sums[i][j] / counts[i]) < 1e-4);
+  }
+}
+
+// a center no sample is closest to is moved to the farthest sample instead
+// of staying put, and the fit ends without empty clusters
+template <typename DType>
+void test_empty_cluster(int n_thread, bool deterministic) {
+  const size_t n = 6000, d = 3, k = 5;
+  auto data = make_data<DType>(n, d);
+  cluster::Matrix<DType> seeds(k, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      seeds(i, j) = i < 3 ? data(i, j) : 1000 + i;
+
+  cluster::Kmeans<DType> kmeans(k, n_thread, 50, 0);
+  kmeans.set_deterministic(deterministic);
+  kmeans.set_centers(seeds);
+  auto ret = kmeans.fit(data, true);
+  assert(ret == cluster::Status::OK);
+  vector<size_t> counts(k);
+  for (auto label : kmeans.labels())
+    ++counts[label];
+  for (size_t i = 0; i < k; ++i) {
+    assert(counts[i] > 0);
+    assert(kmeans.center_matrix()(i, 0) < 100);
+  }
+}
+
+// NUMA mode over emulated nodes reaches the same fit as the shared passes
+template <typename DType>
+void test_numa(int n_thread, bool deterministic) {
+  auto data = make_data<DType>(9000, 6);
+  cluster::Matrix<DType> seeds(4, 6);
+  for (size_t i = 0; i < seeds.rows(); ++i)
+    for (size_t j = 0; j < seeds.cols(); ++j)
+      seeds(i, j) = data(5 * i, j);
+
+  cluster::Kmeans<DType> shared(4, n_thread, 20, 0), numa(4, n_thread, 20, 0);
+  shared.set_deterministic(deterministic);
+  shared.set_centers(seeds);
+  numa.set_deterministic(deterministic);
+  numa.set_numa(true);
+  numa.set_centers(seeds);
+  assert(shared.fit(data, true) == cluster::Status::OK);
+  assert(numa.fit(data, true) == cluster::Status::OK);
+  assert(shared.labels() == numa.labels());
+  for (size_t i = 0; i < seeds.rows(); ++i)
+    for (size_t j = 0; j < seeds.cols(); ++j)
+      assert(fabs(shared.center_matrix()(i, j) -
+                  numa.center_matrix()(i, j)) < 1e-4);
+}
+
+int main() {
+  log_level = WARN;
+  for (int n_thread : {1, 3, 8}) {
+    test_means<float>(n_thread, cluster::Algorithm::LLOYD);
+    test_means<double>(n_thread, cluster::Algorithm::LLOYD);
+    test_means<double>(n_thread, cluster::Algorithm::ELKAN);
+    test_empty_cluster<float>(n_thread, false);
+    test_empty_cluster<double>(n_thread, true);
+  }
+  setenv("KMEANS_NUMA_NODES", "2", 1);
+  for (int n_thread : {1, 3, 8}) {
+    test_numa<float>(n_thread, false);
+    test_numa<double>(n_thread, true);
+  }
+  Test::test_passed("lloyd");
+}
+
+// vim: ts=2 sts=2 sw=2
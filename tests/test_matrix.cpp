@@ -0,0 +1,73 @@
+#include <cstdint>
+#include "kmeans.h"
+#include "matrix.h"
+#include "utils.h"
+
+using namespace std;
+
+int main() {
+  log_level = DEBUG;
+  vector<vector<float>> rows{{1., 2., 3.}, {4., 5., 6.}};
+
+  // test conversion from nested vectors
+  cluster::Matrix<float> m;
+  auto ret = cluster::Matrix<float>::from_vectors(rows, m);
+  assert(ret == cluster::Status::OK);
+  assert(m.rows() == 2 && m.cols() == 3 && m.stride() == 3);
+  assert(m(1, 2) == 6.);
+  assert(m.to_vectors() == rows);
+
+  // test padded rows are aligned and zero filled
+  cluster::Matrix<float> padded;
+  ret = cluster::Matrix<float>::from_vectors(rows, padded, true);
+  assert(ret == cluster::Status::OK);
+  assert(padded.stride() == 16);
+  for (size_t i = 0; i < padded.rows(); ++i) {
+    assert(reinterpret_cast<uintptr_t>(padded.row(i)) % 64 == 0);
+    for (size_t j = padded.cols(); j < padded.stride(); ++j) {
+      assert(padded(i, j) == 0.);
+    }
+  }
+  assert(padded.to_vectors() == rows);
+
+  // test copy owns its memory, move steals it
+  cluster::Matrix<float> copy(padded);
+  assert(copy.data() != padded.data());
+  assert(copy.to_vectors() == rows);
+  const float *buffer = copy.data();
+  cluster::Matrix<float> moved(std::move(copy));
+  assert(moved.data() == buffer && copy.empty());
+
+  // test wrapping external memory
+  vector<double> external{1., 2., 3., 4.};
+  cluster::Matrix<double> view(external.data(), 2, 2, 2);
+  assert(view(1, 0) == 3.);
+  external[2] = 7.;
+  assert(view(1, 0) == 7.);
+
+  // test ragged rows are rejected
+  rows.push_back({7., 8.});
+  ret = cluster::Matrix<float>::from_vectors(rows, m);
+  assert(ret == cluster::Status::DIM_ERROR);
+
+  // test fit/predict on a matrix
+  cluster::Matrix<float> data(4, 2);
+  data(0, 0) = 0.; data(0, 1) = 0.;
+  data(1, 0) = 0.1; data(1, 1) = 0.;
+  data(2, 0) = 10.; data(2, 1) = 10.;
+  data(3, 0) = 10.1; data(3, 1) = 10.;
+  cluster::Kmeans<float> kmeans(2);
+  ret = kmeans.fit(data);
+  assert(ret == cluster::Status::OK);
+  vector<int> labels;
+  ret = kmeans.predict(data, labels);
+  assert(ret == cluster::Status::OK);
+  assert(labels[0] == labels[1] && labels[2] == labels[3]);
+  assert(labels[0] != labels[2]);
+  assert(kmeans.center_matrix().rows() == 2);
+
+  Test::test_passed("test matrix");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
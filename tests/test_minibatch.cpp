@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+void test_minibatch(int n_thread) {
+  const size_t k = 10;
+  auto data = make_blobs<DType>(50000, 4, k, 7, 30);
+  // rows 0..k-1 come from different blobs
+  cluster::Matrix<DType> seeds(k, data.cols());
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      seeds(i, j) = data(i, j);
+
+  cluster::Kmeans<DType> lloyd(k, n_thread);
+  lloyd.set_centers(seeds);
+  auto ret = lloyd.fit(data, true);
+  assert(ret == cluster::Status::OK);
+  DType lloyd_cost;
+  lloyd.cost(data, lloyd_cost);
+
+  cluster::Kmeans<DType> minibatch(k, n_thread);
+  minibatch.set_minibatch(500, 2000);
+  minibatch.set_centers(seeds);
+  ret = minibatch.fit(data, true);
+  assert(ret == cluster::Status::OK);
+  DType minibatch_cost;
+  minibatch.cost(data, minibatch_cost);
+  assert(minibatch_cost < 1.02 * lloyd_cost);
+  assert(minibatch.labels() == lloyd.labels());
+
+  // the holdout is a sample of the same data
+  DType mean_cost = lloyd_cost / data.rows();
+  assert(minibatch.holdout_cost() > 0.8 * mean_cost);
+  assert(minibatch.holdout_cost() < 1.2 * mean_cost);
+
+  // same data streamed from a file
+  char path[] = "/tmp/test_minibatch_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  {
+    ofstream fout(path);
+    fout.precision(10);
+    for (size_t i = 0; i < data.rows(); ++i) {
+      for (size_t j = 0; j < data.cols(); ++j)
+        fout << data(i, j) << ' ';
+      fout << '\n';
+    }
+  }
+  cluster::TextReader<DType> reader;
+  ret = reader.open(path);
+  assert(ret == cluster::Status::OK);
+  cluster::Kmeans<DType> streaming(k, n_thread);
+  streaming.set_minibatch(500, 2000);
+  streaming.set_centers(seeds);
+  ret = streaming.fit(reader, nullptr, true);
+  assert(ret == cluster::Status::OK);
+  assert(streaming.labels().empty());
+  DType streaming_cost;
+  streaming.cost(data, streaming_cost);
+  assert(streaming_cost < 1.05 * lloyd_cost);
+  assert(streaming.holdout_cost() < 1.2 * mean_cost);
+  remove(path);
+}
+
+// an unseeded fit seeds from its own draw, every epoch still gets a full
+// pass of batches
+void test_epochs() {
+  const size_t n = 20000, batch = 500, holdout = 1000;
+  auto data = make_blobs<float>(n, 4, 10, 7, 30);
+  cluster::Kmeans<float> minibatch(10, 2, 3, 0);
+  minibatch.set_minibatch(batch, holdout);
+  assert(minibatch.fit(data) == cluster::Status::OK);
+  const auto iterations = minibatch.stats().iterations;
+  assert(iterations.size() == 3);
+  const size_t pass = (n - holdout + batch - 1) / batch * batch;
+  for (const auto &epoch : iterations)
+    assert(epoch.samples == pass);
+}
+
+void test_ragged_stream() {
+  char path[] = "/tmp/test_minibatch_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  {
+    ofstream fout(path);
+    fout << "1 2\n3 4\n5\n";
+  }
+  cluster::TextReader<float> reader;
+  cluster::Matrix<float> batch;
+  assert(reader.open(path) == cluster::Status::OK);
+  assert(reader.read(2, batch) == cluster::Status::OK);
+  assert(batch.rows() == 2 && batch.cols() == 2 && batch(1, 0) == 3);
+  assert(reader.read(2, batch) == cluster::Status::DIM_ERROR);
+  remove(path);
+}
+
+int main() {
+  log_level = WARN;
+  test_minibatch<float>(1);
+  test_minibatch<float>(4);
+  test_minibatch<double>(3);
+  test_epochs();
+  test_ragged_stream();
+  Test::test_passed("test minibatch");
+  return 0;
+}
+// vim: ts=2 sts=2 sw=2
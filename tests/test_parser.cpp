@@ -0,0 +1,147 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <unistd.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+string temp_path() {
+  char path[] = "/tmp/test_parser_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  return path;
+}
+
+template <typename DType>
+DType parse(const char *token) {
+  DType value = 0;
+  const char *end = cluster::parse_number(token, token + strlen(token), value);
+  assert(end == token + strlen(token));
+  return value;
+}
+
+void test_numbers() {
+  const char *tokens[] = {
+    "0", "-0", "1", "+7", "-3.25", "0.1", ".5", "5.", "1e3", "1E-3",
+    "2.5e+2", "123456789012345678901234", "0.000000000000000000000123",
+    "3.14159265358979323846", "1.7976931348623157e308", "4.9e-324",
+    "-2.2250738585072014e-308", "16777217", "0.30000000000000004", "inf",
+    "-nan"
+  };
+  for (auto token : tokens) {
+    double expected = strtod(token, nullptr);
+    double value = parse<double>(token);
+    if (std::isnan(expected))
+      assert(std::isnan(value));
+    else
+      assert(value == expected);
+    assert(parse<float>(token) == static_cast<float>(value) ||
+           std::isnan(expected));
+  }
+  // random decimals round like strtod
+  mt19937 gen(3);
+  uniform_real_distribution<double> dis(-1e4, 1e4);
+  char buffer[64];
+  for (int i = 0; i < 100000; ++i) {
+    snprintf(buffer, sizeof(buffer), "%.*g", 1 + i % 17, dis(gen));
+    assert(parse<double>(buffer) == strtod(buffer, nullptr));
+  }
+  float value;
+  const char *bad[] = {"", "-", ".", "e5", "abc"};
+  for (auto token : bad)
+    assert(cluster::parse_number(token, token + strlen(token), value) ==
+           nullptr);
+}
+
+void test_lines() {
+  double out[4];
+  const char *line = " 1\t2.5 -3\r";
+  assert(cluster::parse_line(line, line + strlen(line), out, 4) == 3);
+  assert(out[0] == 1 && out[1] == 2.5 && out[2] == -3);
+  assert(cluster::parse_line(line, line + strlen(line), out, 2) == 3);
+  line = "1 2x 3";
+  assert(cluster::parse_line(line, line + strlen(line), out, 4) == -1);
+  line = "  \t";
+  assert(cluster::parse_line(line, line + strlen(line), out, 4) == 0);
+}
+
+template <typename DType>
+void test_file(int n_thread) {
+  // large enough to be split into several chunks
+  const size_t n = 60000, d = 7;
+  cluster::Matrix<DType> data(n, d);
+  mt19937 gen(n_thread);
+  normal_distribution<DType> dis(0, 100);
+  auto path = temp_path();
+  {
+    ofstream fout(path);
+    fout.precision(12);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < d; ++j) {
+        data(i, j) = dis(gen);
+        fout << data(i, j) << (j + 1 < d ? " " : "");
+      }
+      // windows line endings and blank lines are tolerated
+      fout << (i % 1000 == 0 ? "\r\n\n" : "\n");
+    }
+  }
+  cluster::Matrix<DType> parsed;
+  assert(cluster::parse_text_file(path.c_str(), parsed, n_thread) ==
+         cluster::Status::OK);
+  assert(parsed.rows() == n && parsed.cols() == d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      assert(abs(parsed(i, j) - data(i, j)) <= 1e-9 * abs(data(i, j)) ||
+             sizeof(DType) == sizeof(float));
+
+  // same values as the streaming reader
+  cluster::TextReader<DType> reader;
+  cluster::Matrix<DType> streamed;
+  assert(reader.open(path.c_str()) == cluster::Status::OK);
+  assert(reader.read(n + 1, streamed) == cluster::Status::OK);
+  assert(streamed.to_vectors() == parsed.to_vectors());
+
+  // a short row in the middle is caught
+  {
+    ofstream fout(path, ios::app);
+    fout << "1 2 3\n";
+    for (size_t j = 0; j < d; ++j)
+      fout << j << ' ';
+  }
+  assert(cluster::parse_text_file(path.c_str(), parsed, n_thread) ==
+         cluster::Status::DIM_ERROR);
+  {
+    ofstream fout(path);
+    fout << "1 2\n3 4\n5 six\n";
+  }
+  assert(cluster::parse_text_file(path.c_str(), parsed, n_thread) ==
+         cluster::Status::FORMAT_ERROR);
+  {
+    ofstream fout(path);
+    fout << "1 2\n3 4";  // no trailing newline
+  }
+  assert(cluster::parse_text_file(path.c_str(), parsed, n_thread) ==
+         cluster::Status::OK);
+  assert(parsed.rows() == 2 && parsed(1, 1) == 4);
+  remove(path.c_str());
+  assert(cluster::parse_text_file(path.c_str(), parsed, n_thread) ==
+         cluster::Status::IO_ERROR);
+}
+
+int main() {
+  log_level = NONE;
+  test_numbers();
+  test_lines();
+  test_file<float>(1);
+  test_file<float>(4);
+  test_file<double>(3);
+  Test::test_passed("test parser");
+  return 0;
+}
+// vim: ts=2 sts=2 sw=2
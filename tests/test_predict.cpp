@@ -1,6 +1,56 @@
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <random>
 #include "kmeans.h"
 #include "utils.h"
 
+// counts every allocation of the process, to check predict() makes none;
+// gcc flags the malloc'd memory freed through inlined deletes
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+  ++allocations;
+  void *p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+// a served model: many threads predict concurrently with the labels of a
+// single-threaded batch, and a warmed-up thread predicts without allocating
+void check_served(const cluster::Kmeans<float> &served,
+    const cluster::Matrix<float> &queries) {
+  std::vector<int> expected;
+  served.predict(queries, expected);
+  int mismatches = 0;
+#pragma omp parallel num_threads(8) reduction(+:mismatches)
+  for (int rep = 0; rep < 20; ++rep) {
+    for (size_t i = 0; i < queries.rows(); i += 4) {
+      int batch[4];
+      served.predict(queries.row(i), 4, queries.stride(), batch);
+      for (size_t j = 0; j < 4; ++j)
+        mismatches += batch[j] != expected[i + j];
+    }
+  }
+  assert(mismatches == 0);
+
+  int batch[4];
+  float dists[4];
+  served.predict(queries.row(0), 4, queries.stride(), batch, dists);
+  const size_t before = allocations;
+  for (size_t i = 0; i < queries.rows(); i += 4) {
+    served.predict(queries.row(i), 4, queries.stride(), batch, dists);
+    float dist;
+    int label;
+    served.predict(queries.row(i), dist, label);
+  }
+  assert(allocations == before);
+}
+
 int main() {
   log_level = DEBUG;
   cluster::Kmeans<float> kmeans(2);
@@ -38,6 +88,70 @@ int main() {
   ret = kmeans.predict(points, labels);
   assert(ret == cluster::Status::DIM_ERROR);
 
+  // pointer API, one point and a batch with distances
+  const float raw[] = {0.5, 1.5, 2.5, 4.5, 5.5, 6.5, 3.0, 4.0, 5.0};
+  int raw_labels[3];
+  float raw_dists[3];
+  ret = kmeans.predict(raw, 3, 3, raw_labels, raw_dists);
+  assert(ret == cluster::Status::OK);
+  assert(raw_labels[0] == 0 && raw_labels[1] == 1 && raw_labels[2] == 1);
+  assert(fabs(raw_dists[0] - 0.75) < 1e-6 && fabs(raw_dists[2] - 3) < 1e-6);
+
+  // top-k, nearest first
+  int top_labels[6];
+  float top_dists[6];
+  ret = kmeans.predict_top(raw, 3, 3, 2, top_labels, top_dists);
+  assert(ret == cluster::Status::OK);
+  assert(top_labels[0] == 0 && top_labels[1] == 1);
+  assert(top_labels[2] == 1 && top_labels[3] == 0);
+  assert(fabs(top_dists[4] - 3) < 1e-6 && fabs(top_dists[5] - 12) < 1e-6);
+  ret = kmeans.predict_top(raw, 3, 3, 3, top_labels, top_dists);
+  assert(ret == cluster::Status::DIM_ERROR);
+
+  // many threads predicting with one const model
+  std::mt19937 gen(1);
+  std::normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> codebook(300, 20), queries(500, 20);
+  for (size_t i = 0; i < codebook.rows(); ++i)
+    for (size_t j = 0; j < codebook.cols(); ++j)
+      codebook(i, j) = dis(gen);
+  for (size_t i = 0; i < queries.rows(); ++i)
+    for (size_t j = 0; j < queries.cols(); ++j)
+      queries(i, j) = dis(gen);
+  cluster::Kmeans<float> model(300, 2);
+  model.set_centers(codebook);
+  const auto &served = model;
+  check_served(served, queries);
+  std::vector<int> expected;
+  served.predict(queries, expected);
+  std::vector<int> tops(queries.rows() * 5);
+  std::vector<float> top_sq(queries.rows() * 5);
+  served.predict_top(queries.data(), queries.rows(), queries.stride(), 5,
+                     tops.data(), top_sq.data());
+  for (size_t i = 0; i < queries.rows(); ++i) {
+    assert(tops[5 * i] == expected[i]);
+    for (size_t j = 1; j < 5; ++j)
+      assert(top_sq[5 * i + j - 1] <= top_sq[5 * i + j]);
+  }
+
+  // the same under the cosine metric, whose unit centers need no norms
+  cluster::Kmeans<float> spherical(300, 2);
+  spherical.set_metric(cluster::Metric::COSINE);
+  spherical.set_centers(codebook);
+  check_served(spherical, queries);
+  // a wide codebook takes the GEMM path
+  cluster::Matrix<float> wide(300, 80), wide_queries(200, 80);
+  for (size_t i = 0; i < wide.rows(); ++i)
+    for (size_t j = 0; j < wide.cols(); ++j)
+      wide(i, j) = dis(gen);
+  for (size_t i = 0; i < wide_queries.rows(); ++i)
+    for (size_t j = 0; j < wide_queries.cols(); ++j)
+      wide_queries(i, j) = dis(gen);
+  spherical.set_centers(wide);
+  check_served(spherical, wide_queries);
+  model.set_centers(wide);
+  check_served(model, wide_queries);
+
   Test::test_passed("test predict");
   return 0;
 }
@@ -1,8 +1,70 @@
+#include <cstdio>
+#include <random>
 #include "kmeans.h"
 #include "utils.h"
 
 using namespace std;
 
+// values that need every digit to survive a text round trip
+template <typename DType>
+vector<vector<DType>> awkward_centers(size_t k, size_t d) {
+  mt19937 gen(17);
+  uniform_real_distribution<DType> dis(-1000, 1000);
+  vector<vector<DType>> centers(k, vector<DType>(d));
+  for (auto &center : centers)
+    for (auto &value : center)
+      value = dis(gen) / 3;
+  return centers;
+}
+
+template <typename DType>
+void test_round_trip(cluster::ModelFormat format) {
+  auto centers = awkward_centers<DType>(5, 19);
+  cluster::Kmeans<DType> kmeans;
+  kmeans.set_centers(centers);
+  assert(kmeans.save_model("test_model_rt", format) == cluster::Status::OK);
+  cluster::Kmeans<DType> loaded;
+  assert(loaded.load_model("test_model_rt") == cluster::Status::OK);
+  assert(loaded.centers() == centers);
+  remove("test_model_rt");
+}
+
+void test_binary_model() {
+  // metadata and norms travel with the model
+  vector<vector<double>> data;
+  for (int i = 0; i < 300; ++i)
+    data.push_back({i % 3 * 10.0 + i % 7 * 0.01, i % 5 * 0.1});
+  cluster::Kmeans<double> kmeans(3);
+  assert(kmeans.fit(data) == cluster::Status::OK);
+  assert(kmeans.save_model("test_model_bin", cluster::ModelFormat::BINARY) ==
+         cluster::Status::OK);
+
+  cluster::Kmeans<double> loaded;
+  assert(loaded.load_model("test_model_bin") == cluster::Status::OK);
+  assert(loaded.centers() == kmeans.centers());
+  assert(loaded.model_info().n_samples == 300);
+  assert(loaded.model_info().n_iter == kmeans.model_info().n_iter);
+  assert(loaded.model_info().cost == kmeans.model_info().cost);
+  vector<int> labels, loaded_labels;
+  kmeans.predict(data, labels);
+  loaded.predict(data, loaded_labels);
+  assert(labels == loaded_labels);
+
+  // the wrong element type and a flipped byte are caught
+  cluster::Kmeans<float> as_float;
+  assert(as_float.load_model("test_model_bin") ==
+         cluster::Status::FORMAT_ERROR);
+  FILE *file = fopen("test_model_bin", "r+b");
+  fseek(file, 130, SEEK_SET);
+  int byte = fgetc(file);
+  fseek(file, 130, SEEK_SET);
+  fputc(byte ^ 1, file);
+  fclose(file);
+  assert(loaded.load_model("test_model_bin") ==
+         cluster::Status::FORMAT_ERROR);
+  remove("test_model_bin");
+}
+
 int main() {
   log_level = DEBUG;
   cluster::Kmeans<float> kmeans;
@@ -33,6 +95,13 @@ int main() {
   auto centers_loaded = kmeans.centers();
   assert(centers_original == centers_loaded);
 
+  test_round_trip<float>(cluster::ModelFormat::TEXT);
+  test_round_trip<double>(cluster::ModelFormat::TEXT);
+  test_round_trip<float>(cluster::ModelFormat::BINARY);
+  test_round_trip<double>(cluster::ModelFormat::BINARY);
+  log_level = NONE;
+  test_binary_model();
+
   Test::test_passed("test save_load_model");
   return 0;
 }
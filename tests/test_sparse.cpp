@@ -0,0 +1,277 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <unistd.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+string temp_path() {
+  char path[] = "/tmp/test_sparse_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  return path;
+}
+
+// k clusters, each drawing nnz columns out of its own window of `window`
+// columns, windows d / k apart, with values 1 +- noise; row i belongs to
+// cluster i % k
+template <typename DType>
+cluster::SparseMatrix<DType> make_sparse_blobs(size_t n, size_t d, size_t k,
+    size_t nnz, size_t window, DType noise, unsigned seed) {
+  mt19937 gen(seed);
+  uniform_real_distribution<DType> value(1 - noise, 1 + noise);
+  cluster::SparseMatrix<DType> data(d);
+  vector<uint32_t> indices;
+  vector<DType> values;
+  for (size_t i = 0; i < n; ++i) {
+    const size_t first = i % k * (d / k);
+    set<uint32_t> columns;
+    while (columns.size() < nnz) {
+      columns.insert(static_cast<uint32_t>(first + gen() % window));
+    }
+    indices.assign(columns.begin(), columns.end());
+    values.resize(nnz);
+    for (auto &v : values) v = value(gen);
+    assert(data.add_row(indices.data(), values.data(), nnz) ==
+           cluster::Status::OK);
+  }
+  return data;
+}
+
+void test_matrix() {
+  cluster::Matrix<float> dense(3, 5);
+  dense(0, 1) = 2;
+  dense(0, 4) = -1;
+  dense(2, 0) = 3;
+  cluster::SparseMatrix<float> sparse(dense);
+  assert(sparse.rows() == 3 && sparse.cols() == 5 && sparse.nnz() == 3);
+  assert(sparse.row_nnz(0) == 2 && sparse.row_nnz(1) == 0);
+  assert(sparse.row_indices(0)[1] == 4 && sparse.row_values(2)[0] == 3);
+  assert(sparse.row_norm(0) == 5);
+  assert(sparse.to_dense().to_vectors() == dense.to_vectors());
+
+  const float center[5] = {1, 2, 3, 4, 5};
+  assert(cluster::sparse_dot(sparse.row_indices(0), sparse.row_values(0),
+                             sparse.row_nnz(0), center) == -1);
+
+  // columns must increase and fit
+  const uint32_t unordered[2] = {3, 1}, outside[1] = {5};
+  const float values[2] = {1, 1};
+  assert(sparse.add_row(unordered, values, 2) == cluster::Status::DIM_ERROR);
+  assert(sparse.add_row(outside, values, 1) == cluster::Status::DIM_ERROR);
+  assert(sparse.rows() == 3);
+}
+
+template <typename DType>
+void test_libsvm(int n_thread) {
+  auto path = temp_path();
+  {
+    ofstream fout(path);
+    fout << "# comment line\n"
+         << "+1 1:0.5 3:-2 10:4\n"
+         << "\n"
+         << "-1 2:1e-3   # trailing comment\r\n"
+         << "0\n"          // a label and no nonzeros: the zero sample
+         << "4:7";         // no label, no trailing newline
+  }
+  cluster::SparseMatrix<DType> data;
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread) ==
+         cluster::Status::OK);
+  assert(data.rows() == 4 && data.cols() == 10 && data.nnz() == 5);
+  auto dense = data.to_dense();
+  assert(dense(0, 0) == static_cast<DType>(0.5) && dense(0, 2) == -2 &&
+         dense(0, 9) == 4);
+  assert(dense(1, 1) == static_cast<DType>(1e-3));
+  assert(data.row_nnz(2) == 0 && dense(3, 3) == 7);
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread, 12) ==
+         cluster::Status::OK);
+  assert(data.cols() == 12);
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread, 8) ==
+         cluster::Status::DIM_ERROR);
+
+  // the base is what the caller says, not what the file's columns suggest:
+  // a column 0 needs zero_based, and the same indices load the same way
+  // whether or not a file uses column 0
+  {
+    ofstream fout(path);
+    fout << "1 0:1 2:2\n2 5:3\n";
+  }
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread) ==
+         cluster::Status::FORMAT_ERROR);
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread, 0, true) ==
+         cluster::Status::OK);
+  assert(data.cols() == 6 && data.row_indices(0)[1] == 2 &&
+         data.row_indices(1)[0] == 5);
+  {
+    ofstream fout(path);
+    fout << "1 2:2\n2 5:3\n";
+  }
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread, 6, true) ==
+         cluster::Status::OK);
+  assert(data.cols() == 6 && data.row_indices(0)[0] == 2 &&
+         data.row_indices(1)[0] == 5);
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread) ==
+         cluster::Status::OK);
+  assert(data.cols() == 5 && data.row_indices(0)[0] == 1 &&
+         data.row_indices(1)[0] == 4);
+
+  const char *bad[] = {"1 3:1 2:1\n", "1 1:x\n", "1 1:2:3\n", "1 2 3:1\n",
+                       "1 qid:3 1:1\n"};
+  for (auto line : bad) {
+    {
+      ofstream fout(path);
+      fout << "1 1:1\n" << line;
+    }
+    assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread) ==
+           cluster::Status::FORMAT_ERROR);
+  }
+
+  // large enough to be split into several chunks
+  auto blobs = make_sparse_blobs<DType>(60000, 1000, 4, 6, 20, 0.5, 1);
+  {
+    ofstream fout(path);
+    fout.precision(numeric_limits<DType>::max_digits10);
+    for (size_t i = 0; i < blobs.rows(); ++i) {
+      fout << i % 4;
+      for (size_t t = 0; t < blobs.row_nnz(i); ++t)
+        fout << ' ' << blobs.row_indices(i)[t] + 1 << ':'
+             << blobs.row_values(i)[t];
+      fout << '\n';
+    }
+  }
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread,
+                                    blobs.cols()) == cluster::Status::OK);
+  assert(data.rows() == blobs.rows() && data.nnz() == blobs.nnz());
+  for (size_t i = 0; i < blobs.rows(); ++i) {
+    assert(data.indptr(i) == blobs.indptr(i));
+    for (size_t t = 0; t < blobs.row_nnz(i); ++t) {
+      assert(data.row_indices(i)[t] == blobs.row_indices(i)[t]);
+      assert(data.row_values(i)[t] == blobs.row_values(i)[t]);
+    }
+  }
+  remove(path.c_str());
+  assert(cluster::parse_libsvm_file(path.c_str(), data, n_thread) ==
+         cluster::Status::IO_ERROR);
+}
+
+// a sparse fit agrees with the dense fit of the same samples
+template <typename DType>
+void test_fit(int n_thread) {
+  const size_t k = 5;
+  auto sparse = make_sparse_blobs<DType>(3000, 60, k, 8, 11, 0.5, 2);
+  auto dense = sparse.to_dense();
+  cluster::Matrix<DType> seeds(k, dense.cols());
+  for (size_t i = 0; i < k; ++i)
+    copy(dense.row(i), dense.row(i) + dense.cols(), seeds.row(i));
+
+  cluster::Kmeans<DType> plain(k, n_thread, 20, 0), csr(k, n_thread, 20, 0);
+  plain.set_centers(seeds);
+  csr.set_centers(seeds);
+  assert(plain.fit(dense, true) == cluster::Status::OK);
+  assert(csr.fit(sparse, true) == cluster::Status::OK);
+  assert(plain.labels() == csr.labels());
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < dense.cols(); ++j)
+      assert(fabs(plain.center_matrix()(i, j) - csr.center_matrix()(i, j)) <
+             1e-5);
+
+  vector<int> labels;
+  assert(csr.predict(sparse, labels) == cluster::Status::OK);
+  assert(labels == csr.labels());
+  DType plain_cost, csr_cost;
+  assert(plain.cost(dense, plain_cost) == cluster::Status::OK);
+  assert(csr.cost(sparse, csr_cost) == cluster::Status::OK);
+  assert(fabs(plain_cost - csr_cost) <= 1e-4 * plain_cost);
+  assert(fabs(csr.model_info().cost - csr_cost) <= 1e-4 * csr_cost);
+
+  // the same samples through LIBSVM files, zero-based training samples
+  // and one-based queries that never use column 0 agree on the columns
+  string train = temp_path(), test = temp_path();
+  {
+    ofstream ftrain(train), ftest(test);
+    ftrain.precision(numeric_limits<DType>::max_digits10);
+    ftest.precision(numeric_limits<DType>::max_digits10);
+    for (size_t i = 0; i < sparse.rows(); ++i) {
+      for (size_t t = 0; t < sparse.row_nnz(i); ++t) {
+        ftrain << sparse.row_indices(i)[t] << ':'
+               << sparse.row_values(i)[t] << ' ';
+        ftest << sparse.row_indices(i)[t] + 1 << ':'
+              << sparse.row_values(i)[t] << ' ';
+      }
+      ftrain << '\n';
+      ftest << '\n';
+    }
+  }
+  cluster::Kmeans<DType> unseeded(k, n_thread, 20, 0), file_fit(k, n_thread,
+                                                               20, 0);
+  unseeded.set_seed(3);
+  file_fit.set_seed(3);
+  assert(unseeded.fit(sparse) == cluster::Status::OK);
+  assert(file_fit.fit_libsvm(train.c_str(), true) == cluster::Status::OK);
+  assert(file_fit.labels() == unseeded.labels());
+  vector<int> expected;
+  assert(unseeded.predict(sparse, expected) == cluster::Status::OK);
+  assert(file_fit.predict_libsvm(test.c_str(), labels) == cluster::Status::OK);
+  assert(labels == expected);
+  assert(file_fit.predict_libsvm(train.c_str(), labels, true) ==
+         cluster::Status::OK);
+  assert(labels == expected);
+  remove(train.c_str());
+  remove(test.c_str());
+}
+
+// unseeded fits find the blobs, with the same model for any n_thread
+void test_unseeded() {
+  const size_t k = 8;
+  auto data = make_sparse_blobs<float>(20000, 100000, k, 20, 20, 0.05f, 3);
+  vector<cluster::Matrix<float>> centers;
+  vector<vector<int>> labels;
+  for (int n_thread : {1, 3}) {
+    cluster::Kmeans<float> kmeans(k, n_thread, 30, 0);
+    kmeans.set_seed(11);
+    kmeans.set_chunk_size(1000);
+    assert(kmeans.fit(data) == cluster::Status::OK);
+    centers.push_back(kmeans.center_matrix());
+    labels.push_back(kmeans.labels());
+  }
+  assert(labels[0] == labels[1]);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      assert(centers[0](i, j) == centers[1](i, j));
+  // every blob is one cluster
+  map<int, int> blob_of;
+  for (size_t i = 0; i < data.rows(); ++i) {
+    auto it = blob_of.insert(make_pair(labels[0][i], int(i % k))).first;
+    assert(it->second == int(i % k));
+  }
+  assert(blob_of.size() == k);
+
+  cluster::Kmeans<float> other(k, 1, 5, 0);
+  cluster::Matrix<float> seeds(k, 3);
+  other.set_centers(seeds);
+  assert(other.fit(data, true) == cluster::Status::DIM_ERROR);
+  vector<int> predicted;
+  assert(other.predict(data, predicted) == cluster::Status::DIM_ERROR);
+}
+
+int main() {
+  log_level = NONE;
+  test_matrix();
+  test_libsvm<float>(1);
+  test_libsvm<double>(4);
+  for (int n_thread : {1, 3}) {
+    test_fit<float>(n_thread);
+    test_fit<double>(n_thread);
+  }
+  test_unseeded();
+  Test::test_passed("test sparse");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,375 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <unistd.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+string temp_path() {
+  char path[] = "/tmp/test_spherical_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  return path;
+}
+
+// k random directions; row i points along direction i % k, give or take
+// `noise`, with a length anywhere in [0.1, 10]: far apart in euclidean
+// distance, close in angle
+template <typename DType>
+cluster::Matrix<DType> make_directions(size_t n, size_t d, size_t k,
+    DType noise, unsigned seed) {
+  mt19937 gen(seed);
+  normal_distribution<DType> dis(0, 1);
+  uniform_real_distribution<DType> length(0.1, 10);
+  cluster::Matrix<DType> means(k, d), data(n, d);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      means(i, j) = dis(gen);
+  cluster::normalize_rows(means.data(), k, d, means.stride());
+  for (size_t i = 0; i < n; ++i) {
+    const DType scale = length(gen);
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = scale * (means(i % k, j) + noise * dis(gen));
+  }
+  return data;
+}
+
+template <typename DType>
+double cosine(const DType *x, const DType *c, size_t d) {
+  double dot = 0, xx = 0, cc = 0;
+  for (size_t j = 0; j < d; ++j) {
+    dot += x[j] * c[j];
+    xx += x[j] * x[j];
+    cc += c[j] * c[j];
+  }
+  return xx > 0 && cc > 0 ? dot / sqrt(xx * cc) : 0;
+}
+
+// every group of rows i % k is one cluster
+bool recovered(const vector<int> &labels, size_t k) {
+  map<int, int> group_of;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    auto it = group_of.insert(make_pair(labels[i], int(i % k))).first;
+    if (it->second != int(i % k))
+      return false;
+  }
+  return group_of.size() == k;
+}
+
+template <typename DType>
+void assert_unit(const cluster::Matrix<DType> &centers) {
+  for (size_t i = 0; i < centers.rows(); ++i) {
+    double norm = 0;
+    for (size_t j = 0; j < centers.cols(); ++j)
+      norm += centers(i, j) * centers(i, j);
+    assert(fabs(norm - 1) < 1e-5);
+  }
+}
+
+template <typename DType>
+void test_assigner() {
+  mt19937 gen(3);
+  uniform_real_distribution<DType> dis(-1, 1);
+  const size_t n = 150, d = 37, k = 70;
+  cluster::Matrix<DType> centers(k, d, true), points(n, d, true);
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      centers(i, j) = dis(gen);
+  for (size_t i = 1; i < n; ++i)  // point 0 stays zero
+    for (size_t j = 0; j < d; ++j)
+      points(i, j) = 5 * dis(gen);
+
+  // zero rows are left alone
+  cluster::Matrix<DType> zero(1, d, true);
+  cluster::normalize_rows(zero.data(), 1, d, zero.stride());
+  assert(zero(0, 0) == 0);
+  cluster::normalize_rows(centers.data(), k, d, centers.stride());
+  assert_unit(centers);
+
+  for (auto method : {cluster::AssignMethod::PAIRWISE,
+                      cluster::AssignMethod::GEMM}) {
+    cluster::Assigner<DType> assigner;
+    assigner.prepare(centers, method, nullptr, cluster::Metric::COSINE);
+    vector<int> labels(n);
+    vector<DType> dists(n), workspace;
+    assigner.assign(points.data(), n, points.stride(), labels.data(),
+                    dists.data(), workspace);
+    assert(labels[0] == 0 && dists[0] == 1);
+    for (size_t i = 1; i < n; ++i) {
+      double best = -2;
+      for (size_t c = 0; c < k; ++c)
+        best = max(best, cosine(points.row(i), centers.row(c), d));
+      assert(cosine(points.row(i), centers.row(labels[i]), d) > best - 1e-5);
+      assert(fabs(dists[i] - (1 - best)) < 1e-5);
+    }
+  }
+}
+
+template <typename DType>
+void test_fit(int n_thread) {
+  const size_t n = 3000, d = 16, k = 5;
+  auto data = make_directions<DType>(n, d, k, 0.1, 1);
+  cluster::Kmeans<DType> kmeans(k, n_thread, 50, 0);
+  kmeans.set_metric(cluster::Metric::COSINE);
+  kmeans.set_seed(7);
+  assert(kmeans.fit(data) == cluster::Status::OK);
+  assert(recovered(kmeans.labels(), k));
+  auto centers = kmeans.center_matrix();
+  assert_unit(centers);
+  assert(kmeans.model_info().metric ==
+         static_cast<uint32_t>(cluster::Metric::COSINE));
+
+  // costs are sums of 1 - cos, predictions report cos
+  double expected = 0;
+  for (size_t i = 0; i < n; ++i)
+    expected += 1 - cosine(data.row(i), centers.row(kmeans.labels()[i]), d);
+  DType cost;
+  assert(kmeans.cost(data, cost) == cluster::Status::OK);
+  assert(fabs(cost - expected) < 1e-4 * n);
+  assert(fabs(kmeans.model_info().cost - expected) < 1e-4 * n);
+
+  vector<int> labels(n);
+  vector<DType> sims(n);
+  assert(kmeans.predict(data.data(), n, data.stride(), labels.data(),
+                        sims.data()) == cluster::Status::OK);
+  assert(labels == kmeans.labels());
+  const size_t top = 3;
+  vector<int> top_labels(n * top);
+  vector<DType> top_sims(n * top);
+  assert(kmeans.predict_top(data.data(), n, data.stride(), top,
+                            top_labels.data(), top_sims.data()) ==
+         cluster::Status::OK);
+  for (size_t i = 0; i < n; ++i) {
+    const double sim = cosine(data.row(i), centers.row(labels[i]), d);
+    assert(fabs(sims[i] - sim) < 1e-5);
+    DType single;
+    int label;
+    assert(kmeans.predict(data.row(i), single, label) == cluster::Status::OK);
+    assert(label == labels[i] && fabs(single - sim) < 1e-5);
+    assert(top_labels[i * top] == labels[i]);
+    assert(fabs(top_sims[i * top] - sim) < 1e-5);
+    assert(top_sims[i * top] >= top_sims[i * top + 1] &&
+           top_sims[i * top + 1] >= top_sims[i * top + 2]);
+  }
+
+  // exact index searches agree with the scan
+  assert(kmeans.build_index(2, 0) == cluster::Status::OK);
+  vector<DType> indexed(n);
+  assert(kmeans.predict(data.data(), n, data.stride(), labels.data(),
+                        indexed.data()) == cluster::Status::OK);
+  assert(labels == kmeans.labels());
+  for (size_t i = 0; i < n; ++i)
+    assert(fabs(indexed[i] - sims[i]) < 1e-4);
+
+  // the lengths of the samples do not matter
+  cluster::Matrix<DType> scaled(n, d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      scaled(i, j) = data(i, j) * static_cast<DType>(1 + i % 7);
+  cluster::Kmeans<DType> other(k, n_thread, 50, 0);
+  other.set_metric(cluster::Metric::COSINE);
+  other.set_seed(7);
+  assert(other.fit(scaled) == cluster::Status::OK);
+  assert(other.labels() == kmeans.labels());
+}
+
+// deterministic spherical fits do not depend on n_thread, whatever the
+// algorithm asked for
+void test_deterministic() {
+  auto data = make_directions<float>(5000, 40, 12, 0.5f, 2);
+  vector<cluster::Matrix<float>> centers;
+  for (int n_thread : {1, 3}) {
+    cluster::Kmeans<float> kmeans(12, n_thread, 20, 0);
+    kmeans.set_metric(cluster::Metric::COSINE);
+    kmeans.set_algorithm(cluster::Algorithm::HAMERLY);
+    kmeans.set_deterministic(true);
+    kmeans.set_seed(5);
+    assert(kmeans.fit(data) == cluster::Status::OK);
+    assert_unit(kmeans.center_matrix());
+    centers.push_back(kmeans.center_matrix());
+  }
+  for (size_t i = 0; i < centers[0].rows(); ++i)
+    for (size_t j = 0; j < centers[0].cols(); ++j)
+      assert(centers[0](i, j) == centers[1](i, j));
+}
+
+// sparse, encoded, mini-batch and streaming fits run spherical passes too
+void test_other_fits() {
+  const size_t n = 4000, d = 24, k = 4;
+  auto data = make_directions<float>(n, d, k, 0.1f, 4);
+
+  cluster::Matrix<float> seeds(k, d);
+  for (size_t i = 0; i < k; ++i)
+    copy(data.row(i), data.row(i) + d, seeds.row(i));
+  cluster::Kmeans<float> dense(k, 2, 30, 0), csr(k, 2, 30, 0);
+  for (auto model : {&dense, &csr}) {
+    model->set_metric(cluster::Metric::COSINE);
+    model->set_centers(seeds);
+  }
+  cluster::SparseMatrix<float> sparse(data);
+  assert(dense.fit(data, true) == cluster::Status::OK);
+  assert(csr.fit(sparse, true) == cluster::Status::OK);
+  assert(csr.labels() == dense.labels());
+  assert(recovered(csr.labels(), k));
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < d; ++j)
+      assert(fabs(csr.center_matrix()(i, j) - dense.center_matrix()(i, j)) <
+             1e-5);
+  vector<int> labels;
+  assert(csr.predict(sparse, labels) == cluster::Status::OK);
+  assert(labels == csr.labels());
+  float dense_cost, csr_cost;
+  dense.cost(data, dense_cost);
+  csr.cost(sparse, csr_cost);
+  assert(fabs(dense_cost - csr_cost) < 1e-3);
+
+  cluster::Kmeans<float> unseeded(k, 2, 30, 0);
+  unseeded.set_metric(cluster::Metric::COSINE);
+  unseeded.set_seed(2);
+  assert(unseeded.fit(sparse) == cluster::Status::OK);
+  assert(recovered(unseeded.labels(), k));
+
+  cluster::EncodedMatrix<float> half(data, cluster::Encoding::FLOAT16);
+  cluster::Kmeans<float> encoded(k, 2, 30, 0);
+  encoded.set_metric(cluster::Metric::COSINE);
+  encoded.set_seed(3);
+  encoded.set_init_method(cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS);
+  assert(encoded.fit(half) == cluster::Status::OK);
+  assert(recovered(encoded.labels(), k));
+  assert_unit(encoded.center_matrix());
+
+  cluster::Kmeans<float> minibatch(k, 2, 30, 1e-4);
+  minibatch.set_metric(cluster::Metric::COSINE);
+  minibatch.set_minibatch(256, 400);
+  minibatch.set_seed(3);
+  minibatch.set_init_method(cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS);
+  assert(minibatch.fit(data) == cluster::Status::OK);
+  assert(recovered(minibatch.labels(), k));
+  assert_unit(minibatch.center_matrix());
+  assert(minibatch.holdout_cost() > 0 && minibatch.holdout_cost() < 0.15);
+
+  auto path = temp_path(), label_path = temp_path();
+  {
+    ofstream fout(path);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < d; ++j)
+        fout << data(i, j) << ' ';
+      fout << '\n';
+    }
+  }
+  cluster::Kmeans<float> stream(k, 2, 30, 0);
+  stream.set_metric(cluster::Metric::COSINE);
+  stream.set_chunk_size(1000);
+  stream.set_seed(3);
+  stream.set_init_method(cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS);
+  assert(stream.fit(path.c_str(), label_path.c_str()) == cluster::Status::OK);
+  assert_unit(stream.center_matrix());
+  ifstream fin(label_path);
+  labels.assign(n, -1);
+  for (auto &label : labels)
+    fin >> label;
+  assert(recovered(labels, k));
+  remove(path.c_str());
+  remove(label_path.c_str());
+}
+
+// binary models keep the metric
+void test_model() {
+  auto data = make_directions<double>(1000, 8, 3, 0.1, 6);
+  cluster::Kmeans<double> kmeans(3, 1, 20, 0);
+  kmeans.set_metric(cluster::Metric::COSINE);
+  kmeans.set_seed(1);
+  assert(kmeans.fit(data) == cluster::Status::OK);
+  auto path = temp_path();
+  assert(kmeans.save_model(path.c_str(), cluster::ModelFormat::BINARY) ==
+         cluster::Status::OK);
+  cluster::Kmeans<double> loaded;
+  assert(loaded.metric() == cluster::Metric::L2);
+  assert(loaded.load_model(path.c_str()) == cluster::Status::OK);
+  assert(loaded.metric() == cluster::Metric::COSINE);
+  double sim, expected;
+  int label, expected_label;
+  kmeans.predict(data.row(5), expected, expected_label);
+  loaded.predict(data.row(5), sim, label);
+  assert(label == expected_label && sim == expected);
+  remove(path.c_str());
+}
+
+// centers from outside a fit are scaled to unit length, whichever way they
+// come in and in whichever order with the metric
+void test_user_centers() {
+  cluster::Matrix<double> centers(2, 2), query(1, 2);
+  centers(0, 0) = 10;
+  centers(0, 1) = 0;
+  centers(1, 0) = 0.6;
+  centers(1, 1) = 0.8;
+  query(0, 0) = 0.6;
+  query(0, 1) = 0.8;
+  auto check = [&](const cluster::Kmeans<double> &kmeans) {
+    assert(kmeans.metric() == cluster::Metric::COSINE);
+    assert_unit(kmeans.center_matrix());
+    double sim;
+    int label;
+    assert(kmeans.predict(query.row(0), sim, label) == cluster::Status::OK);
+    assert(label == 1 && fabs(sim - 1) < 1e-12);
+    // a batch goes through the GEMM assigner
+    vector<int> labels;
+    assert(kmeans.predict(query, labels) == cluster::Status::OK);
+    assert(labels[0] == 1);
+    int top[2];
+    double sims[2];
+    assert(kmeans.predict_top(query.data(), 1, 2, 2, top, sims) ==
+           cluster::Status::OK);
+    assert(top[0] == 1 && top[1] == 0 && fabs(sims[1] - 0.6) < 1e-12);
+  };
+
+  cluster::Kmeans<double> before(2, 1, 5, 0), after(2, 1, 5, 0);
+  before.set_centers(centers);
+  before.set_metric(cluster::Metric::COSINE);
+  check(before);
+  after.set_metric(cluster::Metric::COSINE);
+  auto rows = centers.to_vectors();
+  after.set_centers(rows);
+  check(after);
+
+  // text and binary models, the latter saved under L2
+  cluster::Kmeans<double> l2(2, 1, 5, 0);
+  l2.set_centers(centers);
+  auto path = temp_path();
+  for (auto format : {cluster::ModelFormat::TEXT,
+                      cluster::ModelFormat::BINARY}) {
+    assert(l2.save_model(path.c_str(), format) == cluster::Status::OK);
+    cluster::Kmeans<double> loaded;
+    loaded.set_metric(cluster::Metric::COSINE);
+    assert(loaded.load_model(path.c_str()) == cluster::Status::OK);
+    if (format == cluster::ModelFormat::BINARY) {
+      assert(loaded.metric() == cluster::Metric::L2);
+      loaded.set_metric(cluster::Metric::COSINE);
+    }
+    check(loaded);
+  }
+  remove(path.c_str());
+}
+
+int main() {
+  log_level = NONE;
+  test_assigner<float>();
+  test_assigner<double>();
+  for (int n_thread : {1, 3}) {
+    test_fit<float>(n_thread);
+    test_fit<double>(n_thread);
+  }
+  test_deterministic();
+  test_other_fits();
+  test_model();
+  test_user_centers();
+  Test::test_passed("test spherical");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,98 @@
+#include <random>
+#include <sstream>
+#include <unistd.h>
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+cluster::Matrix<float> make_data(size_t n, size_t d) {
+  mt19937 gen(9);
+  normal_distribution<float> dis(0, 1);
+  cluster::Matrix<float> data(n, d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data(i, j) = dis(gen) + (i % 4) * 5;
+  return data;
+}
+
+// counters are kept whether or not profiling is on, times only with it
+void test_counters(bool profiling, cluster::Algorithm algorithm) {
+  auto data = make_data(20000, 4);
+  cluster::Kmeans<float> kmeans(8, 3, 20, 0);
+  kmeans.set_profiling(profiling);
+  kmeans.set_algorithm(algorithm);
+  assert(kmeans.fit(data) == cluster::Status::OK);
+  auto stats = kmeans.stats();
+  assert(stats.profiled == profiling);
+  assert(stats.init == "k-means++");
+  assert(stats.iterations.size() == kmeans.model_info().n_iter);
+  assert(stats.iterations[0].reassigned == data.rows());
+  for (size_t i = 0; i < stats.iterations.size(); ++i) {
+    const auto &iter = stats.iterations[i];
+    assert(iter.iter == static_cast<int>(i + 1));
+    assert(iter.samples == data.rows());
+    assert(iter.dist_evals + iter.dist_skipped == data.rows() * 8);
+    assert(iter.cost > 0);
+    assert((iter.assign_s > 0) == profiling);
+    assert(iter.update_s >= 0);
+    assert(profiling ? iter.imbalance >= 1 : iter.imbalance == 0);
+  }
+  assert(stats.iterations.back().cost == kmeans.model_info().cost);
+  assert((stats.fit_s > 0) == profiling);
+  assert((stats.init_s > 0) == profiling);
+  assert((stats.peak_bytes > 0) == profiling);
+  if (algorithm != cluster::Algorithm::LLOYD)
+    assert(stats.iterations.back().dist_skipped > 0);
+
+  vector<int> labels;
+  kmeans.predict(data, labels);
+  float dist;
+  int label;
+  kmeans.predict(data.row(0), dist, label);
+  stats = kmeans.stats();
+  assert(stats.predict_calls == (profiling ? 2u : 0u));
+  assert(stats.predict_points == (profiling ? data.rows() + 1 : 0u));
+
+  // the log line is rendered from the record
+  ostringstream line;
+  line << stats.iterations[0];
+  assert(line.str().find("iter: 1 reassign_ratio: 1 cost: ") == 0);
+}
+
+// mini-batch epochs and a fit from a file, which also times the load
+void test_minibatch_file() {
+  auto data = make_data(5000, 3);
+  char path[] = "/tmp/test_stats_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  assert(cluster::save_dataset(path, data) == cluster::Status::OK);
+  cluster::Kmeans<float> kmeans(4, 2, 5, 0);
+  kmeans.set_profiling(true);
+  kmeans.set_minibatch(500, 200);
+  assert(kmeans.fit(path) == cluster::Status::OK);
+  auto stats = kmeans.stats();
+  assert(stats.load_s > 0);
+  assert(!stats.iterations.empty());
+  for (const auto &iter : stats.iterations) {
+    assert(iter.steps > 0);
+    assert(iter.assign_s > 0);
+  }
+  ostringstream line;
+  line << stats.iterations[0];
+  assert(line.str().find("epoch: 1 steps: ") == 0);
+  unlink(path);
+}
+
+int main() {
+  log_level = WARN;
+  for (bool profiling : {false, true}) {
+    test_counters(profiling, cluster::Algorithm::LLOYD);
+    test_counters(profiling, cluster::Algorithm::HAMERLY);
+  }
+  test_minibatch_file();
+  Test::test_passed("stats");
+}
+
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,81 @@
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+template <typename DType>
+void write_text(const cluster::Matrix<DType> &data, const char *path) {
+  ofstream fout(path);
+  fout.precision(numeric_limits<DType>::max_digits10);
+  for (size_t i = 0; i < data.rows(); ++i) {
+    for (size_t j = 0; j < data.cols(); ++j)
+      fout << data(i, j) << ' ';
+    fout << '\n';
+  }
+}
+
+template <typename DType>
+void test_same_as_in_memory(size_t chunk_size, int n_thread) {
+  const size_t k = 12;
+  auto data = make_blobs<DType>(20000, 6, k, 5);
+  cluster::Matrix<DType> seeds(k, data.cols());
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      seeds(i, j) = data(5 * i, j);
+
+  char data_path[] = "/tmp/test_stream_XXXXXX";
+  char label_path[] = "/tmp/test_stream_labels_XXXXXX";
+  int fd = mkstemp(data_path);
+  assert(fd >= 0);
+  close(fd);
+  fd = mkstemp(label_path);
+  assert(fd >= 0);
+  close(fd);
+  write_text(data, data_path);
+
+  // run both to a fixed point, the streaming pass sums in double
+  cluster::Kmeans<DType> in_memory(k, 1, 100, 0);
+  in_memory.set_centers(seeds);
+  auto ret = in_memory.fit(data, true);
+  assert(ret == cluster::Status::OK);
+
+  cluster::Kmeans<DType> streaming(k, n_thread, 100, 0);
+  cluster::TextReader<DType> reader;
+  assert(reader.open(data_path) == cluster::Status::OK);
+  streaming.set_chunk_size(chunk_size);
+  streaming.set_centers(seeds);
+  ret = streaming.fit(reader, label_path, true);
+  assert(ret == cluster::Status::OK);
+  assert(streaming.labels().empty());
+
+  ifstream fin(label_path);
+  vector<int> labels;
+  int label;
+  while (fin >> label)
+    labels.push_back(label);
+  assert(labels == in_memory.labels());
+
+  auto const &a = in_memory.center_matrix(), &b = streaming.center_matrix();
+  for (size_t i = 0; i < k; ++i)
+    for (size_t j = 0; j < data.cols(); ++j)
+      assert(abs(a(i, j) - b(i, j)) < 1e-3);
+
+  remove(data_path);
+  remove(label_path);
+}
+
+int main() {
+  log_level = WARN;
+  test_same_as_in_memory<float>(1000, 1);
+  test_same_as_in_memory<float>(777, 4);
+  test_same_as_in_memory<double>(5000, 3);
+  test_same_as_in_memory<double>(100000, 2);
+  Test::test_passed("test stream");
+  return 0;
+}
+// vim: ts=2 sts=2 sw=2
@@ -0,0 +1,246 @@
+#include <cmath>
+#include <limits>
+#include <random>
+#include <set>
+#include <type_traits>
+#include "fixtures.h"
+#include "kmeans.h"
+#include "utils.h"
+
+using namespace std;
+
+// row i repeated weights[i] times
+template <typename DType>
+cluster::Matrix<DType> expand(const cluster::Matrix<DType> &data,
+    const vector<double> &weights) {
+  size_t n = 0;
+  for (auto w : weights) n += static_cast<size_t>(w);
+  cluster::Matrix<DType> expanded(n, data.cols());
+  for (size_t i = 0, row = 0; i < data.rows(); ++i)
+    for (size_t r = 0; r < static_cast<size_t>(weights[i]); ++r, ++row)
+      copy(data.row(i), data.row(i) + data.cols(), expanded.row(row));
+  return expanded;
+}
+
+template <typename DType>
+cluster::Matrix<DType> first_rows(const cluster::Matrix<DType> &data,
+    size_t k) {
+  cluster::Matrix<DType> rows(k, data.cols());
+  for (size_t i = 0; i < k; ++i)
+    copy(data.row(i), data.row(i) + data.cols(), rows.row(i));
+  return rows;
+}
+
+template <typename DType>
+void assert_close(const cluster::Matrix<DType> &a,
+    const cluster::Matrix<DType> &b, double tolerance) {
+  assert(a.rows() == b.rows() && a.cols() == b.cols());
+  for (size_t i = 0; i < a.rows(); ++i)
+    for (size_t j = 0; j < a.cols(); ++j)
+      assert(fabs(a(i, j) - b(i, j)) <= tolerance * (1 + fabs(a(i, j))));
+}
+
+// a fit with integer weights is the fit of the samples repeated that often,
+// on every pass: parallel, bounded, sliced and ordered deterministic sums,
+// and cosine
+template <typename DType>
+void test_duplicates(size_t d, size_t k, int n_thread, bool deterministic,
+    cluster::Algorithm algorithm, cluster::Metric metric) {
+  const size_t n = 3000;
+  auto data = make_blobs<DType>(n, d, k, 1, 10);
+  mt19937 gen(2);
+  vector<double> weights(n);
+  for (auto &w : weights) w = gen() % 4;  // some samples drop out
+  auto expanded = expand(data, weights);
+  // start both from rows present in each
+  cluster::Matrix<DType> seeds(k, d);
+  for (size_t c = 0, i = 0; c < k; ++i)
+    if (weights[i] > 0)
+      copy(data.row(i), data.row(i) + d, seeds.row(c++));
+
+  cluster::Kmeans<DType> weighted(k, n_thread, 10, 0);
+  cluster::Kmeans<DType> plain(k, n_thread, 10, 0);
+  for (auto kmeans : {&weighted, &plain}) {
+    kmeans->set_deterministic(deterministic);
+    kmeans->set_algorithm(algorithm);
+    kmeans->set_metric(metric);
+    kmeans->set_centers(seeds);
+  }
+  assert(weighted.fit(data, weights, true) == cluster::Status::OK);
+  assert(plain.fit(expanded, true) == cluster::Status::OK);
+  const double tolerance = is_same<DType, float>::value ? 1e-4 : 1e-10;
+  assert_close(weighted.center_matrix(), plain.center_matrix(), tolerance);
+  assert(weighted.model_info().n_iter == plain.model_info().n_iter);
+  const double cost = plain.model_info().cost;
+  assert(fabs(weighted.model_info().cost - cost) <= tolerance * cost);
+
+  // the samples keep their own labels, the expanded ones theirs
+  assert(weighted.labels().size() == n);
+  for (size_t i = 0, row = 0; i < n; row += static_cast<size_t>(weights[i++]))
+    if (weights[i] > 0)
+      assert(weighted.labels()[i] == plain.labels()[row]);
+
+  DType weighted_cost, plain_cost;
+  assert(weighted.cost(data, weights, weighted_cost) == cluster::Status::OK);
+  assert(plain.cost(expanded, plain_cost) == cluster::Status::OK);
+  assert(fabs(weighted_cost - plain_cost) <= 1e-4 * plain_cost);
+}
+
+// seeding only ever picks samples of positive weight
+void test_seeding() {
+  const size_t n = 2000, d = 4, k = 3;
+  auto data = make_blobs<double>(n, d, 5, 3, 10);
+  vector<double> weights(n);
+  // one sample of each of blobs 0, 1 and 2 carries all the weight
+  weights[10] = 5;
+  weights[11] = 0.5;
+  weights[12] = 100;
+  for (auto init : {cluster::InitMethod::RANDOM,
+                    cluster::InitMethod::KMEANS_PLUSPLUS,
+                    cluster::InitMethod::GREEDY_KMEANS_PLUSPLUS,
+                    cluster::InitMethod::KMEANS_PARALLEL}) {
+    for (uint64_t seed = 0; seed < 5; ++seed) {
+      cluster::Kmeans<double> kmeans(k, 2, 5, 0, init);
+      kmeans.set_seed(seed);
+      assert(kmeans.fit(data, weights) == cluster::Status::OK);
+      // each center sits on one of them, the rest weigh nothing
+      auto centers = kmeans.center_matrix();
+      set<size_t> found;
+      for (size_t c = 0; c < k; ++c)
+        for (size_t i = 10; i < 13; ++i) {
+          double dist = 0;
+          for (size_t j = 0; j < d; ++j)
+            dist += fabs(centers(c, j) - data(i, j));
+          if (dist < 1e-9)
+            found.insert(i);
+        }
+      assert(found.size() == k);
+      assert(kmeans.model_info().cost < 1e-9);
+    }
+  }
+}
+
+// fractional weights give the same model for any n_thread in deterministic
+// mode
+void test_deterministic() {
+  const size_t n = 20000, d = 8, k = 6;
+  auto data = make_blobs<float>(n, d, k, 4, 10);
+  mt19937 gen(5);
+  uniform_real_distribution<double> dis(0, 3);
+  vector<double> weights(n);
+  for (auto &w : weights) w = dis(gen);
+  vector<cluster::Matrix<float>> centers;
+  vector<vector<int>> labels;
+  for (auto init : {cluster::InitMethod::KMEANS_PLUSPLUS,
+                    cluster::InitMethod::KMEANS_PARALLEL}) {
+    for (int n_thread : {1, 3}) {
+      cluster::Kmeans<float> kmeans(k, n_thread, 20, 0, init);
+      kmeans.set_seed(7);
+      kmeans.set_deterministic(true);
+      assert(kmeans.fit(data, weights) == cluster::Status::OK);
+      centers.push_back(kmeans.center_matrix());
+      labels.push_back(kmeans.labels());
+    }
+  }
+  for (size_t r : {0, 2}) {
+    assert(labels[r] == labels[r + 1]);
+    assert_close(centers[r], centers[r + 1], 0);
+  }
+}
+
+// samples of weight 0 are labeled but never move a center, or refill an
+// empty one
+void test_zero_weights() {
+  const size_t n = 1000, d = 3, k = 4;
+  auto data = make_blobs<double>(n, d, k, 6, 10);
+  cluster::Matrix<double> outliers(n + 2, d);
+  for (size_t i = 0; i < n; ++i)
+    copy(data.row(i), data.row(i) + d, outliers.row(i));
+  for (size_t j = 0; j < d; ++j) {
+    outliers(n, j) = 1e6;
+    outliers(n + 1, j) = -1e6;
+  }
+  vector<double> weights(n + 2, 1.0);
+  weights[n] = weights[n + 1] = 0;
+
+  auto seeds = first_rows(data, k);
+  cluster::Kmeans<double> plain(k, 2, 20, 0), weighted(k, 2, 20, 0);
+  plain.set_centers(seeds);
+  weighted.set_centers(seeds);
+  assert(plain.fit(data, true) == cluster::Status::OK);
+  assert(weighted.fit(outliers, weights, true) == cluster::Status::OK);
+  assert_close(plain.center_matrix(), weighted.center_matrix(), 1e-12);
+  assert(fabs(plain.model_info().cost - weighted.model_info().cost) <=
+         1e-9 * plain.model_info().cost);
+  assert(weighted.labels().size() == n + 2);
+
+  // a center whose only member weighs nothing is empty: it moves to a
+  // sample of positive weight, however much farther the other outlier is
+  cluster::Matrix<double> far = seeds;
+  for (size_t j = 0; j < d; ++j) far(k - 1, j) = 9e5;
+  weighted.set_centers(far);
+  assert(weighted.fit(outliers, weights, true) == cluster::Status::OK);
+  for (size_t c = 0; c < k; ++c)
+    for (size_t j = 0; j < d; ++j)
+      assert(fabs(weighted.center_matrix()(c, j)) < 1e5);
+}
+
+void test_errors() {
+  auto data = make_blobs<float>(100, 2, 2, 8, 10);
+  cluster::Kmeans<float> kmeans(3, 1, 5, 0);
+  const float nan = numeric_limits<float>::quiet_NaN();
+  vector<double> weights(100, 1.0);
+  float cost;
+  assert(kmeans.fit(data, vector<double>(99, 1.0)) ==
+         cluster::Status::DIM_ERROR);
+  weights[3] = -1;
+  assert(kmeans.fit(data, weights) == cluster::Status::DIM_ERROR);
+  weights[3] = nan;
+  assert(kmeans.fit(data, weights) == cluster::Status::DIM_ERROR);
+  weights[3] = numeric_limits<double>::infinity();
+  assert(kmeans.fit(data, weights) == cluster::Status::DIM_ERROR);
+  assert(kmeans.fit(data, vector<double>(100, 0.0)) ==
+         cluster::Status::DIM_ERROR);
+  // fewer samples of positive weight than clusters
+  weights.assign(100, 0.0);
+  weights[0] = weights[1] = 1;
+  assert(kmeans.fit(data, weights) == cluster::Status::DIM_ERROR);
+  weights[2] = 1;
+  assert(kmeans.fit(data, weights) == cluster::Status::OK);
+  assert(kmeans.cost(data, vector<double>(5, 1.0), cost) ==
+         cluster::Status::DIM_ERROR);
+
+  // mini-batches are not weighted, the fit runs full passes instead
+  cluster::Kmeans<float> minibatch(2, 1, 20, 0);
+  minibatch.set_minibatch(10, 10);
+  assert(minibatch.fit(data, vector<double>(100, 2.0)) == cluster::Status::OK);
+  assert(minibatch.labels().size() == 100);
+}
+
+int main() {
+  log_level = NONE;
+  for (int n_thread : {1, 3}) {
+    for (bool deterministic : {false, true}) {
+      test_duplicates<float>(5, 4, n_thread, deterministic,
+                             cluster::Algorithm::LLOYD, cluster::Metric::L2);
+      test_duplicates<double>(5, 4, n_thread, deterministic,
+                              cluster::Algorithm::LLOYD, cluster::Metric::L2);
+      test_duplicates<double>(5, 4, n_thread, deterministic,
+                              cluster::Algorithm::HAMERLY, cluster::Metric::L2);
+      test_duplicates<double>(16, 4, n_thread, deterministic,
+                              cluster::Algorithm::LLOYD,
+                              cluster::Metric::COSINE);
+    }
+  }
+  // k * d past the slice budget: deterministic sums are bucketed by label
+  test_duplicates<double>(1100, 64, 3, true, cluster::Algorithm::LLOYD,
+                          cluster::Metric::L2);
+  test_seeding();
+  test_deterministic();
+  test_zero_weights();
+  test_errors();
+  Test::test_passed("test weights");
+  return 0;
+}
+
+// vim: ts=2 sts=2 sw=2
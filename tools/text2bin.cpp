@@ -0,0 +1,50 @@
+#include "dataset.h"
+#include "reader.h"
+#include "utils.h"
+#include <cstring>
+#include <iostream>
+
+template <typename DType>
+cluster::Status convert(const char *input, const char *output, bool padded) {
+  cluster::TextReader<DType> reader;
+  auto ret = reader.open(input);
+  if (ret != cluster::Status::OK) {
+    return ret;
+  }
+  cluster::Matrix<DType> chunk;
+  ret = reader.read(65536, chunk);
+  if (ret != cluster::Status::OK) {
+    return ret;
+  }
+  cluster::DatasetWriter<DType> writer;
+  ret = writer.open(output, chunk.cols(), padded);
+  while (ret == cluster::Status::OK && !chunk.empty()) {
+    ret = writer.append(chunk);
+    if (ret == cluster::Status::OK) {
+      ret = reader.read(65536, chunk);
+    }
+  }
+  if (ret == cluster::Status::OK) {
+    ret = writer.close();
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+    log_level = INFO;
+    if (argc < 3 || argc > 5) {
+        LOG(ERROR) << "Usage: " << argv[0]
+            << " <text data> <binary data> [float|double] [padded]";
+        return 0;
+    }
+    bool use_double = argc > 3 && strcmp(argv[3], "double") == 0;
+    bool padded = argc > 4 && strcmp(argv[4], "padded") == 0;
+    auto ret = use_double ? convert<double>(argv[1], argv[2], padded) :
+                            convert<float>(argv[1], argv[2], padded);
+    if (ret != cluster::Status::OK) {
+        LOG(ERROR) << "conversion failed";
+        return -1;
+    }
+    LOG(INFO) << "wrote " << argv[2];
+    return 0;
+}